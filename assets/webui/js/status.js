@@ -0,0 +1,69 @@
+(function() {
+    if (!window.EventSource)
+        return;
+
+    function set(id, text) {
+        document.getElementById(id).textContent = text;
+    }
+
+    const events = new EventSource('/api/status/events');
+    events.addEventListener('state', function(ev) {
+        set('status-state', JSON.parse(ev.data).state);
+    });
+    events.addEventListener('connection', function(ev) {
+        set('status-connection', JSON.parse(ev.data).connected ? 'Connected' : 'Disconnected');
+    });
+    events.addEventListener('volume', function(ev) {
+        set('status-volume', JSON.parse(ev.data).volume + '%');
+    });
+    events.addEventListener('level', function(ev) {
+        set('status-level', JSON.parse(ev.data).level_db + ' dBFS');
+    });
+    events.addEventListener('turn', function(ev) {
+        const turn = JSON.parse(ev.data);
+        set('status-turn', 'STT ' + turn.stt_ms + ' ms, Genie ' + turn.genie_ms +
+            ' ms, TTS ' + turn.tts_ms + ' ms, total ' + turn.total_ms + ' ms' +
+            (turn.input ? ', SNR ' + turn.input.snr_db.toFixed(1) + ' dB' +
+                (turn.input.clipped ? ', ' + turn.input.clipped + ' samples clipped' : '') : ''));
+    });
+    events.addEventListener('input', function(ev) {
+        const input = JSON.parse(ev.data);
+        set('status-input', (input.speech_frames ? 'SNR ' + input.snr_db.toFixed(1) + ' dB' : 'no speech') +
+            ', noise ' + input.noise_floor_db.toFixed(1) + ' dBFS, peak ' + input.peak_db.toFixed(1) + ' dBFS' +
+            (input.clipped ? ', ' + input.clipped + ' samples clipped' : ''));
+    });
+    events.addEventListener('tls', function(ev) {
+        const tls = JSON.parse(ev.data);
+        const known = tls.handshakes - tls.unknown;
+        set('status-tls', tls.handshakes + ' handshakes, ' +
+            (known > 0 ? Math.round(100 * tls.resumed / known) + '% resumed, ' : '') +
+            'mean ' + tls.mean_ms + ' ms, last ' + tls.last_ms + ' ms');
+    });
+    events.addEventListener('memory', function(ev) {
+        const memory = JSON.parse(ev.data);
+        const mb = function(kb) { return (kb / 1024).toFixed(1) + ' MB'; };
+        const top = Object.keys(memory.components).sort(function(a, b) {
+            return memory.components[b].bytes - memory.components[a].bytes;
+        }).slice(0, 3).map(function(name) {
+            return name + ' ' + Math.round(memory.components[name].bytes / 1024) + ' KB';
+        });
+        set('status-memory', 'RSS ' + mb(memory.rss_kb) +
+            (memory.pss_kb ? ', PSS ' + mb(memory.pss_kb) : '') +
+            (memory.soft_limit_kb ? ' of ' + mb(memory.soft_limit_kb) : '') +
+            (memory.sheds ? ', shed ' + memory.sheds + ' times' : '') +
+            (top.length ? ' (' + top.join(', ') + ')' : ''));
+    });
+    events.addEventListener('cpu', function(ev) {
+        const cpu = JSON.parse(ev.data);
+        const top = Object.keys(cpu.threads).sort(function(a, b) {
+            return cpu.threads[b] - cpu.threads[a];
+        }).slice(0, 3).map(function(name) {
+            return name + ' ' + cpu.threads[name].toFixed(1) + '%';
+        });
+        set('status-cpu', cpu.total.toFixed(1) + '%' +
+            (top.length ? ' (' + top.join(', ') + ')' : ''));
+        set('status-cpu-states', Object.keys(cpu.states).map(function(name) {
+            return name + ' ' + cpu.states[name].total.toFixed(1) + '%';
+        }).join(', '));
+    });
+})();
@@ -24,15 +24,37 @@
 #include "audio/audioplayer.hpp"
 #include "audio/audiovolume.hpp"
 #include "config.hpp"
+#include "config_watcher.hpp"
+#include "cpu_monitor.hpp"
 #include "dns_controller.hpp"
+#include "utils/dns-cache.hpp"
+#include "utils/tls-monitor.hpp"
 #include "utils/net.hpp"
+#include "utils/threads.hpp"
+#include "utils/worker-pool.hpp"
 #include "evinput.hpp"
 #include "leds.hpp"
+#include "memory_monitor.hpp"
+#include "net_monitor.hpp"
 #include "spotifyd.hpp"
 #include "stt.hpp"
 #include "webserver.hpp"
 #include "ws-protocol/client.hpp"
 
+// number of threads for blocking work that must stay off the main loop
+static const int WORKER_POOL_THREADS = 2;
+
+// how often log records queued by the audio thread are written out, when
+// its debug output is enabled
+static const guint LOG_RING_DRAIN_MS = 100;
+
+// delay before reopening the audio input when a rebuild failed to open it
+static const guint AUDIO_INPUT_RETRY_S = 5;
+
+// main loop stall detection, see App::install_stall_check()
+static gint64 stall_budget_us = 0;
+static gint64 last_poll_return = 0;
+
 double time_diff(struct timeval x, struct timeval y) {
   return (((double)y.tv_sec * 1000000 + (double)y.tv_usec) -
           ((double)x.tv_sec * 1000000 + (double)x.tv_usec));
@@ -45,9 +67,16 @@ double time_diff_ms(struct timeval x, struct timeval y) {
 genie::App::App() {
   main_thread = std::this_thread::get_id();
   is_processing = FALSE;
+  input_level = AudioInput::LEVEL_FLOOR_DB;
 }
 
-genie::App::~App() { g_main_loop_unref(main_loop); }
+genie::App::~App() {
+  // Finish the queued jobs first: they use components (the recorder a dump
+  // reads from...) that are destroyed with the members declared after the
+  // pool.
+  worker_pool.reset();
+  g_main_loop_unref(main_loop);
+}
 
 void genie::App::init_soup() {
   // enable proxy support
@@ -76,6 +105,8 @@ void genie::App::init_soup() {
   const gchar *wss_aliases[] = {"wss", NULL};
   g_object_set(soup_session.get(), SOUP_SESSION_HTTPS_ALIASES, wss_aliases,
                NULL);
+
+  tls_monitor = std::make_unique<TLSMonitor>(this, soup_session.get());
 }
 
 int genie::App::process_args(int argc, char *argv[]) {
@@ -116,48 +147,126 @@ int genie::App::exec(int argc, char *argv[]) {
 
   g_unix_signal_add(SIGINT, sigint_handler, main_loop);
   g_unix_signal_add(SIGTERM, sigterm_handler, main_loop);
+  g_unix_signal_add(SIGUSR2, sigusr2_handler, this);
+
+  startup_begin = g_get_monotonic_time();
+  gint64 step_begin = startup_begin;
 
   config = std::make_unique<Config>();
   config->load();
+  add_startup_step("config", step_begin);
+
+  worker_pool = std::make_unique<WorkerPool>(WORKER_POOL_THREADS);
+  install_stall_check();
+  genie::log::start_ring_drain(LOG_RING_DRAIN_MS, "genie::AudioInput");
 
+  step_begin = g_get_monotonic_time();
   init_soup();
+  add_startup_step("soup", step_begin);
+
+  // resolve the servers we talk to while the rest starts up
+  if (config->dns_cache_enabled) {
+    step_begin = g_get_monotonic_time();
+    dns_cache = std::make_unique<DNSCache>(config->dns_cache_ttl_s,
+                                           config->dns_cache_stale_s);
+    dns_cache->pin_url(config->genie_url);
+    dns_cache->pin_url(config->nl_url);
+    add_startup_step("dns-cache", step_begin);
+  }
 
   g_setenv("PULSE_PROP_media.role", "voice-assistant", TRUE);
   g_setenv("GST_REGISTRY_UPDATE", "no", true);
 
+  step_begin = g_get_monotonic_time();
   leds = std::make_unique<Leds>(this);
   leds->init();
   leds->animate(LedsState_t::Starting);
+  add_startup_step("leds", step_begin);
+
+  // queue the DNS fix-up ahead of the first connection attempt
+  if (config->dns_controller_enabled) {
+    step_begin = g_get_monotonic_time();
+    dns_controller = std::make_unique<DNSController>(worker_pool.get(),
+                                                     config->hacks_dns_server);
+    add_startup_step("dns", step_begin);
+  }
 
+  if (config->net_monitor_enabled) {
+    step_begin = g_get_monotonic_time();
+    net_monitor = std::make_unique<NetMonitor>(this);
+    add_startup_step("netmon", step_begin);
+  }
+
+  // Start connecting to the server as early as possible, the handshake
+  // proceeds in the background once the main loop runs. Incoming messages are
+  // only handled from the main loop, after all components exist.
+  step_begin = g_get_monotonic_time();
+  conversation_client = std::make_unique<conversation::Client>(this);
+  conversation_client->init();
+  add_startup_step("conversation", step_begin);
+
+  // AudioInput is the slowest component (loading the wake-word model and
+  // opening the capture device) and depends only on the config, so build it
+  // on a separate thread while the rest is initialized here. It only talks to
+  // the main thread through `dispatch()`, which is not serviced until the main
+  // loop runs.
+  gint64 audio_input_begin = g_get_monotonic_time();
+  gint64 audio_input_end = 0;
+  std::thread audio_input_init([this, &audio_input_end]() {
+    set_thread_name("genie:init");
+    audio_input = std::make_unique<AudioInput>(this);
+    audio_input_end = g_get_monotonic_time();
+  });
+
+  step_begin = g_get_monotonic_time();
   audio_volume_controller = std::make_unique<AudioVolumeController>(this);
+  add_startup_step("volume", step_begin);
 
+  step_begin = g_get_monotonic_time();
   audio_player = std::make_unique<AudioPlayer>(this);
+  add_startup_step("player", step_begin);
 
+  step_begin = g_get_monotonic_time();
   stt = std::make_unique<STT>(this);
+  add_startup_step("stt", step_begin);
 
-  audio_input = std::make_unique<AudioInput>(this);
-
+  step_begin = g_get_monotonic_time();
   spotifyd = std::make_unique<Spotifyd>(this);
   spotifyd->init();
+  add_startup_step("spotifyd", step_begin);
 
-  conversation_client = std::make_unique<conversation::Client>(this);
-  conversation_client->init();
-
+  step_begin = g_get_monotonic_time();
   ev_input = std::make_unique<EVInput>(this);
   ev_input->init();
+  add_startup_step("evinput", step_begin);
 
+  step_begin = g_get_monotonic_time();
   webserver = std::make_unique<WebServer>(this);
-
-  if (config->dns_controller_enabled) {
-    dns_controller = std::make_unique<DNSController>(config->hacks_dns_server);
-  }
+  add_startup_step("webserver", step_begin);
 
   if (config->net_controller_enabled) {
+    step_begin = g_get_monotonic_time();
     net_controller = std::make_unique<NetController>(this);
+    add_startup_step("net", step_begin);
   }
 
+  audio_input_init.join();
+  if (!audio_input->is_running())
+    g_error("failed to initialize audio input");
+  startup_steps.push_back({"audio-input", audio_input_begin, audio_input_end});
+
+  if (config->config_watch_enabled)
+    config_watcher = std::make_unique<ConfigWatcher>(this);
+
+  // after the audio input, the first sample accounts for its recorder
+  memory_monitor = std::make_unique<MemoryMonitor>(this);
+  cpu_monitor = std::make_unique<CpuMonitor>(this);
+
   this->current_state = new state::Sleeping(this);
   this->current_state->enter();
+  track_transit(state::Sleeping::NAME);
+  startup_wake_ready = g_get_monotonic_time();
+  g_idle_add(print_startup_timeline, this);
 
   g_debug("start main loop\n");
   g_main_loop_run(main_loop);
@@ -180,6 +289,100 @@ gboolean genie::App::sigterm_handler(gpointer data) {
   exit(0);
 }
 
+gboolean genie::App::sigusr2_handler(gpointer data) {
+  App *self = static_cast<App *>(data);
+  self->dump_audio_recording("signal");
+  return G_SOURCE_CONTINUE;
+}
+
+void genie::App::dump_audio_recording(const char *reason, bool automatic) {
+  if (automatic && !config->audio_recorder_auto_dump)
+    return;
+  AudioRecorder *recorder = audio_input ? audio_input->get_recorder() : nullptr;
+  if (!recorder) {
+    g_message("Audio flight recorder is disabled, not dumping (%s)", reason);
+    return;
+  }
+  recorder->dump(reason, automatic);
+}
+
+void genie::App::track_audio_dump_done() {
+  if (audio_input_stale && dynamic_cast<state::Sleeping *>(current_state))
+    rebuild_audio_input();
+}
+
+/**
+ * @brief Pause or resume the audio flight recorder. Returns false if it was
+ * disabled in the config, so there is nothing to toggle.
+ */
+bool genie::App::set_audio_recorder_enabled(bool enabled) {
+  AudioRecorder *recorder = audio_input ? audio_input->get_recorder() : nullptr;
+  if (!recorder)
+    return false;
+  recorder->set_enabled(enabled);
+  return true;
+}
+
+/**
+ * @brief Warn about main loop iterations that exceed the configured stall
+ * budget.
+ *
+ * Wraps the default main context's poll function: the time between one poll
+ * returning and the next one starting is what the iteration spent
+ * dispatching callbacks. This costs no extra wakeups.
+ */
+void genie::App::install_stall_check() {
+  if (config->stall_budget_ms == 0)
+    return;
+  stall_budget_us = (gint64)config->stall_budget_ms * 1000;
+  g_main_context_set_poll_func(nullptr, stall_check_poll);
+}
+
+gint genie::App::stall_check_poll(GPollFD *fds, guint nfds, gint timeout) {
+  gint64 now = g_get_monotonic_time();
+  if (last_poll_return > 0 && now - last_poll_return > stall_budget_us) {
+    g_warning("Main loop stalled: iteration took %.1f ms (budget %" G_GINT64_FORMAT
+              " ms)",
+              (now - last_poll_return) / 1000.0, stall_budget_us / 1000);
+  }
+
+  gint rc = g_poll(fds, nfds, timeout);
+  last_poll_return = g_get_monotonic_time();
+  return rc;
+}
+
+void genie::App::add_startup_step(const char *name, gint64 begin) {
+  startup_steps.push_back({name, begin, g_get_monotonic_time()});
+}
+
+/**
+ * @brief Log a milestone reached after `exec()` finished initializing,
+ * relative to process startup (e.g. the first server connection).
+ */
+void genie::App::track_startup_event(const char *name) {
+  g_message("[startup] %s at +%.1f ms", name,
+            (g_get_monotonic_time() - startup_begin) / 1000.0);
+}
+
+gboolean genie::App::print_startup_timeline(gpointer data) {
+  App *self = static_cast<App *>(data);
+  gint64 origin = self->startup_begin;
+
+  g_print("################ Startup Timeline ####################\n");
+  for (const auto &step : self->startup_steps) {
+    g_print("%12s: %8.3lf ms -> %8.3lf ms (%8.3lf ms)\n", step.name,
+            (step.begin - origin) / 1000.0, (step.end - origin) / 1000.0,
+            (step.end - step.begin) / 1000.0);
+  }
+  g_print("------------------------------------------------------\n");
+  g_print("%12s: %8.3lf ms\n", "Wake ready",
+          (self->startup_wake_ready - origin) / 1000.0);
+  g_print("%12s: %8.3lf ms\n", "Main loop",
+          (g_get_monotonic_time() - origin) / 1000.0);
+  g_print("######################################################\n");
+  return G_SOURCE_REMOVE;
+}
+
 void genie::App::print_processing_entry(const char *name, double duration_ms,
                                         double total_ms) {
   g_print("%12s: %8.3lf ms (%3d%%)\n", name, duration_ms,
@@ -204,6 +407,8 @@ void genie::App::track_processing_event(ProcessingEventType event_type) {
     case ProcessingEventType::START_STT:
       gettimeofday(&start_stt, NULL);
       is_processing = true;
+      // null if this turn's input had no summary, never a previous turn's
+      turn_input_quality = std::move(pending_input_quality);
       break;
     case ProcessingEventType::END_STT:
       gettimeofday(&end_stt, NULL);
@@ -234,13 +439,283 @@ void genie::App::track_processing_event(ProcessingEventType event_type) {
       print_processing_entry("TTS", time_diff_ms(start_tts, end_tts), total_ms);
       g_print("------------------------------------------------------\n");
       print_processing_entry("Total", total_ms, total_ms);
+      if (turn_input_quality) {
+        g_print("%12s: SNR %.1f dB, peak %.1f dBFS, %zu clipped\n", "Input",
+                turn_input_quality->snr_db, turn_input_quality->peak_db,
+                turn_input_quality->clipped);
+      }
       g_print("######################################################\n");
 
+      if (webserver) {
+        webserver->publish_turn(time_diff_ms(start_stt, end_stt),
+                                time_diff_ms(start_genie, end_genie),
+                                time_diff_ms(start_tts, end_tts), total_ms,
+                                turn_input_quality.get());
+      }
+      turn_input_quality.reset();
+
       is_processing = false;
       break;
   }
 }
 
+/**
+ * @brief Report the new state on the Web UI status stream, charge the CPU
+ * used so far to the previous state, and rebuild the audio input if a config
+ * change was waiting for the Sleeping state.
+ */
+void genie::App::track_transit(const char *state_name) {
+  if (cpu_monitor)
+    cpu_monitor->state_changed(state_name);
+  if (webserver)
+    webserver->publish_state(state_name);
+  if (audio_input_stale && g_strcmp0(state_name, state::Sleeping::NAME) == 0)
+    rebuild_audio_input();
+}
+
+void genie::App::track_connection(bool connected) {
+  if (webserver)
+    webserver->publish_connection(connected);
+}
+
+void genie::App::track_volume(int volume) {
+  if (webserver)
+    webserver->publish_volume(volume);
+}
+
+void genie::App::track_network(bool has_route) {
+  if (!has_route) {
+    // idle keep-alive connections are bound to the old address and would only
+    // time out, so drop them along with the requests that cannot finish
+    soup_session_abort(soup_session.get());
+  } else if (dns_cache) {
+    // we may be on a different network with a different view of the world
+    dns_cache->invalidate();
+  }
+
+  if (stt)
+    stt->network_changed(has_route);
+  if (conversation_client)
+    conversation_client->network_changed(has_route);
+}
+
+genie::conversation::STTProtocol *genie::App::get_stt_protocol() {
+  if (!conversation_client)
+    return nullptr;
+  return conversation_client->get_stt_protocol();
+}
+
+void genie::App::track_tls(const TLSStats &stats) {
+  if (webserver)
+    webserver->publish_tls(stats);
+}
+
+genie::MemoryReport genie::App::report_memory() {
+  MemoryReport report;
+  if (conversation_client)
+    conversation_client->report_memory(report);
+  if (stt)
+    stt->report_memory(report);
+  if (audio_player)
+    audio_player->report_memory(report);
+  if (audio_input && audio_input->get_recorder())
+    report.push_back({"recorder", audio_input->get_recorder()->memory_size(),
+                      1});
+  if (dns_cache)
+    dns_cache->report_memory(report);
+  if (tls_monitor)
+    tls_monitor->report_memory(report);
+  if (worker_pool)
+    worker_pool->report_memory(report);
+  return report;
+}
+
+void genie::App::shed_memory() {
+  if (dns_cache)
+    dns_cache->shed_memory();
+  if (tls_monitor)
+    tls_monitor->shed_memory();
+  if (audio_player)
+    audio_player->shed_memory();
+}
+
+void genie::App::track_memory(const MemoryStats &stats) {
+  if (webserver)
+    webserver->publish_memory(stats);
+}
+
+void genie::App::track_cpu(const CpuStats &stats) {
+  if (webserver)
+    webserver->publish_cpu(stats);
+}
+
+void genie::App::reload_config(std::unique_ptr<Config> new_config) {
+  ConfigDiff changes = config->diff(*new_config);
+  if (changes.empty())
+    return;
+
+  config = std::move(new_config);
+  config_changed(changes);
+}
+
+// Settings that are only read while the app starts, by components that are
+// not rebuilt on the fly. A null key stands for the whole section.
+static const struct {
+  const char *section;
+  const char *key;
+} restart_only_settings[] = {
+    {"general", "assets_dir"},        {"general", "connect_timeout"},
+    {"audio", "backend"},             {"audio", "volume"},
+    {"audio", "output_fifo"},         {"buttons", "enabled"},
+    {"buttons", "evinput_dev"},       {"buttons", "talk_key"},
+    {"leds", "enabled"},              {"leds", "type"},
+    {"leds", "path"},                 {"leds", "fps"},
+    {"net", nullptr},                 {"system", "dns"},
+    {"system", "watch_config"},       {"system", "net_monitor"},
+    {"system", "dns_cache"},          {"system", "dns_cache_ttl_s"},
+    {"system", "dns_cache_stale_s"},  {"system", "proxy"},
+    {"system", "ssl_strict"},         {"system", "ssl_ca_file"},
+    {"system", "cache_dir"},          {"system", "stall_budget_ms"},
+    {"hacks", "dns_server"},          {"webui", "port"},
+    {"webui", "dev_mode"},
+};
+
+void genie::App::config_changed(const ConfigDiff &changes) {
+  g_assert(std::this_thread::get_id() == main_thread);
+  g_message("Configuration changed: %s", changes.to_string().c_str());
+
+  // Anything not handled here is read where it is used ([sound], [hacks],
+  // ducking, retry interval, web UI status limits...) and applies as is.
+
+  if (conversation_client &&
+      (changes.has("general", "url") || changes.has("general", "auth_mode") ||
+       changes.has("general", "accessToken") ||
+       changes.has("general", "conversationId") ||
+       changes.has("general", "stt_multiplex")))
+    conversation_client->force_reconnect();
+
+  if (stt &&
+      (changes.has("general", "nlUrl") || changes.has("general", "locale") ||
+       changes.has("picovoice", "wake_word_pattern")))
+    stt->reload_config();
+
+  if (audio_player)
+    audio_player->reload_config(changes);
+
+  if (audio_input &&
+      (changes.has_section("vad") || changes.has("buttons", "talk_preroll_ms") ||
+       changes.has("picovoice", "release_on_suspend")))
+    audio_input->reload_config();
+
+  if (leds && changes.has_section("leds"))
+    leds->refresh();
+
+  if (memory_monitor && changes.has("system", "memory_interval_s"))
+    memory_monitor->reload_config();
+
+  if (cpu_monitor && changes.has("system", "cpu_interval_s"))
+    cpu_monitor->reload_config();
+
+  if (audio_input &&
+      (changes.has("audio", "input") || changes.has("audio", "stereo2mono") ||
+       changes.has("audio", "recorder_seconds") || changes.has_section("ec") ||
+       changes.has("picovoice", "model") ||
+       changes.has("picovoice", "keyword") ||
+       changes.has("picovoice", "sensitivity"))) {
+    audio_input_stale = true;
+    if (dynamic_cast<state::Sleeping *>(current_state))
+      rebuild_audio_input();
+    else
+      g_message("Audio input will be rebuilt once back to sleeping");
+  }
+
+  for (const auto &setting : restart_only_settings) {
+    if (setting.key ? changes.has(setting.section, setting.key)
+                    : changes.has_section(setting.section)) {
+      g_warning("Changes to [%s] %s take effect after a restart",
+                setting.section, setting.key ? setting.key : "");
+    }
+  }
+}
+
+/**
+ * @brief Replace the audio input (driver, wake-word engine and flight
+ * recorder) with one built from the current config. Only called while
+ * Sleeping, so no turn is cut short.
+ *
+ * A dump still writing on the worker pool uses the old recorder, so the
+ * rebuild then waits for `track_audio_dump_done()`. The old input is
+ * destroyed before the new one opens the device, which cannot be opened
+ * twice; if the open fails, it is retried every `AUDIO_INPUT_RETRY_S`.
+ */
+void genie::App::rebuild_audio_input() {
+  AudioRecorder *recorder = audio_input->get_recorder();
+  if (recorder && recorder->is_dumping()) {
+    g_message("Audio input will be rebuilt once the recording is saved");
+    return;
+  }
+
+  audio_input_stale = false;
+  gint64 begin = g_get_monotonic_time();
+  audio_input->close();
+  audio_input.reset();
+  audio_input = std::make_unique<AudioInput>(this);
+  if (!audio_input->is_running()) {
+    audio_input_stale = true;
+    g_critical("Failed to rebuild the audio input, retrying in %u s",
+               AUDIO_INPUT_RETRY_S);
+    if (audio_input_retry_id == 0)
+      audio_input_retry_id = g_timeout_add_seconds(
+          AUDIO_INPUT_RETRY_S, retry_audio_input, this);
+    return;
+  }
+  g_message("Audio input rebuilt for the new configuration in %.1f ms",
+            (g_get_monotonic_time() - begin) / 1000.0);
+}
+
+gboolean genie::App::retry_audio_input(gpointer data) {
+  App *self = static_cast<App *>(data);
+  self->audio_input_retry_id = 0;
+  // otherwise `track_transit()` rebuilds it once back to Sleeping
+  if (self->audio_input_stale &&
+      dynamic_cast<state::Sleeping *>(self->current_state))
+    self->rebuild_audio_input();
+  return G_SOURCE_REMOVE;
+}
+
+void genie::App::track_input_level(int level_db) {
+  int current = input_level.load(std::memory_order_relaxed);
+  while (level_db > current &&
+         !input_level.compare_exchange_weak(current, level_db,
+                                            std::memory_order_relaxed)) {
+  }
+}
+
+void genie::App::track_input_quality(const InputQuality &quality) {
+  struct QualityUpdate {
+    App *app;
+    InputQuality quality;
+  };
+  g_main_context_invoke(
+      nullptr,
+      [](gpointer data) -> gboolean {
+        std::unique_ptr<QualityUpdate> update(
+            static_cast<QualityUpdate *>(data));
+        App *app = update->app;
+        app->pending_input_quality =
+            std::make_unique<InputQuality>(update->quality);
+        if (app->webserver)
+          app->webserver->publish_input(update->quality);
+        return G_SOURCE_REMOVE;
+      },
+      new QualityUpdate{this, quality});
+}
+
+int genie::App::take_input_level() {
+  return input_level.exchange(AudioInput::LEVEL_FLOOR_DB,
+                              std::memory_order_relaxed);
+}
+
 void genie::App::replay_deferred_events() {
   // steal all the deferred events
   // this is necessary because handling the event
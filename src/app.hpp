@@ -22,12 +22,16 @@
 
 #include "config.hpp"
 #include "utils/autoptrs.hpp"
+#include "utils/logging.hpp"
+#include "utils/memory.hpp"
+#include <atomic>
 #include <glib.h>
 #include <libsoup/soup.h>
 #include <memory>
 #include <queue>
 #include <sys/time.h>
 #include <thread>
+#include <vector>
 
 #include "audio/audio.hpp"
 
@@ -64,20 +68,36 @@ extern double time_diff_ms(struct timeval x, struct timeval y);
 namespace genie {
 
 class Config;
+class CpuMonitor;
+struct CpuStats;
+class ConfigDiff;
+class ConfigWatcher;
 class AudioInput;
 class AudioFIFO;
 class AudioPlayer;
 class AudioVolumeController;
 class EVInput;
 class Leds;
+struct InputQuality;
+class MemoryMonitor;
+struct MemoryStats;
 class Spotifyd;
 class STT;
 class TTS;
 class DNSController;
+class DNSCache;
+class TLSMonitor;
+struct TLSStats;
 class NetController;
+class NetMonitor;
 class WebServer;
+class WorkerPool;
 namespace conversation {
 class Client;
+class STTProtocol;
+}
+namespace bench {
+class DispatchHarness;
 }
 
 enum class ProcessingEventType {
@@ -98,6 +118,8 @@ class App {
   friend class state::Saying;
   friend class state::Config;
   friend class state::Disabled;
+  // installs a state on a bare App to time dispatch() -> handle()
+  friend class bench::DispatchHarness;
 
 public:
   // =========================================================================
@@ -110,10 +132,14 @@ public:
 
   static gboolean sigint_handler(gpointer data);
   static gboolean sigterm_handler(gpointer data);
+  static gboolean sigusr2_handler(gpointer data);
 
   // Public Instance Members
   // -------------------------------------------------------------------------
 
+  // Replaced (and the old one freed) by `reload_config()`, on the main thread
+  // only. Components copy the strings they keep; the audio input thread
+  // works from values copied by `AudioInput::reload_config()`.
   std::unique_ptr<Config> config;
 
   // Public Instance Methods
@@ -121,6 +147,86 @@ public:
 
   int exec(int argc, char *argv[]);
   void track_processing_event(ProcessingEventType eventType);
+  void track_startup_event(const char *name);
+  void track_connection(bool connected);
+  void track_volume(int volume);
+
+  /**
+   * @brief Called by the network monitor when the default route appears or
+   * disappears.
+   */
+  void track_network(bool has_route);
+
+  /**
+   * @brief Called on the main thread after each TLS handshake made through
+   * the shared SoupSession, with the running totals.
+   */
+  void track_tls(const TLSStats &stats);
+
+  /**
+   * @brief Replace the running configuration with `new_config`, freshly
+   * loaded from disk, and apply whatever differs.
+   */
+  void reload_config(std::unique_ptr<Config> new_config);
+
+  /**
+   * @brief Tell the components owning the `changes` keys to pick up their
+   * new values: live where that is safe, by rebuilding only that subsystem
+   * otherwise. Also used by the web UI after it updated the config in place.
+   */
+  void config_changed(const ConfigDiff &changes);
+
+  /**
+   * @brief Record the peak level of an input frame, in dBFS. This method is
+   * _thread-safe_, it is called from the audio input thread.
+   *
+   * The highest level seen is kept until `take_input_level()` reads it.
+   */
+  void track_input_level(int level_db);
+  int take_input_level();
+
+  /**
+   * @brief Publish the audio quality summary of a turn when its input ends,
+   * and keep it to report with the turn's latencies. This method is
+   * _thread-safe_, it is called from the audio input thread.
+   */
+  void track_input_quality(const InputQuality &quality);
+
+  /**
+   * @brief Save the audio flight recorder to disk, if enabled. `automatic`
+   * is set for dumps after a failed turn, which can be turned off in the
+   * config.
+   */
+  void dump_audio_recording(const char *reason, bool automatic = false);
+
+  /**
+   * @brief Called by the flight recorder when a dump has been written, to
+   * run an audio input rebuild that was waiting for it.
+   */
+  void track_audio_dump_done();
+  bool set_audio_recorder_enabled(bool enabled);
+
+  /**
+   * @brief Collect what the components account for: queues, caches, pools
+   * and pipeline buffers. Used by the memory monitor.
+   */
+  MemoryReport report_memory();
+
+  /**
+   * @brief Drop whatever the components can rebuild later, because the
+   * process is over its memory soft limit.
+   */
+  void shed_memory();
+
+  /**
+   * @brief Called by the memory monitor after each sample.
+   */
+  void track_memory(const MemoryStats &stats);
+
+  /**
+   * @brief Called by the CPU monitor after each sample.
+   */
+  void track_cpu(const CpuStats &stats);
 
   /**
    * @brief Dispatch a state `event`. This method is _thread-safe_.
@@ -131,13 +237,19 @@ public:
    * After the `event` is handled it is deleted.
    */
   template <typename E> guint dispatch(E *event) {
-    g_debug("DISPATCH EVENT %s", typeid(E).name());
+    GENIE_DEBUG("DISPATCH EVENT %s", typeid(E).name());
     DispatchUserData *dispatch_user_data = new DispatchUserData(this, event);
     return g_idle_add(handle<E>, dispatch_user_data);
   }
 
   SoupSession *get_soup_session() { return soup_session.get(); }
 
+  /**
+   * @brief The STT extension of the conversation connection, for STT
+   * sessions to stream over when the server granted it.
+   */
+  conversation::STTProtocol *get_stt_protocol();
+
   /**
    * Defer the handling of this event until the next state.
    */
@@ -156,6 +268,7 @@ public:
   // TODO: make private and react through events
 public:
   std::unique_ptr<NetController> net_controller;
+  std::unique_ptr<WorkerPool> worker_pool;
 
 private:
   // =========================================================================
@@ -196,11 +309,22 @@ private:
   std::unique_ptr<AudioPlayer> audio_player;
   std::unique_ptr<conversation::Client> conversation_client;
   std::unique_ptr<DNSController> dns_controller;
+  std::unique_ptr<DNSCache> dns_cache;
+  std::unique_ptr<TLSMonitor> tls_monitor;
   std::unique_ptr<EVInput> ev_input;
   std::unique_ptr<Leds> leds;
+  std::unique_ptr<NetMonitor> net_monitor;
   std::unique_ptr<Spotifyd> spotifyd;
   std::unique_ptr<STT> stt;
   std::unique_ptr<WebServer> webserver;
+  std::unique_ptr<ConfigWatcher> config_watcher;
+  std::unique_ptr<MemoryMonitor> memory_monitor;
+  std::unique_ptr<CpuMonitor> cpu_monitor;
+
+  // the audio input must be rebuilt for the new config, once back to Sleeping
+  bool audio_input_stale = false;
+  // pending retry after the rebuilt input failed to open its device
+  guint audio_input_retry_id = 0;
 
   // ### Performance Tracking ###
 
@@ -211,6 +335,25 @@ private:
   struct timeval end_genie;
   struct timeval start_tts;
   struct timeval end_tts;
+  std::atomic<int> input_level;
+  // set when the user's command ends, taken for the turn at START_STT
+  std::unique_ptr<InputQuality> pending_input_quality;
+  // reported with the latencies at DONE
+  std::unique_ptr<InputQuality> turn_input_quality;
+
+  /**
+   * @brief A component initialized during `exec()`, with monotonic begin and
+   * end times (in µs).
+   */
+  struct StartupStep {
+    const char *name;
+    gint64 begin;
+    gint64 end;
+  };
+
+  gint64 startup_begin;
+  gint64 startup_wake_ready;
+  std::vector<StartupStep> startup_steps;
 
   // ### State Variables ###
 
@@ -281,9 +424,16 @@ private:
 
   void init_soup();
 
+  void install_stall_check();
+  static gint stall_check_poll(GPollFD *fds, guint nfds, gint timeout);
+  void add_startup_step(const char *name, gint64 begin);
+  static gboolean print_startup_timeline(gpointer data);
   void print_processing_entry(const char *name, double duration_ms,
                               double total_ms);
   void replay_deferred_events();
+  void track_transit(const char *state_name);
+  void rebuild_audio_input();
+  static gboolean retry_audio_input(gpointer data);
 
   /**
    * @brief GLib main loop callback for dispatching state events.
@@ -296,7 +446,7 @@ private:
    * the `state::events::Event`, then deletes the event.
    */
   template <typename E> static gboolean handle(gpointer user_data) {
-    g_debug("HANDLE EVENT %s", typeid(E).name());
+    GENIE_DEBUG("HANDLE EVENT %s", typeid(E).name());
     DispatchUserData *dispatch_user_data =
         static_cast<DispatchUserData *>(user_data);
     App *self = dispatch_user_data->app;
@@ -327,6 +477,7 @@ private:
     delete current_state;
     current_state = new_state;
     current_state->enter();
+    track_transit(S::NAME);
     replay_deferred_events();
   }
 };
@@ -98,7 +98,7 @@ int genie::AudioFIFO::init() {
 
   running = true;
   GError *thread_error = NULL;
-  g_thread_try_new("audioFIFOThread", (GThreadFunc)loop, this, &thread_error);
+  g_thread_try_new("genie:fifo", (GThreadFunc)loop, this, &thread_error);
   if (thread_error) {
     g_print("audioFIFOThread Error: g_thread_try_new() %s\n",
             thread_error->message);
@@ -17,16 +17,12 @@
 // limitations under the License.
 
 #include "input.hpp"
+#include "audio/recorder.hpp"
+#include "utils/logging.hpp"
 
-// Define the following to dump audio streams for debugging reasons
-// #define DEBUG_DUMP_STREAMS
-
-#ifdef DEBUG_DUMP_STREAMS
-FILE *fp_input;
-FILE *fp_input_mono;
-FILE *fp_playback;
-FILE *fp_filter;
-#endif
+// wait between attempts to restart a capture stream that failed, so the input
+// thread does not spin while the device is unusable
+static const gulong RECOVER_INTERVAL_US = 1000 * 1000;
 
 genie::AudioInputAlsa::AudioInputAlsa(App *app) : app(app) {}
 
@@ -38,81 +34,73 @@ genie::AudioInputAlsa::~AudioInputAlsa() {
   if (alsa_handle != NULL) {
     snd_pcm_close(alsa_handle);
   }
-#ifdef DEBUG_DUMP_STREAMS
-  fclose(fp_input);
-  fclose(fp_input_mono);
-  fclose(fp_playback);
-  fclose(fp_filter);
-#endif
 }
 
 bool genie::AudioInputAlsa::init_pcm(gchar *input_audio_device) {
   alsa_handle = NULL;
-  int error_code =
-      snd_pcm_open(&alsa_handle, input_audio_device, SND_PCM_STREAM_CAPTURE, 0);
+  // open non-blocking so a busy device fails instead of stalling the caller
+  // (the main thread when the input is rebuilt), then read blocking
+  int error_code = snd_pcm_open(&alsa_handle, input_audio_device,
+                                SND_PCM_STREAM_CAPTURE, SND_PCM_NONBLOCK);
   if (error_code != 0) {
-    g_error("'snd_pcm_open' failed with '%s'\n", snd_strerror(error_code));
+    g_critical("'snd_pcm_open' failed with '%s'\n", snd_strerror(error_code));
     return false;
   }
+  snd_pcm_nonblock(alsa_handle, 0);
 
-  snd_pcm_hw_params_t *hardware_params = NULL;
-  error_code = snd_pcm_hw_params_malloc(&hardware_params);
-  if (error_code != 0) {
-    g_error("'snd_pcm_hw_params_malloc' failed with '%s'\n",
-            snd_strerror(error_code));
-    return false;
-  }
+  snd_pcm_hw_params_t *hardware_params;
+  snd_pcm_hw_params_alloca(&hardware_params);
 
   error_code = snd_pcm_hw_params_any(alsa_handle, hardware_params);
   if (error_code != 0) {
-    g_error("'snd_pcm_hw_params_any' failed with '%s'\n",
-            snd_strerror(error_code));
+    g_critical("'snd_pcm_hw_params_any' failed with '%s'\n",
+               snd_strerror(error_code));
     return false;
   }
 
   error_code = snd_pcm_hw_params_set_access(alsa_handle, hardware_params,
                                             SND_PCM_ACCESS_RW_INTERLEAVED);
   if (error_code != 0) {
-    g_error("'snd_pcm_hw_params_set_access' failed with '%s'\n",
-            snd_strerror(error_code));
+    g_critical("'snd_pcm_hw_params_set_access' failed with '%s'\n",
+               snd_strerror(error_code));
     return false;
   }
 
   error_code = snd_pcm_hw_params_set_format(alsa_handle, hardware_params,
                                             SND_PCM_FORMAT_S16_LE);
   if (error_code != 0) {
-    g_error("'snd_pcm_hw_params_set_format' failed with '%s'\n",
-            snd_strerror(error_code));
+    g_critical("'snd_pcm_hw_params_set_format' failed with '%s'\n",
+               snd_strerror(error_code));
     return false;
   }
 
   error_code =
       snd_pcm_hw_params_set_rate(alsa_handle, hardware_params, sample_rate, 0);
   if (error_code != 0) {
-    g_error("'snd_pcm_hw_params_set_rate' failed with '%s'\n",
-            snd_strerror(error_code));
+    g_critical("'snd_pcm_hw_params_set_rate' failed with '%s'\n",
+               snd_strerror(error_code));
     return false;
   }
 
   error_code =
       snd_pcm_hw_params_set_channels(alsa_handle, hardware_params, channels);
   if (error_code != 0) {
-    g_error("'snd_pcm_hw_params_set_channels' failed with '%s'\n",
-            snd_strerror(error_code));
+    g_critical("'snd_pcm_hw_params_set_channels' failed with '%s'\n",
+               snd_strerror(error_code));
     return false;
   }
 
   error_code = snd_pcm_hw_params(alsa_handle, hardware_params);
   if (error_code != 0) {
-    g_error("'snd_pcm_hw_params' failed with '%s'\n", snd_strerror(error_code));
+    g_critical("'snd_pcm_hw_params' failed with '%s'\n",
+               snd_strerror(error_code));
     return false;
   }
 
-  snd_pcm_hw_params_free(hardware_params);
-
   error_code = snd_pcm_prepare(alsa_handle);
   if (error_code != 0) {
-    g_error("'snd_pcm_prepare' failed with '%s'\n", snd_strerror(error_code));
+    g_critical("'snd_pcm_prepare' failed with '%s'\n",
+               snd_strerror(error_code));
     return false;
   }
 
@@ -151,16 +139,20 @@ bool genie::AudioInputAlsa::init_speex() {
 bool genie::AudioInputAlsa::init(gchar *audio_input_device, int m_sample_rate,
                                  int m_channels, int max_frame_length) {
   if (!audio_input_device) {
-    g_error("no input audio device");
+    g_critical("no input audio device");
     return false;
   }
   sample_rate = m_sample_rate;
   frame_length = max_frame_length;
 
+  stereo2mono = app->config->audio_input_stereo2mono;
+  ec_loopback = app->config->audio_ec_loopback;
+  ec_enabled = app->config->audio_ec_enabled;
+
   channels = 1;
-  if (app->config->audio_input_stereo2mono) {
+  if (stereo2mono) {
     channels = 2;
-    if (app->config->audio_ec_loopback) {
+    if (ec_loopback) {
       channels = 3;
     }
   }
@@ -169,18 +161,20 @@ bool genie::AudioInputAlsa::init(gchar *audio_input_device, int m_sample_rate,
     return false;
   }
 
-  if (app->config->audio_ec_enabled) {
+  if (ec_enabled) {
     if (!init_speex()) {
       return false;
     }
   }
 
-#ifdef DEBUG_DUMP_STREAMS
-  fp_input = fopen("/tmp/input.raw", "wb+");
-  fp_input_mono = fopen("/tmp/input_mono.raw", "wb+");
-  fp_playback = fopen("/tmp/playback.raw", "wb+");
-  fp_filter = fopen("/tmp/filter.raw", "wb+");
-#endif
+  if (recorder && channels >= 2) {
+    recorder->set_channels(AudioRecorder::Track::RAW, channels);
+    if (ec_loopback && channels == 3)
+      recorder->set_channels(AudioRecorder::Track::REFERENCE, 1);
+    if (ec_enabled && channels == 3)
+      recorder->set_channels(AudioRecorder::Track::FILTERED, 1);
+  }
+
   pcm = (int16_t *)malloc(max_frame_length * channels * sizeof(int16_t));
   if (!pcm) {
     g_error("failed to allocate memory for audio buffer\n");
@@ -208,6 +202,31 @@ bool genie::AudioInputAlsa::init(gchar *audio_input_device, int m_sample_rate,
   return true;
 }
 
+/**
+ * @brief Split an interleaved capture buffer of 2 or 3 channels.
+ *
+ * The first 2 channels (l/r) are mixed to `mono`, or only the left one is
+ * kept without `stereo2mono`. If `playback` is set, the 3rd channel is the
+ * playback signal for echo cancellation and is copied there.
+ */
+void genie::AudioInputAlsa::extract_channels(const int16_t *pcm,
+                                             size_t frame_length, int channels,
+                                             bool stereo2mono, int16_t *mono,
+                                             int16_t *playback) {
+  for (size_t i = 0, j = 0; j < frame_length; i += channels, j++) {
+    int16_t left = pcm[i];
+    int16_t right = pcm[i + 1];
+    if (stereo2mono) {
+      mono[j] = (int16_t)((int32_t(left) + right) / 2);
+    } else {
+      mono[j] = left;
+    }
+    if (playback) {
+      playback[j] = pcm[i + 2];
+    }
+  }
+}
+
 genie::AudioFrame genie::AudioInputAlsa::read_frame(int32_t frame_length) {
   int read_frames = 0;
   int error;
@@ -215,38 +234,32 @@ genie::AudioFrame genie::AudioInputAlsa::read_frame(int32_t frame_length) {
   if (alsa_handle != NULL) {
     read_frames = snd_pcm_readi(alsa_handle, pcm, frame_length);
     if (read_frames < 0) {
-      g_critical("'snd_pcm_readi' failed with '%s'", snd_strerror(read_frames));
+      GENIE_LOG_RATELIMITED(g_critical, 10000,
+                            "'snd_pcm_readi' failed with '%s'",
+                            snd_strerror(read_frames));
+      // overruns and system suspend are recovered right away; anything else
+      // (e.g. a failed resume() left the stream unprepared) is retried later
+      if (snd_pcm_recover(alsa_handle, read_frames, 1) != 0) {
+        g_usleep(RECOVER_INTERVAL_US);
+        snd_pcm_prepare(alsa_handle);
+      }
       return AudioFrame(0);
     }
   }
 
   if (read_frames != frame_length) {
-    g_message("read %d frames instead of %d", read_frames, frame_length);
+    GENIE_LOG_RATELIMITED(g_message, 1000, "read %d frames instead of %d",
+                          read_frames, frame_length);
     return AudioFrame(0);
   }
 
   int16_t *pcm_out = pcm;
 
   if (alsa_handle != NULL && channels >= 2) {
-    // lossy stereo to mono conversion for the first 2 channels (l/r)
-    // extract the playback signal from the 3rd channel
-    for (int32_t i = 0, j = 0; i < (frame_length * channels);
-         i += channels, j++) {
-      int16_t left = *(int16_t *)&pcm[i];
-      int16_t right = *(int16_t *)&pcm[i + 1];
-      if (app->config->audio_input_stereo2mono) {
-        int16_t mix = (int16_t)((int32_t(left) + right) / 2);
-        pcm_mono[j] = mix;
-      } else {
-        pcm_mono[j] = left;
-      }
-      if (app->config->audio_ec_loopback && channels == 3) {
-        int16_t ref = *(int16_t *)&pcm[i + 2];
-        pcm_playback[j] = ref;
-      }
-    }
+    extract_channels(pcm, frame_length, channels, stereo2mono, pcm_mono,
+                     ec_loopback && channels == 3 ? pcm_playback : nullptr);
 
-    if (app->config->audio_ec_enabled && channels == 3) {
+    if (ec_enabled && channels == 3) {
       speex_echo_cancellation(echo_state, (const spx_int16_t *)pcm_mono,
                               (const int16_t *)pcm_playback,
                               (spx_int16_t *)pcm_filter);
@@ -256,24 +269,61 @@ genie::AudioFrame genie::AudioInputAlsa::read_frame(int32_t frame_length) {
         speex_preprocess_run(pp_state, (spx_int16_t *)pcm_filter);
       }
 
-#ifdef DEBUG_DUMP_STREAMS
-      fwrite(pcm_playback, sizeof(int16_t), frame_length, fp_playback);
-      fwrite(pcm_filter, sizeof(int16_t), frame_length, fp_filter);
-#endif
+      if (recorder) {
+        recorder->write(AudioRecorder::Track::REFERENCE, pcm_playback,
+                        frame_length);
+        recorder->write(AudioRecorder::Track::FILTERED, pcm_filter,
+                        frame_length);
+      }
       pcm_out = pcm_filter;
     } else {
       pcm_out = pcm_mono;
     }
-#ifdef DEBUG_DUMP_STREAMS
-    fwrite(pcm_mono, sizeof(int16_t), frame_length, fp_input_mono);
-#endif
+    if (recorder) {
+      recorder->write(AudioRecorder::Track::RAW, pcm, frame_length);
+      recorder->write(AudioRecorder::Track::MONO, pcm_mono, frame_length);
+    }
+  } else if (recorder) {
+    recorder->write(AudioRecorder::Track::MONO, pcm, frame_length);
   }
 
-#ifdef DEBUG_DUMP_STREAMS
-  fwrite(pcm, sizeof(int16_t), frame_length * channels, fp_input);
-#endif
-
   AudioFrame frame(frame_length);
   memcpy(frame.samples, pcm_out, frame_length * sizeof(int16_t));
   return frame;
 }
+
+/**
+ * @brief Stop the capture stream, discarding anything buffered.
+ *
+ * The device stays open so resuming only needs to re-prepare it.
+ */
+void genie::AudioInputAlsa::suspend() {
+  if (alsa_handle == NULL) {
+    return;
+  }
+  int error_code = snd_pcm_drop(alsa_handle);
+  if (error_code != 0) {
+    g_warning("'snd_pcm_drop' failed with '%s'", snd_strerror(error_code));
+  }
+}
+
+bool genie::AudioInputAlsa::resume() {
+  if (alsa_handle == NULL) {
+    return true;
+  }
+  int error_code = snd_pcm_prepare(alsa_handle);
+  if (error_code != 0) {
+    g_critical("'snd_pcm_prepare' failed with '%s'", snd_strerror(error_code));
+    return false;
+  }
+  error_code = snd_pcm_start(alsa_handle);
+  if (error_code != 0) {
+    g_critical("'snd_pcm_start' failed with '%s'", snd_strerror(error_code));
+    return false;
+  }
+  // the echo reference is discontinuous after a gap, start adapting again
+  if (ec_enabled && echo_state) {
+    speex_echo_state_reset(echo_state);
+  }
+  return true;
+}
@@ -35,6 +35,12 @@ public:
   bool init(gchar *audio_input_device, int sample_rate, int channels,
             int max_frame_length);
   AudioFrame read_frame(int32_t frame_length);
+  void suspend();
+  bool resume();
+
+  static void extract_channels(const int16_t *pcm, size_t frame_length,
+                               int channels, bool stereo2mono, int16_t *mono,
+                               int16_t *playback);
 
 private:
   // initialized once and never overwritten
@@ -47,13 +53,19 @@ private:
   SpeexEchoState *echo_state;
   SpeexPreprocessState *pp_state;
 
-  int16_t *pcm;
-  int16_t *pcm_mono;
-  int16_t *pcm_playback;
-  int16_t *pcm_filter;
+  int16_t *pcm = NULL;
+  int16_t *pcm_mono = NULL;
+  int16_t *pcm_playback = NULL;
+  int16_t *pcm_filter = NULL;
   size_t sample_rate;
   int16_t channels;
   size_t frame_length;
+
+  // copied from the config in init(): changing them needs a new driver, so a
+  // reloaded config must not affect the running one
+  bool stereo2mono;
+  bool ec_loopback;
+  bool ec_enabled;
 };
 
 } // namespace genie
@@ -20,6 +20,8 @@
 
 namespace genie {
 
+class AudioRecorder;
+
 class AudioInputDriver {
 public:
   AudioInputDriver(){};
@@ -27,6 +29,15 @@ public:
   virtual bool init(gchar *audio_input_device, int sample_rate, int channels,
                     int max_frame_length) = 0;
   virtual AudioFrame read_frame(int32_t frame_length) = 0;
+  // stop capturing until `resume()`; both are called from the input thread
+  virtual void suspend() = 0;
+  virtual bool resume() = 0;
+
+  // set before `init()`, null when the flight recorder is disabled
+  void set_recorder(AudioRecorder *recorder) { this->recorder = recorder; }
+
+protected:
+  AudioRecorder *recorder = nullptr;
 };
 
 class AudioVolumeDriver {
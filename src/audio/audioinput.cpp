@@ -19,6 +19,9 @@
 #include "audioinput.hpp"
 #include "alsa/input.hpp"
 #include "pulseaudio/input.hpp"
+#include "utils/logging.hpp"
+#include "utils/threads.hpp"
+#include <cstdlib>
 
 // note: we need to redefine G_LOG_DOMAIN here or the definition will
 // bleed into the functions declared in the header, which will break
@@ -28,7 +31,9 @@
 
 genie::AudioInput::AudioInput(App *app)
     : app(app), vad_instance(WebRtcVad_Create()), wakeword(nullptr),
-      input(nullptr), state(State::WAITING) {
+      input(nullptr), state(State::WAITING), suspend_requested(false),
+      resume_requested_time(0), talk_requested(false), talk_hold(false),
+      talk_release_requested(false) {
   wakeword = std::make_unique<WakeWord>(app);
 
   sample_rate = wakeword->sample_rate;
@@ -45,20 +50,31 @@ genie::AudioInput::AudioInput(App *app)
     g_assert_not_reached();
   }
 
+  if (app->config->audio_recorder_seconds > 0) {
+    recorder = std::make_unique<AudioRecorder>(
+        app, sample_rate, app->config->audio_recorder_seconds);
+    input->set_recorder(recorder.get());
+  }
+
   if (!input->init(app->config->audio_input_device, wakeword->sample_rate,
                    channels, max_frame_length)) {
-    g_error("failed to initialized audio input driver");
+    g_critical("failed to initialize audio input driver");
     return;
   }
 
+  if (recorder) {
+    g_message("Audio flight recorder keeps %zu s in %zu KB",
+              app->config->audio_recorder_seconds,
+              recorder->memory_size() / 1024);
+  }
+
   if (WebRtcVad_Init(vad_instance)) {
     g_error("failed to initialize webrtc vad\n");
     return;
   }
 
-  int vadMode = 3;
-  if (WebRtcVad_set_mode(vad_instance, vadMode)) {
-    g_error("unable to set vad mode to %d", vadMode);
+  if (WebRtcVad_set_mode(vad_instance, Endpointer::VAD_MODE)) {
+    g_error("unable to set vad mode to %d", Endpointer::VAD_MODE);
     return;
   }
 
@@ -66,38 +82,96 @@ genie::AudioInput::AudioInput(App *app)
     g_debug("invalid rate %zd or framelength %d", sample_rate, pv_frame_length);
   }
 
-  vad_start_frame_count = ms_to_frames(AUDIO_INPUT_VAD_FRAME_LENGTH,
-                                       app->config->vad_start_speaking_ms);
+  reload_config();
+
+  g_message("Initialized audio input with %s backend\n", audio_driver_type_to_string(app->config->audio_backend));
+  input_thread = std::thread(&AudioInput::loop, this);
+}
+
+genie::AudioInput::~AudioInput() { WebRtcVad_Free(vad_instance); }
+
+/**
+ * @brief Convert the [vad] timings of the current configuration to frame
+ * counts, and copy the other settings the input thread uses. Called again
+ * when the configuration changes; a turn in progress picks up the new values
+ * on its next frame.
+ */
+void genie::AudioInput::reload_config() {
+  size_t start_frames = ms_to_frames(AUDIO_INPUT_VAD_FRAME_LENGTH,
+                                     app->config->vad_start_speaking_ms);
   g_message("Calculated start VAD: %zd ms -> %zd frames",
-            app->config->vad_start_speaking_ms, vad_start_frame_count);
+            app->config->vad_start_speaking_ms, start_frames);
 
-  vad_done_frame_count = ms_to_frames(AUDIO_INPUT_VAD_FRAME_LENGTH,
-                                      app->config->vad_done_speaking_ms);
+  size_t done_frames = ms_to_frames(AUDIO_INPUT_VAD_FRAME_LENGTH,
+                                    app->config->vad_done_speaking_ms);
   g_message("Calculated done VAD: %zd ms -> %zd frames",
-            app->config->vad_done_speaking_ms, vad_done_frame_count);
+            app->config->vad_done_speaking_ms, done_frames);
 
-  vad_input_detected_noise_frame_count = ms_to_frames(
+  size_t noise_frames = ms_to_frames(
       AUDIO_INPUT_VAD_FRAME_LENGTH, app->config->vad_input_detected_noise_ms);
   g_message("Calculated input detection consecutive noise frame count: %zd ms "
             "-> %zd frames",
-            app->config->vad_input_detected_noise_ms,
-            vad_input_detected_noise_frame_count);
+            app->config->vad_input_detected_noise_ms, noise_frames);
 
-  vad_listen_timeout_frame_count = ms_to_frames(
-      AUDIO_INPUT_VAD_FRAME_LENGTH, app->config->vad_listen_timeout_ms);
+  size_t timeout_frames = ms_to_frames(AUDIO_INPUT_VAD_FRAME_LENGTH,
+                                       app->config->vad_listen_timeout_ms);
   g_message("Calculated listen timeout frame count: %zd ms "
             "-> %zd frames",
-            app->config->vad_listen_timeout_ms, vad_listen_timeout_frame_count);
-
-  g_message("Initialized audio input with %s backend\n", audio_driver_type_to_string(app->config->audio_backend));
-  input_thread = std::thread(&AudioInput::loop, this);
+            app->config->vad_listen_timeout_ms, timeout_frames);
+
+  vad_start_frame_count = start_frames;
+  vad_done_frame_count = done_frames;
+  vad_input_detected_noise_frame_count = noise_frames;
+  vad_listen_timeout_frame_count = timeout_frames;
+  talk_preroll_frame_count =
+      ms_to_frames(pv_frame_length, app->config->buttons_talk_preroll_ms);
+  release_on_suspend = app->config->pv_release_on_suspend;
 }
 
-genie::AudioInput::~AudioInput() { WebRtcVad_Free(vad_instance); }
+genie::EndpointLimits genie::AudioInput::vad_limits() const {
+  EndpointLimits limits;
+  limits.start_frames = vad_start_frame_count;
+  limits.done_frames = vad_done_frame_count;
+  limits.noise_frames = vad_input_detected_noise_frame_count;
+  limits.timeout_frames = vad_listen_timeout_frame_count;
+  return limits;
+}
 
 void genie::AudioInput::close() {
   state.store(State::CLOSED);
-  input_thread.join();
+  {
+    std::lock_guard<std::mutex> lock(suspend_mutex);
+  }
+  suspend_cond.notify_one();
+  if (input_thread.joinable())
+    input_thread.join();
+}
+
+/**
+ * @brief Stop capturing and running the wake-word engine until `resume()`.
+ *
+ * Used while the wake-word would be ignored anyway (the Disabled and Config
+ * states). The input thread stops the driver and then blocks, so it uses no
+ * CPU while suspended. Thread-safe, like `wake()`.
+ */
+void genie::AudioInput::suspend() {
+  {
+    std::lock_guard<std::mutex> lock(suspend_mutex);
+    suspend_requested = true;
+  }
+  suspend_cond.notify_one();
+}
+
+void genie::AudioInput::resume() {
+  {
+    std::lock_guard<std::mutex> lock(suspend_mutex);
+    if (!suspend_requested) {
+      return;
+    }
+    resume_requested_time = g_get_monotonic_time();
+    suspend_requested = false;
+  }
+  suspend_cond.notify_one();
 }
 
 /**
@@ -134,6 +208,32 @@ void genie::AudioInput::wake() {
   state.compare_exchange_strong(expect, State::WOKE);
 }
 
+/**
+ * @brief Start a turn for the push-to-talk key, without waiting for the
+ * wake word. This method is _thread-safe_.
+ *
+ * The input thread picks the request up on its next frame, sends the
+ * configured pre-roll from the wake-word buffer and goes straight to
+ * listening. Until `talk_released()`, the end of speech does not end the
+ * input. Pressed during a turn, the key only holds it open.
+ */
+void genie::AudioInput::talk_pressed() {
+  talk_hold = true;
+  talk_requested = true;
+}
+
+/**
+ * @brief The push-to-talk key went up. With `end_input` the input ends on
+ * the next frame, otherwise VAD takes over as after the wake word. This
+ * method is _thread-safe_.
+ */
+void genie::AudioInput::talk_released(bool end_input) {
+  if (end_input)
+    talk_release_requested = true;
+  else
+    talk_hold = false;
+}
+
 /**
  * @brief Convert `ms` milliseconds to number of frames at a given
  * `frame_length` (in samples).
@@ -145,20 +245,47 @@ void genie::AudioInput::wake() {
  * @return int32_t
  */
 size_t genie::AudioInput::ms_to_frames(size_t frame_length, size_t ms) {
-  //     floor <-  (samples/sec * (     seconds     )) / (samples/frame)
-  g_assert(sample_rate > 0);
-  return (size_t)((sample_rate * ((double)ms / 1000)) / frame_length);
+  return EndpointLimits::ms_to_frames(sample_rate, frame_length, ms);
+}
+
+/**
+ * @brief Compute the level statistics of a new frame, and report its peak
+ * level for the web UI meter.
+ */
+genie::FrameStats genie::AudioInput::measure_frame(const AudioFrame &frame) {
+  FrameStats stats = FrameStats::compute(frame.samples, frame.length);
+  app->track_input_level((int)stats.peak_db());
+  return stats;
+}
+
+/**
+ * @brief Close the quality summary of the turn and report it. Called before
+ * dispatching the event that ends the input, so the app has the summary by
+ * the time it handles that event, whatever the outcome.
+ */
+void genie::AudioInput::report_turn_quality() {
+  if (!quality.in_turn())
+    return;
+
+  InputQuality turn = quality.end_turn();
+  g_message("Turn input: SNR %.1f dB (speech %.1f dBFS, noise %.1f dBFS), "
+            "peak %.1f dBFS, %zu samples clipped, DC offset %.2f%%",
+            turn.snr_db, turn.speech_db, turn.noise_floor_db, turn.peak_db,
+            turn.clipped, turn.dc_offset * 100);
+  app->track_input_quality(turn);
 }
 
 void genie::AudioInput::transition(State to_state) {
   // Reset state variables
-  state_woke_frame_count = 0;
-  state_vad_silent_count = 0;
-  state_vad_noise_count = 0;
+  endpointer.reset();
+
+  if (to_state != State::WAITING && !quality.in_turn())
+    quality.start_turn();
 
   switch (to_state) {
     case State::WAITING:
       g_message("[AudioInput] -> State::WAITING");
+      talk_hold = false;
       state = State::WAITING;
       break;
     case State::WOKE:
@@ -182,6 +309,7 @@ void genie::AudioInput::loop_waiting() {
   if (new_frame.length == 0) {
     return;
   }
+  quality.process(measure_frame(new_frame), sample_rate, -1);
 
   // Drop from the queue if there are too many items
   while (frame_buffer.size() > BUFFER_MAX_FRAMES) {
@@ -190,19 +318,33 @@ void genie::AudioInput::loop_waiting() {
 
   // Check the new frame for the wake-word
   bool detected = wakeword->process(&new_frame);
+  if (recorder)
+    recorder->mark_frame(-1, detected);
 
   // Add the new frame to the queue
   frame_buffer.push(std::move(new_frame));
 
-  if (!detected) {
-    // wake-word not found
+  bool talk = talk_requested.exchange(false);
+  if (!detected && !talk) {
+    // wake-word not found; a release without a press is left over from a
+    // turn that already ended
+    talk_release_requested = false;
     return;
   }
 
-  g_message("Wakeword detected in waiting state");
+  if (talk) {
+    // keep the pre-roll, plus the frame captured since the key went down
+    size_t preroll = talk_preroll_frame_count;
+    while (frame_buffer.size() > preroll + 1) {
+      frame_buffer.pop();
+    }
+    g_message("Talk key pressed in waiting state");
+  } else {
+    g_message("Wakeword detected in waiting state");
+  }
   app->dispatch(new state::events::Wake());
 
-  g_debug("Sending prior %zd frames\n", frame_buffer.size());
+  GENIE_RING_DEBUG("Sending prior %zu frames", frame_buffer.size());
 
   while (!frame_buffer.empty()) {
     app->dispatch(
@@ -210,7 +352,31 @@ void genie::AudioInput::loop_waiting() {
     frame_buffer.pop();
   }
 
-  transition(State::WOKE);
+  // with the talk key, the user is already speaking: skip waiting for VAD
+  // to hear the start of speech
+  transition(talk ? State::LISTENING : State::WOKE);
+}
+
+/**
+ * @brief Handle push-to-talk requests during a turn, after the frame was
+ * sent. Returns true if they changed the state.
+ */
+bool genie::AudioInput::check_talk() {
+  if (talk_release_requested.exchange(false)) {
+    talk_requested = false;
+    g_message("Talk key released after %zu frames", endpointer.frames());
+    report_turn_quality();
+    app->dispatch(new state::events::InputDone(true));
+    transition(State::WAITING);
+    return true;
+  }
+
+  // a press during a turn holds it open, the user is speaking already
+  if (talk_requested.exchange(false) && state == State::WOKE) {
+    transition(State::LISTENING);
+    return true;
+  }
+  return false;
 }
 
 void genie::AudioInput::loop_woke() {
@@ -219,8 +385,7 @@ void genie::AudioInput::loop_woke() {
   if (new_frame.length == 0) {
     return;
   }
-
-  state_woke_frame_count += 1;
+  FrameStats stats = measure_frame(new_frame);
 
   // Run Voice Activity Detection (VAD) against the frame
 
@@ -229,45 +394,34 @@ void genie::AudioInput::loop_woke() {
   int vad_result =
       WebRtcVad_Process(vad_instance, sample_rate, new_frame.samples,
                         AUDIO_INPUT_VAD_FRAME_LENGTH);
+  if (recorder)
+    recorder->mark_frame(vad_result, false);
+  quality.process(stats, sample_rate, vad_result);
 
   app->dispatch(new state::events::InputFrame(std::move(new_frame)));
 
-  if (vad_result == VAD_IS_SILENT) {
-    g_debug("Frame %zu is silent in woke state (silent: %zu, noise: %zu)",
-            state_woke_frame_count, state_vad_silent_count,
-            state_vad_noise_count);
-    // We picked up silence
-    //
-    // Increment the silent count
-    state_vad_silent_count += 1;
-    // Set the noise count to zero
-    // state_vad_noise_count = 0;
-  } else if (vad_result == VAD_NOT_SILENT) {
-    g_debug("Frame %zu is not silent in woke state (silent: %zu, noise: %zu)",
-            state_woke_frame_count, state_vad_silent_count,
-            state_vad_noise_count);
-    // We picked up silence
-    //
-    // Increment the noise count
-    state_vad_noise_count += 1;
-    // Set the silent count to zero
-    state_vad_silent_count = 0;
-
-    if (state_vad_noise_count >= vad_input_detected_noise_frame_count) {
-      g_debug("Detected %zu frames of noise, transition to listening",
-              state_vad_noise_count);
-      // We have measured the configured amount of consecutive noise frames,
-      // which means we have detected input.
-      //
-      // Transition to `State::LISTENING`
-      transition(State::LISTENING);
-      return;
-    }
-  }
+  if (check_talk())
+    return;
 
-  if (state_woke_frame_count >= vad_start_frame_count) {
-    g_debug("Not detected VAD input after %zu frames", vad_start_frame_count);
+  Endpointer::Result result = endpointer.process_woke(vad_result, vad_limits());
+  GENIE_RING_DEBUG(
+      "Frame %zu is %s in woke state (silent: %zu, noise: %zu)",
+      endpointer.frames(), vad_result == VAD_IS_SILENT ? "silent" : "not silent",
+      endpointer.silent_frames(), endpointer.noise_frames());
+
+  if (result == Endpointer::Result::STARTED) {
+    GENIE_RING_DEBUG("Detected %zu frames of noise, transition to listening",
+                     endpointer.noise_frames());
+    // We have measured the configured amount of consecutive noise frames,
+    // which means we have detected input.
+    //
+    // Transition to `State::LISTENING`
+    transition(State::LISTENING);
+  } else if (result == Endpointer::Result::NO_SPEECH) {
+    GENIE_RING_DEBUG("Not detected VAD input after %zu frames",
+                     vad_start_frame_count.load());
     // We have not detected speech over the start frame count, give up
+    report_turn_quality();
     app->dispatch(new state::events::InputDone(false));
     transition(State::WAITING);
   }
@@ -279,8 +433,7 @@ void genie::AudioInput::loop_listening() {
   if (new_frame.length == 0) {
     return;
   }
-
-  state_woke_frame_count += 1;
+  FrameStats stats = measure_frame(new_frame);
 
   // Run Voice Activity Detection (VAD) against the frame
 
@@ -288,35 +441,96 @@ void genie::AudioInput::loop_listening() {
   // because the frame will become null when we send it
   int silence = WebRtcVad_Process(vad_instance, sample_rate, new_frame.samples,
                                   AUDIO_INPUT_VAD_FRAME_LENGTH);
+  if (recorder)
+    recorder->mark_frame(silence, false);
+  quality.process(stats, sample_rate, silence);
 
   app->dispatch(new state::events::InputFrame(std::move(new_frame)));
 
-  if (silence == VAD_IS_SILENT) {
-    g_debug("Frame %zu is silent in listening state (silent: %zu, noise: %zu)",
-            state_woke_frame_count, state_vad_silent_count,
-            state_vad_noise_count);
-    state_vad_silent_count += 1;
-  } else if (silence == VAD_NOT_SILENT) {
-    g_debug(
-        "Frame %zu is not silent in listening state (silent: %zu, noise: %zu)",
-        state_woke_frame_count, state_vad_silent_count, state_vad_noise_count);
-    state_vad_silent_count = 0;
-  }
-  if (state_vad_silent_count >= vad_done_frame_count) {
-    g_debug("Detected %zu frames of silence, VAD done", state_vad_silent_count);
+  if (check_talk())
+    return;
+
+  Endpointer::Result result =
+      endpointer.process_listening(silence, vad_limits(), talk_hold);
+  GENIE_RING_DEBUG(
+      "Frame %zu is %s in listening state (silent: %zu, noise: %zu)",
+      endpointer.frames(), silence == VAD_IS_SILENT ? "silent" : "not silent",
+      endpointer.silent_frames(), endpointer.noise_frames());
+
+  if (result == Endpointer::Result::DONE) {
+    GENIE_RING_DEBUG("Detected %zu frames of silence, VAD done",
+                     endpointer.silent_frames());
+    report_turn_quality();
     app->dispatch(new state::events::InputDone(true));
     transition(State::WAITING);
-  } else if (state_woke_frame_count >= vad_listen_timeout_frame_count) {
+  } else if (result == Endpointer::Result::TIMEOUT) {
+    size_t timeout_frames = vad_listen_timeout_frame_count;
     g_message("LISTENING timed out after %zu frames (~%zu ms)",
-              vad_listen_timeout_frame_count,
-              app->config->vad_listen_timeout_ms);
+              timeout_frames,
+              timeout_frames * AUDIO_INPUT_VAD_FRAME_LENGTH * 1000 /
+                  sample_rate);
+    report_turn_quality();
     app->dispatch(new state::events::InputDone(true));
     transition(State::WAITING);
   }
 }
 
+void genie::AudioInput::loop_suspended() {
+  gint64 suspended_at = g_get_monotonic_time();
+
+  input->suspend();
+  bool release = release_on_suspend;
+  if (release) {
+    wakeword->release();
+  }
+
+  // Whatever was buffered is stale by the time we resume, and any turn in
+  // progress is abandoned
+  frame_buffer = std::queue<AudioFrame>();
+  talk_requested = false;
+  talk_hold = false;
+  talk_release_requested = false;
+  if (quality.in_turn())
+    quality.end_turn();
+  State expect = state;
+  if (expect == State::WOKE || expect == State::LISTENING) {
+    state.compare_exchange_strong(expect, State::WAITING);
+  }
+  g_message("[AudioInput] suspended");
+
+  {
+    std::unique_lock<std::mutex> lock(suspend_mutex);
+    suspend_cond.wait(lock, [this] {
+      return !suspend_requested || state == State::CLOSED;
+    });
+  }
+
+  if (state == State::CLOSED) {
+    return;
+  }
+
+  if (release && !wakeword->reload()) {
+    g_critical("failed to reload the wakeword engine");
+  }
+  if (!input->resume()) {
+    g_critical("failed to resume audio input driver");
+  }
+
+  gint64 now = g_get_monotonic_time();
+  g_message("[AudioInput] resumed in %.1f ms, was suspended for %.1f s",
+            (now - resume_requested_time) / 1000.0,
+            (now - suspended_at) / 1000000.0);
+}
+
 void genie::AudioInput::loop() {
+  set_thread_name("genie:input");
+
   for (;;) {
+    if (suspend_requested && state != State::CLOSED) {
+      loop_suspended();
+      continue;
+    }
+
     switch (state) {
       case State::CLOSED:
         return;
@@ -21,16 +21,19 @@
 #include "app.hpp"
 #include "audiodriver.hpp"
 #include "audioplayer.hpp"
+#include "endpointer.hpp"
+#include "inputquality.hpp"
+#include "recorder.hpp"
 #include "stt.hpp"
 #include "utils/webrtc_vad.h"
 #include "wakeword.hpp"
 #include <atomic>
+#include <condition_variable>
 #include <glib.h>
+#include <mutex>
 #include <queue>
 #include <thread>
 
-#define AUDIO_INPUT_VAD_FRAME_LENGTH 480
-
 namespace genie {
 
 class AudioInput {
@@ -39,6 +42,8 @@ public:
   // static const int32_t VAD_FRAME_LENGTH = 480;
   static const int VAD_IS_SILENT = 0;
   static const int VAD_NOT_SILENT = 1;
+  // reported input level for digital silence
+  static const int LEVEL_FLOOR_DB = -96;
 
   enum class State {
     CLOSED,
@@ -51,6 +56,14 @@ public:
   ~AudioInput();
   void close();
   void wake();
+  void suspend();
+  void resume();
+  void talk_pressed();
+  void talk_released(bool end_input);
+  void reload_config();
+  // false if the driver could not be opened; nothing is captured then
+  bool is_running() const { return input_thread.joinable(); }
+  AudioRecorder *get_recorder() { return recorder.get(); }
 
 private:
   // initialized once and never overwritten
@@ -58,10 +71,20 @@ private:
   VadInst *const vad_instance;
   std::unique_ptr<WakeWord> wakeword;
   std::unique_ptr<AudioInputDriver> input;
+  std::unique_ptr<AudioRecorder> recorder;
 
   // thread safe, accessed from both threads
   std::thread input_thread;
   std::atomic<State> state;
+  std::atomic<bool> suspend_requested;
+  std::atomic<gint64> resume_requested_time;
+  std::mutex suspend_mutex;
+  std::condition_variable suspend_cond;
+
+  // push-to-talk requests, see talk_pressed()
+  std::atomic<bool> talk_requested;
+  std::atomic<bool> talk_hold;
+  std::atomic<bool> talk_release_requested;
 
   // only accessed from the input thread
   int32_t pv_frame_length;
@@ -69,21 +92,30 @@ private:
   int16_t channels;
   std::queue<AudioFrame> frame_buffer;
 
-  size_t vad_start_frame_count;
-  size_t vad_done_frame_count;
-  size_t vad_input_detected_noise_frame_count;
-  size_t vad_listen_timeout_frame_count;
+  // Snapshot of the settings read by the input thread, taken by
+  // reload_config() on the main thread: the thread never reads app->config,
+  // which a reload replaces.
+  std::atomic<size_t> vad_start_frame_count;
+  std::atomic<size_t> vad_done_frame_count;
+  std::atomic<size_t> vad_input_detected_noise_frame_count;
+  std::atomic<size_t> vad_listen_timeout_frame_count;
+  std::atomic<size_t> talk_preroll_frame_count;
+  std::atomic<bool> release_on_suspend;
 
   // Loop state variables
-  size_t state_woke_frame_count;
-  size_t state_vad_silent_count;
-  size_t state_vad_noise_count;
+  Endpointer endpointer;
+  InputQualityMeter quality;
 
+  EndpointLimits vad_limits() const;
   size_t ms_to_frames(size_t frame_length, size_t ms);
+  FrameStats measure_frame(const AudioFrame &frame);
+  void report_turn_quality();
   void loop();
   void loop_waiting();
   void loop_woke();
   void loop_listening();
+  bool check_talk();
+  void loop_suspended();
   void transition(State to_state);
 };
 
@@ -17,6 +17,7 @@
 // limitations under the License.
 
 #include "audioplayer.hpp"
+#include "utils/threads.hpp"
 
 #include <glib.h>
 #include <gst/gst.h>
@@ -46,7 +47,9 @@ void genie::URLAudioTask::start() {
 
   // PROF_PRINT("gst pipeline started\n");
   gettimeofday(&t_start, NULL);
-  gst_element_set_state(pipeline.get(), GST_STATE_PLAYING);
+  // to resume at a position, preroll first; the seek happens on ASYNC_DONE
+  gst_element_set_state(pipeline.get(), start_position > 0 ? GST_STATE_PAUSED
+                                                           : GST_STATE_PLAYING);
 }
 
 void genie::SayAudioTask::start() {
@@ -95,19 +98,49 @@ void genie::SayAudioTask::say_get() {
 }
 
 genie::AudioPlayer::AudioPlayer(App *appInstance)
-    : app(appInstance), playing(false) {
+    : app(appInstance), playing(false), pipelines_stale(false),
+      resume_after_queue(false), resume_begin(0), resume_mode(nullptr) {
   gst_init(NULL, NULL);
 #ifdef STATIC
   gst_init_static_plugins();
 #endif
 
+  set_tts_url();
+  init_say_pipeline();
+  init_url_pipeline();
+}
+
+void genie::AudioPlayer::set_tts_url() {
   gchar *location = g_strdup_printf("%s/%s/voice/tts", app->config->nl_url,
                                     app->config->locale);
   base_tts_url = location;
   g_free(location);
+}
 
-  init_say_pipeline();
-  init_url_pipeline();
+void genie::AudioPlayer::reload_config(const ConfigDiff &changes) {
+  if (changes.has("general", "nlUrl") || changes.has("general", "locale")) {
+    // queued tasks hold a reference to base_tts_url and see the new value
+    set_tts_url();
+    if (soup_has_post_data) {
+      g_object_set(G_OBJECT(soupsrc.get()), "location", base_tts_url.c_str(),
+                   NULL);
+    }
+    g_message("TTS endpoint is now %s", base_tts_url.c_str());
+  }
+
+  static const char *const pipeline_keys[] = {
+      "output",       "music_output",    "voice_output",
+      "alert_output", "pause_buffer_kb", nullptr};
+  bool rebuild = false;
+  for (const char *const *key = pipeline_keys; *key && !rebuild; key++)
+    rebuild = changes.has("audio", *key);
+  if (!rebuild)
+    return;
+
+  // queued and playing tasks hold on to the current pipelines
+  pipelines_stale = true;
+  if (!playing && player_queue.empty())
+    dispatch_queue();
 }
 
 static bool has_property(genie::auto_gobject_ptr<GObject> obj,
@@ -119,6 +152,30 @@ static bool has_property(genie::auto_gobject_ptr<GObject> obj,
   return has_prop;
 }
 
+/**
+ * @brief Called from each streaming thread of the pipeline as it starts, to
+ * name it after the element that owns it.
+ */
+static void on_stream_status(GstBus *bus, GstMessage *msg, gpointer data) {
+  GstStreamStatusType type;
+  GstElement *owner;
+  gst_message_parse_stream_status(msg, &type, &owner);
+  if (type != GST_STREAM_STATUS_TYPE_ENTER)
+    return;
+
+  gchar *name = g_strdup_printf("gst:%s", GST_ELEMENT_NAME(owner));
+  genie::set_thread_name(name);
+  g_free(name);
+}
+
+static void name_streaming_threads(GstElement *pipeline) {
+  GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+  gst_bus_enable_sync_message_emission(bus);
+  g_signal_connect(bus, "sync-message::stream-status",
+                   G_CALLBACK(on_stream_status), nullptr);
+  gst_object_unref(bus);
+}
+
 void genie::AudioPlayer::init_say_pipeline() {
   auto pipeline = auto_gobject_ptr<GstElement>(
       gst_pipeline_new("audio-player-say"), adopt_mode::ref_sink);
@@ -142,6 +199,28 @@ void genie::AudioPlayer::init_say_pipeline() {
                  app->config->ssl_ca_file, NULL);
   }
 
+  // Use the app's SoupSession instead of one per request, so TTS reuses its
+  // keep-alive connections and TLS sessions to the NL server. It is already
+  // configured with our proxy and CA file, hence "force".
+  //
+  // Only souphttpsrc before 1.20 reads a SoupSession from this context.
+  // Later versions load libsoup at runtime and expect their own private
+  // GstSoupSession wrapper in the "session" field, which cannot be built
+  // from here; they ignore our context and open their own connections.
+  GstPluginFeature *soup_feature =
+      GST_PLUGIN_FEATURE(gst_element_get_factory(soupsrc.get()));
+  if (!gst_plugin_feature_check_version(soup_feature, 1, 20, 0)) {
+    GstContext *session_context = gst_context_new("gst.soup.session", FALSE);
+    gst_structure_set(gst_context_writable_structure(session_context),
+                      "session", SOUP_TYPE_SESSION, app->get_soup_session(),
+                      "force", G_TYPE_BOOLEAN, TRUE, NULL);
+    gst_element_set_context(soupsrc.get(), session_context);
+    gst_context_unref(session_context);
+  } else {
+    g_message("souphttpsrc from GStreamer 1.20 or later cannot share the "
+              "app's SoupSession, TTS uses its own connections");
+  }
+
   if (soup_has_post_data) {
     g_object_set(G_OBJECT(soupsrc.get()), "location", base_tts_url.c_str(),
                  "method", "POST", "content-type", "application/json", NULL);
@@ -156,6 +235,7 @@ void genie::AudioPlayer::init_say_pipeline() {
   gst_bin_add_many(GST_BIN(pipeline.get()), soupsrc.get(), decoder, sink, NULL);
   gst_element_link_many(soupsrc.get(), decoder, sink, NULL);
 
+  name_streaming_threads(pipeline.get());
   say_pipeline.init(this, pipeline);
 }
 
@@ -171,20 +251,46 @@ void genie::AudioPlayer::init_url_pipeline() {
   auto pipeline = auto_gobject_ptr<GstElement>(
       gst_element_factory_make("playbin", "audio-player-url"),
       adopt_mode::ref_sink);
-  g_object_set(G_OBJECT(pipeline.get()), "audio-sink", sink.get(), nullptr);
+  g_object_set(G_OBJECT(pipeline.get()), "audio-sink", sink.get(),
+               "buffer-size", (gint)(app->config->audio_pause_buffer_kb * 1024),
+               nullptr);
 
+  name_streaming_threads(pipeline.get());
   url_pipeline.init(this, pipeline);
 }
 
 void genie::AudioPlayer::PipelineState::init(
-    AudioPlayer *self, const auto_gobject_ptr<GstElement> &pipeline) {
+    AudioPlayer *self, const auto_gobject_ptr<GstElement> &pipeline,
+    GstBusFunc bus_func) {
   this->pipeline = pipeline;
   auto *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline.get()));
-  bus_watch_id =
-      gst_bus_add_watch(bus, genie::AudioPlayer::bus_call_queue, self);
+  bus_watch_id = gst_bus_add_watch(bus, bus_func, self);
   gst_object_unref(bus);
 }
 
+/**
+ * @brief Stop watching the bus and hand the pipeline over, leaving its state
+ * alone.
+ */
+genie::auto_gobject_ptr<GstElement>
+genie::AudioPlayer::PipelineState::detach() {
+  if (bus_watch_id)
+    g_source_remove(bus_watch_id);
+  bus_watch_id = 0;
+  auto detached = std::move(pipeline);
+  pipeline = nullptr;
+  return detached;
+}
+
+void genie::AudioPlayer::PipelineState::release() {
+  if (bus_watch_id)
+    g_source_remove(bus_watch_id);
+  bus_watch_id = 0;
+  if (pipeline)
+    gst_element_set_state(pipeline.get(), GST_STATE_NULL);
+  pipeline = nullptr;
+}
+
 gboolean genie::AudioPlayer::bus_call_queue(GstBus *bus, GstMessage *msg,
                                             gpointer data) {
   AudioPlayer *obj = static_cast<AudioPlayer *>(data);
@@ -212,6 +318,38 @@ gboolean genie::AudioPlayer::bus_call_queue(GstBus *bus, GstMessage *msg,
             obj->playing_task->type, obj->playing_task->ref_id));
       }
       break;
+    case GST_MESSAGE_ASYNC_DONE:
+      // finish a seek-based resume once the new pipeline prerolled
+      if (obj->playing_task &&
+          obj->playing_task->type == AudioTaskType::URL &&
+          GST_MESSAGE_SRC(msg) ==
+              GST_OBJECT(obj->playing_task->get_pipeline())) {
+        URLAudioTask *task =
+            static_cast<URLAudioTask *>(obj->playing_task.get());
+        if (task->start_position > 0) {
+          gst_element_seek_simple(
+              task->get_pipeline(), GST_FORMAT_TIME,
+              (GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT),
+              task->start_position);
+          task->start_position = -1;
+          gst_element_set_state(task->get_pipeline(), GST_STATE_PLAYING);
+        }
+      }
+      break;
+    case GST_MESSAGE_STATE_CHANGED:
+      if (obj->resume_begin && obj->playing_task &&
+          GST_MESSAGE_SRC(msg) ==
+              GST_OBJECT(obj->playing_task->get_pipeline())) {
+        GstState new_state;
+        gst_message_parse_state_changed(msg, nullptr, &new_state, nullptr);
+        if (new_state == GST_STATE_PLAYING) {
+          g_message("Resumed playback in %.1f ms (%s)",
+                    (g_get_monotonic_time() - obj->resume_begin) / 1000.0,
+                    obj->resume_mode);
+          obj->resume_begin = 0;
+        }
+      }
+      break;
     case GST_MESSAGE_EOS:
       g_message("End of stream");
       if (obj->playing_task) {
@@ -295,8 +433,12 @@ bool genie::AudioPlayer::play_url(const std::string &uri,
 
   g_message("Queueing %s for playback", uri.c_str());
 
-  player_queue.push(
-      std::make_unique<URLAudioTask>(url_pipeline.pipeline, uri, ref_id));
+  // new music replaces whatever was paused
+  if (destination == AudioDestination::MUSIC)
+    discard_paused();
+
+  player_queue.push(std::make_unique<URLAudioTask>(url_pipeline.pipeline, uri,
+                                                   destination, ref_id));
   dispatch_queue();
   return true;
 }
@@ -314,6 +456,15 @@ bool genie::AudioPlayer::say(const std::string &text, gint64 ref_id) {
 }
 
 void genie::AudioPlayer::dispatch_queue() {
+  if (pipelines_stale && !playing && player_queue.empty()) {
+    pipelines_stale = false;
+    say_pipeline.release();
+    url_pipeline.release();
+    init_say_pipeline();
+    init_url_pipeline();
+    g_message("Audio pipelines rebuilt for the new configuration");
+  }
+
   if (!playing && !player_queue.empty()) {
     std::unique_ptr<AudioTask> &task = player_queue.front();
     playing_task = std::move(task);
@@ -321,6 +472,9 @@ void genie::AudioPlayer::dispatch_queue() {
 
     playing_task->start();
     playing = true;
+  } else if (!playing && resume_after_queue) {
+    resume_after_queue = false;
+    resume_now();
   }
 }
 
@@ -335,9 +489,217 @@ gboolean genie::AudioPlayer::clean_queue() {
   return true;
 }
 
+/**
+ * @brief Stop everything, including the paused stream. For the audio
+ * StopEvent only, the end of a turn uses `clean_queue()` so the stream
+ * paused by `Listening` can still be resumed.
+ */
 gboolean genie::AudioPlayer::stop() {
+  discard_paused();
   if (!playing)
     return true;
   clean_queue();
   return true;
 }
+
+/**
+ * @brief Pause the current music stream so `resume()` can continue it, and
+ * drop anything else that is playing or queued.
+ *
+ * The paused pipeline is moved aside, keeping its buffered data (bounded by
+ * the playbin buffer size), and a new pipeline takes its place for sounds
+ * and speech in the meantime. Only one stream is held at a time.
+ *
+ * Returns false if nothing pausable was playing.
+ */
+bool genie::AudioPlayer::pause() {
+  URLAudioTask *task = nullptr;
+  if (playing_task && playing_task->type == AudioTaskType::URL)
+    task = static_cast<URLAudioTask *>(playing_task.get());
+  if (!task || task->destination != AudioDestination::MUSIC) {
+    clean_queue();
+    return false;
+  }
+
+  discard_paused();
+  while (!player_queue.empty())
+    player_queue.pop();
+
+  GstElement *pipeline = task->get_pipeline();
+  gst_element_set_state(pipeline, GST_STATE_PAUSED);
+
+  auto held = std::make_unique<PausedStream>();
+  gst_element_query_position(pipeline, GST_FORMAT_TIME, &held->position);
+  GstQuery *query = gst_query_new_seeking(GST_FORMAT_TIME);
+  if (gst_element_query(pipeline, query)) {
+    gboolean seekable;
+    gst_query_parse_seeking(query, nullptr, &seekable, nullptr, nullptr);
+    held->seekable = seekable;
+  }
+  gst_query_unref(query);
+
+  held->task.reset(static_cast<URLAudioTask *>(playing_task.release()));
+  playing = false;
+
+  if (app->config->audio_pause_hold_s > 0) {
+    held->pipeline.init(this, url_pipeline.detach(), bus_call_paused);
+    held->hold_timeout_id = g_timeout_add_seconds(
+        app->config->audio_pause_hold_s, hold_timeout, this);
+    init_url_pipeline();
+  } else {
+    held->task->stop();
+  }
+
+  g_message("Paused %s at %.1f s (%s)", held->task->get_url().c_str(),
+            held->position / (double)GST_SECOND,
+            held->pipeline.pipeline ? "buffered" : "released");
+  paused = std::move(held);
+  return true;
+}
+
+/**
+ * @brief Continue the paused stream, after anything still playing or
+ * queued (e.g. the answer to the voice turn).
+ */
+bool genie::AudioPlayer::resume() {
+  if (!paused)
+    return false;
+
+  if (playing || !player_queue.empty()) {
+    resume_after_queue = true;
+    return true;
+  }
+  resume_now();
+  return true;
+}
+
+void genie::AudioPlayer::resume_now() {
+  if (!paused)
+    return;
+
+  std::unique_ptr<PausedStream> held = std::move(paused);
+  if (held->hold_timeout_id)
+    g_source_remove(held->hold_timeout_id);
+  resume_begin = g_get_monotonic_time();
+
+  if (held->pipeline.pipeline) {
+    // instant resume: put the paused pipeline back in place
+    resume_mode = "buffered";
+    url_pipeline.release();
+    url_pipeline.init(this, held->pipeline.detach());
+    playing_task = std::move(held->task);
+    playing = true;
+    gst_element_set_state(url_pipeline.pipeline.get(), GST_STATE_PLAYING);
+    return;
+  }
+
+  auto task = std::make_unique<URLAudioTask>(
+      url_pipeline.pipeline, held->task->get_url(), AudioDestination::MUSIC,
+      held->task->ref_id);
+  if (held->seekable && held->position > 0) {
+    resume_mode = "seek";
+    task->start_position = held->position;
+  } else {
+    resume_mode = "restart";
+  }
+  playing_task = std::move(task);
+  playing_task->start();
+  playing = true;
+}
+
+void genie::AudioPlayer::discard_paused() {
+  resume_after_queue = false;
+  if (!paused)
+    return;
+  if (paused->hold_timeout_id)
+    g_source_remove(paused->hold_timeout_id);
+  paused.reset();
+}
+
+/**
+ * @brief Free the paused pipeline and its buffers, keeping what is needed
+ * for a seek-based resume.
+ */
+void genie::AudioPlayer::release_paused(const char *reason) {
+  if (!paused || !paused->pipeline.pipeline)
+    return;
+  paused->pipeline.release();
+  g_message("Released paused stream (%s), resume will %s", reason,
+            paused->seekable ? "seek" : "restart");
+}
+
+/**
+ * @brief Add up the data held by the queues of a pipeline: playbin buffers
+ * the download in a queue2, up to `pause_buffer_kb`.
+ */
+static size_t queued_bytes(GstElement *pipeline) {
+  if (!pipeline || !GST_IS_BIN(pipeline))
+    return 0;
+
+  size_t bytes = 0;
+  GstIterator *it = gst_bin_iterate_recurse(GST_BIN(pipeline));
+  GValue item = G_VALUE_INIT;
+  bool done = false;
+  while (!done) {
+    switch (gst_iterator_next(it, &item)) {
+      case GST_ITERATOR_OK: {
+        GObject *element = G_OBJECT(g_value_get_object(&item));
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(element),
+                                         "current-level-bytes")) {
+          guint level = 0;
+          g_object_get(element, "current-level-bytes", &level, nullptr);
+          bytes += level;
+        }
+        g_value_reset(&item);
+        break;
+      }
+      case GST_ITERATOR_RESYNC:
+        gst_iterator_resync(it);
+        bytes = 0;
+        break;
+      default:
+        done = true;
+        break;
+    }
+  }
+  g_value_unset(&item);
+  gst_iterator_free(it);
+  return bytes;
+}
+
+void genie::AudioPlayer::report_memory(MemoryReport &report) {
+  size_t bytes = 0;
+  size_t pipelines = 0;
+  for (GstElement *pipeline :
+       {say_pipeline.pipeline.get(), url_pipeline.pipeline.get(),
+        paused ? paused->pipeline.pipeline.get() : nullptr}) {
+    if (!pipeline)
+      continue;
+    bytes += queued_bytes(pipeline);
+    pipelines++;
+  }
+  report.push_back({"gst_buffers", bytes, pipelines});
+}
+
+/**
+ * @brief Drop the buffered data of a paused stream; resuming it seeks or
+ * restarts, as after a long pause.
+ */
+void genie::AudioPlayer::shed_memory() { release_paused("memory pressure"); }
+
+gboolean genie::AudioPlayer::hold_timeout(gpointer data) {
+  AudioPlayer *self = static_cast<AudioPlayer *>(data);
+  self->paused->hold_timeout_id = 0;
+  self->release_paused("held too long");
+  return G_SOURCE_REMOVE;
+}
+
+gboolean genie::AudioPlayer::bus_call_paused(GstBus *bus, GstMessage *msg,
+                                             gpointer data) {
+  AudioPlayer *self = static_cast<AudioPlayer *>(data);
+  if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+    // typically the server dropping the connection once our buffer is full
+    self->release_paused("stream error");
+  }
+  return true;
+}
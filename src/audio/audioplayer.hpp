@@ -48,6 +48,7 @@ public:
   AudioTask(AudioTask &&) = delete;
 
   void stop() { gst_element_set_state(pipeline.get(), GST_STATE_READY); }
+  GstElement *get_pipeline() { return pipeline.get(); }
 
   virtual ~AudioTask() = default;
   virtual void start() = 0;
@@ -57,11 +58,18 @@ class URLAudioTask : public AudioTask {
   std::string url;
 
 public:
+  const AudioDestination destination;
+  // when resuming a released stream, seek here (ns) once prerolled
+  gint64 start_position = -1;
+
   URLAudioTask(const auto_gobject_ptr<GstElement> &pipeline,
-               const std::string &url, gint64 ref_id)
-      : AudioTask(pipeline, AudioTaskType::URL, ref_id), url(url) {}
+               const std::string &url, AudioDestination destination,
+               gint64 ref_id)
+      : AudioTask(pipeline, AudioTaskType::URL, ref_id), url(url),
+        destination(destination) {}
 
   void start() override;
+  const std::string &get_url() const { return url; }
 };
 
 class SayAudioTask : public AudioTask {
@@ -101,6 +109,18 @@ public:
   bool say(const std::string &text, gint64 ref_id = -1);
   gboolean clean_queue();
   gboolean stop();
+  bool pause();
+  bool resume();
+
+  /**
+   * @brief Apply configuration `changes` that affect playback: the TTS
+   * endpoint is swapped right away, while new sinks or output devices
+   * rebuild the pipelines once nothing is queued or playing.
+   */
+  void reload_config(const ConfigDiff &changes);
+
+  void report_memory(MemoryReport &report);
+  void shed_memory();
 
 private:
   struct PipelineState {
@@ -108,24 +128,50 @@ private:
     guint bus_watch_id = 0;
 
     PipelineState() = default;
-    ~PipelineState() {
-      g_source_remove(bus_watch_id);
-      gst_element_set_state(pipeline.get(), GST_STATE_NULL);
-    }
+    ~PipelineState() { release(); }
 
-    void init(AudioPlayer *self, const auto_gobject_ptr<GstElement> &pipeline);
+    void init(AudioPlayer *self, const auto_gobject_ptr<GstElement> &pipeline,
+              GstBusFunc bus_func = bus_call_queue);
+    auto_gobject_ptr<GstElement> detach();
+    void release();
   } say_pipeline, url_pipeline;
+
+  /**
+   * A music stream paused by `pause()`. While `pipeline` is set, the stream
+   * sits in PAUSED with its buffered data; once released, resuming goes
+   * through a new pipeline and a seek to `position`.
+   */
+  struct PausedStream {
+    std::unique_ptr<URLAudioTask> task;
+    PipelineState pipeline;
+    gint64 position = -1;
+    bool seekable = false;
+    guint hold_timeout_id = 0;
+  };
+  std::unique_ptr<PausedStream> paused;
+  // resume once the current queue drained
+  bool resume_after_queue;
+  gint64 resume_begin;
+  const char *resume_mode;
+
   auto_gobject_ptr<GstElement> soupsrc;
   App *const app;
   std::string base_tts_url;
   bool soup_has_post_data;
   bool playing;
+  bool pipelines_stale;
 
   void init_say_pipeline();
   void init_url_pipeline();
+  void set_tts_url();
 
   void dispatch_queue();
+  void resume_now();
+  void discard_paused();
+  void release_paused(const char *reason);
+  static gboolean hold_timeout(gpointer data);
   static gboolean bus_call_queue(GstBus *bus, GstMessage *msg, gpointer data);
+  static gboolean bus_call_paused(GstBus *bus, GstMessage *msg, gpointer data);
   std::queue<std::unique_ptr<AudioTask>> player_queue;
   std::unique_ptr<AudioTask> playing_task;
 };
@@ -20,19 +20,31 @@
 
 #include "alsa/volume.hpp"
 #include "pulseaudio/volume.hpp"
+#include <algorithm>
 
-genie::AudioVolumeController::AudioVolumeController(App *app) : app(app) {
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::AudioVolumeController"
+
+genie::AudioVolumeController::AudioVolumeController(App *app)
+    : app(app), target(-1), written(-1), coalesce_timeout_id(0),
+      repeat_count(0), burst_begin(0), burst_requests(0), burst_reads(0),
+      burst_writes(0) {
   if (app->config->audio_backend == AudioDriverType::ALSA)
     driver = std::make_unique<AudioVolumeDriverAlsa>(app);
   else
     driver = std::make_unique<AudioVolumeDriverPulseAudio>(app);
 }
 
+genie::AudioVolumeController::~AudioVolumeController() {
+  if (coalesce_timeout_id)
+    g_source_remove(coalesce_timeout_id);
+}
+
 void genie::AudioVolumeController::duck() { driver->duck(); }
 
 void genie::AudioVolumeController::unduck() { driver->unduck(); }
 
-void genie::AudioVolumeController::set_volume(int volume) {
+int genie::AudioVolumeController::cap_volume(int volume) {
   if (volume > MAX_VOLUME) {
     g_message("Can not adjust playback volume to %d, max is %d. Capping at max",
               volume, MAX_VOLUME);
@@ -42,15 +54,104 @@ void genie::AudioVolumeController::set_volume(int volume) {
               volume, MIN_VOLUME);
     volume = MIN_VOLUME;
   }
+  return volume;
+}
+
+/**
+ * @brief Set the playback volume, capped to the valid range.
+ *
+ * The write may be delayed by up to `COALESCE_MS` and merged with other
+ * changes; `done` is called once it happened.
+ *
+ * @return the volume that will be set
+ */
+int genie::AudioVolumeController::set_volume(int volume, DoneCallback done) {
+  volume = cap_volume(volume);
+  burst_requests++;
+
+  if (!coalesce_timeout_id) {
+    // nothing written recently: apply now, and open a window for followers
+    burst_begin = g_get_monotonic_time();
+    write_volume(volume);
+    coalesce_timeout_id = g_timeout_add(COALESCE_MS, coalesce_timeout, this);
+    if (done)
+      done(volume);
+    return volume;
+  }
+
+  target = volume;
+  if (done)
+    pending_done.push_back(std::move(done));
+  return volume;
+}
+
+int genie::AudioVolumeController::adjust_volume(int delta, DoneCallback done) {
+  int current;
+  if (target >= 0) {
+    current = target;
+  } else if (coalesce_timeout_id) {
+    current = written;
+  } else {
+    current = driver->get_volume();
+    burst_reads++;
+  }
+  return set_volume(current + delta, std::move(done));
+}
+
+/**
+ * @brief Move the volume one step in `direction` (1 or -1) for a volume
+ * key. Auto-repeat events of a held key take smaller steps that grow the
+ * longer the key is held.
+ */
+int genie::AudioVolumeController::step_volume(int direction, bool repeat) {
+  int delta = VOLUME_DELTA;
+  if (repeat) {
+    delta = std::min(VOLUME_REPEAT_DELTA_MIN + repeat_count / 5,
+                     VOLUME_REPEAT_DELTA_MAX);
+    repeat_count++;
+  } else {
+    repeat_count = 0;
+  }
+  return adjust_volume(direction * delta);
+}
 
+void genie::AudioVolumeController::write_volume(int volume) {
   driver->set_volume(volume);
+  written = volume;
+  burst_writes++;
   g_message("Updated playback volume to %d", volume);
 }
 
-void genie::AudioVolumeController::adjust_volume(int delta) {
-  auto current = driver->get_volume();
-  auto updated = current + delta;
-  set_volume(updated);
+gboolean genie::AudioVolumeController::coalesce_timeout(gpointer data) {
+  AudioVolumeController *self = static_cast<AudioVolumeController *>(data);
+
+  if (self->target >= 0) {
+    // write what accumulated, and keep the window open for more
+    if (self->target != self->written)
+      self->write_volume(self->target);
+    self->target = -1;
+
+    std::vector<DoneCallback> done;
+    done.swap(self->pending_done);
+    for (auto &callback : done)
+      callback(self->written);
+    return G_SOURCE_CONTINUE;
+  }
+
+  self->coalesce_timeout_id = 0;
+  if (self->burst_requests > 1) {
+    double elapsed_s = (g_get_monotonic_time() - self->burst_begin) / 1e6;
+    g_message("Volume burst: %u requests, %u mixer writes and %u reads in "
+              "%.2f s (%.1f mixer ops/s)",
+              self->burst_requests, self->burst_writes, self->burst_reads,
+              elapsed_s,
+              (self->burst_writes + self->burst_reads) /
+                  std::max(elapsed_s, COALESCE_MS / 1000.0));
+  }
+  self->burst_requests = 0;
+  self->burst_writes = 0;
+  self->burst_reads = 0;
+  return G_SOURCE_REMOVE;
 }
 
 void genie::AudioVolumeController::increment_volume() {
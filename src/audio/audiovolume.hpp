@@ -21,31 +21,68 @@
 #include "../app.hpp"
 #include "audiodriver.hpp"
 
+#include <functional>
 #include <pulse/error.h>
 #include <pulse/simple.h>
+#include <vector>
 
 namespace genie {
 
+/**
+ * @brief Playback volume control on top of the backend's driver.
+ *
+ * Volume changes are coalesced: the first one after a quiet period is
+ * written right away, later ones within `COALESCE_MS` only move the target,
+ * which is written once when the window closes. During a burst the target
+ * is the base for relative changes, so the driver is not read back either.
+ */
 class AudioVolumeController {
 public:
+  // called with the volume once it was written to the driver
+  typedef std::function<void(int volume)> DoneCallback;
+
   AudioVolumeController(App *appInstance);
+  ~AudioVolumeController();
   void init();
   void duck();
   void unduck();
   int get_volume();
-  void set_volume(int volume);
-  void adjust_volume(int delta);
+  int set_volume(int volume, DoneCallback done = nullptr);
+  int adjust_volume(int delta, DoneCallback done = nullptr);
+  int step_volume(int direction, bool repeat);
   void increment_volume();
   void decrement_volume();
 
   static const int MAX_VOLUME = 100;
   static const int MIN_VOLUME = 0;
   static const int VOLUME_DELTA = 10;
+  // per auto-repeat event of a held volume key, growing to the max
+  static const int VOLUME_REPEAT_DELTA_MIN = 2;
+  static const int VOLUME_REPEAT_DELTA_MAX = 5;
+  static const guint COALESCE_MS = 50;
 
 private:
   App *app;
   bool ducked;
   std::unique_ptr<AudioVolumeDriver> driver;
+
+  // volume to write when the window closes, -1 if nothing is pending
+  int target;
+  // last volume written, valid while `coalesce_timeout_id` is set
+  int written;
+  guint coalesce_timeout_id;
+  std::vector<DoneCallback> pending_done;
+  int repeat_count;
+
+  // statistics of the current burst
+  gint64 burst_begin;
+  guint burst_requests;
+  guint burst_reads;
+  guint burst_writes;
+
+  int cap_volume(int volume);
+  void write_volume(int volume);
+  static gboolean coalesce_timeout(gpointer data);
 };
 
 } // namespace genie
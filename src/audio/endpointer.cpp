@@ -0,0 +1,97 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "endpointer.hpp"
+#include <glib.h>
+
+size_t genie::EndpointLimits::ms_to_frames(size_t sample_rate,
+                                           size_t frame_length, size_t ms) {
+  //     floor <-  (samples/sec * (     seconds     )) / (samples/frame)
+  g_assert(sample_rate > 0);
+  return (size_t)((sample_rate * ((double)ms / 1000)) / frame_length);
+}
+
+genie::EndpointLimits genie::EndpointLimits::from_ms(size_t sample_rate,
+                                                     size_t start_ms,
+                                                     size_t done_ms,
+                                                     size_t noise_ms,
+                                                     size_t timeout_ms) {
+  EndpointLimits limits;
+  limits.start_frames =
+      ms_to_frames(sample_rate, AUDIO_INPUT_VAD_FRAME_LENGTH, start_ms);
+  limits.done_frames =
+      ms_to_frames(sample_rate, AUDIO_INPUT_VAD_FRAME_LENGTH, done_ms);
+  limits.noise_frames =
+      ms_to_frames(sample_rate, AUDIO_INPUT_VAD_FRAME_LENGTH, noise_ms);
+  limits.timeout_frames =
+      ms_to_frames(sample_rate, AUDIO_INPUT_VAD_FRAME_LENGTH, timeout_ms);
+  return limits;
+}
+
+/**
+ * @brief Account one VAD frame after the wake word, while waiting for the
+ * user to start speaking.
+ *
+ * Speech frames count toward `noise_frames` and are not reset by silence,
+ * so short pauses before the command do not restart the wait.
+ */
+genie::Endpointer::Result
+genie::Endpointer::process_woke(int vad_result, const EndpointLimits &limits) {
+  frame_count += 1;
+
+  if (vad_result == VAD_IS_SILENT) {
+    silent_count += 1;
+  } else if (vad_result == VAD_NOT_SILENT) {
+    noise_count += 1;
+    silent_count = 0;
+
+    if (noise_count >= limits.noise_frames) {
+      return Result::STARTED;
+    }
+  }
+
+  if (frame_count >= limits.start_frames) {
+    return Result::NO_SPEECH;
+  }
+  return Result::CONTINUE;
+}
+
+/**
+ * @brief Account one VAD frame while the user is speaking.
+ *
+ * With `hold` set (the talk key is down) trailing silence does not end the
+ * command, only the listen timeout does.
+ */
+genie::Endpointer::Result
+genie::Endpointer::process_listening(int vad_result,
+                                     const EndpointLimits &limits, bool hold) {
+  frame_count += 1;
+
+  if (vad_result == VAD_IS_SILENT) {
+    silent_count += 1;
+  } else if (vad_result == VAD_NOT_SILENT) {
+    silent_count = 0;
+  }
+
+  if (silent_count >= limits.done_frames && !hold) {
+    return Result::DONE;
+  } else if (frame_count >= limits.timeout_frames) {
+    return Result::TIMEOUT;
+  }
+  return Result::CONTINUE;
+}
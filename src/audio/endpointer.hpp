@@ -0,0 +1,92 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stddef.h>
+
+#define AUDIO_INPUT_VAD_FRAME_LENGTH 480
+
+namespace genie {
+
+/**
+ * The [vad] timings, converted to a number of VAD frames.
+ */
+struct EndpointLimits {
+  size_t start_frames;
+  size_t done_frames;
+  size_t noise_frames;
+  size_t timeout_frames;
+
+  static size_t ms_to_frames(size_t sample_rate, size_t frame_length,
+                             size_t ms);
+  static EndpointLimits from_ms(size_t sample_rate, size_t start_ms,
+                                size_t done_ms, size_t noise_ms,
+                                size_t timeout_ms);
+};
+
+/**
+ * Decides when the user started and stopped speaking after the wake word,
+ * from the per-frame WebRTC VAD decisions.
+ *
+ * It only keeps counters; the caller owns the state and calls `reset()` on
+ * each transition. It has no dependency on the rest of the app, so the
+ * offline evaluation tool runs the exact same logic as `AudioInput`.
+ */
+class Endpointer {
+public:
+  // aggressiveness passed to WebRtcVad_set_mode()
+  static const int VAD_MODE = 3;
+  static const int VAD_IS_SILENT = 0;
+  static const int VAD_NOT_SILENT = 1;
+
+  enum class Result {
+    CONTINUE,
+    // enough consecutive speech after the wake word, start listening
+    STARTED,
+    // no speech within the start window
+    NO_SPEECH,
+    // enough trailing silence, the command is complete
+    DONE,
+    // the command ran past the listen timeout
+    TIMEOUT,
+  };
+
+  Endpointer() { reset(); }
+
+  void reset() {
+    frame_count = 0;
+    silent_count = 0;
+    noise_count = 0;
+  }
+
+  Result process_woke(int vad_result, const EndpointLimits &limits);
+  Result process_listening(int vad_result, const EndpointLimits &limits,
+                           bool hold = false);
+
+  size_t frames() const { return frame_count; }
+  size_t silent_frames() const { return silent_count; }
+  size_t noise_frames() const { return noise_count; }
+
+private:
+  size_t frame_count;
+  size_t silent_count;
+  size_t noise_count;
+};
+
+} // namespace genie
@@ -0,0 +1,264 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "inputquality.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+constexpr double genie::FrameStats::FLOOR_DB;
+constexpr double genie::InputQualityMeter::NOISE_FLOOR_FALL;
+constexpr double genie::InputQualityMeter::NOISE_FLOOR_RISE_DB_PER_S;
+
+static double power_db(double mean_square) {
+  if (mean_square <= 0)
+    return genie::FrameStats::FLOOR_DB;
+  // relative to a full scale square wave
+  return std::max(genie::FrameStats::FLOOR_DB,
+                  10 * log10(mean_square / (32768.0 * 32768.0)));
+}
+
+static double amplitude_db(int32_t peak) {
+  if (peak <= 0)
+    return genie::FrameStats::FLOOR_DB;
+  return std::max(genie::FrameStats::FLOOR_DB, 20 * log10(peak / 32768.0));
+}
+
+// samples per SIMD block, small enough that the 16 and 32 bit lane
+// accumulators cannot overflow before they are flushed
+static const size_t SIMD_BLOCK = 8192;
+
+static void accumulate_scalar(const int16_t *samples, size_t length,
+                              genie::FrameStats &stats) {
+  for (size_t i = 0; i < length; i++) {
+    int32_t sample = samples[i];
+    int32_t magnitude = sample < 0 ? -sample : sample;
+    stats.peak = std::max(stats.peak, magnitude);
+    stats.clipped += magnitude >= genie::FrameStats::CLIP_LEVEL;
+    stats.sum += sample;
+    // at most 2^30, no overflow
+    stats.sum_squares += (uint32_t)(sample * sample);
+  }
+}
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+// returns the number of samples consumed, a multiple of 8
+static size_t accumulate_simd(const int16_t *samples, size_t length,
+                              genie::FrameStats &stats) {
+  const int16x8_t clip_level = vdupq_n_s16(genie::FrameStats::CLIP_LEVEL);
+  int16x8_t peak = vdupq_n_s16(0);
+  size_t i = 0;
+  while (i + 8 <= length) {
+    size_t block_end = std::min(length & ~(size_t)7, i + SIMD_BLOCK);
+    uint16x8_t clipped = vdupq_n_u16(0);
+    int32x4_t sum = vdupq_n_s32(0);
+    uint64x2_t sum_squares = vdupq_n_u64(0);
+    for (; i < block_end; i += 8) {
+      int16x8_t v = vld1q_s16(samples + i);
+      // saturating, -32768 becomes 32767
+      int16x8_t magnitude = vqabsq_s16(v);
+      peak = vmaxq_s16(peak, magnitude);
+      // the comparison mask is all ones, or -1
+      clipped = vsubq_u16(clipped, vcgeq_s16(magnitude, clip_level));
+      sum = vpadalq_s16(sum, v);
+      int16x4_t low = vget_low_s16(v), high = vget_high_s16(v);
+      sum_squares = vpadalq_u32(sum_squares,
+                                vreinterpretq_u32_s32(vmull_s16(low, low)));
+      sum_squares = vpadalq_u32(sum_squares,
+                                vreinterpretq_u32_s32(vmull_s16(high, high)));
+    }
+
+    uint16_t clipped_lanes[8];
+    int32_t sum_lanes[4];
+    uint64_t squares_lanes[2];
+    vst1q_u16(clipped_lanes, clipped);
+    vst1q_s32(sum_lanes, sum);
+    vst1q_u64(squares_lanes, sum_squares);
+    for (int lane = 0; lane < 8; lane++)
+      stats.clipped += clipped_lanes[lane];
+    for (int lane = 0; lane < 4; lane++)
+      stats.sum += sum_lanes[lane];
+    stats.sum_squares += squares_lanes[0] + squares_lanes[1];
+  }
+
+  int16_t peak_lanes[8];
+  vst1q_s16(peak_lanes, peak);
+  for (int lane = 0; lane < 8; lane++)
+    stats.peak = std::max(stats.peak, (int32_t)peak_lanes[lane]);
+  return i;
+}
+
+#elif defined(__SSE2__)
+
+// returns the number of samples consumed, a multiple of 8
+static size_t accumulate_simd(const int16_t *samples, size_t length,
+                              genie::FrameStats &stats) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128i below_clip =
+      _mm_set1_epi16(genie::FrameStats::CLIP_LEVEL - 1);
+  __m128i peak = zero;
+  size_t i = 0;
+  while (i + 8 <= length) {
+    size_t block_end = std::min(length & ~(size_t)7, i + SIMD_BLOCK);
+    __m128i clipped = zero;
+    __m128i sum = zero;
+    __m128i sum_squares = zero;
+    for (; i < block_end; i += 8) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(samples + i));
+      // no abs before SSSE3; saturating, -32768 becomes 32767
+      __m128i magnitude = _mm_max_epi16(v, _mm_subs_epi16(zero, v));
+      peak = _mm_max_epi16(peak, magnitude);
+      // the comparison mask is all ones, or -1
+      clipped =
+          _mm_sub_epi16(clipped, _mm_cmpgt_epi16(magnitude, below_clip));
+      sum = _mm_add_epi32(sum, _mm_madd_epi16(v, ones));
+      // pairs of squares, up to 2^31: fits when read as unsigned
+      __m128i squares = _mm_madd_epi16(v, v);
+      sum_squares = _mm_add_epi64(sum_squares,
+                                  _mm_unpacklo_epi32(squares, zero));
+      sum_squares = _mm_add_epi64(sum_squares,
+                                  _mm_unpackhi_epi32(squares, zero));
+    }
+
+    uint16_t clipped_lanes[8];
+    int32_t sum_lanes[4];
+    uint64_t squares_lanes[2];
+    _mm_storeu_si128((__m128i *)clipped_lanes, clipped);
+    _mm_storeu_si128((__m128i *)sum_lanes, sum);
+    _mm_storeu_si128((__m128i *)squares_lanes, sum_squares);
+    for (int lane = 0; lane < 8; lane++)
+      stats.clipped += clipped_lanes[lane];
+    for (int lane = 0; lane < 4; lane++)
+      stats.sum += sum_lanes[lane];
+    stats.sum_squares += squares_lanes[0] + squares_lanes[1];
+  }
+
+  int16_t peak_lanes[8];
+  _mm_storeu_si128((__m128i *)peak_lanes, peak);
+  for (int lane = 0; lane < 8; lane++)
+    stats.peak = std::max(stats.peak, (int32_t)peak_lanes[lane]);
+  return i;
+}
+
+#else
+
+static size_t accumulate_simd(const int16_t *, size_t, genie::FrameStats &) {
+  return 0;
+}
+
+#endif
+
+/**
+ * @brief Runs on every input frame, so it must stay cheap whatever the
+ * build type: the SIMD paths (NEON on ARM, SSE2 on x86) do eight samples
+ * per step, and genie-bench checks the cost per frame against a budget.
+ */
+genie::FrameStats genie::FrameStats::compute(const int16_t *samples,
+                                             size_t length) {
+  FrameStats stats;
+  stats.length = length;
+  size_t done = accumulate_simd(samples, length, stats);
+  accumulate_scalar(samples + done, length - done, stats);
+  return stats;
+}
+
+double genie::FrameStats::peak_db() const { return amplitude_db(peak); }
+
+double genie::FrameStats::rms_db() const {
+  if (length == 0)
+    return FLOOR_DB;
+  return power_db((double)sum_squares / length);
+}
+
+double genie::FrameStats::dc_offset() const {
+  if (length == 0)
+    return 0;
+  return (double)sum / length / 32768.0;
+}
+
+genie::InputQualityMeter::InputQualityMeter()
+    : noise_floor(FrameStats::FLOOR_DB), has_noise_floor(false),
+      turn_active(false) {}
+
+void genie::InputQualityMeter::process(const FrameStats &stats,
+                                       size_t sample_rate, int vad_result) {
+  if (stats.length == 0)
+    return;
+
+  // digital silence is a muted or suspended source, not background noise
+  if (vad_result != 1 && stats.peak > 0) {
+    double level = stats.rms_db();
+    if (!has_noise_floor) {
+      noise_floor = level;
+      has_noise_floor = true;
+    } else if (level < noise_floor) {
+      noise_floor += (level - noise_floor) * NOISE_FLOOR_FALL;
+    } else {
+      double frame_s = (double)stats.length / sample_rate;
+      noise_floor =
+          std::min(level, noise_floor + NOISE_FLOOR_RISE_DB_PER_S * frame_s);
+    }
+  }
+
+  if (!turn_active)
+    return;
+
+  turn.frames++;
+  turn.clipped += stats.clipped;
+  turn_peak = std::max(turn_peak, stats.peak);
+  turn_sum += stats.sum;
+  turn_samples += stats.length;
+  if (vad_result == 1) {
+    turn.speech_frames++;
+    turn_speech_sum_squares += stats.sum_squares;
+    turn_speech_samples += stats.length;
+  }
+}
+
+void genie::InputQualityMeter::start_turn() {
+  turn_active = true;
+  turn = InputQuality();
+  turn.noise_floor_db = noise_floor;
+  turn_speech_sum_squares = 0;
+  turn_speech_samples = 0;
+  turn_peak = 0;
+  turn_sum = 0;
+  turn_samples = 0;
+}
+
+genie::InputQuality genie::InputQualityMeter::end_turn() {
+  turn_active = false;
+
+  turn.peak_db = amplitude_db(turn_peak);
+  if (turn_samples)
+    turn.dc_offset = (double)turn_sum / turn_samples / 32768.0;
+  if (turn_speech_samples) {
+    turn.speech_db =
+        power_db((double)turn_speech_sum_squares / turn_speech_samples);
+    turn.snr_db = turn.speech_db - turn.noise_floor_db;
+  }
+  return turn;
+}
@@ -0,0 +1,110 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace genie {
+
+/**
+ * Level statistics of one input frame, in a single pass over the samples.
+ */
+struct FrameStats {
+  // reported level for digital silence, in dBFS
+  static constexpr double FLOOR_DB = -96;
+  // a sample at or above this magnitude (-0.01 dBFS) counts as clipped
+  static const int32_t CLIP_LEVEL = 32730;
+
+  size_t length = 0;
+  int32_t peak = 0;
+  size_t clipped = 0;
+  int64_t sum = 0;
+  uint64_t sum_squares = 0;
+
+  static FrameStats compute(const int16_t *samples, size_t length);
+
+  double peak_db() const;
+  double rms_db() const;
+  // mean sample value, as a fraction of full scale
+  double dc_offset() const;
+};
+
+/**
+ * Summary of the audio captured during one turn, from the wake word to the
+ * end of the command.
+ */
+struct InputQuality {
+  size_t frames = 0;
+  size_t speech_frames = 0;
+  // mean level of the frames the VAD marked as speech, in dBFS
+  double speech_db = FrameStats::FLOOR_DB;
+  // background level when the turn started, in dBFS
+  double noise_floor_db = FrameStats::FLOOR_DB;
+  // speech_db - noise_floor_db, 0 if there was no speech
+  double snr_db = 0;
+  double peak_db = FrameStats::FLOOR_DB;
+  size_t clipped = 0;
+  double dc_offset = 0;
+};
+
+/**
+ * Tracks the background noise floor across frames, and sums up each turn
+ * into an `InputQuality`.
+ *
+ * The noise floor follows quieter frames quickly and rises slowly, so it
+ * sits under speech and settles on the steady background (fans, a TV)
+ * within a few seconds. Only frames without speech move it.
+ *
+ * Like `Endpointer`, it has no dependency on the rest of the app and is
+ * only used from the audio input thread.
+ */
+class InputQualityMeter {
+public:
+  // how much of the gap to a quieter frame the floor closes at once
+  static constexpr double NOISE_FLOOR_FALL = 0.2;
+  static constexpr double NOISE_FLOOR_RISE_DB_PER_S = 3.0;
+
+  InputQualityMeter();
+
+  /**
+   * @brief Account one frame. `vad_result` is the WebRTC VAD decision, or -1
+   * when the VAD did not run (while waiting for the wake word).
+   */
+  void process(const FrameStats &stats, size_t sample_rate, int vad_result);
+
+  void start_turn();
+  InputQuality end_turn();
+  bool in_turn() const { return turn_active; }
+  double noise_floor_db() const { return noise_floor; }
+
+private:
+  double noise_floor;
+  bool has_noise_floor;
+
+  bool turn_active;
+  InputQuality turn;
+  uint64_t turn_speech_sum_squares;
+  size_t turn_speech_samples;
+  int32_t turn_peak;
+  int64_t turn_sum;
+  size_t turn_samples;
+};
+
+} // namespace genie
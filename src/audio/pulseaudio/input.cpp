@@ -17,8 +17,14 @@
 // limitations under the License.
 
 #include "input.hpp"
+#include "audio/recorder.hpp"
+#include "utils/logging.hpp"
 #include <string.h>
 
+// wait between attempts to reopen the record stream, so the input thread
+// does not spin while the server is unavailable
+static const gulong RECONNECT_INTERVAL_US = 1000 * 1000;
+
 genie::AudioInputPulseSimple::AudioInputPulseSimple(App *app) : app(app) {}
 
 genie::AudioInputPulseSimple::~AudioInputPulseSimple() {
@@ -31,14 +37,12 @@ genie::AudioInputPulseSimple::~AudioInputPulseSimple() {
 bool genie::AudioInputPulseSimple::init(gchar *audio_input_device,
                                         int sample_rate, int channels,
                                         int max_frame_length) {
-  const pa_sample_spec config{/* format */ PA_SAMPLE_S16LE,
-                              /* rate */ (uint32_t)sample_rate,
-                              /* channels */ (uint8_t)channels};
+  sample_spec = pa_sample_spec{/* format */ PA_SAMPLE_S16LE,
+                               /* rate */ (uint32_t)sample_rate,
+                               /* channels */ (uint8_t)channels};
 
-  int error;
-  if (!(pulse_handle = pa_simple_new(NULL, "Genie", PA_STREAM_RECORD, NULL,
-                                     "record", &config, NULL, NULL, &error))) {
-    g_error("pa_simple_new() failed: %s\n", pa_strerror(error));
+  if (!connect()) {
+    g_critical("failed to open pulseaudio record stream");
     return false;
   }
 
@@ -51,24 +55,72 @@ bool genie::AudioInputPulseSimple::init(gchar *audio_input_device,
   return true;
 }
 
+bool genie::AudioInputPulseSimple::connect() {
+  int error;
+  if (!(pulse_handle = pa_simple_new(NULL, "Genie", PA_STREAM_RECORD, NULL,
+                                     "record", &sample_spec, NULL, NULL,
+                                     &error))) {
+    GENIE_LOG_RATELIMITED(g_critical, 60000, "pa_simple_new() failed: %s",
+                          pa_strerror(error));
+    return false;
+  }
+  return true;
+}
+
 genie::AudioFrame
 genie::AudioInputPulseSimple::read_frame(int32_t frame_length) {
   int read_frames = 0;
   int error;
 
+  if (pulse_handle == NULL) {
+    // resume() failed to reopen the stream, or the server went away
+    g_usleep(RECONNECT_INTERVAL_US);
+    if (!connect()) {
+      return AudioFrame(0);
+    }
+    g_message("Reopened the pulseaudio record stream");
+  }
+
   read_frames = frame_length * sizeof(int16_t);
   if (pa_simple_read(pulse_handle, pcm, read_frames, &error) < 0) {
     g_critical("pa_simple_read() failed with '%s'", pa_strerror(error));
+    // reopen on the next read
+    pa_simple_free(pulse_handle);
+    pulse_handle = NULL;
     return AudioFrame(0);
   }
   read_frames /= sizeof(int16_t);
 
   if (read_frames != frame_length) {
-    g_message("read %d frames instead of %d", read_frames, frame_length);
+    GENIE_LOG_RATELIMITED(g_message, 1000, "read %d frames instead of %d",
+                          read_frames, frame_length);
     return AudioFrame(0);
   }
 
+  if (recorder)
+    recorder->write(AudioRecorder::Track::MONO, pcm, frame_length);
+
   AudioFrame frame(frame_length);
   memcpy(frame.samples, pcm, frame_length * sizeof(int16_t));
   return frame;
 }
+
+/**
+ * @brief Close the record stream.
+ *
+ * `pa_simple` cannot cork a stream, so we drop it entirely; this also lets
+ * the server suspend the source when nothing else is recording.
+ */
+void genie::AudioInputPulseSimple::suspend() {
+  if (pulse_handle != NULL) {
+    pa_simple_free(pulse_handle);
+    pulse_handle = NULL;
+  }
+}
+
+bool genie::AudioInputPulseSimple::resume() {
+  if (pulse_handle != NULL) {
+    return true;
+  }
+  return connect();
+}
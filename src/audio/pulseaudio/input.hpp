@@ -34,13 +34,18 @@ public:
   bool init(gchar *audio_input_device, int sample_rate, int channels,
             int max_frame_length);
   AudioFrame read_frame(int32_t frame_length);
+  void suspend();
+  bool resume();
 
 private:
   // initialized once and never overwritten
   App *const app;
   pa_simple *pulse_handle = NULL;
+  pa_sample_spec sample_spec;
 
-  int16_t *pcm;
+  bool connect();
+
+  int16_t *pcm = NULL;
 };
 
 } // namespace genie
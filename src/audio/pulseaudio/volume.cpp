@@ -49,8 +49,8 @@ genie::AudioVolumeDriverPulseAudio::AudioVolumeDriverPulseAudio(App *app)
 }
 
 genie::AudioVolumeDriverPulseAudio::~AudioVolumeDriverPulseAudio() {
-  if (ducking_stream != nullptr)
-    pa_simple_free(ducking_stream);
+  if (ramp_timeout_id > 0)
+    g_source_remove(ramp_timeout_id);
   if (default_sink_name)
     free(default_sink_name);
   if (_context)
@@ -59,24 +59,158 @@ genie::AudioVolumeDriverPulseAudio::~AudioVolumeDriverPulseAudio() {
     pa_glib_mainloop_free(_mainloop);
 }
 
+/**
+ * Interval between two volume updates while ramping ducked streams.
+ */
+static const guint RAMP_STEP_MS = 20;
+
+/**
+ * @brief Attenuate all `media.role=music` streams.
+ *
+ * This only queues an operation on the PulseAudio context, which runs on the
+ * GLib main loop, so it never blocks the wake path. The attenuation itself is
+ * applied by `ramp_step()` once PulseAudio has enumerated the streams.
+ */
 void genie::AudioVolumeDriverPulseAudio::duck() {
-  if (ducking_stream)
+  if (ducked)
+    return;
+  ducked = true;
+  duck_start_time = g_get_monotonic_time();
+
+  if (pa_context_get_state(_context) != PA_CONTEXT_READY) {
+    g_debug("PulseAudio context not ready, not ducking");
     return;
+  }
 
-  const pa_sample_spec config{/* format */ PA_SAMPLE_S16LE,
-                              /* rate */ 44100,
-                              /* channels */ 2};
-  ducking_stream =
-      pa_simple_new(NULL, "Genie-duck", PA_STREAM_PLAYBACK, NULL,
-                    "Dummy Output for Ducking", &config, NULL, NULL, NULL);
+  pa_operation *op =
+      pa_context_get_sink_input_info_list(_context, sink_input_info_cb, this);
+  if (op) {
+    pa_operation_unref(op);
+  }
+
+  g_debug("Ducking requested, main loop blocked for %.3f ms",
+          (g_get_monotonic_time() - duck_start_time) / 1000.0);
 }
 
 void genie::AudioVolumeDriverPulseAudio::unduck() {
-  if (!ducking_stream)
+  if (!ducked)
+    return;
+  ducked = false;
+  duck_start_time = g_get_monotonic_time();
+
+  start_ramp();
+}
+
+void genie::AudioVolumeDriverPulseAudio::sink_input_info_cb(
+    pa_context *c, const pa_sink_input_info *i, int eol, void *userdata) {
+  AudioVolumeDriverPulseAudio *self =
+      static_cast<AudioVolumeDriverPulseAudio *>(userdata);
+
+  if (eol) {
+    if (self->ducked) {
+      g_debug("Found %zu music streams to duck after %.3f ms",
+              self->ducked_streams.size(),
+              (g_get_monotonic_time() - self->duck_start_time) / 1000.0);
+      self->start_ramp();
+    }
+    return;
+  }
+  if (!i || !self->ducked)
+    return;
+
+  const char *role = pa_proplist_gets(i->proplist, PA_PROP_MEDIA_ROLE);
+  if (!role || strcmp(role, "music") != 0)
     return;
 
-  pa_simple_free(ducking_stream);
-  ducking_stream = nullptr;
+  if (self->ducked_streams.count(i->index))
+    return;
+
+  pa_volume_t volume = pa_cvolume_avg(&i->volume);
+  self->ducked_streams.emplace(
+      i->index, DuckedStream{i->volume.channels, volume, volume});
+}
+
+void genie::AudioVolumeDriverPulseAudio::start_ramp() {
+  if (ramp_timeout_id > 0 || ducked_streams.empty())
+    return;
+
+  if (app->config->audio_ducking_ramp_ms == 0) {
+    // no ramp configured, jump straight to the target volume
+    while (!apply_ramp_step()) {
+    }
+    return;
+  }
+
+  ramp_timeout_id = g_timeout_add(RAMP_STEP_MS, ramp_step, this);
+}
+
+gboolean genie::AudioVolumeDriverPulseAudio::ramp_step(gpointer userdata) {
+  AudioVolumeDriverPulseAudio *self =
+      static_cast<AudioVolumeDriverPulseAudio *>(userdata);
+
+  if (self->apply_ramp_step()) {
+    self->ramp_timeout_id = 0;
+    return G_SOURCE_REMOVE;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * @brief Move every tracked stream one step closer to its target volume.
+ *
+ * @return `true` once all streams have reached their target.
+ */
+bool genie::AudioVolumeDriverPulseAudio::apply_ramp_step() {
+  size_t ramp_ms = app->config->audio_ducking_ramp_ms;
+  int ducking_volume = app->config->audio_ducking_volume;
+  bool done = true;
+
+  for (auto &it : ducked_streams) {
+    DuckedStream &stream = it.second;
+    pa_volume_t ducked_level =
+        (pa_volume_t)(((uint64_t)stream.original * ducking_volume) /
+                      AudioVolumeController::MAX_VOLUME);
+    pa_volume_t target = ducked ? ducked_level : stream.original;
+    if (stream.current == target)
+      continue;
+
+    // the ramp always covers the full span in `ramp_ms`, in both directions
+    pa_volume_t span = stream.original - ducked_level;
+    pa_volume_t step = ramp_ms > 0 ? (pa_volume_t)(((uint64_t)span *
+                                                    RAMP_STEP_MS) /
+                                                   ramp_ms)
+                                   : span;
+    if (step == 0)
+      step = 1;
+
+    if (stream.current > target)
+      stream.current =
+          stream.current - target > step ? stream.current - step : target;
+    else
+      stream.current =
+          target - stream.current > step ? stream.current + step : target;
+
+    struct pa_cvolume v;
+    pa_cvolume_init(&v);
+    pa_cvolume_set(&v, stream.channels, stream.current);
+    pa_operation *op = pa_context_set_sink_input_volume(_context, it.first, &v,
+                                                        nullptr, nullptr);
+    if (op) {
+      pa_operation_unref(op);
+    }
+
+    if (stream.current != target)
+      done = false;
+  }
+
+  if (done) {
+    g_message("%s %zu music streams in %.1f ms", ducked ? "Ducked" : "Unducked",
+              ducked_streams.size(),
+              (g_get_monotonic_time() - duck_start_time) / 1000.0);
+    if (!ducked)
+      ducked_streams.clear();
+  }
+  return done;
 }
 
 /**
@@ -124,7 +258,11 @@ void genie::AudioVolumeDriverPulseAudio::context_state_cb(pa_context *c,
         pa_operation_unref(op);
       }
       pa_context_set_subscribe_callback(c, subscribe_cb, userdata);
-      op = pa_context_subscribe(c, PA_SUBSCRIPTION_MASK_SINK, NULL, NULL);
+      op = pa_context_subscribe(
+          c,
+          (pa_subscription_mask_t)(PA_SUBSCRIPTION_MASK_SINK |
+                                   PA_SUBSCRIPTION_MASK_SINK_INPUT),
+          NULL, NULL);
       if (op) {
         pa_operation_unref(op);
       }
@@ -142,13 +280,25 @@ void genie::AudioVolumeDriverPulseAudio::context_state_cb(pa_context *c,
 void genie::AudioVolumeDriverPulseAudio::subscribe_cb(
     pa_context *c, pa_subscription_event_type_t type, uint32_t idx,
     void *userdata) {
+  AudioVolumeDriverPulseAudio *self =
+      static_cast<AudioVolumeDriverPulseAudio *>(userdata);
   unsigned facility = type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+  unsigned event = type & PA_SUBSCRIPTION_EVENT_TYPE_MASK;
 
   pa_operation *op = NULL;
   switch (facility) {
     case PA_SUBSCRIPTION_EVENT_SINK:
       op = pa_context_get_sink_info_by_index(c, idx, sink_info_cb, userdata);
       break;
+    case PA_SUBSCRIPTION_EVENT_SINK_INPUT:
+      if (event == PA_SUBSCRIPTION_EVENT_REMOVE) {
+        self->ducked_streams.erase(idx);
+      } else if (event == PA_SUBSCRIPTION_EVENT_NEW && self->ducked) {
+        // a music stream started while we are ducked, attenuate it too
+        op = pa_context_get_sink_input_info(c, idx, sink_input_info_cb,
+                                            userdata);
+      }
+      break;
     default:
       break;
   }
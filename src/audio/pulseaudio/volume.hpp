@@ -25,6 +25,7 @@
 #include <pulse/glib-mainloop.h>
 #include <pulse/pulseaudio.h>
 #include <pulse/simple.h>
+#include <unordered_map>
 
 namespace genie {
 
@@ -47,10 +48,15 @@ private:
                            uint32_t idx, void *userdata);
   static void sink_info_cb(pa_context *c, const pa_sink_info *i, int eol,
                            void *userdata);
+  static void sink_input_info_cb(pa_context *c, const pa_sink_input_info *i,
+                                 int eol, void *userdata);
+  static gboolean ramp_step(gpointer userdata);
 
   void set_volume(char *device, int channels, int volume);
   void set_default_volume(int volume);
   int get_default_volume();
+  void start_ramp();
+  bool apply_ramp_step();
 
   // initialized once and never overwritten
   App *const app;
@@ -63,7 +69,19 @@ private:
   int sink_num_channels;
   pa_volume_t sink_volume;
 
-  pa_simple *ducking_stream = NULL;
+  /**
+   * A `media.role=music` sink input whose volume we are attenuating.
+   */
+  struct DuckedStream {
+    uint8_t channels;
+    pa_volume_t original;
+    pa_volume_t current;
+  };
+
+  bool ducked = false;
+  std::unordered_map<uint32_t, DuckedStream> ducked_streams;
+  guint ramp_timeout_id = 0;
+  gint64 duck_start_time = 0;
 };
 
 } // namespace genie
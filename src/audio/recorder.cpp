@@ -0,0 +1,325 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "recorder.hpp"
+#include "app.hpp"
+#include "utils/worker-pool.hpp"
+
+#include <algorithm>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::AudioRecorder"
+
+// dumps kept in cache_dir/recordings, older ones are deleted
+static const int MAX_DUMPS = 5;
+// automatic dumps (failed turns) are skipped if the last one is more recent
+static const gint64 AUTO_DUMP_INTERVAL_US = 60 * G_USEC_PER_SEC;
+// frames are never shorter than 10 ms
+static const size_t MIN_FRAME_MS = 10;
+
+static const char *const TRACK_NAMES[] = {"raw", "mono", "reference",
+                                          "filtered"};
+
+struct genie::AudioRecorder::Snapshot {
+  size_t sample_rate;
+  std::string reason;
+  std::vector<int16_t> samples[(int)Track::COUNT];
+  int channels[(int)Track::COUNT];
+  // MONO track position of the first sample in the snapshot
+  uint64_t mono_begin;
+  std::vector<FrameMark> marks;
+};
+
+genie::AudioRecorder::AudioRecorder(App *app, size_t sample_rate,
+                                    size_t seconds)
+    : app(app), sample_rate(sample_rate), seconds(seconds), enabled(true),
+      marks_written(0), dump_in_progress(false), last_auto_dump(0) {
+  allocate(tracks[(int)Track::MONO], 1);
+  marks_capacity = seconds * 1000 / MIN_FRAME_MS;
+  marks.reset(new FrameMark[marks_capacity]);
+}
+
+genie::AudioRecorder::~AudioRecorder() {}
+
+void genie::AudioRecorder::allocate(TrackBuffer &track, int channels) {
+  track.channels = channels;
+  track.capacity = sample_rate * seconds * channels;
+  track.data.reset(new int16_t[track.capacity]);
+  track.written = 0;
+}
+
+/**
+ * @brief Start recording `track` with `channels` interleaved channels.
+ *
+ * Only the MONO track is recorded by default; drivers that produce the
+ * others enable them from `init()`.
+ */
+void genie::AudioRecorder::set_channels(Track track, int channels) {
+  allocate(tracks[(int)track], channels);
+}
+
+size_t genie::AudioRecorder::memory_size() const {
+  size_t total = marks_capacity * sizeof(FrameMark);
+  for (const auto &buffer : tracks)
+    total += buffer.capacity * sizeof(int16_t);
+  return total;
+}
+
+void genie::AudioRecorder::write(Track track, const int16_t *samples,
+                                 size_t frames) {
+  TrackBuffer &buffer = tracks[(int)track];
+  if (!enabled || !buffer.capacity)
+    return;
+
+  size_t count = std::min(frames * buffer.channels, buffer.capacity);
+  uint64_t written = buffer.written.load(std::memory_order_relaxed);
+  size_t offset = written % buffer.capacity;
+  size_t first = std::min(count, buffer.capacity - offset);
+  memcpy(&buffer.data[offset], samples, first * sizeof(int16_t));
+  memcpy(&buffer.data[0], samples + first, (count - first) * sizeof(int16_t));
+  buffer.written.store(written + count, std::memory_order_release);
+}
+
+void genie::AudioRecorder::mark_frame(int vad, bool wake) {
+  if (!enabled)
+    return;
+
+  uint64_t n = marks_written.load(std::memory_order_relaxed);
+  FrameMark &mark = marks[n % marks_capacity];
+  mark.position =
+      tracks[(int)Track::MONO].written.load(std::memory_order_relaxed);
+  mark.vad = vad;
+  mark.wake = wake;
+  marks_written.store(n + 1, std::memory_order_release);
+}
+
+void genie::AudioRecorder::set_enabled(bool enabled) {
+  g_message("Audio flight recorder %s", enabled ? "enabled" : "disabled");
+  this->enabled = enabled;
+}
+
+/**
+ * @brief Copy the rings. Runs on a worker thread concurrently with the
+ * capture thread.
+ */
+std::shared_ptr<genie::AudioRecorder::Snapshot>
+genie::AudioRecorder::snapshot() {
+  auto snap = std::make_shared<Snapshot>();
+  snap->sample_rate = sample_rate;
+  snap->mono_begin = 0;
+
+  for (int i = 0; i < (int)Track::COUNT; i++) {
+    TrackBuffer &buffer = tracks[i];
+    snap->channels[i] = buffer.channels;
+    if (!buffer.capacity)
+      continue;
+
+    uint64_t end = buffer.written.load(std::memory_order_acquire);
+    uint64_t begin = end > buffer.capacity ? end - buffer.capacity : 0;
+    std::vector<int16_t> &out = snap->samples[i];
+    out.resize(end - begin);
+    for (uint64_t pos = begin; pos < end;) {
+      size_t offset = pos % buffer.capacity;
+      size_t n = std::min<uint64_t>(end - pos, buffer.capacity - offset);
+      memcpy(&out[pos - begin], &buffer.data[offset], n * sizeof(int16_t));
+      pos += n;
+    }
+
+    // drop whatever the writer overwrote while we were copying, keeping
+    // whole frames of interleaved samples
+    uint64_t after = buffer.written.load(std::memory_order_acquire);
+    if (after > buffer.capacity && after - buffer.capacity > begin) {
+      uint64_t lost = after - buffer.capacity - begin;
+      lost = std::min<uint64_t>(out.size(), (lost + buffer.channels - 1) /
+                                                buffer.channels *
+                                                buffer.channels);
+      out.erase(out.begin(), out.begin() + lost);
+      begin += lost;
+    }
+    if (i == (int)Track::MONO)
+      snap->mono_begin = begin;
+  }
+
+  uint64_t end = marks_written.load(std::memory_order_acquire);
+  uint64_t begin = end > marks_capacity ? end - marks_capacity : 0;
+  for (uint64_t n = begin; n < end; n++)
+    snap->marks.push_back(marks[n % marks_capacity]);
+  uint64_t after = marks_written.load(std::memory_order_acquire);
+  if (after > marks_capacity && after - marks_capacity > begin) {
+    size_t lost =
+        std::min<uint64_t>(snap->marks.size(), after - marks_capacity - begin);
+    snap->marks.erase(snap->marks.begin(), snap->marks.begin() + lost);
+  }
+
+  return snap;
+}
+
+static void write_le(FILE *file, uint32_t value, int bytes) {
+  for (int i = 0; i < bytes; i++)
+    fputc((value >> (8 * i)) & 0xff, file);
+}
+
+static bool write_wav(const char *filename, const std::vector<int16_t> &samples,
+                      int channels, size_t sample_rate) {
+  FILE *file = fopen(filename, "wb");
+  if (!file)
+    return false;
+
+  uint32_t data_size = samples.size() * sizeof(int16_t);
+  fwrite("RIFF", 1, 4, file);
+  write_le(file, 36 + data_size, 4);
+  fwrite("WAVEfmt ", 1, 8, file);
+  write_le(file, 16, 4);
+  write_le(file, 1, 2); // PCM
+  write_le(file, channels, 2);
+  write_le(file, sample_rate, 4);
+  write_le(file, sample_rate * channels * sizeof(int16_t), 4);
+  write_le(file, channels * sizeof(int16_t), 2);
+  write_le(file, 16, 2);
+  fwrite("data", 1, 4, file);
+  write_le(file, data_size, 4);
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+  fwrite(samples.data(), sizeof(int16_t), samples.size(), file);
+#else
+  for (int16_t sample : samples)
+    write_le(file, (uint16_t)sample, 2);
+#endif
+
+  bool ok = !ferror(file);
+  return fclose(file) == 0 && ok;
+}
+
+bool genie::AudioRecorder::write_snapshot(const Snapshot &snapshot,
+                                          const char *dir) {
+  if (g_mkdir_with_parents(dir, 0755) != 0)
+    return false;
+
+  for (int i = 0; i < (int)Track::COUNT; i++) {
+    if (snapshot.samples[i].empty())
+      continue;
+    gchar *name = g_strdup_printf("%s.wav", TRACK_NAMES[i]);
+    gchar *filename = g_build_filename(dir, name, nullptr);
+    bool ok = write_wav(filename, snapshot.samples[i], snapshot.channels[i],
+                        snapshot.sample_rate);
+    g_free(filename);
+    g_free(name);
+    if (!ok)
+      return false;
+  }
+
+  gchar *filename = g_build_filename(dir, "frames.csv", nullptr);
+  FILE *file = fopen(filename, "w");
+  g_free(filename);
+  if (!file)
+    return false;
+  fprintf(file, "time_ms,vad,wake\n");
+  for (const auto &mark : snapshot.marks) {
+    if (mark.position < snapshot.mono_begin)
+      continue;
+    fprintf(file, "%.1f,%d,%d\n",
+            (mark.position - snapshot.mono_begin) * 1000.0 /
+                snapshot.sample_rate,
+            mark.vad, mark.wake ? 1 : 0);
+  }
+  return fclose(file) == 0;
+}
+
+/**
+ * @brief Delete all but the newest `MAX_DUMPS` dumps. Dump directories are
+ * named after their timestamp, so they sort by age.
+ */
+void genie::AudioRecorder::prune_dumps(const char *root) {
+  GDir *dir = g_dir_open(root, 0, nullptr);
+  if (!dir)
+    return;
+
+  std::vector<std::string> names;
+  const char *name;
+  while ((name = g_dir_read_name(dir)))
+    names.push_back(name);
+  g_dir_close(dir);
+
+  std::sort(names.begin(), names.end());
+  for (size_t i = 0; i + MAX_DUMPS < names.size(); i++) {
+    gchar *path = g_build_filename(root, names[i].c_str(), nullptr);
+    for (const char *file : {"raw.wav", "mono.wav", "reference.wav",
+                             "filtered.wav", "frames.csv"}) {
+      gchar *child = g_build_filename(path, file, nullptr);
+      g_unlink(child);
+      g_free(child);
+    }
+    g_rmdir(path);
+    g_free(path);
+  }
+}
+
+/**
+ * @brief Save the recorder contents under cache_dir/recordings. The copy
+ * and the writing happen on the worker pool.
+ *
+ * `automatic` dumps, after a failed turn, are rate limited so a run of
+ * failures does not keep the disk busy.
+ */
+void genie::AudioRecorder::dump(const char *reason, bool automatic) {
+  if (dump_in_progress) {
+    g_message("Audio recorder dump already in progress, skipping %s", reason);
+    return;
+  }
+  gint64 now = g_get_monotonic_time();
+  if (automatic) {
+    if (last_auto_dump && now - last_auto_dump < AUTO_DUMP_INTERVAL_US)
+      return;
+    last_auto_dump = now;
+  }
+
+  GDateTime *time = g_date_time_new_now_local();
+  gchar *timestamp = g_date_time_format(time, "%Y%m%d-%H%M%S");
+  g_date_time_unref(time);
+  gchar *root =
+      g_build_filename(app->config->cache_dir, "recordings", nullptr);
+  gchar *dirname = g_strdup_printf("%s-%s", timestamp, reason);
+  gchar *dir = g_build_filename(root, dirname, nullptr);
+  std::string root_str(root), dir_str(dir);
+  g_free(dir);
+  g_free(dirname);
+  g_free(root);
+  g_free(timestamp);
+
+  auto ok = std::make_shared<bool>(false);
+  dump_in_progress = true;
+  app->worker_pool->run(
+      [this, root_str, dir_str, ok]() {
+        auto snap = snapshot();
+        *ok = write_snapshot(*snap, dir_str.c_str());
+        prune_dumps(root_str.c_str());
+      },
+      [this, dir_str, ok]() {
+        dump_in_progress = false;
+        if (*ok)
+          g_message("Audio recorder saved to %s", dir_str.c_str());
+        else
+          g_warning("Failed to save audio recorder to %s", dir_str.c_str());
+        // may destroy this recorder, must come last
+        app->track_audio_dump_done();
+      });
+}
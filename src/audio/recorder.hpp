@@ -0,0 +1,114 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <glib.h>
+#include <memory>
+#include <stdint.h>
+
+namespace genie {
+
+class App;
+
+/**
+ * An always-on flight recorder for the audio input.
+ *
+ * It keeps the last few seconds of each stream in a fixed-size ring. The
+ * streams are the raw capture, the mono mix, the echo-cancellation
+ * reference and the post-AEC signal. It also keeps the VAD and wake-word
+ * decision for each frame.
+ *
+ * The capture thread is the only writer, and `write()` and `mark_frame()`
+ * are lock-free with no allocation or I/O. `dump()` copies the rings and
+ * writes them to WAV files on the worker pool. The copy may race with the
+ * writer, so any samples overwritten during the copy are cut from the
+ * start of the dump.
+ */
+class AudioRecorder {
+public:
+  enum class Track {
+    RAW,
+    MONO,
+    REFERENCE,
+    FILTERED,
+    COUNT,
+  };
+
+  AudioRecorder(App *app, size_t sample_rate, size_t seconds);
+  ~AudioRecorder();
+
+  AudioRecorder(const AudioRecorder &) = delete;
+  AudioRecorder &operator=(const AudioRecorder &) = delete;
+
+  // call before capture starts
+  void set_channels(Track track, int channels);
+
+  // capture thread
+  void write(Track track, const int16_t *samples, size_t frames);
+  void mark_frame(int vad, bool wake);
+
+  // main thread
+  void set_enabled(bool enabled);
+  bool is_enabled() const { return enabled; }
+  bool is_dumping() const { return dump_in_progress; }
+  size_t memory_size() const;
+  void dump(const char *reason, bool automatic = false);
+
+private:
+  struct TrackBuffer {
+    std::unique_ptr<int16_t[]> data;
+    size_t capacity = 0;
+    int channels = 1;
+    // total number of samples ever written
+    std::atomic<uint64_t> written{0};
+  };
+
+  /**
+   * A frame decision, `position` is the MONO track sample it applies to.
+   * `vad` is -1 when VAD was not run on the frame.
+   */
+  struct FrameMark {
+    uint64_t position;
+    int8_t vad;
+    bool wake;
+  };
+
+  struct Snapshot;
+
+  App *const app;
+  const size_t sample_rate;
+  const size_t seconds;
+  std::atomic<bool> enabled;
+
+  TrackBuffer tracks[(int)Track::COUNT];
+  std::unique_ptr<FrameMark[]> marks;
+  size_t marks_capacity;
+  std::atomic<uint64_t> marks_written;
+
+  bool dump_in_progress;
+  gint64 last_auto_dump;
+
+  void allocate(TrackBuffer &track, int channels);
+  std::shared_ptr<Snapshot> snapshot();
+  static bool write_snapshot(const Snapshot &snapshot, const char *dir);
+  static void prune_dumps(const char *root);
+};
+
+} // namespace genie
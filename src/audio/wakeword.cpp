@@ -22,41 +22,50 @@
 #include <stdio.h>
 
 #include "wakeword.hpp"
+#include "app.hpp"
+
+/**
+ * @brief Resolve an asset path from the configuration, relative paths are
+ * looked up in the asset directory.
+ */
+std::string genie::WakeWord::asset_path(const char *asset_dir,
+                                        const char *path) {
+  if (path[0] == '/')
+    return path;
+
+  gchar *filename = g_build_filename(asset_dir, path, nullptr);
+  std::string result(filename);
+  g_free(filename);
+  return result;
+}
 
-genie::WakeWord::WakeWord(App *app) : app(app) {
+genie::WakeWord::WakeWord(App *app)
+    : WakeWord(asset_path(app->config->asset_dir, "libpv_porcupine.so"),
+               asset_path(app->config->asset_dir, app->config->pv_model_path),
+               asset_path(app->config->asset_dir,
+                          app->config->pv_keyword_path),
+               app->config->pv_sensitivity) {}
+
+genie::WakeWord::WakeWord(const std::string &library_path,
+                          const std::string &model_path,
+                          const std::string &keyword_path, float sensitivity)
+    : model_path(model_path), keyword_path(keyword_path),
+      sensitivity(sensitivity) {
   porcupine = nullptr;
   porcupine_library = nullptr;
+  pv_porcupine_init_func = nullptr;
   pv_porcupine_delete_func = nullptr;
   pv_porcupine_process_func = nullptr;
   pv_status_to_string_func = nullptr;
 
-  char *library_path =
-      g_build_filename(app->config->asset_dir, "libpv_porcupine.so", nullptr);
-
-  char *model_path;
-  if (app->config->pv_model_path[0] == '/')
-    model_path = g_strdup(app->config->pv_model_path);
-  else
-    model_path = g_build_filename(app->config->asset_dir,
-                                  app->config->pv_model_path, nullptr);
-  g_message("Loading picovoice model from %s", model_path);
-
-  char *keyword_path;
-  if (app->config->pv_keyword_path[0] == '/')
-    keyword_path = g_strdup(app->config->pv_keyword_path);
-  else
-    keyword_path = g_build_filename(app->config->asset_dir,
-                                    app->config->pv_keyword_path, nullptr);
-  g_message("Loading wakeword from %s", keyword_path);
+  g_message("Loading picovoice model from %s", model_path.c_str());
+  g_message("Loading wakeword from %s", keyword_path.c_str());
 
-  const float sensitivity = app->config->pv_sensitivity;
-
-  porcupine_library = dlopen(library_path, RTLD_NOW);
+  porcupine_library = dlopen(library_path.c_str(), RTLD_NOW);
   if (!porcupine_library) {
-    g_error("failed to open library %s: %s", library_path, dlerror());
+    g_error("failed to open library %s: %s", library_path.c_str(), dlerror());
     return;
   }
-  g_free(library_path);
 
   char *error = NULL;
 
@@ -78,7 +87,7 @@ genie::WakeWord::WakeWord(App *app) : app(app) {
   g_assert(sample_rate_signed > 0);
   sample_rate = (size_t)sample_rate_signed;
 
-  auto pv_porcupine_init_func = (decltype(pv_porcupine_init) *)dlsym(
+  pv_porcupine_init_func = (decltype(pv_porcupine_init) *)dlsym(
       porcupine_library, "pv_porcupine_init");
   if ((error = dlerror()) != NULL) {
     g_error("failed to load 'pv_porcupine_init' with '%s'.\n", error);
@@ -110,31 +119,58 @@ genie::WakeWord::WakeWord(App *app) : app(app) {
   pv_frame_length = pv_porcupine_frame_length_func();
 
   porcupine = NULL;
-  pv_status_t status = pv_porcupine_init_func(model_path, 1, &keyword_path,
-                                              &sensitivity, &porcupine);
-  if (status != PV_STATUS_SUCCESS) {
-    g_error("'pv_porcupine_init' failed with '%s'\n",
-            pv_status_to_string_func(status));
+  if (!reload()) {
+    g_error("failed to initialize wakeword engine");
     return;
   }
-  g_free(model_path);
-  g_free(keyword_path);
 
   g_print("Initialized wakeword engine, frame length %d, sample rate %zd\n",
           pv_frame_length, sample_rate);
 }
 
 genie::WakeWord::~WakeWord() {
+  release();
+  if (porcupine_library) {
+    dlclose(porcupine_library);
+  }
+}
+
+/**
+ * @brief Free the Porcupine engine and its working memory.
+ *
+ * `process()` reports no detection until `reload()` is called.
+ */
+void genie::WakeWord::release() {
   if (porcupine) {
     pv_porcupine_delete_func(porcupine);
+    porcupine = nullptr;
   }
-  if (porcupine_library) {
-    dlclose(porcupine_library);
+}
+
+/**
+ * @brief (Re-)create the Porcupine engine from the configured model and
+ * keyword. Does nothing if the engine is already loaded.
+ */
+bool genie::WakeWord::reload() {
+  if (porcupine) {
+    return true;
+  }
+
+  const char *keyword = keyword_path.c_str();
+  pv_status_t status = pv_porcupine_init_func(
+      model_path.c_str(), 1, &keyword, &sensitivity, &porcupine);
+  if (status != PV_STATUS_SUCCESS) {
+    g_critical("'pv_porcupine_init' failed with '%s'\n",
+               pv_status_to_string_func(status));
+    porcupine = nullptr;
+    return false;
   }
+  return true;
 }
 
 int genie::WakeWord::process(AudioFrame *frame) {
-  if (frame->length == 0 || frame->length != (uint32_t)pv_frame_length) {
+  if (!porcupine || frame->length == 0 ||
+      frame->length != (uint32_t)pv_frame_length) {
     return false;
   }
 
@@ -18,26 +18,38 @@
 
 #pragma once
 
-#include "app.hpp"
+#include "audio.hpp"
 #include <pv_porcupine.h>
+#include <string>
 
 namespace genie {
 
+class App;
+
 class WakeWord {
 public:
   WakeWord(App *app);
+  WakeWord(const std::string &library_path, const std::string &model_path,
+           const std::string &keyword_path, float sensitivity);
   ~WakeWord();
+  static std::string asset_path(const char *asset_dir, const char *path);
+
   int process(AudioFrame *frame);
+  void release();
+  bool reload();
 
   int32_t pv_frame_length;
   size_t sample_rate;
 
 private:
   // initialized once and never overwritten
-  App *const app;
+  const std::string model_path;
+  const std::string keyword_path;
+  float sensitivity;
 
   void *porcupine_library;
   pv_porcupine_t *porcupine;
+  decltype(pv_porcupine_init) *pv_porcupine_init_func;
   decltype(pv_porcupine_delete) *pv_porcupine_delete_func;
   decltype(pv_porcupine_process) *pv_porcupine_process_func;
   decltype(pv_status_to_string) *pv_status_to_string_func;
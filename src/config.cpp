@@ -23,12 +23,15 @@
 
 #include "leds.hpp"
 #include "utils/autoptrs.hpp"
+#include "utils/worker-pool.hpp"
+#include <atomic>
 #include <memory>
+#include <mutex>
 
 #undef G_LOG_DOMAIN
 #define G_LOG_DOMAIN "genie::Config"
 
-genie::Config::Config() {}
+genie::Config::Config() : save_queue(std::make_shared<SaveQueue>()) {}
 
 genie::Config::~Config() {
   g_free(genie_url);
@@ -58,6 +61,7 @@ genie::Config::~Config() {
   g_free(proxy);
   g_free(ssl_ca_file);
   g_free(evinput_device);
+  g_free(buttons_talk_key);
   g_free(leds_path);
   g_free(leds_type);
   g_free(cache_dir);
@@ -65,6 +69,8 @@ genie::Config::~Config() {
   g_free(net_wlan_if);
   g_free(net_wlan_ap_ctrl);
   g_free(net_wlan_sta_ctrl);
+  g_free(net_wpa_ctrl_dir);
+  g_free(net_hostapd_ctrl_dir);
 
   g_key_file_unref(key_file);
 }
@@ -367,19 +373,105 @@ genie::AudioDriverType genie::Config::get_audio_backend() {
   return backend;
 }
 
-void genie::Config::save() {
-  GError *error = NULL;
-  g_key_file_save_to_file(key_file, "config.ini", &error);
-  if (error) {
-    g_critical("Failed to save configuration file to disk: %s\n",
-               error->message);
-    g_error_free(error);
+void genie::ConfigDiff::add(const char *section, const char *key) {
+  keys.emplace(section, key);
+}
+
+bool genie::ConfigDiff::has(const char *section, const char *key) const {
+  return keys.count(std::make_pair(std::string(section), std::string(key)));
+}
+
+bool genie::ConfigDiff::has_section(const char *section) const {
+  auto it =
+      keys.lower_bound(std::make_pair(std::string(section), std::string()));
+  return it != keys.end() && it->first == section;
+}
+
+std::string genie::ConfigDiff::to_string() const {
+  std::string result;
+  for (const auto &key : keys) {
+    if (!result.empty())
+      result += ", ";
+    result += key.first + "." + key.second;
   }
+  return result;
+}
+
+/**
+ * @brief Add to `diff` the keys of this configuration that are missing from
+ * `other` or have a different value there.
+ */
+void genie::Config::diff_groups(const Config &other, ConfigDiff &diff) const {
+  std::unique_ptr<gchar *, fn_deleter<gchar *, g_strfreev>> groups(
+      g_key_file_get_groups(key_file, nullptr));
+  for (gchar **group = groups.get(); *group; group++) {
+    std::unique_ptr<gchar *, fn_deleter<gchar *, g_strfreev>> keys(
+        g_key_file_get_keys(key_file, *group, nullptr, nullptr));
+    if (!keys)
+      continue;
+    for (gchar **key = keys.get(); *key; key++) {
+      gchar *value = g_key_file_get_value(key_file, *group, *key, nullptr);
+      gchar *other_value =
+          g_key_file_get_value(other.key_file, *group, *key, nullptr);
+      if (g_strcmp0(value, other_value) != 0)
+        diff.add(*group, *key);
+      g_free(value);
+      g_free(other_value);
+    }
+  }
+}
+
+/**
+ * @brief Compare the raw values of two loaded configurations.
+ *
+ * Keys that were added or removed count as changed, comments do not.
+ */
+genie::ConfigDiff genie::Config::diff(const Config &other) const {
+  ConfigDiff result;
+  diff_groups(other, result);
+  other.diff_groups(*this, result);
+  return result;
+}
+
+/**
+ * @brief Write the configuration back to `config.ini` on a worker thread.
+ *
+ * The key file is serialized here, on the main thread; only the file write
+ * happens on `pool`. If saves overlap, only the most recent one is written.
+ */
+void genie::Config::save(WorkerPool *pool) {
+  auto data = std::make_shared<std::string>();
+  gsize length;
+  gchar *contents = g_key_file_to_data(key_file, &length, nullptr);
+  data->assign(contents, length);
+  g_free(contents);
+  unsigned generation = ++save_queue->generation;
+
+  std::shared_ptr<SaveQueue> queue = save_queue;
+  pool->run([queue, data, generation]() {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (generation != queue->generation)
+      return;
+
+    GError *error = NULL;
+    if (!g_file_set_contents("config.ini", data->c_str(), data->size(),
+                             &error)) {
+      g_critical("Failed to save configuration file to disk: %s\n",
+                 error->message);
+      g_error_free(error);
+    }
+  });
 }
 
-void genie::Config::load() {
+/**
+ * @brief Load config.ini, falling back to the defaults for whatever is
+ * missing. Returns false if the file could not be read or parsed, in which
+ * case everything is at its default.
+ */
+bool genie::Config::load() {
   key_file = g_key_file_new();
 
+  bool loaded = true;
   GError *error = NULL;
   if (!g_key_file_load_from_file(key_file, "config.ini",
                                  (GKeyFileFlags)(G_KEY_FILE_KEEP_COMMENTS |
@@ -388,6 +480,7 @@ void genie::Config::load() {
     if (error->domain != G_FILE_ERROR || error->code != G_FILE_ERROR_NOENT)
       g_critical("config load error: %s\n", error->message);
     g_clear_error(&error);
+    loaded = false;
   }
 
   asset_dir = get_string("general", "assets_dir", pkglibdir "/assets");
@@ -404,6 +497,8 @@ void genie::Config::load() {
   connect_timeout =
       get_size("general", "connect_timeout", DEFAULT_CONNECT_TIMEOUT);
 
+  stt_multiplex = get_bool("general", "stt_multiplex", true);
+
   auth_mode = get_auth_mode(key_file);
   if (auth_mode != AuthMode::NONE) {
     genie_access_token =
@@ -518,11 +613,28 @@ void genie::Config::load() {
     }
   } else {
     g_assert_not_reached();
-    return;
+    return false;
   }
 
   audio_voice = get_string("audio", "voice", DEFAULT_VOICE);
 
+  audio_ducking_volume = get_bounded_size(
+      "audio", "ducking_volume", DEFAULT_AUDIO_DUCKING_VOLUME, 0, 100);
+  audio_ducking_ramp_ms =
+      get_bounded_size("audio", "ducking_ramp_ms", DEFAULT_AUDIO_DUCKING_RAMP_MS,
+                       0, AUDIO_DUCKING_RAMP_MAX_MS);
+
+  audio_recorder_seconds =
+      get_bounded_size("audio", "recorder_seconds",
+                       DEFAULT_AUDIO_RECORDER_SECONDS, 0,
+                       AUDIO_RECORDER_MAX_SECONDS);
+  audio_recorder_auto_dump = get_bool("audio", "recorder_auto_dump", true);
+
+  audio_pause_buffer_kb = get_bounded_size(
+      "audio", "pause_buffer_kb", DEFAULT_AUDIO_PAUSE_BUFFER_KB, 64, 65536);
+  audio_pause_hold_s = get_bounded_size("audio", "pause_hold_s",
+                                        DEFAULT_AUDIO_PAUSE_HOLD_S, 0, 3600);
+
   // Echo Cancellation
   // =========================================================================
 
@@ -565,6 +677,9 @@ void genie::Config::load() {
   pv_wake_word_pattern = get_string("picovoice", "wake_word_pattern",
                                     DEFAULT_PV_WAKE_WORD_PATTERN);
 
+  pv_release_on_suspend = get_bool("picovoice", "release_on_suspend",
+                                   DEFAULT_PV_RELEASE_ON_SUSPEND);
+
   // Sounds
   // =========================================================================
 
@@ -594,6 +709,30 @@ void genie::Config::load() {
     evinput_device = nullptr;
   }
 
+  buttons_talk_key =
+      g_key_file_get_string(key_file, "buttons", "talk_key", nullptr);
+  if (buttons_talk_key && !*buttons_talk_key) {
+    g_free(buttons_talk_key);
+    buttons_talk_key = nullptr;
+  }
+  gchar *talk_mode = get_string("buttons", "talk_mode", "hold");
+  if (strcmp(talk_mode, "hold") == 0) {
+    buttons_talk_hold = true;
+  } else if (strcmp(talk_mode, "tap") == 0) {
+    buttons_talk_hold = false;
+  } else {
+    g_warning("Invalid talk mode %s, using default 'hold'", talk_mode);
+    buttons_talk_hold = true;
+  }
+  g_free(talk_mode);
+  buttons_talk_preroll_ms =
+      get_bounded_size("buttons", "talk_preroll_ms",
+                       DEFAULT_BUTTONS_TALK_PREROLL_MS, 0, 1000);
+  buttons_long_press_ms = get_bounded_size(
+      "buttons", "long_press_ms", DEFAULT_BUTTONS_LONG_PRESS_MS, 100, 5000);
+  buttons_double_press_ms = get_bounded_size(
+      "buttons", "double_press_ms", DEFAULT_BUTTONS_DOUBLE_PRESS_MS, 0, 2000);
+
   // Leds
   // =========================================================================
 
@@ -649,6 +788,10 @@ void genie::Config::load() {
                                                   DEFAULT_LEDS_DISABLED_EFFECT);
     leds_disabled_color = get_dec_color_from_hex_string(
         "leds", "diabled_color", DEFAULT_LEDS_DISABLED_COLOR);
+    leds_volume_color = get_dec_color_from_hex_string(
+        "leds", "volume_color", DEFAULT_LEDS_VOLUME_COLOR);
+    leds_fps =
+        get_bounded_size("leds", "fps", DEFAULT_LEDS_FPS, 1, LEDS_MAX_FPS);
   } else {
     leds_type = nullptr;
     leds_path = nullptr;
@@ -668,10 +811,16 @@ void genie::Config::load() {
     net_wlan_if = get_string("net", "wlan_if", DEFAULT_NET_WLAN_IF);
     net_wlan_ap_ctrl = get_string("net", "ap_ctrl", g_strdup(""));
     net_wlan_sta_ctrl = get_string("net", "sta_ctrl", g_strdup(""));
+    net_wpa_ctrl_dir =
+        get_string("net", "wpa_ctrl_dir", DEFAULT_NET_WPA_CTRL_DIR);
+    net_hostapd_ctrl_dir =
+        get_string("net", "hostapd_ctrl_dir", DEFAULT_NET_HOSTAPD_CTRL_DIR);
   } else {
     net_wlan_if = nullptr;
     net_wlan_ap_ctrl = nullptr;
     net_wlan_sta_ctrl = nullptr;
+    net_wpa_ctrl_dir = nullptr;
+    net_hostapd_ctrl_dir = nullptr;
   }
 
   // System
@@ -680,6 +829,16 @@ void genie::Config::load() {
   dns_controller_enabled =
       g_key_file_get_boolean(key_file, "system", "dns", nullptr);
 
+  config_watch_enabled = get_bool("system", "watch_config", true);
+
+  net_monitor_enabled = get_bool("system", "net_monitor", true);
+
+  dns_cache_enabled = get_bool("system", "dns_cache", true);
+  dns_cache_ttl_s = get_bounded_size("system", "dns_cache_ttl_s",
+                                     DEFAULT_DNS_CACHE_TTL_S, 10, 86400);
+  dns_cache_stale_s = get_bounded_size("system", "dns_cache_stale_s",
+                                       DEFAULT_DNS_CACHE_STALE_S, 0, 604800);
+
   proxy = g_key_file_get_string(key_file, "system", "proxy", nullptr);
   if (!proxy) {
     // use system-wide proxy if available
@@ -714,6 +873,17 @@ void genie::Config::load() {
     }
   }
 
+  stall_budget_ms = get_bounded_size("system", "stall_budget_ms",
+                                     DEFAULT_STALL_BUDGET_MS, 0, 10000);
+
+  memory_interval_s = get_bounded_size("system", "memory_interval_s",
+                                       DEFAULT_MEMORY_INTERVAL_S, 0, 3600);
+  memory_soft_limit_mb =
+      get_bounded_size("system", "memory_soft_limit_mb", 0, 0, 65536);
+
+  cpu_interval_s = get_bounded_size("system", "cpu_interval_s",
+                                    DEFAULT_CPU_INTERVAL_S, 0, 3600);
+
   // Voice Activity Detection (VAD)
   // =========================================================================
 
@@ -737,4 +907,15 @@ void genie::Config::load() {
   // =========================================================================
   webui_port =
       get_bounded_size("webui", "port", DEFAULT_WEBUI_PORT, 1024, 65535);
+  webui_dev_mode = get_bool("webui", "dev_mode", DEFAULT_WEBUI_DEV_MODE);
+  webui_status_max_subscribers =
+      get_bounded_size("webui", "status_max_subscribers",
+                       DEFAULT_WEBUI_STATUS_MAX_SUBSCRIBERS, 1, 32);
+  webui_status_queue_depth = get_bounded_size(
+      "webui", "status_queue_depth", DEFAULT_WEBUI_STATUS_QUEUE_DEPTH, 1, 256);
+  webui_status_level_interval_ms =
+      get_bounded_size("webui", "status_level_interval_ms",
+                       DEFAULT_WEBUI_STATUS_LEVEL_INTERVAL_MS, 50, 5000);
+
+  return loaded;
 }
@@ -19,7 +19,12 @@
 #pragma once
 
 #include "audio/audio.hpp"
+#include <atomic>
 #include <glib.h>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
 
 namespace genie {
 
@@ -27,10 +32,33 @@ enum class AuthMode { NONE, BEARER, COOKIE, HOME_ASSISTANT, OAUTH2 };
 
 enum class WifiAuthMode { OPEN, WEP, WPA };
 
+class WorkerPool;
+
+/**
+ * @brief The keys whose values differ between two configurations, as
+ * (section, key) pairs.
+ */
+class ConfigDiff {
+public:
+  void add(const char *section, const char *key);
+  bool has(const char *section, const char *key) const;
+  bool has_section(const char *section) const;
+  bool empty() const { return keys.empty(); }
+  std::string to_string() const;
+
+private:
+  std::set<std::pair<std::string, std::string>> keys;
+};
+
 class Config {
 public:
   static const size_t DEFAULT_WS_RETRY_INTERVAL = 3000;
   static const size_t DEFAULT_CONNECT_TIMEOUT = 5000;
+  static const size_t DEFAULT_STALL_BUDGET_MS = 50;
+  static const size_t DEFAULT_DNS_CACHE_TTL_S = 300;
+  static const size_t DEFAULT_DNS_CACHE_STALE_S = 3600;
+  static const size_t DEFAULT_MEMORY_INTERVAL_S = 10;
+  static const size_t DEFAULT_CPU_INTERVAL_S = 5;
   static const size_t VAD_MIN_MS = 100;
   static const size_t VAD_MAX_MS = 5000;
   static const size_t DEFAULT_VAD_START_SPEAKING_MS = 3000;
@@ -46,6 +74,13 @@ public:
   static const constexpr char *DEFAULT_ALSA_AUDIO_OUTPUT_DEVICE = "hw:0";
   static const constexpr char *DEFAULT_ALSA_AUDIO_VOLUME_CONTROL =
       "Master Playback Volume";
+  static const size_t DEFAULT_AUDIO_DUCKING_VOLUME = 20;
+  static const size_t DEFAULT_AUDIO_DUCKING_RAMP_MS = 150;
+  static const size_t AUDIO_DUCKING_RAMP_MAX_MS = 2000;
+  static const size_t DEFAULT_AUDIO_RECORDER_SECONDS = 10;
+  static const size_t AUDIO_RECORDER_MAX_SECONDS = 60;
+  static const size_t DEFAULT_AUDIO_PAUSE_BUFFER_KB = 2048;
+  static const size_t DEFAULT_AUDIO_PAUSE_HOLD_S = 300;
   static const constexpr char *DEFAULT_GENIE_URL =
       "wss://genie.stanford.edu/me/api/conversation";
   static const constexpr AuthMode DEFAULT_AUTH_MODE = AuthMode::OAUTH2;
@@ -54,6 +89,10 @@ public:
   static const constexpr char *DEFAULT_LOCALE = "en-US";
   static const constexpr char *DEFAULT_VOICE = "male";
   static const constexpr char *DEFAULT_NET_WLAN_IF = "wlan0";
+  static const constexpr char *DEFAULT_NET_WPA_CTRL_DIR =
+      "/var/run/wpa_supplicant";
+  static const constexpr char *DEFAULT_NET_HOSTAPD_CTRL_DIR =
+      "/var/run/hostapd";
 
   // Hacks Defaults
   // ---------------------------------------------------------------------------
@@ -79,6 +118,7 @@ public:
   static const constexpr char *DEFAULT_PV_WAKE_WORD_PATTERN =
       "^([A-Za-z]+[ .,]? (gene|genie|jeannie|jenny|jennie|dean)|beijing|pg and "
       "e|ragini|pagini|paging)[.,]?";
+  static const bool DEFAULT_PV_RELEASE_ON_SUSPEND = false;
 
   // Sound Defaults
   // -------------------------------------------------------------------------
@@ -95,6 +135,9 @@ public:
   // Buttons Defaults
   // -------------------------------------------------------------------------
   static const constexpr char *DEFAULT_EVINPUT_DEV = "/dev/input/event0";
+  static const size_t DEFAULT_BUTTONS_TALK_PREROLL_MS = 300;
+  static const size_t DEFAULT_BUTTONS_LONG_PRESS_MS = 500;
+  static const size_t DEFAULT_BUTTONS_DOUBLE_PRESS_MS = 400;
 
   // Leds Defaults
   // -------------------------------------------------------------------------
@@ -117,15 +160,23 @@ public:
   static const constexpr char *DEFAULT_LEDS_NET_ERROR_COLOR = "ffa500";
   static const constexpr char *DEFAULT_LEDS_DISABLED_EFFECT = "solid";
   static const constexpr char *DEFAULT_LEDS_DISABLED_COLOR = "ff0000";
+  static const constexpr char *DEFAULT_LEDS_VOLUME_COLOR = "ffffff";
+  static const size_t DEFAULT_LEDS_FPS = 20;
+  static const size_t LEDS_MAX_FPS = 60;
 
   // Web UI Defaults
   // -------------------------------------------------------------------------
   static const constexpr int DEFAULT_WEBUI_PORT = 8000;
+  static const bool DEFAULT_WEBUI_DEV_MODE = false;
+  static const size_t DEFAULT_WEBUI_STATUS_MAX_SUBSCRIBERS = 4;
+  static const size_t DEFAULT_WEBUI_STATUS_QUEUE_DEPTH = 8;
+  static const size_t DEFAULT_WEBUI_STATUS_LEVEL_INTERVAL_MS = 250;
 
   Config();
   ~Config();
-  void load();
-  void save();
+  bool load();
+  void save(WorkerPool *pool);
+  ConfigDiff diff(const Config &other) const;
 
   // Configuration File Values
   // =========================================================================
@@ -139,6 +190,12 @@ public:
   gchar *genie_url;
   size_t retry_interval;
   size_t connect_timeout;
+
+  /**
+   * @brief Ask the server to carry speech-to-text over the conversation
+   * websocket (protocol:stt) instead of opening a websocket per turn.
+   */
+  bool stt_multiplex;
   gchar *genie_access_token;
   gchar *conversation_id;
   gchar *nl_url;
@@ -168,6 +225,43 @@ public:
    */
   bool audio_input_stereo2mono;
 
+  /**
+   * @brief Volume (in percent of their current volume) that music streams are
+   * attenuated to while the assistant is listening. PulseAudio only.
+   */
+  size_t audio_ducking_volume;
+
+  /**
+   * @brief Duration of the volume ramp when ducking and unducking music
+   * streams. PulseAudio only.
+   */
+  size_t audio_ducking_ramp_ms;
+
+  /**
+   * @brief Seconds of input audio kept in memory by the flight recorder, 0
+   * to disable it. Costs 32 KB per second per recorded track at 16 kHz.
+   */
+  size_t audio_recorder_seconds;
+
+  /**
+   * @brief Save the flight recorder to disk after a failed turn (no input
+   * detected, STT error).
+   */
+  bool audio_recorder_auto_dump;
+
+  /**
+   * @brief Network buffer of the music pipeline, which bounds what a paused
+   * stream holds in memory.
+   */
+  size_t audio_pause_buffer_kb;
+
+  /**
+   * @brief How long a paused stream keeps its pipeline and buffered data.
+   * After that (or with 0) the pipeline is released and resuming seeks back
+   * to the paused position, or restarts live streams.
+   */
+  size_t audio_pause_hold_s;
+
   // Echo Cancellation
   // -------------------------------------------------------------------------
 
@@ -225,6 +319,12 @@ public:
   float pv_sensitivity;
   gchar *pv_wake_word_pattern;
 
+  /**
+   * @brief Free the Porcupine engine while audio input is suspended (Disabled
+   * and Config states), trading memory for a slower resume.
+   */
+  bool pv_release_on_suspend;
+
   // Sounds
   // -------------------------------------------------------------------------
 
@@ -241,6 +341,32 @@ public:
   bool buttons_enabled;
   gchar *evinput_device;
 
+  /**
+   * @brief Key that starts a turn without the wake word (push-to-talk), as
+   * an evdev name like `KEY_F1` or a numeric code. Null when unset.
+   */
+  gchar *buttons_talk_key;
+
+  /**
+   * @brief With `talk_mode=hold` input ends when the talk key is released.
+   * With `talk_mode=tap` VAD ends it as after the wake word, unless the key
+   * was held for at least `buttons_long_press_ms`.
+   */
+  bool buttons_talk_hold;
+
+  /**
+   * @brief Audio from before the talk key was pressed to include in the
+   * turn, taken from the wake-word buffer.
+   */
+  size_t buttons_talk_preroll_ms;
+  size_t buttons_long_press_ms;
+
+  /**
+   * @brief A second press of the talk key within this many ms of the first
+   * one being released cancels the turn and stops playback.
+   */
+  size_t buttons_double_press_ms;
+
   // Leds
   // -------------------------------------------------------------------------
 
@@ -266,6 +392,13 @@ public:
   gint leds_net_error_color;
   gint leds_disabled_effect;
   gint leds_disabled_color;
+  gint leds_volume_color;
+
+  /**
+   * @brief Frame rate of the LED renderer, which bounds how often animations
+   * write to the LED controller.
+   */
+  size_t leds_fps;
 
   // Network
   // -------------------------------------------------------------------------
@@ -274,15 +407,63 @@ public:
   gchar *net_wlan_ap_ctrl;
   gchar *net_wlan_sta_ctrl;
 
+  /**
+   * @brief Directories holding the wpa_supplicant and hostapd control
+   * sockets. When the socket for `net_wlan_if` exists it is used instead of
+   * the helper scripts.
+   */
+  gchar *net_wpa_ctrl_dir;
+  gchar *net_hostapd_ctrl_dir;
+
   // System
   // -------------------------------------------------------------------------
 
   bool dns_controller_enabled;
+
+  /**
+   * @brief Reload `config.ini` when it changes on disk, see `ConfigWatcher`.
+   */
+  bool config_watch_enabled;
+
+  /**
+   * @brief Watch link and route changes over netlink to reconnect as soon as
+   * the network comes back, and to stop retrying while it is down.
+   */
+  bool net_monitor_enabled;
+
+  /**
+   * @brief Cache host name lookups in process, see `DNSCache`. Entries are
+   * fresh for `dns_cache_ttl_s` and can be served stale, while being
+   * refreshed, for `dns_cache_stale_s` more.
+   */
+  bool dns_cache_enabled;
+  size_t dns_cache_ttl_s;
+  size_t dns_cache_stale_s;
   gchar *proxy;
   bool ssl_strict;
   gchar *ssl_ca_file;
   gchar *cache_dir;
 
+  /**
+   * @brief Warn when a single main loop iteration (all the callbacks it
+   * dispatches) runs longer than this. 0 disables the check.
+   */
+  size_t stall_budget_ms;
+
+  /**
+   * @brief Sample the process memory every `memory_interval_s` seconds (0
+   * disables it), and shed caches when it goes over `memory_soft_limit_mb`
+   * (0 for no limit). See `MemoryMonitor`.
+   */
+  size_t memory_interval_s;
+  size_t memory_soft_limit_mb;
+
+  /**
+   * @brief Sample the CPU time of each thread every `cpu_interval_s` seconds
+   * (0 disables it). See `CpuMonitor`.
+   */
+  size_t cpu_interval_s;
+
   // Voice Activity Detection (VAD)
   // -------------------------------------------------------------------------
 
@@ -295,6 +476,28 @@ public:
   // -------------------------------------------------------------------------
   int webui_port;
 
+  /**
+   * @brief Watch the webui directory and reload assets and templates when
+   * they change, and tell browsers not to cache them.
+   */
+  bool webui_dev_mode;
+
+  /**
+   * @brief How many browsers can follow the status stream at once.
+   */
+  size_t webui_status_max_subscribers;
+
+  /**
+   * @brief How many status events can be waiting to be written to one
+   * subscriber. Beyond that, updates are coalesced until it catches up.
+   */
+  size_t webui_status_queue_depth;
+
+  /**
+   * @brief How often the input level meter is pushed to subscribers.
+   */
+  size_t webui_status_level_interval_ms;
+
   void set_genie_url(const char *url) {
     char *old = genie_url;
     genie_url = g_strdup(url);
@@ -326,6 +529,14 @@ protected:
 private:
   GKeyFile *key_file = nullptr;
 
+  // Orders the writes of `save()`; the queued jobs share it, so it outlives
+  // a Config replaced by a reload.
+  struct SaveQueue {
+    std::mutex mutex;
+    std::atomic<unsigned> generation{0};
+  };
+  std::shared_ptr<SaveQueue> save_queue;
+
   int get_leds_effect_string(const char *section, const char *key,
                              const gchar *default_value);
   int get_dec_color_from_hex_string(const char *section, const char *key,
@@ -344,6 +555,7 @@ private:
                             const double max);
   bool get_bool(const char *section, const char *key, const bool default_value);
   AudioDriverType get_audio_backend();
+  void diff_groups(const Config &other, ConfigDiff &diff) const;
 };
 
 } // namespace genie
@@ -0,0 +1,85 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "config_watcher.hpp"
+#include "app.hpp"
+
+#include <memory>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::ConfigWatcher"
+
+// quiet period after the last change before the file is read again
+static const guint RELOAD_DEBOUNCE_MS = 250;
+
+genie::ConfigWatcher::ConfigWatcher(App *app)
+    : app(app), reload_timeout_id(0) {
+  auto_gobject_ptr<GFile> file(g_file_new_for_path("config.ini"),
+                               adopt_mode::owned);
+
+  GError *error = nullptr;
+  m_file_monitor = auto_gobject_ptr<GFileMonitor>(
+      g_file_monitor(file.get(), G_FILE_MONITOR_NONE, nullptr, &error),
+      adopt_mode::owned);
+  if (error) {
+    g_critical("Failed to install file monitor for the configuration: %s",
+               error->message);
+    g_error_free(error);
+    return;
+  }
+
+  g_signal_connect(m_file_monitor.get(), "changed", G_CALLBACK(on_changed),
+                   this);
+}
+
+genie::ConfigWatcher::~ConfigWatcher() {
+  if (reload_timeout_id)
+    g_source_remove(reload_timeout_id);
+  if (m_file_monitor)
+    g_object_run_dispose(G_OBJECT(m_file_monitor.get()));
+}
+
+void genie::ConfigWatcher::on_changed(GFileMonitor *monitor, GFile *file,
+                                      GFile *other_file,
+                                      GFileMonitorEvent event, gpointer data) {
+  ConfigWatcher *self = static_cast<ConfigWatcher *>(data);
+  if (event == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED ||
+      event == G_FILE_MONITOR_EVENT_DELETED)
+    return;
+
+  if (self->reload_timeout_id)
+    g_source_remove(self->reload_timeout_id);
+  self->reload_timeout_id =
+      g_timeout_add(RELOAD_DEBOUNCE_MS, on_reload_timeout, self);
+}
+
+gboolean genie::ConfigWatcher::on_reload_timeout(gpointer data) {
+  ConfigWatcher *self = static_cast<ConfigWatcher *>(data);
+  self->reload_timeout_id = 0;
+
+  // a half-saved or mistyped file would otherwise be applied as defaults,
+  // dropping the URL and the access token
+  auto config = std::make_unique<Config>();
+  if (!config->load()) {
+    g_warning("Failed to load the changed configuration, keeping the "
+              "current one");
+    return G_SOURCE_REMOVE;
+  }
+  self->app->reload_config(std::move(config));
+  return G_SOURCE_REMOVE;
+}
@@ -0,0 +1,56 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "utils/autoptrs.hpp"
+
+namespace genie {
+
+class App;
+
+/**
+ * @brief Reloads `config.ini` when it changes on disk.
+ *
+ * Editors and `g_file_set_contents()` replace the file in several steps, so
+ * events are debounced before the file is parsed into a fresh `Config`,
+ * which the app diffs against the running one. Saves of our own (from the
+ * web UI) come back as an empty diff and are dropped.
+ */
+class ConfigWatcher {
+public:
+  ConfigWatcher(App *app);
+  ~ConfigWatcher();
+
+  ConfigWatcher(const ConfigWatcher &) = delete;
+  ConfigWatcher &operator=(const ConfigWatcher &) = delete;
+
+private:
+  App *const app;
+  auto_gobject_ptr<GFileMonitor> m_file_monitor;
+  guint reload_timeout_id;
+
+  static void on_changed(GFileMonitor *monitor, GFile *file, GFile *other_file,
+                         GFileMonitorEvent event, gpointer self);
+  static gboolean on_reload_timeout(gpointer data);
+};
+
+} // namespace genie
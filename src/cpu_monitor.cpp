@@ -0,0 +1,201 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_monitor.hpp"
+#include "app.hpp"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::CpuMonitor"
+
+genie::CpuMonitor::CpuMonitor(App *app)
+    : app(app), ticks_per_s(sysconf(_SC_CLK_TCK)), pid(getpid()),
+      timeout_id(0), state_name(nullptr) {
+  schedule();
+}
+
+genie::CpuMonitor::~CpuMonitor() {
+  if (timeout_id)
+    g_source_remove(timeout_id);
+}
+
+void genie::CpuMonitor::reload_config() { schedule(); }
+
+void genie::CpuMonitor::schedule() {
+  if (timeout_id) {
+    g_source_remove(timeout_id);
+    timeout_id = 0;
+  }
+  if (app->config->cpu_interval_s == 0)
+    return;
+
+  // new baseline, the time used while disabled is not charged to any state
+  tasks.clear();
+  read_tasks(tasks);
+  last_read = interval_start = g_get_monotonic_time();
+  interval_cpu_s.clear();
+
+  timeout_id =
+      g_timeout_add_seconds(app->config->cpu_interval_s, sample_timeout, this);
+}
+
+gboolean genie::CpuMonitor::sample_timeout(gpointer data) {
+  static_cast<CpuMonitor *>(data)->publish();
+  return G_SOURCE_CONTINUE;
+}
+
+void genie::CpuMonitor::state_changed(const char *new_state) {
+  if (timeout_id)
+    accumulate();
+  state_name = new_state;
+}
+
+/**
+ * @brief Drop the instance number from a thread name, "gst:queue2-3" and
+ * "gst:queue2-4" are the same thread in two pipelines.
+ */
+std::string genie::CpuMonitor::thread_group(const char *comm) {
+  size_t len = strlen(comm);
+  while (len > 0 && g_ascii_isdigit(comm[len - 1]))
+    len--;
+  while (len > 0 && (comm[len - 1] == '-' || comm[len - 1] == '_'))
+    len--;
+  return len ? std::string(comm, len) : std::string(comm);
+}
+
+bool genie::CpuMonitor::read_tasks(std::unordered_map<pid_t, Task> &current) {
+  GDir *dir = g_dir_open("/proc/self/task", 0, nullptr);
+  if (!dir)
+    return false;
+
+  const gchar *entry;
+  while ((entry = g_dir_read_name(dir))) {
+    pid_t tid = (pid_t)g_ascii_strtoll(entry, nullptr, 10);
+    gchar *path = g_build_filename("/proc/self/task", entry, "stat", nullptr);
+    gchar *contents;
+    gboolean ok = g_file_get_contents(path, &contents, nullptr, nullptr);
+    g_free(path);
+    if (!ok) {
+      // the thread exited in the meantime
+      continue;
+    }
+
+    // "tid (comm) state ...", comm can contain spaces and parentheses
+    char *open = strchr(contents, '(');
+    char *close = strrchr(contents, ')');
+    unsigned long utime, stime;
+    if (open && close > open &&
+        sscanf(close + 1,
+               " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime,
+               &stime) == 2) {
+      *close = '\0';
+      std::string group =
+          tid == pid ? std::string("main") : thread_group(open + 1);
+      current[tid] = Task{group, (guint64)utime + stime};
+    }
+    g_free(contents);
+  }
+  g_dir_close(dir);
+  return true;
+}
+
+void genie::CpuMonitor::accumulate() {
+  std::unordered_map<pid_t, Task> current;
+  if (!read_tasks(current))
+    return;
+
+  gint64 now = g_get_monotonic_time();
+  // nothing to charge before the first state
+  StateTotals *totals = state_name ? &states[state_name] : nullptr;
+  if (totals)
+    totals->wall_s += (double)(now - last_read) / G_USEC_PER_SEC;
+
+  for (const auto &it : current) {
+    auto previous = tasks.find(it.first);
+    // threads started since the last read count from zero
+    guint64 before = previous != tasks.end() ? previous->second.ticks : 0;
+    if (it.second.ticks <= before)
+      continue;
+    double cpu_s = (double)(it.second.ticks - before) / ticks_per_s;
+    interval_cpu_s[it.second.group] += cpu_s;
+    if (totals)
+      totals->cpu_s[it.second.group] += cpu_s;
+  }
+
+  // threads that exited since the last read drop out here, with the time
+  // they used in their last moments
+  tasks.swap(current);
+  last_read = now;
+}
+
+static std::vector<genie::CpuStats::Group>
+to_percent(const std::map<std::string, double> &cpu_s, double wall_s,
+           double *total_percent) {
+  std::vector<genie::CpuStats::Group> groups;
+  *total_percent = 0;
+  if (wall_s <= 0)
+    return groups;
+
+  for (const auto &it : cpu_s) {
+    double percent = it.second / wall_s * 100;
+    *total_percent += percent;
+    groups.push_back(genie::CpuStats::Group{it.first, percent});
+  }
+  std::sort(groups.begin(), groups.end(),
+            [](const genie::CpuStats::Group &a,
+               const genie::CpuStats::Group &b) {
+              return a.percent > b.percent;
+            });
+  return groups;
+}
+
+void genie::CpuMonitor::publish() {
+  accumulate();
+
+  CpuStats stats;
+  stats.interval_s = (double)(last_read - interval_start) / G_USEC_PER_SEC;
+  stats.groups =
+      to_percent(interval_cpu_s, stats.interval_s, &stats.total_percent);
+  for (const auto &it : states) {
+    CpuStats::State state;
+    state.name = it.first;
+    state.wall_s = it.second.wall_s;
+    state.groups =
+        to_percent(it.second.cpu_s, it.second.wall_s, &state.total_percent);
+    stats.states.push_back(std::move(state));
+  }
+
+  std::string busiest;
+  for (size_t i = 0; i < stats.groups.size() && i < 3; i++) {
+    gchar *entry = g_strdup_printf("%s%s %.1f%%", i ? ", " : "",
+                                   stats.groups[i].name.c_str(),
+                                   stats.groups[i].percent);
+    busiest += entry;
+    g_free(entry);
+  }
+  GENIE_DEBUG("CPU: %.1f%% over %.1f s; %s", stats.total_percent,
+              stats.interval_s, busiest.c_str());
+
+  interval_cpu_s.clear();
+  interval_start = last_read;
+  app->track_cpu(stats);
+}
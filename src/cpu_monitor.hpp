@@ -0,0 +1,116 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <glib.h>
+#include <map>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+namespace genie {
+
+class App;
+
+/**
+ * @brief CPU use by thread group, in % of one core.
+ */
+struct CpuStats {
+  struct Group {
+    std::string name;
+    double percent;
+  };
+
+  struct State {
+    std::string name;
+    // time spent in the state since startup
+    double wall_s;
+    double total_percent;
+    std::vector<Group> groups;
+  };
+
+  // over the last interval
+  double interval_s = 0;
+  double total_percent = 0;
+  std::vector<Group> groups;
+
+  // since startup, by app state
+  std::vector<State> states;
+};
+
+/**
+ * @brief Samples the CPU time of every thread of the process from
+ * /proc/self/task every `cpu_interval_s` seconds, and publishes the rates
+ * through the app.
+ *
+ * Threads are grouped by name with the trailing digits removed (so all the
+ * worker threads, or the souphttpsrc threads of successive pipelines, add
+ * up), and the main thread is reported as "main". CPU time is also charged
+ * to the app state that was current when it was used, sampling again on
+ * every transition, to compare Sleeping against Listening or Saying.
+ */
+class CpuMonitor {
+public:
+  CpuMonitor(App *app);
+  ~CpuMonitor();
+
+  CpuMonitor(const CpuMonitor &) = delete;
+  CpuMonitor &operator=(const CpuMonitor &) = delete;
+
+  void reload_config();
+
+  /**
+   * @brief Charge the CPU used so far to the state being left.
+   */
+  void state_changed(const char *state_name);
+
+private:
+  struct Task {
+    std::string group;
+    guint64 ticks;
+  };
+
+  struct StateTotals {
+    double wall_s = 0;
+    std::map<std::string, double> cpu_s;
+  };
+
+  App *const app;
+  const long ticks_per_s;
+  const pid_t pid;
+  guint timeout_id;
+
+  std::unordered_map<pid_t, Task> tasks;
+  gint64 last_read;
+  const char *state_name;
+  std::map<std::string, StateTotals> states;
+
+  std::map<std::string, double> interval_cpu_s;
+  gint64 interval_start;
+
+  static gboolean sample_timeout(gpointer data);
+  static std::string thread_group(const char *comm);
+  bool read_tasks(std::unordered_map<pid_t, Task> &current);
+  void schedule();
+  void accumulate();
+  void publish();
+};
+
+} // namespace genie
@@ -17,13 +17,15 @@
 // limitations under the License.
 
 #include "dns_controller.hpp"
+#include "utils/worker-pool.hpp"
 
 #include <cstdio>
 #include <memory>
 #include <sstream>
 
-genie::DNSController::DNSController(const char *dns_server)
-    : dns_server(dns_server) {
+genie::DNSController::DNSController(WorkerPool *pool, const char *dns_server)
+    : pool(pool), dns_server(dns_server), update_in_flight(false),
+      update_pending(false) {
   g_debug("Initializing DNS controller...");
 
   update_dns_config();
@@ -58,7 +60,31 @@ void genie::DNSController::on_changed(GFileMonitor *monitor, GFile *file,
   self->update_dns_config();
 }
 
+/**
+ * @brief Queue a rewrite of the DNS configuration on the worker pool.
+ *
+ * Only one rewrite runs at a time; changes observed meanwhile (including
+ * the one caused by our own write) trigger a single follow-up pass.
+ */
 void genie::DNSController::update_dns_config() {
+  if (update_in_flight) {
+    update_pending = true;
+    return;
+  }
+
+  update_in_flight = true;
+  std::string server(dns_server);
+  pool->run([server]() { rewrite_resolv_conf(server); },
+            [this]() {
+              update_in_flight = false;
+              if (update_pending) {
+                update_pending = false;
+                update_dns_config();
+              }
+            });
+}
+
+void genie::DNSController::rewrite_resolv_conf(const std::string &dns_server) {
   g_debug("Updating DNS configuration...");
 
   char *contents;
@@ -26,17 +26,23 @@
 
 namespace genie {
 
+class WorkerPool;
+
 class DNSController {
 private:
+  WorkerPool *const pool;
   auto_gobject_ptr<GFileMonitor> m_file_monitor;
   std::string dns_server;
+  bool update_in_flight;
+  bool update_pending;
 
   static void on_changed(GFileMonitor *monitor, GFile *file, GFile *other_file,
                          GFileMonitorEvent event, gpointer self);
+  static void rewrite_resolv_conf(const std::string &dns_server);
   void update_dns_config();
 
 public:
-  DNSController(const char *dns_server);
+  DNSController(WorkerPool *pool, const char *dns_server);
   ~DNSController();
 
   DNSController(const DNSController &) = delete;
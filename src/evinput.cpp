@@ -23,11 +23,23 @@
 #include <glib.h>
 #include <linux/input.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
-genie::EVInput::EVInput(App *app) : app(app) {}
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::EVInput"
+
+// before Linux 4.16 the timestamp was only reachable as a struct timeval
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+genie::EVInput::EVInput(App *app)
+    : app(app), talk_key(-1), talk_down_at(0), talk_tap_up_at(0),
+      talk_cancelled(false) {}
 
 genie::EVInput::~EVInput() { g_source_unref(source); }
 
@@ -57,18 +69,22 @@ gboolean genie::EVInput::event_dispatch(GSource *g_source, GSourceFunc callback,
               libevdev_event_type_get_name(ev.type), ev.code,
               libevdev_event_code_get_name(ev.type, ev.code), ev.value);
       // Dispatch key events
-      if (ev.type == EV_KEY && ev.value == 0) {
+      if (ev.type == EV_KEY && ev.code == ev_input->talk_key) {
+        ev_input->handle_talk_key(ev);
+      } else if (ev.type == EV_KEY &&
+                 (ev.code == KEY_VOLUMEUP || ev.code == KEY_VOLUMEDOWN)) {
+        // step on press and on auto-repeat while held, the volume
+        // controller coalesces the bursts
+        if (ev.value != 0) {
+          ev_input->app->dispatch(new state::events::AdjustVolume(
+              ev.code == KEY_VOLUMEUP ? 1 : -1, ev.value == 2));
+        }
+      } else if (ev.type == EV_KEY && ev.value == 0) {
         // For key constant names/values see:
         //
         // https://github.com/torvalds/linux/blob/master/include/uapi/linux/input-event-codes.h
         //
         switch (ev.code) {
-          case KEY_VOLUMEUP:
-            ev_input->app->dispatch(new state::events::AdjustVolume(1));
-            break;
-          case KEY_VOLUMEDOWN:
-            ev_input->app->dispatch(new state::events::AdjustVolume(-1));
-            break;
           case KEY_MUTE:
             ev_input->app->dispatch(new state::events::ToggleDisabled());
             break;
@@ -92,6 +108,50 @@ gboolean genie::EVInput::event_dispatch(GSource *g_source, GSourceFunc callback,
   return callback(user_data);
 }
 
+/**
+ * @brief Turn presses of the push-to-talk key into TalkPressed and
+ * TalkReleased events, recognizing long presses and double presses.
+ *
+ * Gestures are timed with the timestamps of the input events, so they do
+ * not depend on how quickly the main loop gets to read them.
+ */
+void genie::EVInput::handle_talk_key(const input_event &ev) {
+  gint64 time =
+      (gint64)ev.input_event_sec * G_USEC_PER_SEC + ev.input_event_usec;
+
+  if (ev.value == 1) {
+    if (talk_tap_up_at &&
+        time - talk_tap_up_at <
+            (gint64)app->config->buttons_double_press_ms * 1000) {
+      g_message("Talk key double press, cancelling");
+      talk_tap_up_at = 0;
+      talk_cancelled = true;
+      app->dispatch(new state::events::TalkReleased(true));
+      app->dispatch(new state::events::Panic());
+      return;
+    }
+    talk_down_at = time;
+    talk_cancelled = false;
+    app->dispatch(new state::events::TalkPressed());
+  } else if (ev.value == 0) {
+    if (talk_cancelled) {
+      // the second press of a double press
+      talk_cancelled = false;
+      return;
+    }
+    gint64 held = time - talk_down_at;
+    bool long_press =
+        held >= (gint64)app->config->buttons_long_press_ms * 1000;
+    // only a short tap can be the first half of a double press
+    talk_tap_up_at = long_press ? 0 : time;
+    g_message("Talk key released after %.0f ms%s", held / 1000.0,
+              long_press ? " (long press)" : "");
+    app->dispatch(new state::events::TalkReleased(
+        app->config->buttons_talk_hold || long_press));
+  }
+  // value 2 is auto-repeat while the key is held
+}
+
 gboolean genie::EVInput::callback(gpointer user_data) {
   return G_SOURCE_CONTINUE;
 }
@@ -102,6 +162,23 @@ int genie::EVInput::init() {
 
   int fd, rc = 1;
 
+  const char *talk_key_name = app->config->buttons_talk_key;
+  if (talk_key_name) {
+    talk_key = libevdev_event_code_from_name(EV_KEY, talk_key_name);
+    if (talk_key < 0) {
+      char *end;
+      long code = strtol(talk_key_name, &end, 0);
+      if (*end == '\0' && code > 0 && code <= KEY_MAX)
+        talk_key = (int)code;
+    }
+    if (talk_key < 0) {
+      g_warning("Unknown push-to-talk key %s", talk_key_name);
+    } else {
+      g_message("Push-to-talk on key %d, %s mode", talk_key,
+                app->config->buttons_talk_hold ? "hold" : "tap");
+    }
+  }
+
   source = g_source_new(&event_funcs, sizeof(InputEventSource));
   InputEventSource *event_source = (InputEventSource *)source;
 
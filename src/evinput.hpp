@@ -38,6 +38,15 @@ public:
 
 private:
   App *app;
+
+  // push-to-talk key code, or -1; times are from the kernel's event
+  // timestamps, in µs
+  int talk_key;
+  gint64 talk_down_at;
+  gint64 talk_tap_up_at;
+  bool talk_cancelled;
+
+  void handle_talk_key(const input_event &ev);
   static gboolean event_prepare(GSource *source, gint *timeout);
   static gboolean event_check(GSource *source);
   static gboolean event_dispatch(GSource *g_source, GSourceFunc callback,
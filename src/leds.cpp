@@ -17,6 +17,8 @@
 // limitations under the License.
 
 #include "leds.hpp"
+#include "utils/threads.hpp"
+#include <errno.h>
 #include <fcntl.h>
 #include <glib-unix.h>
 #include <glib.h>
@@ -24,25 +26,62 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::Leds"
+
+// one LED moves every step of the circular animation
+static const gint64 CIRCULAR_STEP_US = 100 * 1000;
+// one full pulse (dark -> bright -> dark) per this many ms per brightness
+// level, so the ramp speed matches the controller's range
+static const gint64 PULSE_PERIOD_US_PER_LEVEL = 10 * 1000;
+// how long the volume level stays visible after a change
+static const gint64 VOLUME_OVERLAY_US = 1500 * 1000;
+// interval of the write rate report
+static const gint64 STATS_INTERVAL_US = 60 * G_USEC_PER_SEC;
 
 genie::Leds::Leds(App *appInstance) {
   app = appInstance;
   initialized = false;
-  update_timer_circular = false;
-  update_timer_pulse = false;
   ctrl_path_base = nullptr;
   ctrl_path_all = nullptr;
   ctrl_path_brightness = nullptr;
-  leds = nullptr;
+  fd_all = -1;
+  fd_brightness = -1;
+  current_state = LedsState_t::Starting;
+  render_stop = false;
+  render_dirty = false;
+  color_step_us = 0;
+  pulsing = false;
+  animation_start = 0;
+  overlay_until = 0;
+  last_brightness = -1;
+  write_count = 0;
 }
 
 genie::Leds::~Leds() {
+  if (render_thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(render_mutex);
+      render_stop = true;
+    }
+    render_cond.notify_one();
+    render_thread.join();
+  }
   if (initialized) {
     set_user(false);
   }
-  free(ctrl_path_all);
-  free(ctrl_path_brightness);
-  free(leds);
+  if (fd_all >= 0)
+    close(fd_all);
+  if (fd_brightness >= 0)
+    close(fd_brightness);
+  g_free(ctrl_path_all);
+  g_free(ctrl_path_brightness);
+  g_free(ctrl_path_base);
 }
 
 int genie::Leds::init() {
@@ -51,7 +90,7 @@ int genie::Leds::init() {
 
   if (strcmp(app->config->leds_type, "aw") == 0) {
     led_count = 12;
-    ctrl_path_base = app->config->leds_path;
+    ctrl_path_base = g_strdup(app->config->leds_path);
     ctrl_path_brightness = g_strdup_printf("%s/brightness", ctrl_path_base);
     ctrl_path_all = g_strdup_printf("%s/set_all_led_color", ctrl_path_base);
   } else {
@@ -59,22 +98,47 @@ int genie::Leds::init() {
     return false;
   }
 
-  leds = (int *)malloc(led_count * sizeof(int));
+  fd_all = open(ctrl_path_all, O_WRONLY);
+  fd_brightness = open(ctrl_path_brightness, O_WRONLY);
+  if (fd_all < 0 || fd_brightness < 0) {
+    g_warning("Failed to open LED controls in %s", ctrl_path_base);
+    return false;
+  }
 
   max_brightness = get_brightness_internal(true);
   brightness = get_brightness_internal(false);
+  frame_us = G_USEC_PER_SEC / app->config->leds_fps;
+  build_pulse_table();
 
-  base_color = 0;
   animate_internal(LedsAnimation_t::None);
-  if (set_user(true)) {
-    initialized = true;
-    return true;
+  if (!set_user(true)) {
+    return false;
   }
 
-  return false;
+  initialized = true;
+  render_thread = std::thread(&Leds::render_loop, this);
+  return true;
+}
+
+/**
+ * @brief Precompute the brightness of each frame of a pulse (a triangle
+ * wave from 0 to `max_brightness` and back).
+ */
+void genie::Leds::build_pulse_table() {
+  gint64 period_us = std::max<gint64>(max_brightness, 1) *
+                     PULSE_PERIOD_US_PER_LEVEL;
+  size_t frames = std::max<gint64>(period_us / frame_us, 2);
+
+  pulse_table.resize(frames);
+  for (size_t i = 0; i < frames; i++) {
+    double phase = (double)i / frames;
+    double level = phase < 0.5 ? phase * 2 : (1 - phase) * 2;
+    pulse_table[i] = (int)(level * max_brightness + 0.5);
+  }
 }
 
 void genie::Leds::animate(LedsState_t state) {
+  current_state = state;
   if (!app->config->leds_enabled || !initialized)
     return;
 
@@ -127,174 +191,205 @@ void genie::Leds::animate(LedsState_t state) {
   }
 }
 
-void genie::Leds::animate_internal(LedsAnimation_t style, int color,
-                                   int duration) {
+void genie::Leds::refresh() { animate(current_state); }
+
+/**
+ * @brief Show `volume` (0-100) as the number of lit LEDs, on top of the
+ * current animation, for a short while.
+ */
+void genie::Leds::show_volume(int volume) {
+  if (!initialized)
+    return;
+
+  int lit = (volume * led_count + 50) / 100;
+  {
+    std::lock_guard<std::mutex> lock(render_mutex);
+    overlay.assign(led_count, -1);
+    for (int i = 0; i < lit; i++)
+      overlay[i] = app->config->leds_volume_color;
+    overlay_until = g_get_monotonic_time() + VOLUME_OVERLAY_US;
+    render_dirty = true;
+  }
+  render_cond.notify_one();
+}
+
+void genie::Leds::animate_internal(LedsAnimation_t style, int color) {
+  std::vector<std::vector<int>> frames;
+  gint64 step_us = 0;
+  bool pulse = false;
+
   switch (style) {
     case LedsAnimation_t::None:
-      solid(0);
+      frames.emplace_back(led_count, 0);
       break;
     case LedsAnimation_t::Solid:
-      solid(color);
+      frames.emplace_back(led_count, color);
       break;
     case LedsAnimation_t::Circular:
-      circular(color);
+      // one lit LED sweeping around a dark ring
+      for (int i = 0; i < led_count; i++) {
+        frames.emplace_back(led_count, 0);
+        frames.back()[i] = color;
+      }
+      step_us = std::max(CIRCULAR_STEP_US, frame_us);
       break;
     case LedsAnimation_t::Pulse:
-      solid(color);
-      pulse();
+      frames.emplace_back(led_count, color);
+      pulse = true;
       break;
   }
-}
-
-bool genie::Leds::set_user(bool enabled) {
-  char path[256];
-  snprintf(path, sizeof(path) - 1, "%s/user_space", ctrl_path_base);
-  int fd = open(path, O_WRONLY);
-  if (fd > 0) {
-    write(fd, enabled ? "1" : "0", 1);
-  } else {
-    return false;
-  }
-  close(fd);
-  return true;
-}
-
-bool genie::Leds::set_brightness(int level) {
-  if (level > max_brightness)
-    return false;
-
-  char buffer[16];
-  snprintf(buffer, sizeof(buffer) - 1, "%d", level);
-  int fd = open(ctrl_path_brightness, O_WRONLY);
-  if (fd > 0) {
-    write(fd, buffer, strlen(buffer));
-  } else {
-    return false;
-  }
-  close(fd);
-  return true;
-}
-
-int genie::Leds::get_brightness_internal(bool max = false) {
-  char path[256], buffer[64];
-  snprintf(path, sizeof(path) - 1, "%s/%sbrightness", ctrl_path_base,
-           max ? "max_" : "");
-  int fd = open(path, O_RDONLY);
-  if (fd > 0) {
-    read(fd, buffer, sizeof(buffer) - 1);
-  } else {
-    return false;
-  }
-  close(fd);
-  int result = -1;
-  sscanf(buffer, "%d", &result);
-  return result;
-}
-
-void genie::Leds::solid(int color) {
-  if (update_timer_circular) {
-    update_timer_circular = false;
-    usleep(100);
-  }
-  clear(color);
-  set_leds();
-}
 
-void genie::Leds::clear(int color) {
-  for (int i = 0; i < led_count; i++) {
-    leds[i] = color;
+  std::vector<std::string> strings;
+  for (const auto &frame : frames)
+    strings.push_back(format_colors(frame));
+
+  {
+    std::lock_guard<std::mutex> lock(render_mutex);
+    color_frames.swap(frames);
+    color_strings.swap(strings);
+    color_step_us = step_us;
+    pulsing = pulse;
+    animation_start = g_get_monotonic_time();
+    render_dirty = true;
   }
+  render_cond.notify_one();
 }
 
-bool genie::Leds::set_leds() {
+std::string genie::Leds::format_colors(const std::vector<int> &colors) {
   char buffer[128];
   for (int i = 0, j = 0; i < led_count; i++) {
-    j += snprintf(buffer + j, sizeof(buffer) - j, "%d ", leds[i]);
-  }
-  int fd = open(ctrl_path_all, O_WRONLY);
-  if (fd > 0) {
-    write(fd, buffer, strlen(buffer));
-    // g_debug("write-set-leds %s\n", buffer);
-  } else {
-    return false;
+    j += snprintf(buffer + j, sizeof(buffer) - j, "%d ", colors[i]);
   }
-  close(fd);
-  return true;
+  return std::string(buffer);
 }
 
-gboolean genie::Leds::update_circular(gpointer data) {
-  Leds *obj = (Leds *)data;
+void genie::Leds::render_loop() {
+  set_thread_name("genie:leds");
 
-  if (!obj->update_timer_circular)
-    return false;
+  gint64 stats_start = g_get_monotonic_time();
+  guint64 stats_writes = write_count;
 
-  obj->leds[obj->step_circular] = obj->base_color;
-  obj->step_circular++;
-  if (obj->step_circular == obj->led_count) {
-    obj->step_circular = 0;
-  }
-  obj->leds[obj->step_circular] = obj->color_circular;
+  std::unique_lock<std::mutex> lock(render_mutex);
+  while (!render_stop) {
+    gint64 now = g_get_monotonic_time();
+    gint64 next = G_MAXINT64;
 
-  obj->set_leds();
+    size_t index = 0;
+    if (color_step_us > 0 && color_frames.size() > 1) {
+      gint64 step = (now - animation_start) / color_step_us;
+      index = step % color_frames.size();
+      next = std::min(next, animation_start + (step + 1) * color_step_us);
+    }
 
-  return obj->update_timer_circular;
-}
+    std::string colors;
+    bool overlay_active = overlay_until > now;
+    if (overlay_active) {
+      std::vector<int> composite(color_frames[index]);
+      for (int i = 0; i < led_count; i++) {
+        if (overlay[i] >= 0)
+          composite[i] = overlay[i];
+      }
+      colors = format_colors(composite);
+      next = std::min(next, overlay_until);
+    } else {
+      colors = color_strings[index];
+    }
 
-gboolean genie::Leds::update_pulse(gpointer data) {
-  Leds *obj = (Leds *)data;
+    int level = brightness;
+    if (pulsing && !overlay_active) {
+      gint64 step = (now - animation_start) / frame_us;
+      level = pulse_table[step % pulse_table.size()];
+      next = std::min(next, animation_start + (step + 1) * frame_us);
+    }
 
-  if (!obj->update_timer_pulse) {
-    obj->set_brightness(obj->brightness);
-    return false;
-  }
+    lock.unlock();
+    write_colors(colors);
+    write_brightness(level);
+
+    if (now - stats_start >= STATS_INTERVAL_US) {
+      guint64 writes = write_count;
+      if (writes > stats_writes) {
+        g_debug("%.1f writes/s over the last %" G_GINT64_FORMAT " s",
+                (writes - stats_writes) * (double)G_USEC_PER_SEC /
+                    (now - stats_start),
+                (now - stats_start) / G_USEC_PER_SEC);
+      }
+      stats_start = now;
+      stats_writes = writes;
+    }
+    lock.lock();
 
-  if (obj->bright_direction) {
-    if (obj->step_bright < obj->max_brightness) {
-      obj->step_bright += 10;
-    } else {
-      obj->step_bright = obj->max_brightness;
-      obj->bright_direction = 0;
+    if (render_stop)
+      break;
+    if (render_dirty) {
+      render_dirty = false;
+      continue;
     }
-  } else {
-    if (obj->step_bright > 0) {
-      obj->step_bright -= 10;
+
+    auto woken = [this] { return render_dirty || render_stop; };
+    if (next == G_MAXINT64) {
+      // static frame, sleep until something changes
+      render_cond.wait(lock, woken);
     } else {
-      obj->step_bright = 0;
-      obj->bright_direction = 1;
+      gint64 wait_us = next - g_get_monotonic_time();
+      if (wait_us > 0)
+        render_cond.wait_for(lock, std::chrono::microseconds(wait_us), woken);
     }
+    render_dirty = false;
   }
-  obj->set_brightness(obj->step_bright);
-
-  return obj->update_timer_pulse;
 }
 
-void genie::Leds::circular(int color) {
-  if (update_timer_circular) {
-    color_circular = color;
+void genie::Leds::write_colors(const std::string &colors) {
+  if (colors == last_colors)
+    return;
+  if (pwrite(fd_all, colors.data(), colors.size(), 0) < 0) {
+    g_warning("Failed to write LED colors: %s", g_strerror(errno));
     return;
   }
-  if (update_timer_pulse) {
-    update_timer_pulse = false;
-    clear(base_color);
-  }
-
-  step_circular = 0;
-  color_circular = color;
-  update_timer_circular = true;
-  g_timeout_add(100, update_circular, this);
+  last_colors = colors;
+  write_count++;
 }
 
-void genie::Leds::pulse() {
-  if (update_timer_pulse)
+void genie::Leds::write_brightness(int level) {
+  if (level == last_brightness || level > max_brightness)
+    return;
+
+  char buffer[16];
+  int length = snprintf(buffer, sizeof(buffer), "%d", level);
+  if (pwrite(fd_brightness, buffer, length, 0) < 0) {
+    g_warning("Failed to write LED brightness: %s", g_strerror(errno));
     return;
-  if (update_timer_circular) {
-    update_timer_circular = false;
-    usleep(100);
   }
+  last_brightness = level;
+  write_count++;
+}
 
-  step_bright = brightness;
-  bright_direction = true;
-  set_brightness(0);
-  update_timer_pulse = true;
-  g_timeout_add(50, update_pulse, this);
+bool genie::Leds::set_user(bool enabled) {
+  char path[256];
+  snprintf(path, sizeof(path) - 1, "%s/user_space", ctrl_path_base);
+  int fd = open(path, O_WRONLY);
+  if (fd > 0) {
+    write(fd, enabled ? "1" : "0", 1);
+  } else {
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+int genie::Leds::get_brightness_internal(bool max = false) {
+  char path[256], buffer[64];
+  snprintf(path, sizeof(path) - 1, "%s/%sbrightness", ctrl_path_base,
+           max ? "max_" : "");
+  int fd = open(path, O_RDONLY);
+  if (fd > 0) {
+    ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+    buffer[length > 0 ? length : 0] = '\0';
+  } else {
+    return false;
+  }
+  close(fd);
+  int result = -1;
+  sscanf(buffer, "%d", &result);
+  return result;
 }
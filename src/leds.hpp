@@ -19,6 +19,12 @@
 #pragma once
 
 #include "app.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace genie {
 
@@ -36,6 +42,15 @@ enum class LedsState_t {
 
 enum class LedsAnimation_t { None, Solid, Circular, Pulse };
 
+/**
+ * @brief LED ring driver.
+ *
+ * Animations are turned into frame tables when they start; a renderer thread
+ * then steps through them at up to `leds_fps` and writes to the controller's
+ * sysfs files (kept open) only when the output actually changes. A
+ * short-lived overlay (the volume level) is composited on top of the current
+ * animation.
+ */
 class Leds {
 public:
   Leds(App *appInstance);
@@ -43,21 +58,24 @@ public:
   int init();
 
   void animate(enum LedsState_t state);
+  void show_volume(int volume);
+
+  /**
+   * @brief Run the current animation again with the colors and effects of
+   * a changed configuration.
+   */
+  void refresh();
 
 protected:
-  void animate_internal(LedsAnimation_t style, int color = 0, int duration = 0);
+  void animate_internal(LedsAnimation_t style, int color = 0);
   bool set_user(bool enabled);
   int get_brightness_internal(bool max);
-  bool set_brightness(int level);
-  bool set_leds();
-
-  void clear(int color = 0);
-  void solid(int color);
-  void circular(int color);
-  void pulse();
+  void build_pulse_table();
 
-  static gboolean update_circular(gpointer data);
-  static gboolean update_pulse(gpointer data);
+  void render_loop();
+  void write_colors(const std::string &colors);
+  void write_brightness(int level);
+  std::string format_colors(const std::vector<int> &colors);
 
 private:
   bool initialized;
@@ -65,20 +83,40 @@ private:
   gchar *ctrl_path_base;
   gchar *ctrl_path_brightness;
   gchar *ctrl_path_all;
-  int *leds;
+  int fd_all;
+  int fd_brightness;
   int led_count;
   int max_brightness;
-
-  int base_color;
   int brightness;
+  gint64 frame_us;
+
+  // brightness levels for one pulse period, one entry per frame
+  std::vector<int> pulse_table;
+
+  // renderer state, protected by render_mutex
+  std::mutex render_mutex;
+  std::condition_variable render_cond;
+  std::thread render_thread;
+  bool render_stop;
+  bool render_dirty;
+
+  // the current animation: color frames stepped every `color_step_us`,
+  // optionally pulsing the brightness
+  std::vector<std::vector<int>> color_frames;
+  std::vector<std::string> color_strings;
+  gint64 color_step_us;
+  bool pulsing;
+  gint64 animation_start;
 
-  int step_circular;
-  int color_circular;
-  bool update_timer_circular;
+  // overlay composited on top of the animation until `overlay_until`;
+  // negative entries are transparent
+  std::vector<int> overlay;
+  gint64 overlay_until;
 
-  int step_bright;
-  int bright_direction;
-  bool update_timer_pulse;
+  // only accessed from the renderer thread
+  std::string last_colors;
+  int last_brightness;
+  std::atomic<guint64> write_count;
 };
 
 } // namespace genie
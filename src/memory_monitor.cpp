@@ -0,0 +1,159 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "memory_monitor.hpp"
+#include "app.hpp"
+
+#include <algorithm>
+#include <string.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::MemoryMonitor"
+
+genie::MemoryMonitor::MemoryMonitor(App *app)
+    : app(app), timeout_id(0), last_shed(0), sheds(0) {
+  schedule();
+}
+
+genie::MemoryMonitor::~MemoryMonitor() {
+  if (timeout_id)
+    g_source_remove(timeout_id);
+}
+
+void genie::MemoryMonitor::reload_config() { schedule(); }
+
+void genie::MemoryMonitor::schedule() {
+  if (timeout_id) {
+    g_source_remove(timeout_id);
+    timeout_id = 0;
+  }
+  if (app->config->memory_interval_s == 0)
+    return;
+
+  timeout_id = g_timeout_add_seconds(app->config->memory_interval_s,
+                                     sample_timeout, this);
+  // first sample right away, for the web UI
+  sample();
+}
+
+gboolean genie::MemoryMonitor::sample_timeout(gpointer data) {
+  static_cast<MemoryMonitor *>(data)->sample();
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * @brief Read a "Key:   1234 kB" line from a /proc file.
+ */
+static size_t proc_value_kb(const char *contents, const char *key) {
+  const char *line = strstr(contents, key);
+  if (!line)
+    return 0;
+  return (size_t)g_ascii_strtoull(line + strlen(key), nullptr, 10);
+}
+
+bool genie::MemoryMonitor::read_proc(MemoryStats &stats) {
+  gchar *contents;
+  if (!g_file_get_contents("/proc/self/status", &contents, nullptr, nullptr))
+    return false;
+  stats.rss_kb = proc_value_kb(contents, "\nVmRSS:");
+  stats.hwm_kb = proc_value_kb(contents, "\nVmHWM:");
+  g_free(contents);
+
+  // PSS splits shared pages between the processes mapping them, it is the
+  // fair share next to spotifyd and GStreamer plugins; needs Linux 4.14
+  if (g_file_get_contents("/proc/self/smaps_rollup", &contents, nullptr,
+                          nullptr)) {
+    stats.pss_kb = proc_value_kb(contents, "\nPss:");
+    g_free(contents);
+  }
+  return true;
+}
+
+std::string genie::MemoryMonitor::format_accounts(const MemoryReport &accounts) {
+  MemoryReport sorted(accounts);
+  std::sort(sorted.begin(), sorted.end(),
+            [](const MemoryAccount &a, const MemoryAccount &b) {
+              return a.bytes > b.bytes;
+            });
+
+  std::string result;
+  for (const auto &account : sorted) {
+    if (!result.empty())
+      result += ", ";
+    gchar *entry = g_strdup_printf("%s %zu KB (%zu)", account.name,
+                                   account.bytes / 1024, account.items);
+    result += entry;
+    g_free(entry);
+  }
+  return result;
+}
+
+void genie::MemoryMonitor::sample() {
+  MemoryStats stats;
+  if (!read_proc(stats)) {
+    g_warning("Failed to read /proc/self/status, memory monitor disabled");
+    g_source_remove(timeout_id);
+    timeout_id = 0;
+    return;
+  }
+  stats.accounts = app->report_memory();
+  stats.soft_limit_kb = app->config->memory_soft_limit_mb * 1024;
+
+  GENIE_DEBUG("Memory: RSS %zu KB, PSS %zu KB; %s", stats.rss_kb,
+              stats.pss_kb, format_accounts(stats.accounts).c_str());
+
+  if (stats.soft_limit_kb && stats.used_kb() > stats.soft_limit_kb &&
+      (!last_shed ||
+       g_get_monotonic_time() - last_shed >= SHED_INTERVAL_S * G_USEC_PER_SEC))
+    shed(stats);
+
+  stats.sheds = sheds;
+  app->track_memory(stats);
+}
+
+void genie::MemoryMonitor::shed(MemoryStats &stats) {
+  g_warning("Memory use of %zu KB is over the soft limit of %zu KB "
+            "(RSS %zu KB, peak %zu KB), shedding caches. Accounted: %s",
+            stats.used_kb(), stats.soft_limit_kb, stats.rss_kb, stats.hwm_kb,
+            format_accounts(stats.accounts).c_str());
+
+  size_t before_kb = stats.used_kb();
+  app->shed_memory();
+#ifdef __GLIBC__
+  // hand the freed heap back, otherwise RSS does not go down
+  malloc_trim(0);
+#endif
+
+  last_shed = g_get_monotonic_time();
+  sheds++;
+
+  MemoryStats after;
+  if (read_proc(after)) {
+    stats.rss_kb = after.rss_kb;
+    stats.pss_kb = after.pss_kb;
+    stats.accounts = app->report_memory();
+  }
+  g_message("Shedding released %zd KB, now at %zu KB",
+            (gssize)before_kb - (gssize)stats.used_kb(), stats.used_kb());
+  if (stats.used_kb() > stats.soft_limit_kb) {
+    g_warning("Still over the memory soft limit after shedding");
+  }
+}
@@ -0,0 +1,86 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "utils/memory.hpp"
+#include <glib.h>
+#include <string>
+
+namespace genie {
+
+class App;
+
+/**
+ * @brief A sample of the process memory use and of what the components
+ * account for.
+ */
+struct MemoryStats {
+  // from /proc/self/status and /proc/self/smaps_rollup; 0 when unavailable
+  size_t rss_kb = 0;
+  size_t hwm_kb = 0;
+  size_t pss_kb = 0;
+  size_t soft_limit_kb = 0;
+  size_t sheds = 0;
+  MemoryReport accounts;
+
+  // PSS when the kernel reports it, RSS otherwise
+  size_t used_kb() const { return pss_kb ? pss_kb : rss_kb; }
+};
+
+/**
+ * @brief Samples the process RSS/PSS and the per-component accounting every
+ * `memory_interval_s` seconds, and publishes them through the app.
+ *
+ * When the process goes over `memory_soft_limit_mb`, the components drop
+ * what they can rebuild (caches, paused streams) and freed heap is returned
+ * to the kernel, before the OOM killer has to pick a victim. Shedding runs
+ * at most once per `SHED_INTERVAL_S`, the breakdown is logged each time so
+ * the component that grew can be found afterwards.
+ */
+class MemoryMonitor {
+public:
+  static const gint64 SHED_INTERVAL_S = 60;
+
+  MemoryMonitor(App *app);
+  ~MemoryMonitor();
+
+  MemoryMonitor(const MemoryMonitor &) = delete;
+  MemoryMonitor &operator=(const MemoryMonitor &) = delete;
+
+  /**
+   * @brief Pick up a new `memory_interval_s`; the soft limit is read on
+   * every sample.
+   */
+  void reload_config();
+
+private:
+  App *const app;
+  guint timeout_id;
+  gint64 last_shed;
+  size_t sheds;
+
+  static gboolean sample_timeout(gpointer data);
+  static bool read_proc(MemoryStats &stats);
+  static std::string format_accounts(const MemoryReport &accounts);
+  void schedule();
+  void sample();
+  void shed(MemoryStats &stats);
+};
+
+} // namespace genie
@@ -0,0 +1,253 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "net_monitor.hpp"
+#include "app.hpp"
+
+#include <errno.h>
+#include <glib-unix.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::NetMonitor"
+
+genie::NetMonitor::NetMonitor(App *app)
+    : app(app), fd(-1), port_id(0), watch_id(0), dump_seq(0), dump_in_flight(false),
+      dump_pending(false), dump_saw_default(false), default_route(true) {
+  fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+              NETLINK_ROUTE);
+  if (fd < 0) {
+    g_warning("Failed to open netlink socket: %s", strerror(errno));
+    return;
+  }
+
+  struct sockaddr_nl addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_ROUTE;
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    g_warning("Failed to subscribe to netlink route events: %s",
+              strerror(errno));
+    close(fd);
+    fd = -1;
+    return;
+  }
+
+  socklen_t addr_len = sizeof(addr);
+  if (getsockname(fd, (struct sockaddr *)&addr, &addr_len) == 0)
+    port_id = addr.nl_pid;
+
+  watch_id = g_unix_fd_add(fd, G_IO_IN, on_readable, this);
+  request_route_dump();
+}
+
+genie::NetMonitor::~NetMonitor() {
+  if (watch_id > 0)
+    g_source_remove(watch_id);
+  if (fd >= 0)
+    close(fd);
+}
+
+gboolean genie::NetMonitor::on_readable(gint fd, GIOCondition condition,
+                                        gpointer data) {
+  NetMonitor *self = static_cast<NetMonitor *>(data);
+  char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+  for (;;) {
+    ssize_t len = recv(fd, buf, sizeof(buf), 0);
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == ENOBUFS) {
+        // the kernel dropped notifications, resynchronize from a dump
+        g_message("Netlink receive buffer overrun, reloading routes");
+        self->dump_in_flight = false;
+        self->request_route_dump();
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        g_warning("Failed to read from netlink socket: %s", strerror(errno));
+      break;
+    }
+    if (len == 0)
+      break;
+
+    self->handle_messages(buf, len);
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+void genie::NetMonitor::handle_messages(const char *buf, ssize_t len) {
+  bool any_change = false;
+  int remaining = (int)len;
+
+  for (const nlmsghdr *hdr = (const nlmsghdr *)buf; NLMSG_OK(hdr, remaining);
+       hdr = NLMSG_NEXT(hdr, remaining)) {
+    bool is_dump_reply = dump_in_flight && hdr->nlmsg_seq == dump_seq;
+    if (!is_dump_reply && port_id != 0 && hdr->nlmsg_pid == port_id) {
+      // leftover from a dump we abandoned after an overrun
+      continue;
+    }
+
+    switch (hdr->nlmsg_type) {
+      case NLMSG_DONE:
+      case NLMSG_ERROR:
+        if (is_dump_reply) {
+          dump_in_flight = false;
+          if (hdr->nlmsg_type == NLMSG_DONE) {
+            update(dump_saw_default);
+          } else {
+            g_warning("Netlink route dump failed");
+          }
+          if (dump_pending) {
+            dump_pending = false;
+            request_route_dump();
+          }
+        }
+        break;
+
+      case RTM_NEWROUTE:
+        if (is_dump_reply) {
+          if (is_default_route(hdr))
+            dump_saw_default = true;
+        } else if (is_default_route(hdr)) {
+          // a usable default route appeared, no need to wait for the dump
+          update(true);
+          any_change = true;
+        } else {
+          any_change = true;
+        }
+        break;
+
+      case RTM_DELROUTE:
+        any_change = true;
+        break;
+
+      case RTM_NEWLINK:
+      case RTM_DELLINK:
+        handle_link(hdr);
+        any_change = true;
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  if (any_change)
+    request_route_dump();
+}
+
+void genie::NetMonitor::handle_link(const nlmsghdr *hdr) {
+  const struct ifinfomsg *ifi = (const struct ifinfomsg *)NLMSG_DATA(hdr);
+  if (ifi->ifi_flags & IFF_LOOPBACK)
+    return;
+
+  const char *ifname = "?";
+  int attrlen = IFLA_PAYLOAD(hdr);
+  for (const struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, attrlen);
+       rta = RTA_NEXT(rta, attrlen)) {
+    if (rta->rta_type == IFLA_IFNAME) {
+      ifname = (const char *)RTA_DATA(rta);
+      break;
+    }
+  }
+
+  if (hdr->nlmsg_type == RTM_DELLINK) {
+    g_message("Link %s removed", ifname);
+  } else {
+    g_debug("Link %s is %s%s", ifname,
+            (ifi->ifi_flags & IFF_UP) ? "up" : "down",
+            (ifi->ifi_flags & IFF_RUNNING) ? ", running" : "");
+  }
+}
+
+bool genie::NetMonitor::is_default_route(const nlmsghdr *hdr) {
+  const struct rtmsg *rtm = (const struct rtmsg *)NLMSG_DATA(hdr);
+  if (rtm->rtm_family != AF_INET || rtm->rtm_dst_len != 0 ||
+      rtm->rtm_type != RTN_UNICAST)
+    return false;
+
+  // routes through a link without carrier are kept in the table but unusable
+  if (rtm->rtm_flags & RTNH_F_LINKDOWN)
+    return false;
+
+  uint32_t table = rtm->rtm_table;
+  int attrlen = RTM_PAYLOAD(hdr);
+  for (const struct rtattr *rta = RTM_RTA(rtm); RTA_OK(rta, attrlen);
+       rta = RTA_NEXT(rta, attrlen)) {
+    if (rta->rta_type == RTA_TABLE)
+      table = *(const uint32_t *)RTA_DATA(rta);
+  }
+
+  return table == RT_TABLE_MAIN;
+}
+
+/**
+ * @brief Ask the kernel for all IPv4 routes.
+ *
+ * Only one dump runs at a time; events that arrive meanwhile trigger a
+ * single follow-up dump once it completes.
+ */
+void genie::NetMonitor::request_route_dump() {
+  if (fd < 0)
+    return;
+  if (dump_in_flight) {
+    dump_pending = true;
+    return;
+  }
+
+  struct {
+    struct nlmsghdr hdr;
+    struct rtmsg rtm;
+  } req;
+  memset(&req, 0, sizeof(req));
+  req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+  req.hdr.nlmsg_type = RTM_GETROUTE;
+  req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req.hdr.nlmsg_seq = ++dump_seq;
+  req.rtm.rtm_family = AF_INET;
+
+  struct sockaddr_nl kernel;
+  memset(&kernel, 0, sizeof(kernel));
+  kernel.nl_family = AF_NETLINK;
+
+  if (sendto(fd, &req, req.hdr.nlmsg_len, 0, (struct sockaddr *)&kernel,
+             sizeof(kernel)) < 0) {
+    g_warning("Failed to request netlink route dump: %s", strerror(errno));
+    return;
+  }
+
+  dump_in_flight = true;
+  dump_saw_default = false;
+}
+
+void genie::NetMonitor::update(bool has_route) {
+  if (has_route == default_route)
+    return;
+  default_route = has_route;
+
+  g_message("Default route %s", has_route ? "available" : "lost");
+  app->track_network(has_route);
+}
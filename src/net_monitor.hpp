@@ -0,0 +1,69 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <glib.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct nlmsghdr;
+
+namespace genie {
+
+class App;
+
+/**
+ * @brief Watches the kernel routing tables over netlink and tells the app
+ * when the default route comes and goes.
+ *
+ * Link and route notifications (RTNLGRP_LINK, RTNLGRP_IPV4_ROUTE) are read
+ * from the main loop. Any of them triggers a dump of the IPv4 routes, so a
+ * default route whose link lost carrier counts as gone even though the
+ * kernel does not announce that as a route change.
+ */
+class NetMonitor {
+public:
+  NetMonitor(App *app);
+  ~NetMonitor();
+
+  NetMonitor(const NetMonitor &) = delete;
+  NetMonitor &operator=(const NetMonitor &) = delete;
+
+  bool has_default_route() const { return default_route; }
+
+private:
+  App *const app;
+  int fd;
+  uint32_t port_id;
+  guint watch_id;
+  uint32_t dump_seq;
+  bool dump_in_flight;
+  bool dump_pending;
+  bool dump_saw_default;
+  bool default_route;
+
+  static gboolean on_readable(gint fd, GIOCondition condition, gpointer data);
+  void handle_messages(const char *buf, ssize_t len);
+  void handle_link(const nlmsghdr *hdr);
+  static bool is_default_route(const nlmsghdr *hdr);
+  void request_route_dump();
+  void update(bool has_route);
+};
+
+} // namespace genie
@@ -23,6 +23,7 @@
 #include <glib/gstdio.h>
 #include <json-glib/json-glib.h>
 #include <signal.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
@@ -32,11 +33,179 @@
 
 #define SPOTIFYD_VERSION "0.3.4"
 
-genie::Spotifyd::Spotifyd(App *app) : app(app), child_pid(-1) {}
+static const guint RETRY_DELAY_MIN_S = 1;
+static const guint RETRY_DELAY_MAX_S = 60;
+// a child that ran at least this long is considered healthy, and restarting
+// it after an exit does not back off
+static const gint64 STABLE_RUN_US = 30 * G_USEC_PER_SEC;
+
+genie::Spotifyd::Spotifyd(App *app)
+    : app(app), cancellable(g_cancellable_new(), adopt_mode::owned),
+      binary_ready(false), restart_pending(false), retry_timeout_id(0),
+      retry_delay_s(RETRY_DELAY_MIN_S), spawn_time(0),
+      playback_requested_time(0) {
+  binary_path = g_build_filename(app->config->cache_dir, "spotifyd", nullptr);
+  archive_path = g_strdup_printf("%s/spotifyd-%s.tar.gz.part",
+                                 app->config->cache_dir, SPOTIFYD_VERSION);
+}
+
+genie::Spotifyd::~Spotifyd() {
+  g_cancellable_cancel(cancellable.get());
+  if (retry_timeout_id > 0)
+    g_source_remove(retry_timeout_id);
+  close();
+  g_free(binary_path);
+  g_free(archive_path);
+}
+
+/**
+ * @brief Start bringing up spotifyd. Returns immediately, the rest happens
+ * from the main loop.
+ */
+int genie::Spotifyd::init() {
+  // kill any instance left over from a previous run before we spawn ours
+  GError *error = nullptr;
+  GSubprocess *killall =
+      g_subprocess_new(G_SUBPROCESS_FLAGS_STDERR_SILENCE, &error, "killall",
+                       "spotifyd", nullptr);
+  if (!killall) {
+    g_warning("Failed to run killall: %s", error->message);
+    g_error_free(error);
+    check_binary();
+    return true;
+  }
 
-genie::Spotifyd::~Spotifyd() { close(); }
+  g_subprocess_wait_async(killall, cancellable.get(), on_stale_killed, this);
+  g_object_unref(killall);
+  return true;
+}
 
-int genie::Spotifyd::download() {
+void genie::Spotifyd::on_stale_killed(GObject *source, GAsyncResult *res,
+                                      gpointer data) {
+  GError *error = nullptr;
+  if (!g_subprocess_wait_finish(G_SUBPROCESS(source), res, &error)) {
+    g_error_free(error);
+    return;
+  }
+  static_cast<Spotifyd *>(data)->check_binary();
+}
+
+static gchar *hash_file(const char *path) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return nullptr;
+  }
+
+  GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA1);
+  guchar buf[16384];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    g_checksum_update(checksum, buf, n);
+  }
+  fclose(fp);
+
+  gchar *digest = g_strdup(g_checksum_get_string(checksum));
+  g_checksum_free(checksum);
+  return digest;
+}
+
+/**
+ * @brief Check that the spotifyd binary is present and the version we need.
+ *
+ * Runs on a worker thread. Running `spotifyd --version` is comparatively
+ * slow, so the result is cached in `spotifyd.version` next to the binary,
+ * keyed by the binary's SHA1.
+ */
+void genie::Spotifyd::check_version_thread(GTask *task, gpointer source,
+                                           gpointer task_data,
+                                           GCancellable *cancellable) {
+  gchar **paths = static_cast<gchar **>(task_data);
+  gchar *binary_path = paths[0];
+  const gchar *cache_path = paths[1];
+
+  if (!g_file_test(binary_path, G_FILE_TEST_IS_EXECUTABLE)) {
+    g_message("spotifyd not found, downloading...");
+    g_task_return_boolean(task, FALSE);
+    return;
+  }
+
+  gchar *digest = hash_file(binary_path);
+  gchar *expected =
+      g_strdup_printf("%s %s\n", digest ? digest : "", SPOTIFYD_VERSION);
+
+  bool up_to_date = false;
+  gchar *cached = nullptr;
+  if (digest && g_file_get_contents(cache_path, &cached, nullptr, nullptr) &&
+      strcmp(cached, expected) == 0) {
+    up_to_date = true;
+  } else {
+    gchar *argv[] = {binary_path, (gchar *)"--version", nullptr};
+    gchar *out = nullptr;
+    char version[128];
+    if (g_spawn_sync(nullptr, argv, nullptr, G_SPAWN_STDERR_TO_DEV_NULL,
+                     nullptr, nullptr, &out, nullptr, nullptr, nullptr) &&
+        out && sscanf(out, "spotifyd %127s", version) == 1) {
+      if (strcmp(version, SPOTIFYD_VERSION) == 0) {
+        up_to_date = true;
+        if (digest)
+          g_file_set_contents(cache_path, expected, -1, nullptr);
+      } else {
+        g_message("spotifyd local version %s, need %s, updating...", version,
+                  SPOTIFYD_VERSION);
+      }
+    } else {
+      g_message("unable to get local spotifyd version, updating...");
+    }
+    g_free(out);
+  }
+
+  g_free(cached);
+  g_free(expected);
+  g_free(digest);
+  g_task_return_boolean(task, up_to_date);
+}
+
+void genie::Spotifyd::check_binary() {
+  gchar **paths = g_new0(gchar *, 3);
+  paths[0] = g_strdup(binary_path);
+  paths[1] =
+      g_build_filename(app->config->cache_dir, "spotifyd.version", nullptr);
+
+  GTask *task = g_task_new(nullptr, cancellable.get(), on_version_checked, this);
+  g_task_set_task_data(task, paths, (GDestroyNotify)g_strfreev);
+  g_task_run_in_thread(task, check_version_thread);
+  g_object_unref(task);
+}
+
+void genie::Spotifyd::on_version_checked(GObject *source, GAsyncResult *res,
+                                         gpointer data) {
+  GError *error = nullptr;
+  gboolean up_to_date = g_task_propagate_boolean(G_TASK(res), &error);
+  if (error) {
+    // only happens when we are being destroyed
+    g_error_free(error);
+    return;
+  }
+
+  Spotifyd *self = static_cast<Spotifyd *>(data);
+  if (!up_to_date) {
+    self->download();
+    return;
+  }
+
+  g_message("spotifyd " SPOTIFYD_VERSION " is ready");
+  self->binary_ready = true;
+  self->retry_delay_s = RETRY_DELAY_MIN_S;
+  self->maybe_spawn();
+}
+
+/**
+ * @brief Download the spotifyd release in the background.
+ *
+ * The archive is kept at `archive_path` until it has been extracted, so an
+ * interrupted download is resumed on the next attempt instead of restarting.
+ */
+void genie::Spotifyd::download() {
   const gchar *dl_arch;
   std::string arch;
   struct utsname un;
@@ -53,74 +222,115 @@ int genie::Spotifyd::download() {
     dl_arch = "";
   }
 
-  gchar *cmd = g_strdup_printf(
-      "curl "
+  gchar *url = g_strdup_printf(
       "https://github.com/stanford-oval/spotifyd/releases/download/v%s/"
-      "spotifyd-linux-%sslim.tar.gz -L | tar -xvz -C %s",
-      SPOTIFYD_VERSION, dl_arch, app->config->cache_dir);
-  int rc = system(cmd);
-  g_free(cmd);
+      "spotifyd-linux-%sslim.tar.gz",
+      SPOTIFYD_VERSION, dl_arch);
+  g_message("Downloading spotifyd from %s", url);
+
+  GError *error = nullptr;
+  GSubprocess *curl =
+      g_subprocess_new(G_SUBPROCESS_FLAGS_NONE, &error, "curl", "-L", "-f",
+                       "-sS", "-C", "-", "-o", archive_path, url, nullptr);
+  g_free(url);
+  if (!curl) {
+    g_warning("Failed to run curl: %s", error->message);
+    g_error_free(error);
+    schedule_retry(retry_download);
+    return;
+  }
 
-  return rc;
+  g_subprocess_wait_check_async(curl, cancellable.get(), on_downloaded, this);
+  g_object_unref(curl);
 }
 
-int genie::Spotifyd::check_version() {
-  FILE *fp;
-  char buf[128];
+void genie::Spotifyd::on_downloaded(GObject *source, GAsyncResult *res,
+                                    gpointer data) {
+  GError *error = nullptr;
+  if (!g_subprocess_wait_check_finish(G_SUBPROCESS(source), res, &error)) {
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_error_free(error);
+      return;
+    }
+    Spotifyd *self = static_cast<Spotifyd *>(data);
+    g_warning("Failed to download spotifyd: %s", error->message);
+    g_error_free(error);
+    // a partial download that keeps failing to resume is likely corrupt
+    if (self->retry_delay_s >= RETRY_DELAY_MAX_S / 2)
+      g_unlink(self->archive_path);
+    self->schedule_retry(retry_download);
+    return;
+  }
 
-  gchar *cmd = g_strdup_printf("%s/spotifyd --version", app->config->cache_dir);
-  fp = popen(cmd, "r");
-  if (fp == NULL) {
-    g_free(cmd);
-    return true;
+  static_cast<Spotifyd *>(data)->extract();
+}
+
+void genie::Spotifyd::extract() {
+  GError *error = nullptr;
+  GSubprocess *tar =
+      g_subprocess_new(G_SUBPROCESS_FLAGS_NONE, &error, "tar", "-xzf",
+                       archive_path, "-C", app->config->cache_dir, nullptr);
+  if (!tar) {
+    g_warning("Failed to run tar: %s", error->message);
+    g_error_free(error);
+    schedule_retry(retry_download);
+    return;
   }
-  g_free(cmd);
 
-  bool update = false;
-  if (fscanf(fp, "spotifyd %127s", buf) == 1) {
-    if (strlen(buf) <= 0) {
-      g_message("unable to get local spotifyd version, updating...");
-      update = true;
-    } else {
-      if (strcmp(SPOTIFYD_VERSION, buf) != 0) {
-        g_message("spotifyd local version %s, need %s, updating...", buf,
-                  SPOTIFYD_VERSION);
-        update = true;
-      }
-    }
+  g_subprocess_wait_check_async(tar, cancellable.get(), on_extracted, this);
+  g_object_unref(tar);
+}
+
+void genie::Spotifyd::on_extracted(GObject *source, GAsyncResult *res,
+                                   gpointer data) {
+  GError *error = nullptr;
+  gboolean ok = g_subprocess_wait_check_finish(G_SUBPROCESS(source), res, &error);
+  if (error && g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    g_error_free(error);
+    return;
   }
 
-  if (pclose(fp) == -1) {
-    return true;
+  Spotifyd *self = static_cast<Spotifyd *>(data);
+  g_unlink(self->archive_path);
+  if (!ok) {
+    g_warning("Failed to extract spotifyd: %s", error->message);
+    g_error_free(error);
+    self->schedule_retry(retry_download);
+    return;
   }
 
-  return update;
+  // hash the new binary and record its version
+  self->check_binary();
 }
 
-int genie::Spotifyd::init() {
-  gchar *cmd = g_strdup_printf("killall spotifyd");
-  system(cmd);
-  g_free(cmd);
+void genie::Spotifyd::schedule_retry(GSourceFunc func) {
+  if (retry_timeout_id > 0)
+    return;
 
-  gchar *file_path = g_strdup_printf("%s/spotifyd", app->config->cache_dir);
-  if (!g_file_test(file_path, G_FILE_TEST_IS_EXECUTABLE)) {
-    download();
-  } else {
-    if (check_version()) {
-      download();
-    }
-  }
-  g_free(file_path);
+  g_message("Retrying spotifyd in %u s", retry_delay_s);
+  retry_timeout_id = g_timeout_add_seconds(retry_delay_s, func, this);
+  retry_delay_s = MIN(retry_delay_s * 2, RETRY_DELAY_MAX_S);
+}
 
-  if (!username.empty() && !access_token.empty())
-    return spawn();
-  return true;
+gboolean genie::Spotifyd::retry_download(gpointer data) {
+  Spotifyd *self = static_cast<Spotifyd *>(data);
+  self->retry_timeout_id = 0;
+  self->download();
+  return G_SOURCE_REMOVE;
+}
+
+gboolean genie::Spotifyd::retry_spawn(gpointer data) {
+  Spotifyd *self = static_cast<Spotifyd *>(data);
+  self->retry_timeout_id = 0;
+  self->maybe_spawn();
+  return G_SOURCE_REMOVE;
 }
 
 int genie::Spotifyd::close() {
-  if (child_pid > 0) {
-    g_debug("kill spotifyd pid %d\n", child_pid);
-    return kill(child_pid, SIGINT);
+  if (process) {
+    g_debug("kill spotifyd pid %s\n",
+            g_subprocess_get_identifier(process.get()));
+    g_subprocess_send_signal(process.get(), SIGINT);
   }
   return true;
 }
@@ -179,12 +389,12 @@ void genie::Spotifyd::pause() {
                              nullptr);
 }
 
-void genie::Spotifyd::child_watch_cb(GPid pid, gint status, gpointer data) {
-  Spotifyd *obj = reinterpret_cast<Spotifyd *>(data);
-  g_print("spotifyd child %" G_PID_FORMAT " exited with rc %d\n", pid,
-          g_spawn_check_exit_status(status, NULL));
-  g_spawn_close_pid(pid);
-  obj->child_pid = -1;
+/**
+ * @brief Start timing a Spotify playback request, reported once spotifyd
+ * logs that the first track is loaded.
+ */
+void genie::Spotifyd::expect_playback() {
+  playback_requested_time = g_get_monotonic_time();
 }
 
 static void child_setup(gpointer user_data) {
@@ -196,17 +406,27 @@ static void child_setup(gpointer user_data) {
   prctl(PR_SET_PDEATHSIG, SIGTERM);
 }
 
-int genie::Spotifyd::spawn() {
-  gchar *file_path = g_strdup_printf("%s/spotifyd", app->config->cache_dir);
+void genie::Spotifyd::maybe_spawn() {
+  if (!binary_ready || process || username.empty() || access_token.empty())
+    return;
+  spawn();
+}
+
+bool genie::Spotifyd::spawn() {
   const gchar *device_name = "genie-cpp";
   const char *backend = audio_driver_type_to_string(app->config->audio_backend);
 
-  gchar **envp;
-  envp = g_get_environ();
-  envp = g_environ_setenv(envp, "PULSE_PROP_media.role", "music", TRUE);
+  auto_gobject_ptr<GSubprocessLauncher> launcher(
+      g_subprocess_launcher_new((GSubprocessFlags)(
+          G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDERR_MERGE)),
+      adopt_mode::owned);
+  g_subprocess_launcher_setenv(launcher.get(), "PULSE_PROP_media.role",
+                               "music", TRUE);
+  g_subprocess_launcher_set_child_setup(launcher.get(), child_setup, nullptr,
+                                        nullptr);
 
   std::vector<const gchar *> argv{
-      file_path,       "--no-daemon",
+      binary_path,     "--no-daemon",
       "--device",      app->config->audio_output_device_music,
       "--device-name", device_name,
       "--device-type", "speaker",
@@ -217,44 +437,124 @@ int genie::Spotifyd::spawn() {
   };
 
   g_debug("spawn spotifyd");
-  for (int i = 0; argv[i]; i++) {
-    g_debug("%s", argv[i]);
-  }
 
-  GError *gerror = NULL;
-  g_spawn_async_with_pipes(NULL, (gchar **)argv.data(), envp,
-                           G_SPAWN_DO_NOT_REAP_CHILD, child_setup, NULL,
-                           &child_pid, NULL, NULL, NULL, &gerror);
-  if (gerror) {
-    g_strfreev(envp);
-    g_free(file_path);
-    g_critical("spawning spotifyd child failed: %s\n", gerror->message);
-    g_error_free(gerror);
+  GError *error = nullptr;
+  process = auto_gobject_ptr<GSubprocess>(
+      g_subprocess_launcher_spawnv(launcher.get(), argv.data(), &error),
+      adopt_mode::owned);
+  if (!process) {
+    g_critical("spawning spotifyd child failed: %s\n", error->message);
+    g_error_free(error);
+    schedule_retry(retry_spawn);
     return false;
   }
 
-  g_strfreev(envp);
-  g_free(file_path);
+  spawn_time = g_get_monotonic_time();
+  g_subprocess_wait_async(process.get(), cancellable.get(), on_child_exit,
+                          this);
+
+  output = auto_gobject_ptr<GDataInputStream>(
+      g_data_input_stream_new(g_subprocess_get_stdout_pipe(process.get())),
+      adopt_mode::owned);
+  read_output_line();
 
-  g_child_watch_add(child_pid, child_watch_cb, this);
-  g_print("spotifyd loaded, pid: %d\n", child_pid);
+  g_print("spotifyd loaded, pid: %s\n",
+          g_subprocess_get_identifier(process.get()));
   return true;
 }
 
+void genie::Spotifyd::on_child_exit(GObject *source, GAsyncResult *res,
+                                    gpointer data) {
+  GSubprocess *child = G_SUBPROCESS(source);
+  GError *error = nullptr;
+  if (!g_subprocess_wait_finish(child, res, &error)) {
+    g_error_free(error);
+    return;
+  }
+
+  if (g_subprocess_get_if_exited(child)) {
+    g_print("spotifyd child exited with rc %d\n",
+            g_subprocess_get_exit_status(child));
+  } else if (g_subprocess_get_if_signaled(child)) {
+    g_print("spotifyd child killed by signal %d\n",
+            g_subprocess_get_term_sig(child));
+  }
+
+  Spotifyd *self = static_cast<Spotifyd *>(data);
+  if (self->process.get() != child)
+    return;
+  self->process = nullptr;
+  self->output = nullptr;
+
+  if (self->restart_pending) {
+    // the credentials changed, start again with the new ones right away
+    self->restart_pending = false;
+    self->maybe_spawn();
+    return;
+  }
+
+  // unexpected exit, keep it running but back off if it keeps crashing
+  if (g_get_monotonic_time() - self->spawn_time >= STABLE_RUN_US)
+    self->retry_delay_s = RETRY_DELAY_MIN_S;
+  self->schedule_retry(retry_spawn);
+}
+
+void genie::Spotifyd::read_output_line() {
+  g_data_input_stream_read_line_async(output.get(), G_PRIORITY_DEFAULT,
+                                      cancellable.get(), on_output_line, this);
+}
+
+void genie::Spotifyd::on_output_line(GObject *source, GAsyncResult *res,
+                                     gpointer data) {
+  GError *error = nullptr;
+  gchar *line = g_data_input_stream_read_line_finish(G_DATA_INPUT_STREAM(source),
+                                                     res, nullptr, &error);
+  if (!line) {
+    // end of stream (the child exited) or cancelled
+    if (error)
+      g_error_free(error);
+    return;
+  }
+
+  Spotifyd *self = static_cast<Spotifyd *>(data);
+  g_debug("spotifyd: %s", line);
+
+  if (self->playback_requested_time > 0 && strstr(line, "loaded")) {
+    g_message("Time to first Spotify audio: %.1f ms",
+              (g_get_monotonic_time() - self->playback_requested_time) /
+                  1000.0);
+    self->playback_requested_time = 0;
+  }
+  g_free(line);
+
+  if (G_DATA_INPUT_STREAM(source) == self->output.get())
+    self->read_output_line();
+}
+
 bool genie::Spotifyd::set_credentials(const std::string &username,
                                       const std::string &access_token) {
   if (access_token.empty())
     return false;
 
-  if (this->username == username && this->access_token == access_token &&
-      child_pid != -1)
+  this->access_token = access_token;
+
+  if (this->username == username && process) {
+    // spotifyd only uses the token to log in, after which it keeps its own
+    // session; a refreshed token is kept for the Web API and the next spawn
+    g_debug("spotify access token updated, keeping spotifyd running");
     return true;
+  }
 
   this->username = username;
-  this->access_token = access_token;
-  g_debug("setting spotify username %s access token %s", this->username.c_str(),
-          this->access_token.c_str());
-  close();
-  g_usleep(500);
-  return spawn();
+  g_debug("setting spotify username %s", this->username.c_str());
+
+  if (process) {
+    // respawn from on_child_exit once the old instance is gone
+    restart_pending = true;
+    close();
+    return true;
+  }
+
+  maybe_spawn();
+  return true;
 }
@@ -19,10 +19,20 @@
 #pragma once
 
 #include "app.hpp"
+#include <gio/gio.h>
 #include <string>
 
 namespace genie {
 
+/**
+ * @brief Supervisor for the spotifyd child process.
+ *
+ * Everything runs asynchronously on the main loop: stale instances are
+ * killed, the binary is version-checked (cached by its hash) and downloaded
+ * in the background if needed, and the child is spawned as soon as both the
+ * binary and credentials are available, then kept running and restarted if
+ * it dies.
+ */
 class Spotifyd {
 public:
   Spotifyd(App *app);
@@ -30,18 +40,49 @@ public:
   int init();
   int close();
   void pause();
+  void expect_playback();
   bool set_credentials(const std::string &username,
                        const std::string &access_token);
 
 protected:
-  int spawn();
-  int download();
-  int check_version();
-  static void child_watch_cb(GPid pid, gint status, gpointer data);
+  void check_binary();
+  void download();
+  void extract();
+  void maybe_spawn();
+  bool spawn();
+  void schedule_retry(GSourceFunc func);
+  void read_output_line();
+
+  static void on_stale_killed(GObject *source, GAsyncResult *res,
+                              gpointer data);
+  static void check_version_thread(GTask *task, gpointer source,
+                                   gpointer task_data,
+                                   GCancellable *cancellable);
+  static void on_version_checked(GObject *source, GAsyncResult *res,
+                                 gpointer data);
+  static void on_downloaded(GObject *source, GAsyncResult *res, gpointer data);
+  static void on_extracted(GObject *source, GAsyncResult *res, gpointer data);
+  static void on_child_exit(GObject *source, GAsyncResult *res, gpointer data);
+  static void on_output_line(GObject *source, GAsyncResult *res,
+                             gpointer data);
+  static gboolean retry_download(gpointer data);
+  static gboolean retry_spawn(gpointer data);
 
 private:
   App *app;
-  GPid child_pid;
+  auto_gobject_ptr<GCancellable> cancellable;
+  auto_gobject_ptr<GSubprocess> process;
+  auto_gobject_ptr<GDataInputStream> output;
+  gchar *binary_path;
+  gchar *archive_path;
+
+  bool binary_ready;
+  bool restart_pending;
+  guint retry_timeout_id;
+  guint retry_delay_s;
+  gint64 spawn_time;
+  gint64 playback_requested_time;
+
   std::string username;
   std::string access_token;
 };
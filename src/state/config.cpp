@@ -21,6 +21,7 @@
 #include "utils/net.hpp"
 #include "leds.hpp"
 #include "app.hpp"
+#include "audio/audioinput.hpp"
 
 #undef G_LOG_DOMAIN
 #define G_LOG_DOMAIN "genie::state::Config"
@@ -32,12 +33,14 @@ void Config::enter() {
   State::enter();
 
   app->leds->animate(LedsState_t::Config);
+  app->audio_input->suspend();
   // app->net_controller->stop_sta();
   // app->net_controller->start_ap();
 }
 
 void Config::exit() {
   State::exit();
+  app->audio_input->resume();
   // app->net_controller->stop_ap();
   // app->net_controller->start_sta();
 }
@@ -36,6 +36,9 @@ public:
 
   void react(events::ToggleConfigMode *) override;
 
+  // the audio input is suspended, there is no turn to start
+  void react(events::TalkPressed *) override {}
+
 private:
 };
 
@@ -18,6 +18,7 @@
 
 #include "state/disabled.hpp"
 #include "app.hpp"
+#include "audio/audioinput.hpp"
 #include "audio/audioplayer.hpp"
 #include "audio/audiovolume.hpp"
 #include "leds.hpp"
@@ -34,9 +35,13 @@ namespace state {
 void Disabled::enter() {
   State::enter();
   app->leds->animate(LedsState_t::Disabled);
+  app->audio_input->suspend();
 }
 
-void Disabled::exit() { State::exit(); }
+void Disabled::exit() {
+  State::exit();
+  app->audio_input->resume();
+}
 
 void Disabled::react(events::Panic *) {
   g_warning("PANIC!!! :D");
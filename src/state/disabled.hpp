@@ -41,6 +41,7 @@ public:
 
   // Events that state::State handles that we want to ignore
   void react(events::Wake *) override {}
+  void react(events::TalkPressed *) override {}
   void react(events::TextMessage *) override {}
   void react(events::AudioMessage *) override {}
   void react(events::SoundMessage *) override {}
@@ -52,6 +53,7 @@ public:
   // doesn't block on the client" (- Gio)
   void react(events::audio::PrepareEvent *event) override { event->resolve(); }
   void react(events::audio::PlayURLsEvent *event) override { event->resolve(); }
+  void react(events::audio::ResumeEvent *event) override { event->resolve(); }
   void react(events::audio::SetMuteEvent *event) override { event->resolve(); }
   void react(events::audio::SetVolumeEvent *event) override {
     event->resolve();
@@ -75,6 +75,9 @@ template <> struct RequestEvent<void> : public Event {
     request->reject(error_code, error_message);
   }
 
+  // for handlers that resolve the request after the event is gone
+  std::unique_ptr<Request<void>> take_request() { return std::move(request); }
+
 private:
   std::unique_ptr<Request<void>> request;
 };
@@ -149,14 +152,25 @@ struct SpotifyCredentials : Event {
 
 struct AdjustVolume : Event {
   int delta; // 1 or -1
+  bool repeat; // auto-repeat of a held key
 
-  AdjustVolume(int delta) : delta(delta) {}
+  AdjustVolume(int delta, bool repeat = false) : delta(delta), repeat(repeat) {}
 };
 
 struct TogglePlayback : Event {};
 
 struct Panic : Event {};
 
+// the push-to-talk key went down
+struct TalkPressed : Event {};
+
+struct TalkReleased : Event {
+  // end the input now, rather than leaving it to VAD
+  bool end_input;
+
+  TalkReleased(bool end_input) : end_input(end_input) {}
+};
+
 struct ToggleDisabled : Event {};
 
 struct ToggleConfigMode : Event {};
@@ -226,6 +240,16 @@ struct StopEvent : public RequestEvent<void> {
       : RequestEvent<void>(std::move(req)) {}
 };
 
+struct PauseEvent : public RequestEvent<void> {
+  PauseEvent(std::unique_ptr<Request<void>> &&req)
+      : RequestEvent<void>(std::move(req)) {}
+};
+
+struct ResumeEvent : public RequestEvent<void> {
+  ResumeEvent(std::unique_ptr<Request<void>> &&req)
+      : RequestEvent<void>(std::move(req)) {}
+};
+
 struct PlayURLsEvent : public RequestEvent<void> {
   PlayURLsEvent(std::unique_ptr<Request<void>> &&req,
                 std::vector<std::string> urls)
@@ -37,8 +37,8 @@ void Listening::enter() {
   app->stt->begin_session(is_follow_up);
   app->audio_input->wake();
   app->audio_volume_controller->duck();
-  g_message("Stopping audio player...\n");
-  app->audio_player->stop();
+  g_message("Pausing audio player...\n");
+  app->audio_player->pause();
   if (!is_follow_up) {
     g_message("Playing WAKE sound...\n");
     app->audio_player->play_sound(Sound_t::WAKE);
@@ -57,17 +57,20 @@ void Listening::react(events::InputFrame *input_frame) {
 void Listening::react(events::InputDone *input_done) {
   g_message("Handling InputDone...\n");
   app->stt->send_done();
-  app->audio_player->stop();
+  app->audio_player->clean_queue();
   if (input_done->vad_detected) {
     app->audio_player->play_sound(Sound_t::WORKING);
+  } else {
+    app->dump_audio_recording("no-input", true);
   }
   app->transit(new Processing(app));
 }
 
 void Listening::react(events::InputNotDetected *) {
   g_message("Handling InputNotDetected...\n");
+  app->dump_audio_recording("no-input", true);
   app->stt->abort();
-  app->audio_player->stop();
+  app->audio_player->clean_queue();
   app->audio_player->play_sound(Sound_t::NO_INPUT);
   app->transit(new Sleeping(app));
 }
@@ -75,7 +78,7 @@ void Listening::react(events::InputNotDetected *) {
 void Listening::react(events::InputTimeout *) {
   g_message("Handling InputTimeout...\n");
   app->stt->abort();
-  app->audio_player->stop();
+  app->audio_player->clean_queue();
   app->audio_player->play_sound(Sound_t::TOO_MUCH_INPUT);
   app->transit(new Sleeping(app));
 }
@@ -59,6 +59,7 @@ void Processing::react(events::stt::ErrorResponse *response) {
   app->track_processing_event(ProcessingEventType::END_STT);
   g_warning("STT completed with an error (code=%d): %s", response->code,
             response->message.c_str());
+  app->dump_audio_recording("stt-error", true);
   if (response->code != 404) {
     app->audio_player.get()->play_sound(Sound_t::STT_ERROR);
     app->leds->animate(LedsState_t::Error);
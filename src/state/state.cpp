@@ -18,9 +18,12 @@
 
 #include "state/state.hpp"
 #include "app.hpp"
+#include "audio/audioinput.hpp"
 #include "audio/audioplayer.hpp"
 #include "audio/audiovolume.hpp"
+#include "leds.hpp"
 #include "spotifyd.hpp"
+#include "webserver.hpp"
 #include "ws-protocol/client.hpp"
 
 #undef G_LOG_DOMAIN
@@ -52,7 +55,9 @@ void State::react(events::Wake *) {
 }
 
 void State::react(events::InputFrame *input_frame) {
-  g_debug("FIXME received InputFrame when not in Listen state, discarding.");
+  GENIE_LOG_RATELIMITED(g_debug, 5000,
+                        "Discarding input frames received in %s state",
+                        name());
 }
 
 void State::react(events::InputDone *) {
@@ -109,8 +114,10 @@ void State::react(events::SpotifyCredentials *spotify_credentials) {
 }
 
 void State::react(events::AdjustVolume *adjust_volume) {
-  app->audio_volume_controller->adjust_volume(
-      adjust_volume->delta * AudioVolumeController::VOLUME_DELTA);
+  int volume = app->audio_volume_controller->step_volume(
+      adjust_volume->delta, adjust_volume->repeat);
+  app->leds->show_volume(volume);
+  app->track_volume(volume);
 }
 
 void State::react(events::TogglePlayback *) {
@@ -124,6 +131,16 @@ void State::react(events::Panic *) {
   app->transit(new Sleeping(app));
 }
 
+void State::react(events::TalkPressed *) {
+  // the input thread dispatches Wake along with the pre-roll, like it does
+  // for the wake word
+  app->audio_input->talk_pressed();
+}
+
+void State::react(events::TalkReleased *talk_released) {
+  app->audio_input->talk_released(talk_released->end_input);
+}
+
 void State::react(events::ToggleDisabled *) {
   g_message("DISABLING...");
   app->transit(new Disabled(app));
@@ -161,6 +178,7 @@ void State::react(events::stt::ErrorResponse *response) {
 // ---------------------------------------------------------------------------
 
 void State::react(events::audio::CheckSpotifyEvent *check_spotify) {
+  app->spotifyd->expect_playback();
   app->spotifyd->set_credentials(check_spotify->username,
                                  check_spotify->access_token);
   check_spotify->resolve(std::make_pair(true, ""));
@@ -183,19 +201,38 @@ void State::react(events::audio::StopEvent *stop) {
   stop->resolve();
 }
 
+void State::react(events::audio::PauseEvent *pause) {
+  app->audio_player->pause();
+  pause->resolve();
+}
+
+void State::react(events::audio::ResumeEvent *resume) {
+  app->audio_player->resume();
+  resume->resolve();
+}
+
 void State::react(events::audio::SetMuteEvent *set_mute) {
   // TODO implement
   set_mute->resolve();
 }
 
+// Volume requests are resolved once the (possibly coalesced) change was
+// written, rather than when the event is handled
+
 void State::react(events::audio::SetVolumeEvent *set_volume) {
-  app->audio_volume_controller->set_volume(set_volume->volume);
-  set_volume->resolve();
+  std::shared_ptr<events::Request<void>> request(set_volume->take_request());
+  int volume = app->audio_volume_controller->set_volume(
+      set_volume->volume, [request](int) { request->resolve(); });
+  app->leds->show_volume(volume);
+  app->track_volume(volume);
 }
 
 void State::react(events::audio::AdjVolumeEvent *adj_volume) {
-  app->audio_volume_controller->adjust_volume(adj_volume->delta);
-  adj_volume->resolve();
+  std::shared_ptr<events::Request<void>> request(adj_volume->take_request());
+  int volume = app->audio_volume_controller->adjust_volume(
+      adj_volume->delta, [request](int) { request->resolve(); });
+  app->leds->show_volume(volume);
+  app->track_volume(volume);
 }
 
 } // namespace state
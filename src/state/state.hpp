@@ -62,6 +62,8 @@ public:
   virtual void react(events::AdjustVolume *adjust_volume);
   virtual void react(events::TogglePlayback *);
   virtual void react(events::Panic *);
+  virtual void react(events::TalkPressed *);
+  virtual void react(events::TalkReleased *talk_released);
   virtual void react(events::ToggleDisabled *);
   virtual void react(events::PlayerStreamEnter *player_stream_enter);
   virtual void react(events::PlayerStreamEnd *player_stream_end);
@@ -71,6 +73,8 @@ public:
   virtual void react(events::audio::PrepareEvent *prepare);
   virtual void react(events::audio::PlayURLsEvent *play_urls);
   virtual void react(events::audio::StopEvent *stop);
+  virtual void react(events::audio::PauseEvent *pause);
+  virtual void react(events::audio::ResumeEvent *resume);
   virtual void react(events::audio::SetMuteEvent *set_mute);
   virtual void react(events::audio::SetVolumeEvent *set_volume);
   virtual void react(events::audio::AdjVolumeEvent *adj_volume);
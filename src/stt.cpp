@@ -17,6 +17,8 @@
 // limitations under the License.
 
 #include "stt.hpp"
+#include "utils/logging.hpp"
+#include "ws-protocol/stt.hpp"
 
 #include <cstring>
 #include <glib-object.h>
@@ -44,9 +46,25 @@ static std::string get_ws_url(genie::App *app) {
   return ws_url.str();
 }
 
-genie::STT::STT(App *app) : m_app(app), m_url(get_ws_url(app)) {
-  wake_word_pattern = std::regex(app->config->pv_wake_word_pattern,
-                                 std::regex_constants::icase);
+genie::WakeWordMatcher::WakeWordMatcher(const char *pattern)
+    : pattern(pattern, std::regex_constants::icase) {}
+
+bool genie::WakeWordMatcher::contains(const char *text) const {
+  return std::regex_search(text, pattern);
+}
+
+std::string genie::WakeWordMatcher::strip(const char *text) const {
+  return std::regex_replace(text, pattern, "");
+}
+
+genie::STT::STT(App *app)
+    : m_app(app), m_url(get_ws_url(app)),
+      wake_word(app->config->pv_wake_word_pattern) {}
+
+void genie::STT::reload_config() {
+  m_url = get_ws_url(m_app);
+  wake_word = WakeWordMatcher(m_app->config->pv_wake_word_pattern);
+  g_message("STT endpoint is now %s", m_url.c_str());
 }
 
 void genie::STT::complete_success(STTSession *session, const char *text) {
@@ -94,6 +112,26 @@ void genie::STT::send_done() {
 
 void genie::STT::abort() { send_done(); }
 
+void genie::STT::network_changed(bool has_route) {
+  if (has_route || !m_current_session)
+    return;
+
+  // a session that is still connecting fails by itself once the soup session
+  // is aborted, so only the established one needs to be torn down here
+  if (m_current_session->state() == STTSession::State::STREAMING) {
+    g_message("Network lost, abandoning STT session");
+    complete_error(m_current_session.get(), SOUP_WEBSOCKET_CLOSE_ABNORMAL,
+                   "network unavailable");
+  }
+}
+
+void genie::STT::report_memory(MemoryReport &report) {
+  size_t frames = 0;
+  size_t bytes =
+      m_current_session ? m_current_session->memory_usage(frames) : 0;
+  report.push_back({"stt_audio", bytes, frames});
+}
+
 void genie::STT::send_frame(AudioFrame frame) {
   if (!m_current_session) {
     g_warning("Sending audio frame without an active speech to text request");
@@ -134,11 +172,21 @@ void genie::STT::record_timing_event(STTSession *session,
 genie::STTSession::STTSession(STT *controller, const char *url,
                               bool is_follow_up)
     : m_controller(controller), m_state(State::INITIAL), m_done(false),
-      is_follow_up(is_follow_up), m_url(url), retries(0) {
+      is_follow_up(is_follow_up), m_url(url), retries(0), m_channel(nullptr) {
+  conversation::STTProtocol *channel = controller->m_app->get_stt_protocol();
+  if (channel && channel->begin(this, is_follow_up)) {
+    g_debug("STT streaming over the conversation connection");
+    m_channel = channel;
+    m_state = State::STREAMING;
+    return;
+  }
+
   connect();
 }
 
 genie::STTSession::~STTSession() {
+  if (m_channel)
+    m_channel->end(this);
   if (m_connection) {
     // remove all signals because the object was deleted
     g_signal_handlers_disconnect_by_data(m_connection.get(), this);
@@ -150,8 +198,8 @@ genie::STTSession::~STTSession() {
 void genie::STTSession::connect() {
   g_debug("STT connecting...\n");
 
-  auto_gobject_ptr<SoupMessage> msg(soup_message_new(SOUP_METHOD_GET, m_url),
-                                    adopt_mode::owned);
+  auto_gobject_ptr<SoupMessage> msg(
+      soup_message_new(SOUP_METHOD_GET, m_url.c_str()), adopt_mode::owned);
 
   soup_session_websocket_connect_async(
       m_controller->m_app->get_soup_session(), msg.get(), NULL, NULL, NULL,
@@ -199,8 +247,7 @@ void genie::STTSession::on_connection(SoupSession *session, GAsyncResult *res,
 
 void genie::STTSession::handle_stt_result(const char *text) {
   if (m_controller->m_app->config->hacks_wake_word_verification) {
-    bool has_wake_word =
-        std::regex_search(text, m_controller->wake_word_pattern);
+    bool has_wake_word = m_controller->wake_word.contains(text);
 
     if (!has_wake_word && !is_follow_up) {
       m_controller->complete_error(this, 404, "no wakeword");
@@ -208,8 +255,7 @@ void genie::STTSession::handle_stt_result(const char *text) {
     }
   }
 
-  std::string mangled =
-      std::regex_replace(text, m_controller->wake_word_pattern, "");
+  std::string mangled = m_controller->wake_word.strip(text);
 
   if (mangled.empty()) {
     m_controller->complete_error(this, 400, "wakeword only");
@@ -233,18 +279,27 @@ void genie::STTSession::on_message(SoupWebsocketConnection *conn, gint type,
     return;
   }
 
-  self->m_controller->record_timing_event(self, STT::Event::DONE);
-  self->m_state = State::CLOSING;
-
   gsize sz;
   const gchar *ptr = (const gchar *)g_bytes_get_data(message, &sz);
-  g_debug("WS Received data: %s\n", ptr);
+  GENIE_DEBUG("WS Received data: %.*s%s", genie::log::payload_length(sz), ptr,
+              genie::log::payload_suffix(sz));
 
   JsonParser *parser = json_parser_new();
   json_parser_load_from_data(parser, ptr, -1, NULL);
 
   JsonReader *reader = json_reader_new(json_parser_get_root(parser));
 
+  // note that this may free self
+  self->handle_result(reader);
+
+  g_object_unref(reader);
+  g_object_unref(parser);
+}
+
+void genie::STTSession::handle_result(JsonReader *reader) {
+  m_controller->record_timing_event(this, STT::Event::DONE);
+  m_state = State::CLOSING;
+
   json_reader_read_member(reader, "status");
   int status = json_reader_get_int_value(reader);
   json_reader_end_member(reader);
@@ -260,7 +315,7 @@ void genie::STTSession::on_message(SoupWebsocketConnection *conn, gint type,
       json_reader_end_member(reader);
 
       PROF_PRINT("STT text: %s\n", text);
-      self->handle_stt_result(text);
+      handle_stt_result(text);
     }
   } else {
     g_print("STT status %d\n", status);
@@ -269,11 +324,25 @@ void genie::STTSession::on_message(SoupWebsocketConnection *conn, gint type,
     const char *code = json_reader_get_string_value(reader);
     json_reader_end_member(reader);
 
-    self->m_controller->complete_error(self, status, code);
+    m_controller->complete_error(this, status, code);
   }
+}
 
-  g_object_unref(reader);
-  g_object_unref(parser);
+void genie::STTSession::channel_lost() {
+  g_message("Conversation connection lost during STT, falling back to %s",
+            m_url.c_str());
+  m_channel = nullptr;
+
+  // replay what the server never answered, then whatever is still queued
+  std::deque<AudioFrame> replay;
+  for (auto &frame : m_sent)
+    replay.push_back(std::move(frame));
+  m_sent.clear();
+  for (auto &frame : queue)
+    replay.push_back(std::move(frame));
+  queue.swap(replay);
+
+  connect();
 }
 
 void genie::STTSession::on_close(SoupWebsocketConnection *conn, gpointer data) {
@@ -297,10 +366,20 @@ void genie::STTSession::on_close(SoupWebsocketConnection *conn, gpointer data) {
 void genie::STTSession::flush_queue() {
   while (!queue.empty()) {
     dispatch_frame(std::move(queue.front()));
-    queue.pop();
+    queue.pop_front();
   }
 }
 
+size_t genie::STTSession::memory_usage(size_t &frames) const {
+  size_t bytes = 0;
+  for (const auto &frame : queue)
+    bytes += sizeof(AudioFrame) + frame.length * sizeof(int16_t);
+  for (const auto &frame : m_sent)
+    bytes += sizeof(AudioFrame) + frame.length * sizeof(int16_t);
+  frames = queue.size() + m_sent.size();
+  return bytes;
+}
+
 /**
  * @brief Queue an audio input (speech) frame to be sent to the Speech-To-Text
  * (STT) service.
@@ -322,7 +401,7 @@ void genie::STTSession::send_frame(AudioFrame frame) {
   } else {
     // The connection is not open yet, queue the frame to be sent when it does
     // open.
-    queue.push(std::move(frame));
+    queue.push_back(std::move(frame));
   }
 }
 
@@ -339,6 +418,18 @@ void genie::STTSession::send_done() {
 }
 
 void genie::STTSession::dispatch_frame(AudioFrame frame) {
+  if (m_channel) {
+    bool last = frame.length == 0;
+    // no connect on this path, the first frame starts the timings
+    if (m_sent.empty())
+      m_controller->record_timing_event(this, STT::Event::FIRST_FRAME);
+    m_channel->send_frame(this, frame);
+    m_sent.push_back(std::move(frame));
+    if (last)
+      m_controller->record_timing_event(this, STT::Event::LAST_FRAME);
+    return;
+  }
+
   soup_websocket_connection_send_binary(m_connection.get(), frame.samples,
                                         frame.length * sizeof(int16_t));
   if (frame.length == 0) {
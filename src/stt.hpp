@@ -19,17 +19,39 @@
 #pragma once
 
 #include <glib.h>
+#include <json-glib/json-glib.h>
 #include <libsoup/soup.h>
 
 #include "app.hpp"
 #include "utils/autoptrs.hpp"
-#include <queue>
+#include <deque>
 #include <regex>
+#include <string>
+#include <vector>
 
 namespace genie {
 
+namespace conversation {
+class STTProtocol;
+}
+
 class STT;
 
+/**
+ * @brief Finds and strips the wake word in STT transcripts, with the
+ * case-insensitive `pv_wake_word_pattern`.
+ */
+class WakeWordMatcher {
+public:
+  explicit WakeWordMatcher(const char *pattern);
+
+  bool contains(const char *text) const;
+  std::string strip(const char *text) const;
+
+private:
+  std::regex pattern;
+};
+
 class STTSession {
 public:
   enum class State {
@@ -44,13 +66,18 @@ private:
   STT *const m_controller;
 
   State m_state;
-  std::queue<AudioFrame> queue;
+  std::deque<AudioFrame> queue;
   auto_gobject_ptr<SoupWebsocketConnection> m_connection;
   bool m_done;
   bool is_follow_up;
-  const char *m_url;
+  const std::string m_url;
   int retries;
 
+  // set while streaming over the conversation websocket (protocol:stt); the
+  // frames sent there are kept to replay them if we have to fall back
+  conversation::STTProtocol *m_channel;
+  std::vector<AudioFrame> m_sent;
+
   void handle_stt_result(const char *text);
 
 public:
@@ -66,12 +93,30 @@ public:
 
   State state() const { return m_state; }
 
+  /**
+   * @brief Bytes of audio held by the session: queued until the connection
+   * opens, or kept for a replay. Sets `frames` to their number.
+   */
+  size_t memory_usage(size_t &frames) const;
+
   void flush_queue();
   void dispatch_frame(AudioFrame frame);
   gboolean is_connection_open() { return m_state == State::STREAMING; }
 
   void send_frame(AudioFrame frame);
   void send_done();
+
+  /**
+   * @brief Handle the final message from the server, from either transport.
+   * This may free the session.
+   */
+  void handle_result(JsonReader *reader);
+
+  /**
+   * @brief The conversation websocket closed while streaming over it.
+   * Reconnect through /voice/stream and send the audio again.
+   */
+  void channel_lost();
 };
 
 class STT {
@@ -85,6 +130,21 @@ public:
   void send_done();
   void abort();
 
+  /**
+   * @brief Abandon a streaming session when the default route goes away,
+   * rather than waiting for its socket to time out. There are no idle
+   * connections to invalidate, each session opens its own websocket.
+   */
+  void network_changed(bool has_route);
+
+  void report_memory(MemoryReport &report);
+
+  /**
+   * @brief Pick up a new nlUrl, locale or wake word pattern. A session in
+   * progress keeps the URL it started with.
+   */
+  void reload_config();
+
 private:
   enum class Event {
     CONNECT,
@@ -99,10 +159,10 @@ private:
   void record_timing_event(STTSession *session, Event ev);
 
   App *const m_app;
-  const std::string m_url;
+  std::string m_url;
   std::unique_ptr<STTSession> m_current_session;
 
-  std::regex wake_word_pattern;
+  WakeWordMatcher wake_word;
 
   struct timeval tConnect;
   struct timeval tFirstFrame;
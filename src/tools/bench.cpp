@@ -0,0 +1,362 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmarks for the client's hot paths.
+//
+// Each benchmark runs its body in batches until it has run for at least
+// the minimum time, and reports the mean cost per operation. The results
+// are printed to stdout as JSON, so they can be stored and compared
+// between releases:
+//
+//   {"version": "...", "benchmarks": [{"name": "...", "iterations": N,
+//    "ns_per_op": X, "ops_per_sec": Y}, ...]}
+//
+// Benchmarks of code with a fixed CPU budget also report "budget_ns", and
+// the run fails when one goes over it.
+
+#include "app.hpp"
+#include "audio/alsa/input.hpp"
+#include "audio/endpointer.hpp"
+#include "audio/inputquality.hpp"
+#include "stt.hpp"
+#include "utils/webrtc_vad.h"
+#include "ws-protocol/client.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <json-glib/json-glib.h>
+#include <string>
+#include <vector>
+
+namespace genie {
+namespace bench {
+
+/**
+ * Runs `App::dispatch()` and `App::handle()` on a bare App, with a state
+ * that only counts the frames it receives.
+ */
+class DispatchHarness {
+public:
+  DispatchHarness() : counting(&app) {
+    app.main_loop = g_main_loop_new(nullptr, FALSE);
+    app.current_state = &counting;
+  }
+
+  void run(size_t events) {
+    counting.received = 0;
+    for (size_t i = 0; i < events; i++) {
+      app.dispatch(new state::events::InputFrame(
+          AudioFrame(AUDIO_INPUT_VAD_FRAME_LENGTH)));
+    }
+    while (counting.received < events) {
+      g_main_context_iteration(nullptr, FALSE);
+    }
+  }
+
+private:
+  class CountingState : public state::State {
+  public:
+    static const constexpr char *NAME = "Counting";
+
+    CountingState(App *app) : State{app} {}
+
+    const char *name() override { return NAME; }
+    void react(state::events::InputFrame *) override { received++; }
+
+    size_t received = 0;
+  };
+
+  App app;
+  CountingState counting;
+};
+
+} // namespace bench
+} // namespace genie
+
+using namespace genie;
+
+namespace {
+
+struct Result {
+  std::string name;
+  size_t iterations;
+  double ns_per_op;
+  // 0 if the benchmark has no budget
+  double budget_ns;
+
+  bool over_budget() const { return budget_ns > 0 && ns_per_op > budget_ns; }
+};
+
+// per 30 ms input frame, on the slowest supported ARM boards in a debug
+// build: well under 0.1% of a core
+const double INPUT_QUALITY_BUDGET_NS = 20000;
+
+gint opt_min_time_ms = 500;
+gchar *opt_filter = nullptr;
+
+// keep the compiler from optimizing away a result
+void keep(const void *p) { asm volatile("" : : "r"(p) : "memory"); }
+
+/**
+ * @brief Time `body`, which performs `batch` operations per call, and
+ * check the cost per operation against `budget_ns` if set.
+ */
+void run(std::vector<Result> &results, const char *name, size_t batch,
+         const std::function<void()> &body, double budget_ns = 0) {
+  if (opt_filter && !strstr(name, opt_filter))
+    return;
+
+  using clock = std::chrono::steady_clock;
+  // warm up caches and lazy initialization
+  body();
+
+  size_t calls = 0;
+  auto min_time = std::chrono::milliseconds(opt_min_time_ms);
+  auto start = clock::now();
+  clock::duration elapsed;
+  do {
+    body();
+    calls++;
+    elapsed = clock::now() - start;
+  } while (elapsed < min_time);
+
+  Result result;
+  result.name = name;
+  result.iterations = calls * batch;
+  result.ns_per_op =
+      std::chrono::duration<double, std::nano>(elapsed).count() /
+      result.iterations;
+  result.budget_ns = budget_ns;
+  results.push_back(result);
+
+  g_printerr("%-36s %12.1f ns/op%s\n", name, result.ns_per_op,
+             result.over_budget() ? " OVER BUDGET" : "");
+}
+
+// a synthetic voiced signal: a few harmonics of 150 Hz plus some noise
+std::vector<int16_t> make_signal(size_t samples, size_t sample_rate) {
+  std::vector<int16_t> signal(samples);
+  guint32 seed = 1;
+  for (size_t i = 0; i < samples; i++) {
+    double t = (double)i / sample_rate;
+    double v = 0;
+    for (int h = 1; h <= 5; h++) {
+      v += sin(2 * G_PI * 150 * h * t) / h;
+    }
+    seed = seed * 1103515245 + 12345;
+    v += ((seed >> 16) & 0x7fff) / 32768.0 * 0.1 - 0.05;
+    signal[i] = (int16_t)(v * 6000);
+  }
+  return signal;
+}
+
+const char *CONVERSATION_MESSAGE =
+    "{\"type\":\"text\",\"id\":42,\"text\":\"The weather in Palo Alto "
+    "tomorrow is sunny, with a high of 72 and a low of 54 "
+    "degrees.\",\"icon\":\"org.thingpedia.weather\"}";
+
+void bench_dispatch(std::vector<Result> &results) {
+  bench::DispatchHarness harness;
+  const size_t batch = 1000;
+  run(results, "app/dispatch_handle", batch, [&]() { harness.run(batch); });
+}
+
+void bench_audio_frame(std::vector<Result> &results) {
+  run(results, "audio/frame_alloc_move", 1, []() {
+    AudioFrame frame(AUDIO_INPUT_VAD_FRAME_LENGTH);
+    AudioFrame moved(std::move(frame));
+    keep(moved.samples);
+  });
+}
+
+void bench_extract_channels(std::vector<Result> &results) {
+  const size_t frame_length = AUDIO_INPUT_VAD_FRAME_LENGTH;
+  std::vector<int16_t> pcm = make_signal(frame_length * 3, 16000);
+  std::vector<int16_t> mono(frame_length), playback(frame_length);
+
+  run(results, "alsa/extract_channels_stereo2mono", 1, [&]() {
+    AudioInputAlsa::extract_channels(pcm.data(), frame_length, 2, true,
+                                     mono.data(), nullptr);
+    keep(mono.data());
+  });
+  run(results, "alsa/extract_channels_ec_loopback", 1, [&]() {
+    AudioInputAlsa::extract_channels(pcm.data(), frame_length, 3, true,
+                                     mono.data(), playback.data());
+    keep(mono.data());
+    keep(playback.data());
+  });
+}
+
+void bench_vad(std::vector<Result> &results) {
+  const size_t sample_rate = 16000;
+  std::vector<int16_t> signal = make_signal(sample_rate, sample_rate);
+  const size_t frames = signal.size() / AUDIO_INPUT_VAD_FRAME_LENGTH;
+
+  VadInst *vad = WebRtcVad_Create();
+  if (WebRtcVad_Init(vad) || WebRtcVad_set_mode(vad, Endpointer::VAD_MODE)) {
+    g_error("failed to initialize webrtc vad");
+  }
+  run(results, "vad/process_frame", frames, [&]() {
+    int speech = 0;
+    for (size_t i = 0; i < frames; i++) {
+      speech += WebRtcVad_Process(
+          vad, sample_rate, signal.data() + i * AUDIO_INPUT_VAD_FRAME_LENGTH,
+          AUDIO_INPUT_VAD_FRAME_LENGTH);
+    }
+    keep(&speech);
+  });
+  WebRtcVad_Free(vad);
+}
+
+void bench_input_quality(std::vector<Result> &results) {
+  const size_t sample_rate = 16000;
+  std::vector<int16_t> signal = make_signal(sample_rate, sample_rate);
+  const size_t frames = signal.size() / AUDIO_INPUT_VAD_FRAME_LENGTH;
+
+  // same steps as AudioInput for every frame
+  InputQualityMeter meter;
+  meter.start_turn();
+  run(
+      results, "audio/input_quality_frame", frames,
+      [&]() {
+        for (size_t i = 0; i < frames; i++) {
+          FrameStats stats = FrameStats::compute(
+              signal.data() + i * AUDIO_INPUT_VAD_FRAME_LENGTH,
+              AUDIO_INPUT_VAD_FRAME_LENGTH);
+          meter.process(stats, sample_rate, i % 2);
+        }
+        keep(&meter);
+      },
+      INPUT_QUALITY_BUDGET_NS);
+}
+
+void bench_json(std::vector<Result> &results) {
+  run(results, "json/parse_message", 1, []() {
+    const char *type;
+    auto_gobject_ptr<JsonReader> reader =
+        conversation::Client::parse_message(CONVERSATION_MESSAGE, &type);
+    keep(type);
+  });
+
+  run(results, "json/serialize_command", 1, []() {
+    auto_gobject_ptr<JsonBuilder> builder =
+        conversation::Client::command_message(
+            "what's the weather like tomorrow");
+    gsize length;
+    gchar *str = conversation::Client::serialize(builder.get(), &length);
+    keep(str);
+    g_free(str);
+  });
+}
+
+void bench_regex(std::vector<Result> &results) {
+  // the checks of STTSession::handle_stt_result()
+  WakeWordMatcher wake_word(Config::DEFAULT_PV_WAKE_WORD_PATTERN);
+  const char *text = "Hey Genie, what's the weather like in Palo Alto "
+                     "tomorrow?";
+  run(results, "regex/wake_word_transcript", 1, [&]() {
+    bool has_wake_word = wake_word.contains(text);
+    std::string mangled = wake_word.strip(text);
+    keep(&has_wake_word);
+    keep(mangled.data());
+  });
+}
+
+void print_results(const std::vector<Result> &results) {
+  auto_gobject_ptr<JsonBuilder> builder(json_builder_new(), adopt_mode::owned);
+  json_builder_begin_object(builder.get());
+  json_builder_set_member_name(builder.get(), "version");
+  json_builder_add_string_value(builder.get(), PACKAGE_VERSION);
+  json_builder_set_member_name(builder.get(), "benchmarks");
+  json_builder_begin_array(builder.get());
+  for (const Result &result : results) {
+    json_builder_begin_object(builder.get());
+    json_builder_set_member_name(builder.get(), "name");
+    json_builder_add_string_value(builder.get(), result.name.c_str());
+    json_builder_set_member_name(builder.get(), "iterations");
+    json_builder_add_int_value(builder.get(), result.iterations);
+    json_builder_set_member_name(builder.get(), "ns_per_op");
+    json_builder_add_double_value(builder.get(), result.ns_per_op);
+    json_builder_set_member_name(builder.get(), "ops_per_sec");
+    json_builder_add_double_value(builder.get(), 1e9 / result.ns_per_op);
+    if (result.budget_ns > 0) {
+      json_builder_set_member_name(builder.get(), "budget_ns");
+      json_builder_add_double_value(builder.get(), result.budget_ns);
+    }
+    json_builder_end_object(builder.get());
+  }
+  json_builder_end_array(builder.get());
+  json_builder_end_object(builder.get());
+
+  JsonGenerator *gen = json_generator_new();
+  JsonNode *root = json_builder_get_root(builder.get());
+  json_generator_set_root(gen, root);
+  json_generator_set_pretty(gen, TRUE);
+  gchar *str = json_generator_to_data(gen, nullptr);
+  g_print("%s\n", str);
+  g_free(str);
+  json_node_free(root);
+  g_object_unref(gen);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  GOptionEntry entries[] = {
+      {"min-time", 't', 0, G_OPTION_ARG_INT, &opt_min_time_ms,
+       "Minimum run time of each benchmark, in ms (default: 500)", "MS"},
+      {"filter", 'f', 0, G_OPTION_ARG_STRING, &opt_filter,
+       "Only run the benchmarks whose name contains FILTER", "FILTER"},
+      {nullptr, 0, 0, G_OPTION_ARG_NONE, nullptr, nullptr, nullptr}};
+
+  GError *error = nullptr;
+  GOptionContext *context = g_option_context_new(nullptr);
+  g_option_context_set_summary(context,
+                               "Run the microbenchmarks and print the "
+                               "results as JSON.");
+  g_option_context_add_main_entries(context, entries, nullptr);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("option parsing failed: %s\n", error->message);
+    g_error_free(error);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free(context);
+
+  std::vector<Result> results;
+  bench_dispatch(results);
+  bench_audio_frame(results);
+  bench_extract_channels(results);
+  bench_vad(results);
+  bench_input_quality(results);
+  bench_json(results);
+  bench_regex(results);
+
+  print_results(results);
+  g_free(opt_filter);
+
+  for (const Result &result : results) {
+    if (result.over_budget()) {
+      g_printerr("%s is over its budget of %.0f ns/op\n",
+                 result.name.c_str(), result.budget_ns);
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
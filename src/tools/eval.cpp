@@ -0,0 +1,647 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Offline evaluation of the wake word and endpointing settings.
+//
+// Runs the same WakeWord and Endpointer code as AudioInput over a
+// directory of labelled recordings, for every combination of the given
+// settings, and reports error rates and latencies for each one.
+//
+// The corpus directory holds 16-bit mono WAV files at the wake word
+// sample rate and a `labels.tsv` file with one line per recording:
+//
+//   <file.wav> <keyword end ms | -> <speech end ms | ->
+//
+// A `-` keyword end marks a negative sample, which should never trigger
+// the wake word. Endpointing is evaluated on the recordings with a speech
+// end, starting at the labelled keyword end (or at the start of the file
+// for negative samples), so it does not depend on the wake word setting.
+
+#include "audio/endpointer.hpp"
+#include "audio/wakeword.hpp"
+#include "config.h"
+#include "config.hpp"
+#include "utils/webrtc_vad.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <glib.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace genie;
+
+namespace {
+
+struct Sample {
+  std::string name;
+  std::vector<int16_t> audio;
+  // negative if not present
+  double keyword_end_ms;
+  double speech_end_ms;
+
+  bool has_keyword() const { return keyword_end_ms >= 0; }
+  bool has_speech() const { return speech_end_ms >= 0; }
+};
+
+struct VadSetting {
+  size_t start_ms;
+  size_t done_ms;
+  size_t noise_ms;
+  size_t timeout_ms;
+  EndpointLimits limits;
+};
+
+struct WakeResult {
+  size_t detections = 0;
+  // time of the first detection, at the end of the detecting frame
+  double first_ms = -1;
+};
+
+struct EndpointResult {
+  // CONTINUE if the recording ended before the endpointer decided
+  Endpointer::Result result = Endpointer::Result::CONTINUE;
+  double end_ms = -1;
+};
+
+struct SampleResult {
+  std::vector<WakeResult> wake;
+  std::vector<EndpointResult> endpoint;
+};
+
+struct Options {
+  std::string library_path;
+  std::string model_path;
+  std::string keyword_path;
+  std::vector<float> sensitivities;
+  std::vector<VadSetting> vad_settings;
+  size_t jobs;
+};
+
+gboolean opt_verbose = false;
+
+GLogWriterOutput log_writer(GLogLevelFlags log_level, const GLogField *fields,
+                            gsize n_fields, gpointer user_data) {
+  if (!opt_verbose && (log_level & (G_LOG_LEVEL_MESSAGE | G_LOG_LEVEL_INFO |
+                                    G_LOG_LEVEL_DEBUG))) {
+    return G_LOG_WRITER_HANDLED;
+  }
+  return g_log_writer_default(log_level, fields, n_fields, user_data);
+}
+
+bool parse_size_list(const char *value, std::vector<size_t> &out) {
+  gchar **items = g_strsplit(value, ",", -1);
+  bool ok = true;
+  for (gchar **item = items; *item; item++) {
+    gchar *end;
+    guint64 parsed = g_ascii_strtoull(*item, &end, 10);
+    if (end == *item || *end != '\0') {
+      ok = false;
+      break;
+    }
+    out.push_back((size_t)parsed);
+  }
+  g_strfreev(items);
+  return ok && !out.empty();
+}
+
+bool parse_float_list(const char *value, std::vector<float> &out) {
+  gchar **items = g_strsplit(value, ",", -1);
+  bool ok = true;
+  for (gchar **item = items; *item; item++) {
+    gchar *end;
+    double parsed = g_ascii_strtod(*item, &end);
+    if (end == *item || *end != '\0' || parsed < 0 || parsed > 1) {
+      ok = false;
+      break;
+    }
+    out.push_back((float)parsed);
+  }
+  g_strfreev(items);
+  return ok && !out.empty();
+}
+
+uint32_t read_le32(const guint8 *data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+uint16_t read_le16(const guint8 *data) { return data[0] | (data[1] << 8); }
+
+/**
+ * @brief Load a 16-bit mono PCM WAV file at the given sample rate.
+ */
+bool load_wav(const char *filename, size_t sample_rate,
+              std::vector<int16_t> &audio) {
+  gchar *contents;
+  gsize length;
+  GError *error = nullptr;
+  if (!g_file_get_contents(filename, &contents, &length, &error)) {
+    g_warning("Failed to read %s: %s", filename, error->message);
+    g_error_free(error);
+    return false;
+  }
+
+  const guint8 *data = (const guint8 *)contents;
+  bool format_ok = false;
+  bool ok = false;
+  if (length < 12 || memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4)) {
+    g_warning("%s is not a WAV file", filename);
+    g_free(contents);
+    return false;
+  }
+
+  size_t offset = 12;
+  while (offset + 8 <= length) {
+    const guint8 *chunk = data + offset;
+    size_t chunk_size = read_le32(chunk + 4);
+    size_t available = std::min(chunk_size, length - offset - 8);
+
+    if (!memcmp(chunk, "fmt ", 4) && available >= 16) {
+      uint16_t format = read_le16(chunk + 8);
+      uint16_t channels = read_le16(chunk + 10);
+      uint32_t rate = read_le32(chunk + 12);
+      uint16_t bits = read_le16(chunk + 22);
+      format_ok =
+          format == 1 && channels == 1 && rate == sample_rate && bits == 16;
+      if (!format_ok) {
+        g_warning("%s: expected 16-bit mono PCM at %zu Hz, got format %u, "
+                  "%u channels, %u Hz, %u bits",
+                  filename, sample_rate, format, channels, rate, bits);
+        break;
+      }
+    } else if (!memcmp(chunk, "data", 4) && format_ok) {
+      size_t samples = available / 2;
+      audio.resize(samples);
+      for (size_t i = 0; i < samples; i++) {
+        audio[i] = (int16_t)read_le16(chunk + 8 + i * 2);
+      }
+      ok = true;
+      break;
+    }
+    // chunks are padded to an even size
+    offset += 8 + chunk_size + (chunk_size & 1);
+  }
+
+  if (format_ok && !ok)
+    g_warning("%s has no audio data", filename);
+  g_free(contents);
+  return ok;
+}
+
+bool parse_label_ms(const char *value, double &ms) {
+  if (!strcmp(value, "-")) {
+    ms = -1;
+    return true;
+  }
+  gchar *end;
+  ms = g_ascii_strtod(value, &end);
+  return end != value && *end == '\0' && ms >= 0;
+}
+
+bool load_corpus(const char *dir, size_t sample_rate,
+                 std::vector<Sample> &corpus) {
+  gchar *labels_path = g_build_filename(dir, "labels.tsv", nullptr);
+  gchar *contents;
+  GError *error = nullptr;
+  if (!g_file_get_contents(labels_path, &contents, nullptr, &error)) {
+    g_printerr("Failed to read %s: %s\n", labels_path, error->message);
+    g_error_free(error);
+    g_free(labels_path);
+    return false;
+  }
+
+  gchar **lines = g_strsplit(contents, "\n", -1);
+  g_free(contents);
+
+  size_t line_number = 0;
+  for (gchar **line = lines; *line; line++) {
+    line_number++;
+    g_strstrip(*line);
+    if ((*line)[0] == '\0' || (*line)[0] == '#')
+      continue;
+
+    char name[256], keyword_end[32], speech_end[32];
+    Sample sample;
+    if (sscanf(*line, "%255s %31s %31s", name, keyword_end, speech_end) != 3 ||
+        !parse_label_ms(keyword_end, sample.keyword_end_ms) ||
+        !parse_label_ms(speech_end, sample.speech_end_ms)) {
+      g_printerr("%s:%zu: malformed label line\n", labels_path, line_number);
+      continue;
+    }
+
+    gchar *filename = g_build_filename(dir, name, nullptr);
+    sample.name = name;
+    if (load_wav(filename, sample_rate, sample.audio))
+      corpus.push_back(std::move(sample));
+    g_free(filename);
+  }
+
+  g_strfreev(lines);
+  g_free(labels_path);
+  return !corpus.empty();
+}
+
+double samples_to_ms(size_t samples, size_t sample_rate) {
+  return samples * 1000.0 / sample_rate;
+}
+
+WakeResult run_wakeword(WakeWord &wakeword, const Sample &sample) {
+  WakeResult result;
+
+  // start each recording from a fresh engine
+  wakeword.release();
+  if (!wakeword.reload())
+    return result;
+
+  size_t frame_length = (size_t)wakeword.pv_frame_length;
+  for (size_t offset = 0; offset + frame_length <= sample.audio.size();
+       offset += frame_length) {
+    AudioFrame frame(frame_length);
+    memcpy(frame.samples, sample.audio.data() + offset,
+           frame_length * sizeof(int16_t));
+    if (wakeword.process(&frame)) {
+      if (result.detections == 0) {
+        result.first_ms =
+            samples_to_ms(offset + frame_length, wakeword.sample_rate);
+      }
+      result.detections++;
+    }
+  }
+  return result;
+}
+
+/**
+ * @brief Replay the VAD decisions through the endpointer, the way
+ * AudioInput does in the WOKE and LISTENING states.
+ */
+EndpointResult run_endpointer(const std::vector<int> &vad, double start_ms,
+                              size_t sample_rate, const VadSetting &setting) {
+  Endpointer endpointer;
+  EndpointResult result;
+  bool listening = false;
+
+  for (size_t i = 0; i < vad.size(); i++) {
+    Endpointer::Result r =
+        listening ? endpointer.process_listening(vad[i], setting.limits)
+                  : endpointer.process_woke(vad[i], setting.limits);
+    if (r == Endpointer::Result::CONTINUE)
+      continue;
+    if (r == Endpointer::Result::STARTED) {
+      endpointer.reset();
+      listening = true;
+      continue;
+    }
+
+    result.result = r;
+    result.end_ms =
+        start_ms +
+        samples_to_ms((i + 1) * AUDIO_INPUT_VAD_FRAME_LENGTH, sample_rate);
+    break;
+  }
+  return result;
+}
+
+void run_worker(const Options &options, const std::vector<Sample> &corpus,
+                std::vector<SampleResult> &results,
+                std::atomic<size_t> &next) {
+  std::vector<std::unique_ptr<WakeWord>> wakewords;
+  for (float sensitivity : options.sensitivities) {
+    wakewords.push_back(std::make_unique<WakeWord>(
+        options.library_path, options.model_path, options.keyword_path,
+        sensitivity));
+  }
+  size_t sample_rate = wakewords.front()->sample_rate;
+
+  VadInst *vad_instance = WebRtcVad_Create();
+
+  for (size_t index = next++; index < corpus.size(); index = next++) {
+    const Sample &sample = corpus[index];
+    SampleResult &result = results[index];
+
+    for (auto &wakeword : wakewords) {
+      result.wake.push_back(run_wakeword(*wakeword, sample));
+    }
+
+    if (!sample.has_speech())
+      continue;
+
+    // the VAD decisions do not depend on the setting, compute them once
+    double start_ms = std::max(sample.keyword_end_ms, 0.0);
+    size_t start = (size_t)(start_ms * sample_rate / 1000);
+    std::vector<int> vad;
+    if (WebRtcVad_Init(vad_instance) ||
+        WebRtcVad_set_mode(vad_instance, Endpointer::VAD_MODE)) {
+      g_error("failed to initialize webrtc vad");
+    }
+    for (size_t offset = start;
+         offset + AUDIO_INPUT_VAD_FRAME_LENGTH <= sample.audio.size();
+         offset += AUDIO_INPUT_VAD_FRAME_LENGTH) {
+      vad.push_back(WebRtcVad_Process(vad_instance, sample_rate,
+                                      sample.audio.data() + offset,
+                                      AUDIO_INPUT_VAD_FRAME_LENGTH));
+    }
+
+    for (const VadSetting &setting : options.vad_settings) {
+      result.endpoint.push_back(
+          run_endpointer(vad, start_ms, sample_rate, setting));
+    }
+  }
+
+  WebRtcVad_Free(vad_instance);
+}
+
+double percentile(std::vector<double> values, double p) {
+  if (values.empty())
+    return 0;
+  std::sort(values.begin(), values.end());
+  size_t index = (size_t)(p * (values.size() - 1) + 0.5);
+  return values[index];
+}
+
+double mean(const std::vector<double> &values) {
+  if (values.empty())
+    return 0;
+  double sum = 0;
+  for (double v : values)
+    sum += v;
+  return sum / values.size();
+}
+
+double rate(size_t count, size_t total) {
+  return total ? 100.0 * count / total : 0;
+}
+
+void report_wakeword(const Options &options, const std::vector<Sample> &corpus,
+                     const std::vector<SampleResult> &results,
+                     size_t sample_rate) {
+  g_print("\nWake word (latency from labelled keyword end, ms)\n");
+  g_print("%-11s %9s %9s %9s %9s %8s %8s %8s\n", "sensitivity", "FR %",
+          "FA files", "FA %", "FA/hour", "mean", "p50", "p90");
+
+  for (size_t s = 0; s < options.sensitivities.size(); s++) {
+    size_t positives = 0, rejected = 0;
+    size_t negatives = 0, accepted_files = 0, accepts = 0;
+    double negative_ms = 0;
+    std::vector<double> latencies;
+
+    for (size_t i = 0; i < corpus.size(); i++) {
+      const WakeResult &wake = results[i].wake[s];
+      if (corpus[i].has_keyword()) {
+        positives++;
+        if (wake.detections == 0)
+          rejected++;
+        else
+          latencies.push_back(wake.first_ms - corpus[i].keyword_end_ms);
+      } else {
+        negatives++;
+        negative_ms += samples_to_ms(corpus[i].audio.size(), sample_rate);
+        accepts += wake.detections;
+        if (wake.detections > 0)
+          accepted_files++;
+      }
+    }
+
+    double hours = negative_ms / 3600000;
+    g_print("%-11.2f %9.2f %9zu %9.2f %9.2f %8.0f %8.0f %8.0f\n",
+            options.sensitivities[s], rate(rejected, positives),
+            accepted_files, rate(accepted_files, negatives),
+            hours > 0 ? accepts / hours : 0.0, mean(latencies),
+            percentile(latencies, 0.5), percentile(latencies, 0.9));
+  }
+}
+
+void report_endpoint(const Options &options, const std::vector<Sample> &corpus,
+                     const std::vector<SampleResult> &results) {
+  g_print("\nEndpointing (latency from labelled speech end, ms)\n");
+  g_print("%-24s %6s %8s %8s %8s %8s %8s %8s %8s\n",
+          "start/done/noise/timeout", "n", "trunc %", "nospch %", "tmout %",
+          "eof %", "mean", "p50", "p90");
+
+  for (size_t v = 0; v < options.vad_settings.size(); v++) {
+    const VadSetting &setting = options.vad_settings[v];
+    size_t total = 0, truncated = 0, no_speech = 0, timeouts = 0, eof = 0;
+    std::vector<double> latencies;
+
+    for (size_t i = 0; i < corpus.size(); i++) {
+      if (!corpus[i].has_speech())
+        continue;
+      const EndpointResult &endpoint = results[i].endpoint[v];
+      total++;
+
+      switch (endpoint.result) {
+        case Endpointer::Result::CONTINUE:
+          eof++;
+          continue;
+        case Endpointer::Result::NO_SPEECH:
+          no_speech++;
+          break;
+        case Endpointer::Result::TIMEOUT:
+          timeouts++;
+          break;
+        default:
+          break;
+      }
+
+      // any decision before the user stopped speaking cuts the command
+      if (endpoint.end_ms < corpus[i].speech_end_ms)
+        truncated++;
+      else if (endpoint.result == Endpointer::Result::DONE)
+        latencies.push_back(endpoint.end_ms - corpus[i].speech_end_ms);
+    }
+
+    gchar *label =
+        g_strdup_printf("%zu/%zu/%zu/%zu", setting.start_ms, setting.done_ms,
+                        setting.noise_ms, setting.timeout_ms);
+    g_print("%-24s %6zu %8.2f %8.2f %8.2f %8.2f %8.0f %8.0f %8.0f\n", label,
+            total, rate(truncated, total), rate(no_speech, total),
+            rate(timeouts, total), rate(eof, total), mean(latencies),
+            percentile(latencies, 0.5), percentile(latencies, 0.9));
+    g_free(label);
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  gchar *opt_assets = nullptr;
+  gchar *opt_model = nullptr;
+  gchar *opt_keyword = nullptr;
+  gchar *opt_sensitivity = nullptr;
+  gchar *opt_start_ms = nullptr;
+  gchar *opt_done_ms = nullptr;
+  gchar *opt_noise_ms = nullptr;
+  gchar *opt_timeout_ms = nullptr;
+  gint opt_jobs = 0;
+
+  GOptionEntry entries[] = {
+      {"assets", 'a', 0, G_OPTION_ARG_FILENAME, &opt_assets,
+       "Directory with the Porcupine library, model and keyword", "DIR"},
+      {"model", 'm', 0, G_OPTION_ARG_FILENAME, &opt_model,
+       "Porcupine model, relative to the assets directory", "PATH"},
+      {"keyword", 'k', 0, G_OPTION_ARG_FILENAME, &opt_keyword,
+       "Porcupine keyword, relative to the assets directory", "PATH"},
+      {"sensitivity", 's', 0, G_OPTION_ARG_STRING, &opt_sensitivity,
+       "Comma-separated wake word sensitivities", "LIST"},
+      {"start-ms", 0, 0, G_OPTION_ARG_STRING, &opt_start_ms,
+       "Comma-separated vad_start_speaking_ms values", "LIST"},
+      {"done-ms", 0, 0, G_OPTION_ARG_STRING, &opt_done_ms,
+       "Comma-separated vad_done_speaking_ms values", "LIST"},
+      {"noise-ms", 0, 0, G_OPTION_ARG_STRING, &opt_noise_ms,
+       "Comma-separated vad_input_detected_noise_ms values", "LIST"},
+      {"timeout-ms", 0, 0, G_OPTION_ARG_STRING, &opt_timeout_ms,
+       "Comma-separated vad_listen_timeout_ms values", "LIST"},
+      {"jobs", 'j', 0, G_OPTION_ARG_INT, &opt_jobs,
+       "Number of worker threads (default: one per core)", "N"},
+      {"verbose", 'v', 0, G_OPTION_ARG_NONE, &opt_verbose,
+       "Show the wake word engine messages", nullptr},
+      {nullptr, 0, 0, G_OPTION_ARG_NONE, nullptr, nullptr, nullptr}};
+
+  GError *error = nullptr;
+  GOptionContext *context = g_option_context_new("CORPUS_DIR");
+  g_option_context_set_summary(
+      context, "Evaluate wake word and endpointing settings on a directory "
+               "of labelled recordings.");
+  g_option_context_add_main_entries(context, entries, nullptr);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("option parsing failed: %s\n", error->message);
+    g_error_free(error);
+    return EXIT_FAILURE;
+  }
+  if (argc != 2) {
+    gchar *help = g_option_context_get_help(context, TRUE, nullptr);
+    g_printerr("%s", help);
+    g_free(help);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free(context);
+
+  g_log_set_writer_func(log_writer, nullptr, nullptr);
+
+  const char *assets = opt_assets ? opt_assets : pkglibdir "/assets";
+  Options options;
+  options.library_path = WakeWord::asset_path(assets, "libpv_porcupine.so");
+  options.model_path = WakeWord::asset_path(
+      assets, opt_model ? opt_model : Config::DEFAULT_PV_MODEL_PATH);
+  options.keyword_path = WakeWord::asset_path(
+      assets, opt_keyword ? opt_keyword : Config::DEFAULT_PV_KEYWORD_PATH);
+
+  if (opt_sensitivity) {
+    if (!parse_float_list(opt_sensitivity, options.sensitivities)) {
+      g_printerr("invalid sensitivity list: %s\n", opt_sensitivity);
+      return EXIT_FAILURE;
+    }
+  } else {
+    options.sensitivities.push_back((float)Config::DEFAULT_PV_SENSITIVITY);
+  }
+
+  std::vector<size_t> start_ms, done_ms, noise_ms, timeout_ms;
+  struct {
+    const char *name;
+    const gchar *value;
+    size_t fallback;
+    std::vector<size_t> &list;
+  } vad_options[] = {
+      {"start-ms", opt_start_ms, (size_t)Config::DEFAULT_VAD_START_SPEAKING_MS,
+       start_ms},
+      {"done-ms", opt_done_ms, (size_t)Config::DEFAULT_VAD_DONE_SPEAKING_MS,
+       done_ms},
+      {"noise-ms", opt_noise_ms,
+       (size_t)Config::DEFAULT_VAD_INPUT_DETECTED_NOISE_MS, noise_ms},
+      {"timeout-ms", opt_timeout_ms,
+       (size_t)Config::DEFAULT_VAD_LISTEN_TIMEOUT_MS, timeout_ms},
+  };
+  for (auto &option : vad_options) {
+    if (!option.value) {
+      option.list.push_back(option.fallback);
+    } else if (!parse_size_list(option.value, option.list)) {
+      g_printerr("invalid %s list: %s\n", option.name, option.value);
+      return EXIT_FAILURE;
+    }
+  }
+
+  options.jobs = opt_jobs > 0 ? (size_t)opt_jobs : g_get_num_processors();
+
+  // probe the engine once for its sample rate, and to fail early on a bad
+  // asset path
+  size_t sample_rate;
+  {
+    WakeWord probe(options.library_path, options.model_path,
+                   options.keyword_path, options.sensitivities.front());
+    sample_rate = probe.sample_rate;
+  }
+
+  for (size_t start : start_ms)
+    for (size_t done : done_ms)
+      for (size_t noise : noise_ms)
+        for (size_t timeout : timeout_ms) {
+          VadSetting setting;
+          setting.start_ms = start;
+          setting.done_ms = done;
+          setting.noise_ms = noise;
+          setting.timeout_ms = timeout;
+          setting.limits =
+              EndpointLimits::from_ms(sample_rate, start, done, noise, timeout);
+          options.vad_settings.push_back(setting);
+        }
+
+  std::vector<Sample> corpus;
+  if (!load_corpus(argv[1], sample_rate, corpus)) {
+    g_printerr("No usable recordings in %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  size_t positives =
+      std::count_if(corpus.begin(), corpus.end(),
+                    [](const Sample &s) { return s.has_keyword(); });
+  g_print("Evaluating %zu recordings (%zu with keyword), %zu wake word and "
+          "%zu endpointing settings on %zu threads\n",
+          corpus.size(), positives, options.sensitivities.size(),
+          options.vad_settings.size(), options.jobs);
+
+  std::vector<SampleResult> results(corpus.size());
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  gint64 started = g_get_monotonic_time();
+  for (size_t i = 0; i < std::min(options.jobs, corpus.size()); i++) {
+    workers.emplace_back(run_worker, std::cref(options), std::cref(corpus),
+                         std::ref(results), std::ref(next));
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  g_print("Done in %.1f s\n", (g_get_monotonic_time() - started) / 1e6);
+
+  report_wakeword(options, corpus, results, sample_rate);
+  report_endpoint(options, corpus, results);
+
+  g_free(opt_assets);
+  g_free(opt_model);
+  g_free(opt_keyword);
+  g_free(opt_sensitivity);
+  g_free(opt_start_ms);
+  g_free(opt_done_ms);
+  g_free(opt_noise_ms);
+  g_free(opt_timeout_ms);
+  return EXIT_SUCCESS;
+}
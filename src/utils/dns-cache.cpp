@@ -0,0 +1,550 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "dns-cache.hpp"
+#include "logging.hpp"
+
+#include <libsoup/soup.h>
+#include <memory>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::DNSCache"
+
+// GResolver subclass that forwards to genie::DNSCache
+
+struct GenieCachingResolver {
+  GResolver parent_instance;
+  genie::DNSCache *cache;
+};
+
+struct GenieCachingResolverClass {
+  GResolverClass parent_class;
+};
+
+G_DEFINE_TYPE(GenieCachingResolver, genie_caching_resolver, G_TYPE_RESOLVER)
+
+static genie::DNSCache *get_cache(GResolver *resolver) {
+  return reinterpret_cast<GenieCachingResolver *>(resolver)->cache;
+}
+
+static GList *resolver_lookup_by_name(GResolver *resolver, const gchar *host,
+                                      GCancellable *cancellable,
+                                      GError **error) {
+  return get_cache(resolver)->lookup(host, 0, cancellable, error);
+}
+
+static void resolver_lookup_by_name_async(GResolver *resolver,
+                                          const gchar *host,
+                                          GCancellable *cancellable,
+                                          GAsyncReadyCallback callback,
+                                          gpointer data) {
+  GTask *task = g_task_new(resolver, cancellable, callback, data);
+  get_cache(resolver)->lookup_async(host, 0, task);
+}
+
+static GList *resolver_lookup_finish(GResolver *resolver, GAsyncResult *result,
+                                     GError **error) {
+  return static_cast<GList *>(g_task_propagate_pointer(G_TASK(result), error));
+}
+
+#if GLIB_CHECK_VERSION(2, 60, 0)
+static GList *
+resolver_lookup_by_name_with_flags(GResolver *resolver, const gchar *host,
+                                   GResolverNameLookupFlags flags,
+                                   GCancellable *cancellable, GError **error) {
+  return get_cache(resolver)->lookup(host, flags, cancellable, error);
+}
+
+static void resolver_lookup_by_name_with_flags_async(
+    GResolver *resolver, const gchar *host, GResolverNameLookupFlags flags,
+    GCancellable *cancellable, GAsyncReadyCallback callback, gpointer data) {
+  GTask *task = g_task_new(resolver, cancellable, callback, data);
+  get_cache(resolver)->lookup_async(host, flags, task);
+}
+#endif
+
+// reverse, SRV and record lookups are not cached, they go straight upstream
+
+static gchar *resolver_lookup_by_address(GResolver *resolver,
+                                         GInetAddress *address,
+                                         GCancellable *cancellable,
+                                         GError **error) {
+  return g_resolver_lookup_by_address(get_cache(resolver)->upstream_resolver(),
+                                      address, cancellable, error);
+}
+
+static void resolver_lookup_by_address_async(GResolver *resolver,
+                                             GInetAddress *address,
+                                             GCancellable *cancellable,
+                                             GAsyncReadyCallback callback,
+                                             gpointer data) {
+  GTask *task = g_task_new(resolver, cancellable, callback, data);
+  g_resolver_lookup_by_address_async(
+      get_cache(resolver)->upstream_resolver(), address, cancellable,
+      [](GObject *source, GAsyncResult *result, gpointer data) {
+        GTask *task = G_TASK(data);
+        GError *error = nullptr;
+        gchar *name = g_resolver_lookup_by_address_finish(G_RESOLVER(source),
+                                                          result, &error);
+        if (error)
+          g_task_return_error(task, error);
+        else
+          g_task_return_pointer(task, name, g_free);
+        g_object_unref(task);
+      },
+      task);
+}
+
+static gchar *resolver_lookup_by_address_finish(GResolver *resolver,
+                                                GAsyncResult *result,
+                                                GError **error) {
+  return static_cast<gchar *>(g_task_propagate_pointer(G_TASK(result), error));
+}
+
+static GList *resolver_lookup_service(GResolver *resolver, const gchar *rrname,
+                                      GCancellable *cancellable,
+                                      GError **error) {
+  GResolverClass *klass =
+      G_RESOLVER_GET_CLASS(get_cache(resolver)->upstream_resolver());
+  return klass->lookup_service(get_cache(resolver)->upstream_resolver(), rrname,
+                               cancellable, error);
+}
+
+static void resolver_lookup_service_async(GResolver *resolver,
+                                          const gchar *rrname,
+                                          GCancellable *cancellable,
+                                          GAsyncReadyCallback callback,
+                                          gpointer data) {
+  GResolver *upstream = get_cache(resolver)->upstream_resolver();
+  GTask *task = g_task_new(resolver, cancellable, callback, data);
+  G_RESOLVER_GET_CLASS(upstream)->lookup_service_async(
+      upstream, rrname, cancellable,
+      [](GObject *source, GAsyncResult *result, gpointer data) {
+        GTask *task = G_TASK(data);
+        GError *error = nullptr;
+        GList *targets = G_RESOLVER_GET_CLASS(source)->lookup_service_finish(
+            G_RESOLVER(source), result, &error);
+        if (error)
+          g_task_return_error(task, error);
+        else
+          g_task_return_pointer(task, targets,
+                                (GDestroyNotify)g_resolver_free_targets);
+        g_object_unref(task);
+      },
+      task);
+}
+
+static GList *resolver_lookup_records(GResolver *resolver, const gchar *rrname,
+                                      GResolverRecordType record_type,
+                                      GCancellable *cancellable,
+                                      GError **error) {
+  return g_resolver_lookup_records(get_cache(resolver)->upstream_resolver(),
+                                   rrname, record_type, cancellable, error);
+}
+
+static void free_records(gpointer records) {
+  g_list_free_full(static_cast<GList *>(records),
+                   (GDestroyNotify)g_variant_unref);
+}
+
+static void resolver_lookup_records_async(GResolver *resolver,
+                                          const gchar *rrname,
+                                          GResolverRecordType record_type,
+                                          GCancellable *cancellable,
+                                          GAsyncReadyCallback callback,
+                                          gpointer data) {
+  GTask *task = g_task_new(resolver, cancellable, callback, data);
+  g_resolver_lookup_records_async(
+      get_cache(resolver)->upstream_resolver(), rrname, record_type,
+      cancellable,
+      [](GObject *source, GAsyncResult *result, gpointer data) {
+        GTask *task = G_TASK(data);
+        GError *error = nullptr;
+        GList *records = g_resolver_lookup_records_finish(G_RESOLVER(source),
+                                                          result, &error);
+        if (error)
+          g_task_return_error(task, error);
+        else
+          g_task_return_pointer(task, records, free_records);
+        g_object_unref(task);
+      },
+      task);
+}
+
+static void genie_caching_resolver_class_init(GenieCachingResolverClass *klass) {
+  GResolverClass *resolver_class = G_RESOLVER_CLASS(klass);
+
+  resolver_class->lookup_by_name = resolver_lookup_by_name;
+  resolver_class->lookup_by_name_async = resolver_lookup_by_name_async;
+  resolver_class->lookup_by_name_finish = resolver_lookup_finish;
+#if GLIB_CHECK_VERSION(2, 60, 0)
+  resolver_class->lookup_by_name_with_flags =
+      resolver_lookup_by_name_with_flags;
+  resolver_class->lookup_by_name_with_flags_async =
+      resolver_lookup_by_name_with_flags_async;
+  resolver_class->lookup_by_name_with_flags_finish = resolver_lookup_finish;
+#endif
+  resolver_class->lookup_by_address = resolver_lookup_by_address;
+  resolver_class->lookup_by_address_async = resolver_lookup_by_address_async;
+  resolver_class->lookup_by_address_finish = resolver_lookup_by_address_finish;
+  resolver_class->lookup_service = resolver_lookup_service;
+  resolver_class->lookup_service_async = resolver_lookup_service_async;
+  resolver_class->lookup_service_finish = resolver_lookup_finish;
+  resolver_class->lookup_records = resolver_lookup_records;
+  resolver_class->lookup_records_async = resolver_lookup_records_async;
+  resolver_class->lookup_records_finish = resolver_lookup_finish;
+}
+
+static void genie_caching_resolver_init(GenieCachingResolver *self) {
+  self->cache = nullptr;
+}
+
+// DNSCache
+
+genie::DNSCache::DNSCache(guint ttl_s, guint stale_s)
+    : ttl_us((gint64)ttl_s * G_USEC_PER_SEC),
+      stale_us((gint64)stale_s * G_USEC_PER_SEC) {
+  upstream = g_resolver_get_default();
+
+  GenieCachingResolver *self = reinterpret_cast<GenieCachingResolver *>(
+      g_object_new(genie_caching_resolver_get_type(), nullptr));
+  self->cache = this;
+  resolver = G_RESOLVER(self);
+  g_resolver_set_default(resolver);
+
+  prefetch_timeout_id =
+      g_timeout_add_seconds(MAX(1, ttl_s / 10), prefetch_tick, this);
+}
+
+genie::DNSCache::~DNSCache() {
+  g_source_remove(prefetch_timeout_id);
+  g_resolver_set_default(upstream);
+  reinterpret_cast<GenieCachingResolver *>(resolver)->cache = nullptr;
+  g_object_unref(resolver);
+  g_object_unref(upstream);
+
+  for (auto &it : entries)
+    g_resolver_free_addresses(it.second.addresses);
+}
+
+std::string genie::DNSCache::make_key(const char *host, int flags) {
+  std::string key(host);
+  key += '/';
+  key += std::to_string(flags);
+  return key;
+}
+
+GList *genie::DNSCache::copy_addresses(GList *addresses) {
+  return g_list_copy_deep(addresses, (GCopyFunc)g_object_ref, nullptr);
+}
+
+void genie::DNSCache::free_addresses(gpointer addresses) {
+  g_resolver_free_addresses(static_cast<GList *>(addresses));
+}
+
+void genie::DNSCache::store(Entry &entry, GList *addresses) {
+  g_resolver_free_addresses(entry.addresses);
+  entry.addresses = addresses;
+  entry.expires = g_get_monotonic_time() + ttl_us;
+  entry.invalidated = false;
+}
+
+bool genie::DNSCache::can_serve(const Entry &entry, gint64 now) const {
+  return entry.addresses && !entry.invalidated &&
+         now < entry.expires + stale_us;
+}
+
+/**
+ * @brief Drop the entries past their stale window, and the oldest ones
+ * beyond `MAX_ENTRIES`. Pinned entries, entries being resolved and `keep`
+ * stay. Called with `mutex` held.
+ */
+void genie::DNSCache::evict(gint64 now, const std::string &keep) {
+  auto removable = [&](const std::pair<const std::string, Entry> &it) {
+    return !it.second.pinned && !it.second.resolving && it.first != keep;
+  };
+
+  for (auto it = entries.begin(); it != entries.end();) {
+    if (removable(*it) && now >= it->second.expires + stale_us) {
+      g_resolver_free_addresses(it->second.addresses);
+      it = entries.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  while (entries.size() > MAX_ENTRIES) {
+    auto oldest = entries.end();
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+      if (removable(*it) && (oldest == entries.end() ||
+                             it->second.expires < oldest->second.expires))
+        oldest = it;
+    }
+    if (oldest == entries.end())
+      break;
+    g_resolver_free_addresses(oldest->second.addresses);
+    entries.erase(oldest);
+  }
+}
+
+void genie::DNSCache::pin_url(const char *url) {
+  SoupURI *uri = soup_uri_new(url);
+  if (!uri)
+    return;
+
+  const char *host = soup_uri_get_host(uri);
+  if (host && !g_hostname_is_ip_address(host)) {
+    std::string key = make_key(host, 0);
+    bool start;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Entry &entry = entries[key];
+      entry.host = host;
+      entry.pinned = true;
+      start = !entry.resolving && !entry.addresses;
+      if (start)
+        entry.resolving = true;
+    }
+    if (start) {
+      g_debug("Prefetching %s", host);
+      start_refresh(key, host, 0);
+    }
+  }
+
+  soup_uri_free(uri);
+}
+
+void genie::DNSCache::invalidate() {
+  gint64 now = g_get_monotonic_time();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = entries.begin(); it != entries.end();) {
+      Entry &entry = it->second;
+      if (!entry.pinned && !entry.resolving) {
+        g_resolver_free_addresses(entry.addresses);
+        it = entries.erase(it);
+        continue;
+      }
+      entry.expires = MIN(entry.expires, now);
+      entry.invalidated = true;
+      ++it;
+    }
+  }
+  // resolve the pinned hosts now rather than on the next prefetch tick; the
+  // reconnect that follows a network change waits for the new addresses
+  prefetch_tick(this);
+}
+
+void genie::DNSCache::report_memory(MemoryReport &report) {
+  std::lock_guard<std::mutex> lock(mutex);
+  size_t bytes = 0;
+  for (const auto &it : entries) {
+    // GInetAddress is opaque, count 64 bytes for each
+    bytes += sizeof(Entry) + it.first.size() + it.second.host.size() +
+             g_list_length(it.second.addresses) * (sizeof(GList) + 64);
+  }
+  report.push_back({"dns_cache", bytes, entries.size()});
+}
+
+void genie::DNSCache::shed_memory() {
+  std::lock_guard<std::mutex> lock(mutex);
+  size_t before = entries.size();
+  for (auto it = entries.begin(); it != entries.end();) {
+    if (it->second.pinned || it->second.resolving) {
+      ++it;
+      continue;
+    }
+    g_resolver_free_addresses(it->second.addresses);
+    it = entries.erase(it);
+  }
+  g_message("Dropped %zu of %zu cached host names", before - entries.size(),
+            before);
+}
+
+gboolean genie::DNSCache::prefetch_tick(gpointer data) {
+  DNSCache *self = static_cast<DNSCache *>(data);
+  gint64 now = g_get_monotonic_time();
+  gint64 refresh_at = now + self->ttl_us / 10;
+
+  std::vector<std::pair<std::string, std::string>> due;
+  {
+    std::lock_guard<std::mutex> lock(self->mutex);
+    self->evict(now, std::string());
+    for (auto &it : self->entries) {
+      Entry &entry = it.second;
+      if (entry.pinned && !entry.resolving && entry.expires < refresh_at) {
+        entry.resolving = true;
+        due.emplace_back(it.first, entry.host);
+      }
+    }
+  }
+
+  for (const auto &it : due)
+    self->start_refresh(it.first, it.second, 0);
+
+  return G_SOURCE_CONTINUE;
+}
+
+GList *genie::DNSCache::lookup(const char *host, int flags,
+                               GCancellable *cancellable, GError **error) {
+  std::string key = make_key(host, flags);
+  gint64 now = g_get_monotonic_time();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it != entries.end() && can_serve(it->second, now)) {
+      // stale entries are refreshed by the next async lookup or prefetch
+      GENIE_DEBUG("Cache hit for %s%s", host,
+                  now < it->second.expires ? "" : " (stale)");
+      return copy_addresses(it->second.addresses);
+    }
+  }
+
+  GList *addresses;
+#if GLIB_CHECK_VERSION(2, 60, 0)
+  addresses = g_resolver_lookup_by_name_with_flags(
+      upstream, host, (GResolverNameLookupFlags)flags, cancellable, error);
+#else
+  addresses = g_resolver_lookup_by_name(upstream, host, cancellable, error);
+#endif
+  g_message("Resolved %s in %.1f ms%s", host,
+            (g_get_monotonic_time() - now) / 1000.0,
+            addresses ? "" : " (failed)");
+  if (!addresses)
+    return nullptr;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  Entry &entry = entries[key];
+  entry.host = host;
+  entry.flags = flags;
+  store(entry, copy_addresses(addresses));
+  if (entries.size() > MAX_ENTRIES)
+    evict(now, key);
+  return addresses;
+}
+
+void genie::DNSCache::lookup_async(const char *host, int flags, GTask *task) {
+  std::string key = make_key(host, flags);
+  gint64 now = g_get_monotonic_time();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  Entry &entry = entries[key];
+  entry.host = host;
+  entry.flags = flags;
+
+  if (can_serve(entry, now)) {
+    bool stale = now >= entry.expires;
+    bool refresh = stale && !entry.resolving;
+    if (refresh)
+      entry.resolving = true;
+    GList *addresses = copy_addresses(entry.addresses);
+    lock.unlock();
+
+    GENIE_DEBUG("Cache hit for %s%s", host, stale ? " (stale)" : "");
+    g_task_return_pointer(task, addresses, free_addresses);
+    g_object_unref(task);
+
+    if (refresh)
+      start_refresh(key, host, flags);
+    return;
+  }
+
+  entry.waiters.push_back({task, now});
+  if (entry.resolving)
+    return;
+  entry.resolving = true;
+  if (entries.size() > MAX_ENTRIES)
+    evict(now, key);
+  lock.unlock();
+
+  start_refresh(key, host, flags);
+}
+
+void genie::DNSCache::start_refresh(const std::string &key,
+                                    const std::string &host, int flags) {
+  Refresh *refresh = new Refresh{this, key, g_get_monotonic_time()};
+#if GLIB_CHECK_VERSION(2, 60, 0)
+  g_resolver_lookup_by_name_with_flags_async(
+      upstream, host.c_str(), (GResolverNameLookupFlags)flags, nullptr,
+      on_resolved, refresh);
+#else
+  g_resolver_lookup_by_name_async(upstream, host.c_str(), nullptr, on_resolved,
+                                  refresh);
+#endif
+}
+
+void genie::DNSCache::on_resolved(GObject *source, GAsyncResult *result,
+                                  gpointer data) {
+  std::unique_ptr<Refresh> refresh(static_cast<Refresh *>(data));
+  DNSCache *self = refresh->cache;
+  GError *error = nullptr;
+
+#if GLIB_CHECK_VERSION(2, 60, 0)
+  GList *addresses = g_resolver_lookup_by_name_with_flags_finish(
+      G_RESOLVER(source), result, &error);
+#else
+  GList *addresses =
+      g_resolver_lookup_by_name_finish(G_RESOLVER(source), result, &error);
+#endif
+
+  gint64 now = g_get_monotonic_time();
+  std::vector<Waiter> waiters;
+  GList *answer = nullptr;
+  std::string host;
+  {
+    std::lock_guard<std::mutex> lock(self->mutex);
+    Entry &entry = self->entries[refresh->key];
+    host = entry.host;
+    entry.resolving = false;
+    waiters.swap(entry.waiters);
+
+    if (addresses) {
+      self->store(entry, addresses);
+      answer = copy_addresses(addresses);
+    } else if (entry.addresses && now < entry.expires + self->stale_us) {
+      // keep answering with what we had until the server is reachable again
+      answer = copy_addresses(entry.addresses);
+    }
+  }
+
+  if (error) {
+    g_warning("Failed to resolve %s after %.1f ms: %s%s", host.c_str(),
+              (now - refresh->start) / 1000.0, error->message,
+              answer ? ", using stale addresses" : "");
+  } else {
+    g_message("Resolved %s in %.1f ms", host.c_str(),
+              (now - refresh->start) / 1000.0);
+  }
+
+  // complete the waiting lookups outside the lock, their callbacks may
+  // resolve again
+  for (auto &waiter : waiters) {
+    GENIE_DEBUG("Lookup of %s waited %.1f ms", host.c_str(),
+                (now - waiter.start) / 1000.0);
+    if (answer)
+      g_task_return_pointer(waiter.task, copy_addresses(answer),
+                            free_addresses);
+    else
+      g_task_return_error(waiter.task, g_error_copy(error));
+    g_object_unref(waiter.task);
+  }
+
+  g_resolver_free_addresses(answer);
+  if (error)
+    g_error_free(error);
+}
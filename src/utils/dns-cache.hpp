@@ -0,0 +1,135 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "memory.hpp"
+
+namespace genie {
+
+/**
+ * @brief In-process cache of host name lookups.
+ *
+ * The cache is installed as the default `GResolver`, so it serves every
+ * connection in the process: the shared SoupSession (conversation and STT
+ * websockets) and the souphttpsrc elements used for TTS. Lookups it cannot
+ * answer go to the resolver that was the default before.
+ *
+ * Entries are fresh for `ttl_s` seconds. After that they are still returned
+ * for up to `stale_s` more seconds while a lookup refreshes them in the
+ * background, and they are also used when that lookup fails. Pinned hosts
+ * (the Genie and NL servers) are refreshed before they expire. Other hosts
+ * are dropped once past the stale window, and the least recently resolved
+ * ones when there are more than `MAX_ENTRIES`.
+ *
+ * All methods are _thread-safe_, GStreamer resolves from its own threads.
+ */
+class DNSCache {
+public:
+  static const size_t MAX_ENTRIES = 64;
+
+  DNSCache(guint ttl_s, guint stale_s);
+  ~DNSCache();
+
+  DNSCache(const DNSCache &) = delete;
+  DNSCache &operator=(const DNSCache &) = delete;
+
+  /**
+   * @brief Keep the host of this URL resolved, starting now. Must be called
+   * from the main thread.
+   */
+  void pin_url(const char *url);
+
+  /**
+   * @brief Forget the cached answers, e.g. after the network changed, and
+   * resolve the pinned hosts again. Until that completes, lookups of those
+   * hosts wait for it rather than get the old addresses. Must be called from
+   * the main thread.
+   */
+  void invalidate();
+
+  void report_memory(MemoryReport &report);
+
+  /**
+   * @brief Forget the entries that are not pinned or being resolved, they
+   * are looked up again when needed.
+   */
+  void shed_memory();
+
+  // called by the GResolver implementation
+  GList *lookup(const char *host, int flags, GCancellable *cancellable,
+                GError **error);
+  void lookup_async(const char *host, int flags, GTask *task);
+  GResolver *upstream_resolver() { return upstream; }
+
+private:
+  struct Waiter {
+    GTask *task;
+    gint64 start;
+  };
+
+  struct Entry {
+    std::string host;
+    int flags = 0;
+    GList *addresses = nullptr;
+    gint64 expires = 0;
+    bool pinned = false;
+    bool resolving = false;
+    // the network changed since `addresses` were resolved, so they are only
+    // used if resolving again fails
+    bool invalidated = false;
+    std::vector<Waiter> waiters;
+  };
+
+  struct Refresh {
+    DNSCache *cache;
+    std::string key;
+    gint64 start;
+  };
+
+  GResolver *upstream;
+  GResolver *resolver;
+  const gint64 ttl_us;
+  const gint64 stale_us;
+  guint prefetch_timeout_id;
+
+  std::mutex mutex;
+  std::unordered_map<std::string, Entry> entries;
+
+  static std::string make_key(const char *host, int flags);
+  static GList *copy_addresses(GList *addresses);
+  static void free_addresses(gpointer addresses);
+  static gboolean prefetch_tick(gpointer data);
+  static void on_resolved(GObject *source, GAsyncResult *result,
+                          gpointer data);
+
+  void start_refresh(const std::string &key, const std::string &host,
+                     int flags);
+  void store(Entry &entry, GList *addresses);
+  bool can_serve(const Entry &entry, gint64 now) const;
+  void evict(gint64 now, const std::string &keep);
+};
+
+} // namespace genie
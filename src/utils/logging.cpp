@@ -0,0 +1,123 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "logging.hpp"
+
+#include <string.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::log"
+
+/**
+ * @brief Whether debug messages for `domain` would be written.
+ *
+ * This is the check GLib's default writer does after formatting the message;
+ * doing it up front lets disabled call sites skip the formatting.
+ */
+bool genie::log::debug_enabled(const char *domain) {
+#if GLIB_CHECK_VERSION(2, 68, 0)
+  return !g_log_writer_default_would_drop(G_LOG_LEVEL_DEBUG, domain);
+#else
+  const char *domains = g_getenv("G_MESSAGES_DEBUG");
+  if (!domains)
+    return false;
+  if (strcmp(domains, "all") == 0)
+    return true;
+  return domain && strstr(domains, domain) != nullptr;
+#endif
+}
+
+bool genie::log::RateLimit::allow(guint *suppressed_out) {
+  gint64 now = g_get_monotonic_time();
+  gint64 expected = next.load(std::memory_order_relaxed);
+  if (now < expected ||
+      !next.compare_exchange_strong(expected, now + interval,
+                                    std::memory_order_relaxed)) {
+    suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  *suppressed_out = suppressed.exchange(0, std::memory_order_relaxed);
+  return true;
+}
+
+void genie::log::Ring::push(GLogLevelFlags level, const char *domain,
+                            const char *format, size_t a, size_t b,
+                            size_t c) {
+  size_t h = head.load(std::memory_order_relaxed);
+  if (h - tail.load(std::memory_order_acquire) >= CAPACITY) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  Record &record = records[h % CAPACITY];
+  record.time = g_get_monotonic_time();
+  record.level = level;
+  record.domain = domain;
+  record.format = format;
+  record.args[0] = a;
+  record.args[1] = b;
+  record.args[2] = c;
+  head.store(h + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Format and write all queued records. Main thread only.
+ */
+void genie::log::Ring::drain() {
+  size_t t = tail.load(std::memory_order_relaxed);
+  size_t h = head.load(std::memory_order_acquire);
+  gint64 now = g_get_monotonic_time();
+
+  for (; t != h; t++) {
+    const Record &record = records[t % CAPACITY];
+    gchar *message = g_strdup_printf(record.format, record.args[0],
+                                     record.args[1], record.args[2]);
+    g_log(record.domain, record.level, "%s (%.1f ms ago)", message,
+          (now - record.time) / 1000.0);
+    g_free(message);
+  }
+  tail.store(t, std::memory_order_release);
+
+  size_t lost = dropped.exchange(0, std::memory_order_relaxed);
+  if (lost)
+    g_warning("Log ring full, dropped %zu records", lost);
+}
+
+genie::log::Ring &genie::log::audio_ring() {
+  static Ring ring;
+  return ring;
+}
+
+/**
+ * @brief Drain the ring every `interval_ms`, if debug output is enabled for
+ * `domain`, the log domain of the ring's producer. Otherwise nothing is ever
+ * pushed, and no timer wakes the process up.
+ */
+void genie::log::start_ring_drain(guint interval_ms, const char *domain) {
+  if (GENIE_LOG_MIN_LEVEL > 0 || !debug_enabled(domain))
+    return;
+
+  g_timeout_add(
+      interval_ms,
+      [](gpointer) -> gboolean {
+        audio_ring().drain();
+        return G_SOURCE_CONTINUE;
+      },
+      nullptr);
+}
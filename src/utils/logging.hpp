@@ -0,0 +1,153 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "config.h"
+
+#include <atomic>
+#include <glib.h>
+#include <stddef.h>
+
+// GENIE_DEBUG() and GENIE_RING_DEBUG() calls are compiled out when this is
+// above 0, see the `debug_logs` meson option
+#ifndef GENIE_LOG_MIN_LEVEL
+#define GENIE_LOG_MIN_LEVEL 0
+#endif
+
+namespace genie {
+namespace log {
+
+/**
+ * @brief Longest payload (protocol message, JSON body...) written to the log
+ * before it is cut.
+ */
+static const size_t PAYLOAD_MAX = 512;
+
+bool debug_enabled(const char *domain);
+
+inline int payload_length(size_t length) {
+  return (int)MIN(length, PAYLOAD_MAX);
+}
+inline const char *payload_suffix(size_t length) {
+  return length > PAYLOAD_MAX ? "..." : "";
+}
+
+/**
+ * @brief Per call site limit of one log line every `interval_ms`.
+ *
+ * Lines dropped in between are counted and reported with the next line
+ * that gets through. Safe to share between threads.
+ */
+class RateLimit {
+public:
+  RateLimit(gint64 interval_ms)
+      : interval(interval_ms * 1000), next(0), suppressed(0) {}
+
+  bool allow(guint *suppressed_out);
+
+private:
+  const gint64 interval;
+  std::atomic<gint64> next;
+  std::atomic<guint> suppressed;
+};
+
+/**
+ * @brief Fixed size, single producer log ring.
+ *
+ * The producer (the audio input thread) only stores the format string and
+ * up to three `size_t` arguments; formatting and writing happen when the
+ * main loop drains the ring. Format strings must be literals and may only
+ * use `%zu` conversions. When the ring is full, records are dropped and
+ * the drop count is reported on the next drain.
+ */
+class Ring {
+public:
+  static const size_t CAPACITY = 256;
+
+  void push(GLogLevelFlags level, const char *domain, const char *format,
+            size_t a = 0, size_t b = 0, size_t c = 0);
+  void drain();
+
+private:
+  struct Record {
+    gint64 time;
+    GLogLevelFlags level;
+    const char *domain;
+    const char *format;
+    size_t args[3];
+  };
+
+  Record records[CAPACITY];
+  std::atomic<size_t> head{0};
+  std::atomic<size_t> tail{0};
+  std::atomic<size_t> dropped{0};
+};
+
+Ring &audio_ring();
+void start_ring_drain(guint interval_ms, const char *domain);
+
+} // namespace log
+} // namespace genie
+
+/**
+ * @brief Like `g_debug()`, but compiled out below `GENIE_LOG_MIN_LEVEL`, and
+ * the arguments are neither evaluated nor formatted unless debug output is
+ * enabled for the domain (checked once per call site).
+ */
+#define GENIE_DEBUG(...)                                                       \
+  do {                                                                         \
+    if (GENIE_LOG_MIN_LEVEL <= 0) {                                            \
+      static const bool genie_log_site_enabled =                               \
+          genie::log::debug_enabled(G_LOG_DOMAIN);                             \
+      if (genie_log_site_enabled)                                              \
+        g_debug(__VA_ARGS__);                                                  \
+    }                                                                          \
+  } while (0)
+
+/**
+ * @brief Log with `log_func` (`g_message`, `g_warning`...) at most once every
+ * `interval_ms` from this call site.
+ */
+#define GENIE_LOG_RATELIMITED(log_func, interval_ms, format, ...)              \
+  do {                                                                         \
+    static genie::log::RateLimit genie_log_limit(interval_ms);                 \
+    guint genie_log_suppressed;                                                \
+    if (genie_log_limit.allow(&genie_log_suppressed)) {                        \
+      if (genie_log_suppressed)                                                \
+        log_func(format " (%u similar suppressed)", ##__VA_ARGS__,             \
+                 genie_log_suppressed);                                        \
+      else                                                                     \
+        log_func(format, ##__VA_ARGS__);                                       \
+    }                                                                          \
+  } while (0)
+
+/**
+ * @brief Debug log from the audio input thread through the log ring. Only
+ * `%zu` conversions are allowed, see `genie::log::Ring`.
+ */
+#define GENIE_RING_DEBUG(format, ...)                                          \
+  do {                                                                         \
+    if (GENIE_LOG_MIN_LEVEL <= 0) {                                            \
+      static const bool genie_log_site_enabled =                               \
+          genie::log::debug_enabled(G_LOG_DOMAIN);                             \
+      if (genie_log_site_enabled)                                              \
+        genie::log::audio_ring().push(G_LOG_LEVEL_DEBUG, G_LOG_DOMAIN,         \
+                                      format, ##__VA_ARGS__);                  \
+    }                                                                          \
+  } while (0)
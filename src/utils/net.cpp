@@ -17,6 +17,7 @@
 // limitations under the License.
 
 #include "net.hpp"
+#include "worker-pool.hpp"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,13 +25,55 @@
 #include <net/if.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <string>
 #include <sys/ioctl.h>
 #include <unistd.h>
 
-genie::NetController::NetController(App *app) : app(app) {}
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::NetController"
+
+genie::NetController::NetController(App *app)
+    : app(app), ap_enabled(false), sta_connected(false), switch_begin(0),
+      switch_target(nullptr) {
+  if (!app->config->net_wlan_if)
+    return;
+
+  gchar *path = g_build_filename(app->config->net_wpa_ctrl_dir,
+                                 app->config->net_wlan_if, nullptr);
+  wpa = std::make_unique<WpaCtrl>(
+      path, [this](const std::string &event) { on_wpa_event(event); });
+  g_free(path);
+
+  path = g_build_filename(app->config->net_hostapd_ctrl_dir,
+                          app->config->net_wlan_if, nullptr);
+  hostapd = std::make_unique<WpaCtrl>(
+      path, [this](const std::string &event) { on_hostapd_event(event); });
+  g_free(path);
+
+  if (has_wpa()) {
+    g_message("Using wpa_supplicant control socket %s", wpa->path().c_str());
+    refresh_sta_status();
+  }
+  if (has_hostapd()) {
+    g_message("Using hostapd control socket %s", hostapd->path().c_str());
+    hostapd->request("STATUS", [this](bool ok, const std::string &reply) {
+      ap_enabled = ok && reply.find("state=ENABLED") != std::string::npos;
+    });
+  }
+}
 
 genie::NetController::~NetController() {}
 
+const char *genie::NetController::get_status_text() const {
+  if (ap_enabled)
+    return "Access point";
+  if (sta_connected)
+    return "Connected";
+  if (switch_target)
+    return "Switching";
+  return "Disconnected";
+}
+
 genie::WifiAuthMode genie::NetController::parse_auth_mode(const char *auth_mode) {
   if (strcmp(auth_mode, "open") == 0) {
     return genie::WifiAuthMode::OPEN;
@@ -45,10 +88,37 @@ genie::WifiAuthMode genie::NetController::parse_auth_mode(const char *auth_mode)
   }
 }
 
+bool genie::NetController::is_valid_secret(const char *secret) {
+  for (const char *c = secret; *c; c++) {
+    if (*c < 0x20 || *c > 0x7e || *c == '"')
+      return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Hex-encode `ssid`, the form wpa_supplicant takes without quotes,
+ * so any byte is safe.
+ */
+static std::string ssid_to_hex(const std::string &ssid) {
+  std::string ssid_hex;
+  for (unsigned char c : ssid) {
+    char hex[3];
+    snprintf(hex, sizeof(hex), "%02x", c);
+    ssid_hex += hex;
+  }
+  return ssid_hex;
+}
+
 bool genie::NetController::set_wifi_config(WifiAuthMode mode, const char *ssid,
                                            const char *secret) {
   FILE *fp;
 
+  if (mode != WifiAuthMode::OPEN && !is_valid_secret(secret)) {
+    g_warning("Refusing a wifi secret with quotes or control characters");
+    return false;
+  }
+
   fp = fopen("/tmp/wpa_supplicant.conf", "w");
   if (!fp) {
     return false;
@@ -57,7 +127,7 @@ bool genie::NetController::set_wifi_config(WifiAuthMode mode, const char *ssid,
   fprintf(fp,
           "ctrl_interface=/var/run/wpa_supplicant\n"
           "update_config=1\ncountry=%s\nnetwork={\n", "US");
-  fprintf(fp, "\tssid=\"%s\"\n", ssid);
+  fprintf(fp, "\tssid=%s\n", ssid_to_hex(ssid).c_str());
   if (mode == WifiAuthMode::OPEN || mode == WifiAuthMode::WEP) {
     fprintf(fp, "\tkey_mgmt=NONE\n");
     if (mode == WifiAuthMode::WEP) {
@@ -72,9 +142,180 @@ bool genie::NetController::set_wifi_config(WifiAuthMode mode, const char *ssid,
   return true;
 }
 
+/**
+ * @brief Switch from AP to station mode with a new network.
+ *
+ * With a wpa_supplicant control socket the network is added and selected
+ * in place. Otherwise the configuration file is rewritten and the helper
+ * scripts restart the daemons, which can take seconds, on the worker pool.
+ */
+void genie::NetController::apply_wifi_config(WifiAuthMode mode,
+                                             const char *ssid,
+                                             const char *secret) {
+  begin_switch("station");
+
+  if (has_wpa()) {
+    stop_ap();
+    configure_sta(mode, ssid, secret);
+    return;
+  }
+
+  // the scripts must run in order, so they share one job
+  std::vector<std::string> commands;
+  if (app->config->net_wlan_ap_ctrl && strlen(app->config->net_wlan_ap_ctrl))
+    commands.push_back(std::string(app->config->net_wlan_ap_ctrl) + " stop " +
+                       app->config->net_wlan_if);
+  if (app->config->net_wlan_sta_ctrl && strlen(app->config->net_wlan_sta_ctrl))
+    commands.push_back(std::string(app->config->net_wlan_sta_ctrl) +
+                       " start " + app->config->net_wlan_if);
+
+  std::string ssid_str(ssid);
+  std::string secret_str(secret);
+  app->worker_pool->run(
+      [this, mode, ssid_str, secret_str, commands]() {
+        if (!set_wifi_config(mode, ssid_str.c_str(), secret_str.c_str())) {
+          g_warning("Failed to write wifi configuration");
+          return;
+        }
+        for (const auto &cmd : commands) {
+          int rc = system(cmd.c_str());
+          if (rc != 0)
+            g_warning("%s exited with status %d", cmd.c_str(), rc);
+        }
+      },
+      [this]() {
+        // the scripts do not report when the station is connected
+        finish_switch("station");
+      });
+}
+
+/**
+ * @brief Replace the configured networks with `ssid` and connect to it. The
+ * SSID is sent hex-encoded, so it needs no quoting; the secret is quoted and
+ * checked with `is_valid_secret()`.
+ */
+void genie::NetController::configure_sta(WifiAuthMode mode,
+                                         const std::string &ssid,
+                                         const std::string &secret) {
+  if (mode != WifiAuthMode::OPEN && !is_valid_secret(secret.c_str())) {
+    g_warning("Refusing a wifi secret with quotes or control characters");
+    return;
+  }
+  std::string ssid_hex = ssid_to_hex(ssid);
+
+  wpa->request("REMOVE_NETWORK all");
+  wpa->request("ADD_NETWORK", [this, mode, ssid_hex,
+                               secret](bool ok, const std::string &reply) {
+    if (!ok) {
+      g_warning("Failed to add wifi network: %s", reply.c_str());
+      return;
+    }
+    std::string id = reply.substr(0, reply.find_first_of("\r\n"));
+    std::string set = "SET_NETWORK " + id + " ";
+
+    std::vector<std::string> commands;
+    commands.push_back(set + "ssid " + ssid_hex);
+    if (mode == WifiAuthMode::WPA) {
+      commands.push_back(set + "psk \"" + secret + "\"");
+    } else {
+      commands.push_back(set + "key_mgmt NONE");
+      if (mode == WifiAuthMode::WEP) {
+        commands.push_back(set + "wep_key0 \"" + secret + "\"");
+        commands.push_back(set + "wep_tx_keyidx 0");
+      }
+    }
+    commands.push_back("SELECT_NETWORK " + id);
+    commands.push_back("SAVE_CONFIG");
+
+    run_sequence(wpa.get(), std::move(commands), [](bool ok) {
+      if (!ok)
+        g_warning("Failed to configure wifi network");
+    });
+  });
+}
+
+/**
+ * @brief Send `commands` in order, stopping at the first failure.
+ */
+void genie::NetController::run_sequence(WpaCtrl *ctrl,
+                                        std::vector<std::string> commands,
+                                        std::function<void(bool)> done) {
+  if (commands.empty()) {
+    done(true);
+    return;
+  }
+
+  std::string command = commands.front();
+  commands.erase(commands.begin());
+  ctrl->request(command, [this, ctrl, commands, done](
+                             bool ok, const std::string &reply) {
+    if (!ok) {
+      done(false);
+      return;
+    }
+    run_sequence(ctrl, commands, done);
+  });
+}
+
+void genie::NetController::refresh_sta_status() {
+  wpa->request("STATUS", [this](bool ok, const std::string &reply) {
+    if (!ok)
+      return;
+
+    std::unique_ptr<char *, fn_deleter<char *, g_strfreev>> lines(
+        g_strsplit(reply.c_str(), "\n", -1));
+    for (int i = 0; lines.get()[i]; i++) {
+      const char *line = lines.get()[i];
+      if (g_str_has_prefix(line, "wpa_state="))
+        sta_connected = strcmp(line + strlen("wpa_state="), "COMPLETED") == 0;
+      else if (g_str_has_prefix(line, "ssid="))
+        sta_ssid = line + strlen("ssid=");
+    }
+  });
+}
+
+void genie::NetController::on_wpa_event(const std::string &event) {
+  g_debug("wpa_supplicant: %s", event.c_str());
+
+  if (g_str_has_prefix(event.c_str(), "CTRL-EVENT-CONNECTED")) {
+    sta_connected = true;
+    refresh_sta_status();
+    finish_switch("station");
+  } else if (g_str_has_prefix(event.c_str(), "CTRL-EVENT-DISCONNECTED")) {
+    sta_connected = false;
+  } else if (g_str_has_prefix(event.c_str(), "CTRL-EVENT-SSID-TEMP-DISABLED") &&
+             event.find("reason=WRONG_KEY") != std::string::npos) {
+    g_warning("Wifi passphrase rejected by the access point");
+  }
+}
+
+void genie::NetController::on_hostapd_event(const std::string &event) {
+  g_debug("hostapd: %s", event.c_str());
+
+  if (g_str_has_prefix(event.c_str(), "AP-ENABLED")) {
+    ap_enabled = true;
+    finish_switch("access point");
+  } else if (g_str_has_prefix(event.c_str(), "AP-DISABLED")) {
+    ap_enabled = false;
+  }
+}
+
+void genie::NetController::begin_switch(const char *target) {
+  switch_begin = g_get_monotonic_time();
+  switch_target = target;
+}
+
+void genie::NetController::finish_switch(const char *target) {
+  if (!switch_target || strcmp(switch_target, target) != 0)
+    return;
+
+  g_message("Switched to %s mode in %.0f ms", target,
+            (g_get_monotonic_time() - switch_begin) / 1000.0);
+  switch_target = nullptr;
+}
+
 bool genie::NetController::get_mac_address(char *ifname, char **outbuf) {
   struct ifreq ifr;
-  char buf[1024];
   int success = 0;
 
   int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
@@ -82,10 +323,11 @@ bool genie::NetController::get_mac_address(char *ifname, char **outbuf) {
     return false;
   }
 
-  strncpy(ifr.ifr_name, ifname, sizeof(buf) - 1);
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
   if (ioctl(sock, SIOCGIFFLAGS, &ifr) == 0) {
     if (ioctl(sock, SIOCGIFHWADDR, &ifr) == 0) {
-      memcpy(outbuf, ifr.ifr_hwaddr.sa_data, 6);
+      memcpy(*outbuf, ifr.ifr_hwaddr.sa_data, 6);
       close(sock);
       return true;
     }
@@ -97,7 +339,29 @@ bool genie::NetController::get_mac_address(char *ifname, char **outbuf) {
   return false;
 }
 
+/**
+ * @brief Run a helper script on the worker pool. The scripts restart the
+ * wifi daemons and can take seconds.
+ */
+void genie::NetController::run_helper(const char *helper, const char *args) {
+  gchar *cmd = g_strdup_printf("%s %s", helper, args);
+  std::string cmd_str(cmd);
+  g_free(cmd);
+
+  app->worker_pool->run([cmd_str]() {
+    int rc = system(cmd_str.c_str());
+    if (rc != 0)
+      g_warning("%s exited with status %d", cmd_str.c_str(), rc);
+  });
+}
+
 bool genie::NetController::start_ap() {
+  if (has_hostapd()) {
+    begin_switch("access point");
+    hostapd->request("ENABLE");
+    return true;
+  }
+
   if (!app->config->net_wlan_ap_ctrl || !strlen(app->config->net_wlan_ap_ctrl)) {
     return false;
   }
@@ -105,63 +369,71 @@ bool genie::NetController::start_ap() {
       g_build_filename(app->config->asset_dir, app->config->net_wlan_ap_ctrl, nullptr);
 
   if (!app->config->net_wlan_if) {
+    g_free(helper_path);
     return false;
   }
   char *buf = (char *)malloc(16);
   if (!get_mac_address(app->config->net_wlan_if, &buf)) {
     g_free(buf);
+    g_free(helper_path);
     return false;
   }
 
-  gchar *cmd =
-      g_strdup_printf("%s start %s \"Genie Speaker %02x%02x%02x\"", helper_path,
+  gchar *args =
+      g_strdup_printf("start %s \"Genie Speaker %02x%02x%02x\"",
                       app->config->net_wlan_if, buf[3], buf[4], buf[5]);
   g_free(buf);
-  g_free(helper_path);
 
-  int rc = system(cmd);
-  g_free(cmd);
-  return rc == 0 ? true : false;
+  run_helper(helper_path, args);
+  g_free(helper_path);
+  g_free(args);
+  return true;
 }
 
 bool genie::NetController::stop_ap() {
+  if (has_hostapd()) {
+    hostapd->request("DISABLE");
+    return true;
+  }
+
   if (!app->config->net_wlan_ap_ctrl || !strlen(app->config->net_wlan_ap_ctrl)) {
     return false;
   }
-  char *helper_path =
-      g_build_filename(app->config->net_wlan_ap_ctrl, nullptr);
-  gchar *cmd = g_strdup_printf("%s stop %s", helper_path, app->config->net_wlan_if);
-  g_free(helper_path);
-
-  int rc = system(cmd);
-  g_free(cmd);
-  return rc == 0 ? true : false;
+  gchar *args = g_strdup_printf("stop %s", app->config->net_wlan_if);
+  run_helper(app->config->net_wlan_ap_ctrl, args);
+  g_free(args);
+  return true;
 }
 
 bool genie::NetController::start_sta() {
+  if (has_wpa()) {
+    if (!switch_target)
+      begin_switch("station");
+    wpa->request("ENABLE_NETWORK all");
+    wpa->request("RECONNECT");
+    return true;
+  }
+
   if (!app->config->net_wlan_sta_ctrl || !strlen(app->config->net_wlan_sta_ctrl)) {
     return false;
   }
-  char *helper_path =
-      g_build_filename(app->config->net_wlan_sta_ctrl, nullptr);
-  gchar *cmd = g_strdup_printf("%s start %s", helper_path, app->config->net_wlan_if);
-  g_free(helper_path);
-
-  int rc = system(cmd);
-  g_free(cmd);
-  return rc == 0 ? true : false;
+  gchar *args = g_strdup_printf("start %s", app->config->net_wlan_if);
+  run_helper(app->config->net_wlan_sta_ctrl, args);
+  g_free(args);
+  return true;
 }
 
 bool genie::NetController::stop_sta() {
+  if (has_wpa()) {
+    wpa->request("DISCONNECT");
+    return true;
+  }
+
   if (!app->config->net_wlan_sta_ctrl || !strlen(app->config->net_wlan_sta_ctrl)) {
     return false;
   }
-  char *helper_path =
-      g_build_filename(app->config->net_wlan_sta_ctrl, nullptr);
-  gchar *cmd = g_strdup_printf("%s stop %s", helper_path, app->config->net_wlan_if);
-  g_free(helper_path);
-
-  int rc = system(cmd);
-  g_free(cmd);
-  return rc == 0 ? true : false;
+  gchar *args = g_strdup_printf("stop %s", app->config->net_wlan_if);
+  run_helper(app->config->net_wlan_sta_ctrl, args);
+  g_free(args);
+  return true;
 }
@@ -19,9 +19,26 @@
 #pragma once
 
 #include "app.hpp"
+#include "wpa-ctrl.hpp"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace genie {
 
+/**
+ * Switches the wifi interface between access point (for setup) and station
+ * mode.
+ *
+ * When wpa_supplicant and hostapd expose their control sockets, commands go
+ * to them directly and status follows their events. Otherwise the
+ * configured helper scripts are run on the worker pool, as before.
+ *
+ * The start/stop methods only start the operation and return false if
+ * neither a control socket nor a helper script is available.
+ */
 class NetController {
 public:
   NetController(App *app);
@@ -29,16 +46,54 @@ public:
 
   bool start_ap();
   bool stop_ap();
-  bool status_ap();
+  bool status_ap() { return ap_enabled; }
   bool set_wifi_config(WifiAuthMode mode, const char *ssid, const char *secret);
+  void apply_wifi_config(WifiAuthMode mode, const char *ssid,
+                         const char *secret);
   WifiAuthMode parse_auth_mode(const char *auth_mode);
+
+  /**
+   * @brief Whether `secret` can be written as a quoted wpa_supplicant value:
+   * printable ASCII without double quotes, so it cannot end the value and
+   * inject other network options.
+   */
+  static bool is_valid_secret(const char *secret);
   bool get_mac_address(char *ifname, char **outbuf);
   bool start_sta();
   bool stop_sta();
-  bool status_sta();
+  bool status_sta() { return sta_connected; }
+
+  const std::string &get_sta_ssid() const { return sta_ssid; }
+  const char *get_status_text() const;
 
 private:
   App *app;
+
+  std::unique_ptr<WpaCtrl> wpa;
+  std::unique_ptr<WpaCtrl> hostapd;
+
+  bool ap_enabled;
+  bool sta_connected;
+  std::string sta_ssid;
+
+  // for measuring how long a switch between AP and station mode takes
+  gint64 switch_begin;
+  const char *switch_target;
+
+  bool has_wpa() const { return wpa && wpa->available(); }
+  bool has_hostapd() const { return hostapd && hostapd->available(); }
+
+  void run_helper(const char *helper, const char *args);
+  void run_sequence(WpaCtrl *ctrl, std::vector<std::string> commands,
+                    std::function<void(bool)> done);
+  void configure_sta(WifiAuthMode mode, const std::string &ssid,
+                     const std::string &secret);
+
+  void on_wpa_event(const std::string &event);
+  void on_hostapd_event(const std::string &event);
+  void refresh_sta_status();
+  void begin_switch(const char *target);
+  void finish_switch(const char *target);
 };
 
 } // namespace genie
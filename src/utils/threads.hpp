@@ -0,0 +1,33 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+namespace genie {
+
+/**
+ * @brief Name the calling thread, as shown by top -H and in
+ * /proc/self/task/<tid>/comm.
+ *
+ * Our threads are called "genie:<role>" and the GStreamer streaming threads
+ * "gst:<element>". Linux keeps at most 15 characters, longer names are cut.
+ * The main thread keeps the process name.
+ */
+void set_thread_name(const char *name);
+
+} // namespace genie
@@ -0,0 +1,205 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tls-monitor.hpp"
+#include "../app.hpp"
+
+#include <memory>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::TLSMonitor"
+
+static const char *HANDSHAKE_START_KEY = "genie-tls-handshake-start";
+static const char *MONITORED_KEY = "genie-tls-monitored";
+
+namespace {
+
+struct StatsUpdate {
+  genie::App *app;
+  genie::TLSStats stats;
+};
+
+} // namespace
+
+genie::TLSMonitor::TLSMonitor(App *app, SoupSession *session)
+    : app(app), session(session, adopt_mode::ref) {
+  request_queued_id = g_signal_connect(session, "request-queued",
+                                       G_CALLBACK(on_request_queued), this);
+}
+
+genie::TLSMonitor::~TLSMonitor() {
+  g_signal_handler_disconnect(session.get(), request_queued_id);
+}
+
+void genie::TLSMonitor::on_request_queued(SoupSession *session,
+                                          SoupMessage *msg, gpointer data) {
+  // a message is queued again after a redirect
+  if (g_object_get_data(G_OBJECT(msg), MONITORED_KEY))
+    return;
+  g_object_set_data(G_OBJECT(msg), MONITORED_KEY, GINT_TO_POINTER(1));
+  g_signal_connect(msg, "network-event", G_CALLBACK(on_network_event), data);
+}
+
+void genie::TLSMonitor::on_network_event(SoupMessage *msg,
+                                         GSocketClientEvent event,
+                                         GIOStream *connection, gpointer data) {
+  TLSMonitor *self = static_cast<TLSMonitor *>(data);
+  if (!G_IS_TLS_CLIENT_CONNECTION(connection))
+    return;
+
+  if (event == G_SOCKET_CLIENT_TLS_HANDSHAKING)
+    self->handshake_started(G_TLS_CLIENT_CONNECTION(connection));
+  else if (event == G_SOCKET_CLIENT_TLS_HANDSHAKED)
+    self->handshake_done(G_TLS_CLIENT_CONNECTION(connection));
+}
+
+std::string genie::TLSMonitor::server_key(GTlsClientConnection *conn) {
+  GSocketConnectable *identity =
+      g_tls_client_connection_get_server_identity(conn);
+  if (!identity)
+    return std::string();
+
+  gchar *str = g_socket_connectable_to_string(identity);
+  std::string key(str);
+  g_free(str);
+  return key;
+}
+
+/**
+ * @brief 1 if the handshake resumed a session, 0 if it did not, -1 if the
+ * TLS backend does not say.
+ */
+int genie::TLSMonitor::is_resumed(GTlsClientConnection *conn) {
+  // exposed by newer glib-networking versions only
+  if (!g_object_class_find_property(G_OBJECT_GET_CLASS(conn),
+                                    "session-resumed"))
+    return -1;
+
+  gboolean resumed = false;
+  g_object_get(conn, "session-resumed", &resumed, nullptr);
+  return resumed ? 1 : 0;
+}
+
+/**
+ * @brief A client connection over in-memory streams holding a copy of the
+ * session state of `conn`, so it can be resumed without keeping `conn` and
+ * its socket alive. Returns null if the backend cannot create one.
+ */
+GTlsClientConnection *
+genie::TLSMonitor::copy_session(GTlsClientConnection *conn) {
+  GInputStream *input = g_memory_input_stream_new();
+  GOutputStream *output = g_memory_output_stream_new_resizable();
+  GIOStream *base = g_simple_io_stream_new(input, output);
+  g_object_unref(input);
+  g_object_unref(output);
+
+  GIOStream *copy = g_tls_client_connection_new(
+      base, g_tls_client_connection_get_server_identity(conn), nullptr);
+  g_object_unref(base);
+  if (!copy)
+    return nullptr;
+
+  g_tls_client_connection_copy_session_state(G_TLS_CLIENT_CONNECTION(copy),
+                                             conn);
+  return G_TLS_CLIENT_CONNECTION(copy);
+}
+
+void genie::TLSMonitor::handshake_started(GTlsClientConnection *conn) {
+  gint64 *start = g_new(gint64, 1);
+  *start = g_get_monotonic_time();
+  g_object_set_data_full(G_OBJECT(conn), HANDSHAKE_START_KEY, start, g_free);
+
+  std::string key = server_key(conn);
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = sessions.find(key);
+  if (it == sessions.end())
+    return;
+
+  // an open connection has also seen the tickets sent after the handshake
+  // (TLS 1.3), prefer it to the copy
+  GObject *previous = G_OBJECT(g_weak_ref_get(&it->second->connection));
+  if (previous) {
+    g_tls_client_connection_copy_session_state(
+        conn, G_TLS_CLIENT_CONNECTION(previous));
+    g_object_unref(previous);
+  } else if (it->second->state) {
+    g_tls_client_connection_copy_session_state(conn,
+                                               it->second->state.get());
+  }
+}
+
+void genie::TLSMonitor::report_memory(MemoryReport &report) {
+  std::lock_guard<std::mutex> lock(mutex);
+  // the session states are opaque, their number is what to watch
+  report.push_back({"tls_sessions", 0, sessions.size()});
+}
+
+void genie::TLSMonitor::shed_memory() {
+  std::lock_guard<std::mutex> lock(mutex);
+  g_message("Dropping %zu TLS sessions kept for resumption", sessions.size());
+  sessions.clear();
+}
+
+void genie::TLSMonitor::handshake_done(GTlsClientConnection *conn) {
+  const gint64 *start = static_cast<const gint64 *>(
+      g_object_get_data(G_OBJECT(conn), HANDSHAKE_START_KEY));
+  if (!start)
+    return;
+  double ms = (g_get_monotonic_time() - *start) / 1000.0;
+  int resumed = is_resumed(conn);
+  std::string key = server_key(conn);
+
+  g_message("TLS handshake with %s took %.1f ms (%s)", key.c_str(), ms,
+            resumed < 0 ? "resumption unknown"
+                        : resumed ? "resumed" : "full handshake");
+
+  // a backend that reports resumption keeps its own session cache
+  GTlsClientConnection *state = resumed < 0 ? copy_session(conn) : nullptr;
+
+  StatsUpdate *update = new StatsUpdate{app, TLSStats()};
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (state) {
+      std::unique_ptr<Session> &session = sessions[key];
+      if (!session)
+        session = std::make_unique<Session>();
+      g_weak_ref_set(&session->connection, conn);
+      session->state =
+          auto_gobject_ptr<GTlsClientConnection>(state, adopt_mode::owned);
+    }
+
+    stats.handshakes++;
+    if (resumed > 0)
+      stats.resumed++;
+    else if (resumed < 0)
+      stats.resumption_unknown++;
+    stats.last_ms = ms;
+    stats.total_ms += ms;
+    stats.last_host = key;
+    update->stats = stats;
+  }
+
+  g_main_context_invoke(
+      nullptr,
+      [](gpointer data) -> gboolean {
+        std::unique_ptr<StatsUpdate> update(static_cast<StatsUpdate *>(data));
+        update->app->track_tls(update->stats);
+        return G_SOURCE_REMOVE;
+      },
+      update);
+}
@@ -0,0 +1,107 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <libsoup/soup.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "autoptrs.hpp"
+#include "memory.hpp"
+
+namespace genie {
+
+class App;
+
+struct TLSStats {
+  size_t handshakes = 0;
+  size_t resumed = 0;
+  // handshakes for which the TLS backend cannot tell if the session resumed
+  size_t resumption_unknown = 0;
+  double last_ms = 0;
+  double total_ms = 0;
+  std::string last_host;
+};
+
+/**
+ * @brief Times the TLS handshakes of a SoupSession and helps them resume.
+ *
+ * TLS backends that report `session-resumed` keep a process-wide session
+ * cache, and nothing more is done for them. With older backends, before each
+ * handshake the session state of the last connection to the same server is
+ * copied into the new one, so a resumption ticket is still offered. Only a
+ * weak reference to that connection is kept, with a copy of its session
+ * state taken at handshake time for when it is gone.
+ *
+ * Handshakes can happen on any thread that uses the session (GStreamer
+ * sends its requests from the streaming thread); the statistics are
+ * reported to the app on the main thread.
+ */
+class TLSMonitor {
+public:
+  TLSMonitor(App *app, SoupSession *session);
+  ~TLSMonitor();
+
+  TLSMonitor(const TLSMonitor &) = delete;
+  TLSMonitor &operator=(const TLSMonitor &) = delete;
+
+  void report_memory(MemoryReport &report);
+
+  /**
+   * @brief Let go of the kept session states; the next handshake to each
+   * server is a full one (unless the TLS backend has its own cache).
+   */
+  void shed_memory();
+
+private:
+  App *const app;
+  auto_gobject_ptr<SoupSession> session;
+  gulong request_queued_id;
+
+  struct Session {
+    // the last connection to the server, while it is open
+    GWeakRef connection;
+    // a connection without a socket, holding a copy of its session state
+    auto_gobject_ptr<GTlsClientConnection> state;
+
+    Session() { g_weak_ref_init(&connection, nullptr); }
+    ~Session() { g_weak_ref_clear(&connection); }
+  };
+
+  std::mutex mutex;
+  std::unordered_map<std::string, std::unique_ptr<Session>> sessions;
+  TLSStats stats;
+
+  static void on_request_queued(SoupSession *session, SoupMessage *msg,
+                                gpointer data);
+  static void on_network_event(SoupMessage *msg, GSocketClientEvent event,
+                               GIOStream *connection, gpointer data);
+  static std::string server_key(GTlsClientConnection *conn);
+  static int is_resumed(GTlsClientConnection *conn);
+  static GTlsClientConnection *copy_session(GTlsClientConnection *conn);
+
+  void handshake_started(GTlsClientConnection *conn);
+  void handshake_done(GTlsClientConnection *conn);
+};
+
+} // namespace genie
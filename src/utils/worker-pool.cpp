@@ -0,0 +1,98 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "worker-pool.hpp"
+#include "threads.hpp"
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::WorkerPool"
+
+// warn if a job waits this long for a free thread
+static const gint64 QUEUE_WARN_US = 500 * 1000;
+
+genie::WorkerPool::WorkerPool(int max_threads) {
+  GError *error = nullptr;
+  pool = g_thread_pool_new(worker_func, this, max_threads, FALSE, &error);
+  if (!pool) {
+    g_error("Failed to create worker pool: %s", error->message);
+    return;
+  }
+}
+
+/**
+ * Waits for queued jobs to finish. Their `done` callbacks are not run.
+ */
+genie::WorkerPool::~WorkerPool() {
+  if (pool)
+    g_thread_pool_free(pool, FALSE, TRUE);
+}
+
+void genie::WorkerPool::run(std::function<void()> work,
+                            std::function<void()> done) {
+  Job *job = new Job{std::move(work), std::move(done), g_get_monotonic_time()};
+
+  GError *error = nullptr;
+  if (!g_thread_pool_push(pool, job, &error)) {
+    // no thread could be started, do the work inline rather than dropping it
+    g_warning("Failed to queue job on worker pool: %s", error->message);
+    g_error_free(error);
+    job->work();
+    if (job->done)
+      job->done();
+    delete job;
+  }
+}
+
+/**
+ * @brief Account the jobs waiting for a thread. Their closures may capture
+ * more, only the job itself is counted.
+ */
+void genie::WorkerPool::report_memory(MemoryReport &report) {
+  size_t queued = g_thread_pool_unprocessed(pool);
+  report.push_back({"worker_queue", queued * sizeof(Job), queued});
+}
+
+void genie::WorkerPool::worker_func(gpointer data, gpointer user_data) {
+  Job *job = static_cast<Job *>(data);
+
+  // GLib creates the pool threads on demand and may reuse them across pools
+  static thread_local bool named = false;
+  if (!named) {
+    set_thread_name("genie:worker");
+    named = true;
+  }
+
+  gint64 waited = g_get_monotonic_time() - job->queued_time;
+  if (waited > QUEUE_WARN_US)
+    g_warning("Job waited %.1f ms for a worker thread", waited / 1000.0);
+
+  job->work();
+
+  if (!job->done) {
+    delete job;
+    return;
+  }
+  g_main_context_invoke(nullptr, done_func, job);
+}
+
+gboolean genie::WorkerPool::done_func(gpointer data) {
+  Job *job = static_cast<Job *>(data);
+  job->done();
+  delete job;
+  return G_SOURCE_REMOVE;
+}
@@ -0,0 +1,62 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <functional>
+#include <glib.h>
+
+#include "memory.hpp"
+
+namespace genie {
+
+/**
+ * A small bounded pool of threads for blocking work (file I/O, helper
+ * scripts) that must not run on the main loop.
+ *
+ * `run()` executes `work` on one of the worker threads, then `done` (if
+ * given) back on the main context. Jobs beyond the thread limit are queued;
+ * there is no ordering guarantee between jobs, callers that need one must
+ * serialize their own jobs.
+ */
+class WorkerPool {
+public:
+  WorkerPool(int max_threads);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  void run(std::function<void()> work, std::function<void()> done = nullptr);
+
+  void report_memory(MemoryReport &report);
+
+private:
+  struct Job {
+    std::function<void()> work;
+    std::function<void()> done;
+    gint64 queued_time;
+  };
+
+  static void worker_func(gpointer data, gpointer user_data);
+  static gboolean done_func(gpointer data);
+
+  GThreadPool *pool;
+};
+
+} // namespace genie
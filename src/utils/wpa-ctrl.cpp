@@ -0,0 +1,258 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wpa-ctrl.hpp"
+
+#include <errno.h>
+#include <glib-unix.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::WpaCtrl"
+
+// wpa_cli waits up to 10 seconds too; SCAN and SAVE_CONFIG can be slow
+static const guint REQUEST_TIMEOUT_MS = 10000;
+static const size_t MAX_REPLY_SIZE = 4096;
+
+// commands can carry passphrases, only the verb goes into the log
+static std::string command_name(const std::string &command) {
+  return command.substr(0, command.find(' '));
+}
+
+genie::WpaCtrl::WpaCtrl(const std::string &ctrl_path, EventCallback on_event)
+    : ctrl_path(ctrl_path), on_event(std::move(on_event)), fd(-1),
+      watch_id(0), timeout_id(0), in_flight(false) {}
+
+genie::WpaCtrl::~WpaCtrl() {
+  // callbacks must not run once the owner is being destroyed
+  pending.clear();
+  close();
+}
+
+bool genie::WpaCtrl::available() const {
+  return g_file_test(ctrl_path.c_str(), G_FILE_TEST_EXISTS);
+}
+
+bool genie::WpaCtrl::open() {
+  if (fd >= 0)
+    return true;
+
+  static int counter = 0;
+  gchar *name = g_strdup_printf("genie-wpa-ctrl-%d-%d", (int)getpid(),
+                                counter++);
+  gchar *path = g_build_filename(g_get_tmp_dir(), name, nullptr);
+  local_path = path;
+  g_free(name);
+  g_free(path);
+
+  struct sockaddr_un local, dest;
+  if (local_path.size() >= sizeof(local.sun_path) ||
+      ctrl_path.size() >= sizeof(dest.sun_path)) {
+    g_warning("Control socket path too long: %s", ctrl_path.c_str());
+    return false;
+  }
+
+  fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    g_warning("Failed to create control socket: %s", strerror(errno));
+    return false;
+  }
+
+  memset(&local, 0, sizeof(local));
+  local.sun_family = AF_UNIX;
+  strcpy(local.sun_path, local_path.c_str());
+  unlink(local_path.c_str());
+  if (bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+    g_warning("Failed to bind control socket %s: %s", local_path.c_str(),
+              strerror(errno));
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+
+  memset(&dest, 0, sizeof(dest));
+  dest.sun_family = AF_UNIX;
+  strcpy(dest.sun_path, ctrl_path.c_str());
+  if (connect(fd, (struct sockaddr *)&dest, sizeof(dest)) < 0) {
+    g_debug("Failed to connect to %s: %s", ctrl_path.c_str(), strerror(errno));
+    close();
+    return false;
+  }
+
+  watch_id = g_unix_fd_add(fd, G_IO_IN, on_readable, this);
+
+  // ask for events before anything else
+  pending.push_front({"ATTACH", [this](bool ok, const std::string &reply) {
+                        if (!ok)
+                          g_warning("Failed to attach to %s",
+                                    ctrl_path.c_str());
+                      }});
+  return true;
+}
+
+void genie::WpaCtrl::close() {
+  if (timeout_id > 0)
+    g_source_remove(timeout_id);
+  timeout_id = 0;
+  if (watch_id > 0)
+    g_source_remove(watch_id);
+  watch_id = 0;
+  if (fd >= 0) {
+    ::close(fd);
+    unlink(local_path.c_str());
+  }
+  fd = -1;
+  in_flight = false;
+}
+
+void genie::WpaCtrl::request(const std::string &command, ReplyCallback done) {
+  pending.push_back({command, std::move(done)});
+  if (!open()) {
+    fail_all("control socket unavailable");
+    return;
+  }
+  send_next();
+}
+
+void genie::WpaCtrl::send_next() {
+  if (in_flight || pending.empty() || fd < 0)
+    return;
+
+  const std::string &command = pending.front().command;
+  if (send(fd, command.data(), command.size(), 0) < 0) {
+    g_warning("Failed to send %s to %s: %s", command_name(command).c_str(),
+              ctrl_path.c_str(), strerror(errno));
+    // the daemon restarted or went away, our next request reconnects
+    close();
+    fail_all("send failed");
+    return;
+  }
+
+  in_flight = true;
+  timeout_id = g_timeout_add(REQUEST_TIMEOUT_MS, on_timeout, this);
+}
+
+void genie::WpaCtrl::complete(bool ok, const std::string &reply) {
+  if (timeout_id > 0)
+    g_source_remove(timeout_id);
+  timeout_id = 0;
+  in_flight = false;
+
+  if (pending.empty())
+    return;
+  Request req = std::move(pending.front());
+  pending.pop_front();
+
+  if (req.done)
+    req.done(ok, reply);
+  send_next();
+}
+
+void genie::WpaCtrl::fail_all(const char *reason) {
+  std::deque<Request> failed;
+  failed.swap(pending);
+  for (auto &req : failed) {
+    g_debug("%s: %s failed: %s", ctrl_path.c_str(),
+            command_name(req.command).c_str(), reason);
+    if (req.done)
+      req.done(false, reason);
+  }
+}
+
+gboolean genie::WpaCtrl::on_readable(gint fd, GIOCondition condition,
+                                     gpointer data) {
+  WpaCtrl *self = static_cast<WpaCtrl *>(data);
+  const guint watch = self->watch_id;
+  char buf[MAX_REPLY_SIZE];
+
+  for (;;) {
+    ssize_t len = recv(fd, buf, sizeof(buf) - 1, 0);
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        g_warning("Failed to read from %s: %s", self->ctrl_path.c_str(),
+                  strerror(errno));
+        self->watch_id = 0;
+        self->close();
+        self->fail_all("read failed");
+        return G_SOURCE_REMOVE;
+      }
+      break;
+    }
+
+    // events look like "<3>CTRL-EVENT-CONNECTED ...", replies never start
+    // with '<'
+    if (len > 3 && buf[0] == '<' && g_ascii_isdigit(buf[1])) {
+      const char *end = (const char *)memchr(buf, '>', len);
+      if (end) {
+        std::string event(end + 1, buf + len - (end + 1));
+        if (self->on_event)
+          self->on_event(event);
+        if (self->watch_id != watch)
+          return G_SOURCE_REMOVE;
+        continue;
+      }
+    }
+
+    std::string reply(buf, len);
+    bool ok = !g_str_has_prefix(reply.c_str(), "FAIL") &&
+              !g_str_has_prefix(reply.c_str(), "UNKNOWN COMMAND");
+    self->complete(ok, reply);
+
+    // the callback may have closed (and reopened) the socket
+    if (self->watch_id != watch)
+      return G_SOURCE_REMOVE;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+gboolean genie::WpaCtrl::on_timeout(gpointer data) {
+  WpaCtrl *self = static_cast<WpaCtrl *>(data);
+  self->timeout_id = 0;
+
+  g_warning("No reply from %s to %s", self->ctrl_path.c_str(),
+            self->pending.empty()
+                ? "?"
+                : command_name(self->pending.front().command).c_str());
+
+  // reopen the socket, so a late reply is not taken for the next command's
+  self->close();
+  std::deque<Request> rest;
+  rest.swap(self->pending);
+  if (!rest.empty()) {
+    Request timed_out = std::move(rest.front());
+    rest.pop_front();
+    if (timed_out.done)
+      timed_out.done(false, "timeout");
+  }
+  for (auto &req : rest)
+    self->pending.push_back(std::move(req));
+  if (!self->pending.empty()) {
+    if (self->open())
+      self->send_next();
+    else
+      self->fail_all("control socket unavailable");
+  }
+
+  return G_SOURCE_REMOVE;
+}
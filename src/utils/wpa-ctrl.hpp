@@ -0,0 +1,89 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <glib.h>
+#include <string>
+
+namespace genie {
+
+/**
+ * Asynchronous client for the control interface of wpa_supplicant and
+ * hostapd: a UNIX datagram socket per interface, usually
+ * `/var/run/wpa_supplicant/<ifname>` or `/var/run/hostapd/<ifname>`.
+ *
+ * Commands are sent one at a time from the main loop and answered through
+ * `ReplyCallback`. The connection is attached, so unsolicited events
+ * (`CTRL-EVENT-CONNECTED`, `AP-ENABLED`, ...) arrive on the same socket and
+ * are passed to `EventCallback` without their `<level>` prefix.
+ *
+ * If the daemon goes away the socket is closed; the next command opens it
+ * again.
+ */
+class WpaCtrl {
+public:
+  typedef std::function<void(bool ok, const std::string &reply)>
+      ReplyCallback;
+  typedef std::function<void(const std::string &event)> EventCallback;
+
+  WpaCtrl(const std::string &ctrl_path, EventCallback on_event);
+  ~WpaCtrl();
+
+  WpaCtrl(const WpaCtrl &) = delete;
+  WpaCtrl &operator=(const WpaCtrl &) = delete;
+
+  const std::string &path() const { return ctrl_path; }
+  bool available() const;
+  bool is_open() const { return fd >= 0; }
+
+  bool open();
+  void close();
+
+  /**
+   * @brief Queue `command`. `done` receives false if the daemon answered
+   * FAIL, did not answer within the timeout, or could not be reached.
+   */
+  void request(const std::string &command, ReplyCallback done = nullptr);
+
+private:
+  struct Request {
+    std::string command;
+    ReplyCallback done;
+  };
+
+  const std::string ctrl_path;
+  EventCallback on_event;
+  std::string local_path;
+  int fd;
+  guint watch_id;
+  guint timeout_id;
+  bool in_flight;
+  std::deque<Request> pending;
+
+  static gboolean on_readable(gint fd, GIOCondition condition, gpointer data);
+  static gboolean on_timeout(gpointer data);
+
+  void send_next();
+  void complete(bool ok, const std::string &reply);
+  void fail_all(const char *reason);
+};
+
+} // namespace genie
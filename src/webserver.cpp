@@ -18,12 +18,19 @@
 
 #include "webserver.hpp"
 #include "app.hpp"
+#include "audio/audioinput.hpp"
+#include "cpu_monitor.hpp"
+#include "memory_monitor.hpp"
 #include "string.h"
 #include "utils/c-style-callback.hpp"
 #include "utils/soup-utils.hpp"
+#include "utils/tls-monitor.hpp"
 #include "utils/net.hpp"
+#include "utils/worker-pool.hpp"
+#include <algorithm>
 #include <fcntl.h>
 #include <functional>
+#include <memory>
 #include <json-glib/json-glib.h>
 
 #include "config.h"
@@ -45,6 +52,15 @@ static const char *reply_404 =
        "href=\"/\">Home page</a></p>");
 static const char *reply_405 = N_("<h1>Method Not Allowed</h1>");
 
+// assets are revalidated with their ETag after this long
+static const char *ASSET_CACHE_CONTROL = "public, max-age=3600";
+static const char *ASSET_CACHE_CONTROL_DEV = "no-cache";
+
+static const char *const STATUS_TOPIC_NAMES[] = {
+    "state", "volume", "connection", "turn", "level", "stream", "tls",
+    "memory", "cpu", "input",
+};
+
 static gchar *gen_random(size_t size) {
   guchar *buffer = (guchar *)g_malloc(size);
   int fd = open("/dev/urandom", O_RDONLY);
@@ -76,12 +92,58 @@ static mustache::mustache load_html_template(genie::App *app,
   return tmpl;
 }
 
+static bool is_compressible(const char *content_type) {
+  return g_str_has_prefix(content_type, "text/") ||
+         strcmp(content_type, "application/javascript") == 0;
+}
+
+static GBytes *gzip_bytes(GBytes *input) {
+  auto_gobject_ptr<GZlibCompressor> compressor(
+      g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, 9),
+      adopt_mode::owned);
+
+  gsize in_size;
+  const guint8 *in = (const guint8 *)g_bytes_get_data(input, &in_size);
+  GByteArray *out = g_byte_array_sized_new(in_size / 2 + 64);
+  guint8 buffer[16384];
+  gsize consumed = 0;
+
+  for (;;) {
+    gsize bytes_read = 0, bytes_written = 0;
+    GError *error = nullptr;
+    GConverterResult result = g_converter_convert(
+        G_CONVERTER(compressor.get()), in + consumed, in_size - consumed,
+        buffer, sizeof(buffer), G_CONVERTER_INPUT_AT_END, &bytes_read,
+        &bytes_written, &error);
+    if (result == G_CONVERTER_ERROR) {
+      g_warning("Failed to compress asset: %s", error->message);
+      g_error_free(error);
+      g_byte_array_unref(out);
+      return nullptr;
+    }
+
+    consumed += bytes_read;
+    g_byte_array_append(out, buffer, bytes_written);
+    if (result == G_CONVERTER_FINISHED)
+      break;
+  }
+
+  return g_byte_array_free_to_bytes(out);
+}
+
 genie::WebServer::WebServer(App *app)
     : app(app),
       server(soup_server_new("server-header",
                              PACKAGE_NAME "/" PACKAGE_VERSION " ", nullptr),
              adopt_mode::owned),
-      page_layout(load_html_template(app, "layout.html")) {
+      cache_generation(0), status_flush_source(0), status_level_source(0),
+      status_last_level(AudioInput::LEVEL_FLOOR_DB), status_coalesced(0) {
+  // parse the templates now rather than on the first request
+  get_template("layout.html");
+  get_template("config.html");
+  get_template("network.html");
+  if (app->config->webui_dev_mode)
+    watch_assets();
 
   gchar *tmp = gen_random(32);
   csrf_token = tmp;
@@ -120,6 +182,22 @@ genie::WebServer::WebServer(App *app)
         self->handle_asset(msg, path);
       },
       this, nullptr);
+  soup_server_add_handler(
+      server.get(), "/api/status/events",
+      [](SoupServer *server, SoupMessage *msg, const char *path,
+         GHashTable *query, SoupClientContext *context, gpointer data) {
+        static_cast<WebServer *>(data)->handle_status_events(msg);
+      },
+      this, nullptr);
+
+  soup_server_add_handler(
+      server.get(), "/api/recorder",
+      [](SoupServer *server, SoupMessage *msg, const char *path,
+         GHashTable *query, SoupClientContext *context, gpointer data) {
+        static_cast<WebServer *>(data)->handle_recorder(msg);
+      },
+      this, nullptr);
+
   soup_server_add_handler(
       server.get(), "/oauth-redirect",
       [](SoupServer *server, SoupMessage *msg, const char *path,
@@ -154,6 +232,312 @@ genie::WebServer::WebServer(App *app)
   g_message("Web UI listening on port %d", app->config->webui_port);
 }
 
+genie::WebServer::~WebServer() {
+  if (status_flush_source)
+    g_source_remove(status_flush_source);
+  if (status_level_source)
+    g_source_remove(status_level_source);
+  for (auto &sub : status_subscribers) {
+    g_signal_handlers_disconnect_by_data(sub->msg, sub.get());
+    g_object_unref(sub->msg);
+  }
+}
+
+/**
+ * @brief Serve the status stream as Server-Sent Events.
+ *
+ * The response stays open, updates are appended as chunks when they are
+ * published. A new subscriber first receives the latest value of every
+ * topic.
+ */
+void genie::WebServer::handle_status_events(SoupMessage *msg) {
+  const char *path = "/api/status/events";
+  if (check_method(msg, path, (int)AllowedMethod::GET) != AllowedMethod::GET)
+    return;
+
+  if (status_subscribers.size() >= app->config->webui_status_max_subscribers) {
+    log_request(msg, path, 503);
+    soup_message_headers_replace(msg->response_headers, "Retry-After", "10");
+    send_error(msg, 503, "Too many status subscribers");
+    return;
+  }
+
+  log_request(msg, path, 200);
+  soup_message_set_status(msg, 200);
+  soup_message_headers_set_content_type(msg->response_headers,
+                                        "text/event-stream", nullptr);
+  soup_message_headers_replace(msg->response_headers, "Cache-Control",
+                               "no-cache");
+  soup_message_headers_set_encoding(msg->response_headers,
+                                    SOUP_ENCODING_CHUNKED);
+  // written chunks are dropped instead of being kept for the whole stream
+  soup_message_body_set_accumulate(msg->response_body, FALSE);
+
+  auto sub = std::make_unique<StatusSubscriber>();
+  sub->self = this;
+  sub->msg = msg;
+  sub->connected_at = g_get_monotonic_time();
+  g_object_ref(msg);
+  g_signal_connect(msg, "wrote-chunk", G_CALLBACK(on_status_chunk_written),
+                   sub.get());
+  g_signal_connect(msg, "finished", G_CALLBACK(on_status_finished),
+                   sub.get());
+  status_subscribers.push_back(std::move(sub));
+  StatusSubscriber *added = status_subscribers.back().get();
+
+  for (int topic = 0; topic < STATUS_TOPIC_COUNT; topic++) {
+    if (!status_payloads[topic].empty())
+      added->pending |= 1 << topic;
+  }
+
+  if (!status_level_source) {
+    status_level_source =
+        g_timeout_add(app->config->webui_status_level_interval_ms,
+                      poll_input_level, this);
+  }
+
+  g_message("Status subscriber connected (%zu of %zu)",
+            status_subscribers.size(),
+            app->config->webui_status_max_subscribers);
+  publish_stream_stats();
+}
+
+void genie::WebServer::publish_state(const char *state_name) {
+  gchar *payload = g_strdup_printf("{\"state\":\"%s\"}", state_name);
+  publish_status(STATUS_STATE, payload);
+  g_free(payload);
+}
+
+void genie::WebServer::publish_volume(int volume) {
+  publish_status(STATUS_VOLUME, std::string("{\"volume\":") +
+                                    std::to_string(volume) + "}");
+}
+
+void genie::WebServer::publish_connection(bool connected) {
+  publish_status(STATUS_CONNECTION, connected ? "{\"connected\":true}"
+                                              : "{\"connected\":false}");
+}
+
+static std::string input_quality_json(const genie::InputQuality &input) {
+  gchar *json = g_strdup_printf(
+      "{\"snr_db\":%.1f,\"speech_db\":%.1f,\"noise_floor_db\":%.1f,"
+      "\"peak_db\":%.1f,\"clipped\":%zu,\"dc_offset\":%.4f,"
+      "\"frames\":%zu,\"speech_frames\":%zu}",
+      input.snr_db, input.speech_db, input.noise_floor_db, input.peak_db,
+      input.clipped, input.dc_offset, input.frames, input.speech_frames);
+  std::string result(json);
+  g_free(json);
+  return result;
+}
+
+void genie::WebServer::publish_turn(double stt_ms, double genie_ms,
+                                    double tts_ms, double total_ms,
+                                    const InputQuality *input) {
+  std::string input_json = input ? input_quality_json(*input) : "null";
+
+  gchar *payload = g_strdup_printf(
+      "{\"stt_ms\":%.0f,\"genie_ms\":%.0f,\"tts_ms\":%.0f,"
+      "\"total_ms\":%.0f,\"input\":%s}",
+      stt_ms, genie_ms, tts_ms, total_ms, input_json.c_str());
+  publish_status(STATUS_TURN, payload);
+  g_free(payload);
+}
+
+void genie::WebServer::publish_input(const InputQuality &input) {
+  publish_status(STATUS_INPUT, input_quality_json(input));
+}
+
+void genie::WebServer::publish_tls(const TLSStats &stats) {
+  gchar *payload = g_strdup_printf(
+      "{\"handshakes\":%zu,\"resumed\":%zu,\"unknown\":%zu,"
+      "\"last_ms\":%.1f,\"mean_ms\":%.1f}",
+      stats.handshakes, stats.resumed, stats.resumption_unknown,
+      stats.last_ms, stats.total_ms / MAX(stats.handshakes, 1));
+  publish_status(STATUS_TLS, payload);
+  g_free(payload);
+}
+
+void genie::WebServer::publish_memory(const MemoryStats &stats) {
+  std::string components;
+  for (const auto &account : stats.accounts) {
+    gchar *entry = g_strdup_printf("%s\"%s\":{\"bytes\":%zu,\"items\":%zu}",
+                                   components.empty() ? "" : ",", account.name,
+                                   account.bytes, account.items);
+    components += entry;
+    g_free(entry);
+  }
+
+  gchar *payload = g_strdup_printf(
+      "{\"rss_kb\":%zu,\"hwm_kb\":%zu,\"pss_kb\":%zu,\"soft_limit_kb\":%zu,"
+      "\"sheds\":%zu,\"components\":{%s}}",
+      stats.rss_kb, stats.hwm_kb, stats.pss_kb, stats.soft_limit_kb,
+      stats.sheds, components.c_str());
+  publish_status(STATUS_MEMORY, payload);
+  g_free(payload);
+}
+
+/**
+ * @brief `{"name":percent,...}`, thread names come from the kernel and are
+ * escaped.
+ */
+static std::string
+cpu_groups_json(const std::vector<genie::CpuStats::Group> &groups) {
+  std::string json;
+  for (const auto &group : groups) {
+    gchar *name = g_strescape(group.name.c_str(), nullptr);
+    gchar *entry = g_strdup_printf("%s\"%s\":%.1f", json.empty() ? "" : ",",
+                                   name, group.percent);
+    json += entry;
+    g_free(entry);
+    g_free(name);
+  }
+  return "{" + json + "}";
+}
+
+void genie::WebServer::publish_cpu(const CpuStats &stats) {
+  std::string states;
+  for (const auto &state : stats.states) {
+    gchar *entry = g_strdup_printf(
+        "%s\"%s\":{\"wall_s\":%.1f,\"total\":%.1f,\"threads\":%s}",
+        states.empty() ? "" : ",", state.name.c_str(), state.wall_s,
+        state.total_percent, cpu_groups_json(state.groups).c_str());
+    states += entry;
+    g_free(entry);
+  }
+
+  gchar *payload = g_strdup_printf(
+      "{\"interval_s\":%.1f,\"total\":%.1f,\"threads\":%s,"
+      "\"states\":{%s}}",
+      stats.interval_s, stats.total_percent,
+      cpu_groups_json(stats.groups).c_str(), states.c_str());
+  publish_status(STATUS_CPU, payload);
+  g_free(payload);
+}
+
+/**
+ * @brief Report subscriber count and send-queue depths on the stream itself.
+ */
+void genie::WebServer::publish_stream_stats() {
+  std::string queues;
+  for (auto &sub : status_subscribers) {
+    if (!queues.empty())
+      queues += ",";
+    queues += std::to_string(sub->queued);
+  }
+
+  gchar *payload = g_strdup_printf(
+      "{\"subscribers\":%zu,\"max_subscribers\":%zu,\"queue_limit\":%zu,"
+      "\"queues\":[%s],\"coalesced\":%zu}",
+      status_subscribers.size(), app->config->webui_status_max_subscribers,
+      app->config->webui_status_queue_depth, queues.c_str(),
+      status_coalesced);
+  publish_status(STATUS_STREAM, payload);
+  g_free(payload);
+}
+
+/**
+ * @brief Store the latest `payload` for `topic` and mark it pending for every
+ * subscriber. Writing happens later from an idle, so a burst of updates
+ * costs one write per subscriber.
+ */
+void genie::WebServer::publish_status(StatusTopic topic, std::string payload) {
+  status_payloads[topic] = std::move(payload);
+  if (status_subscribers.empty())
+    return;
+
+  for (auto &sub : status_subscribers) {
+    if (sub->pending & (1 << topic)) {
+      sub->coalesced++;
+      status_coalesced++;
+    }
+    sub->pending |= 1 << topic;
+  }
+
+  if (!status_flush_source)
+    status_flush_source = g_idle_add(flush_status, this);
+}
+
+gboolean genie::WebServer::flush_status(gpointer data) {
+  WebServer *self = static_cast<WebServer *>(data);
+  self->status_flush_source = 0;
+  for (auto &sub : self->status_subscribers)
+    self->flush_subscriber(sub.get());
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Write pending topics to one subscriber, up to its queue limit. What
+ * does not fit stays pending until libsoup reports chunks as written.
+ */
+void genie::WebServer::flush_subscriber(StatusSubscriber *sub) {
+  bool wrote = false;
+  for (int topic = 0; topic < STATUS_TOPIC_COUNT && sub->pending; topic++) {
+    if (!(sub->pending & (1 << topic)))
+      continue;
+    if (sub->queued >= app->config->webui_status_queue_depth)
+      break;
+
+    gchar *chunk = g_strdup_printf("event: %s\ndata: %s\n\n",
+                                   STATUS_TOPIC_NAMES[topic],
+                                   status_payloads[topic].c_str());
+    soup_message_body_append(sub->msg->response_body, SOUP_MEMORY_TAKE, chunk,
+                             strlen(chunk));
+    sub->pending &= ~(1 << topic);
+    sub->queued++;
+    sub->max_queued = std::max(sub->max_queued, sub->queued);
+    sub->sent++;
+    wrote = true;
+  }
+
+  if (wrote)
+    soup_server_unpause_message(server.get(), sub->msg);
+}
+
+gboolean genie::WebServer::poll_input_level(gpointer data) {
+  WebServer *self = static_cast<WebServer *>(data);
+  if (self->status_subscribers.empty()) {
+    self->status_level_source = 0;
+    return G_SOURCE_REMOVE;
+  }
+
+  int level = self->app->take_input_level();
+  if (level != self->status_last_level) {
+    self->status_last_level = level;
+    self->publish_status(STATUS_LEVEL, std::string("{\"level_db\":") +
+                                           std::to_string(level) + "}");
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+void genie::WebServer::on_status_chunk_written(SoupMessage *msg,
+                                               gpointer data) {
+  StatusSubscriber *sub = static_cast<StatusSubscriber *>(data);
+  WebServer *self = sub->self;
+  if (sub->queued > 0)
+    sub->queued--;
+  if (sub->pending && !self->status_flush_source)
+    self->status_flush_source = g_idle_add(flush_status, self);
+}
+
+void genie::WebServer::on_status_finished(SoupMessage *msg, gpointer data) {
+  StatusSubscriber *sub = static_cast<StatusSubscriber *>(data);
+  WebServer *self = sub->self;
+
+  g_message("Status subscriber left after %.1f s: %zu events sent, %zu "
+            "coalesced, max queue %zu",
+            (g_get_monotonic_time() - sub->connected_at) / 1000000.0,
+            sub->sent, sub->coalesced, sub->max_queued);
+
+  g_signal_handlers_disconnect_by_data(msg, sub);
+  self->status_subscribers.remove_if(
+      [sub](const std::unique_ptr<StatusSubscriber> &other) {
+        return other.get() == sub;
+      });
+  g_object_unref(msg);
+
+  self->publish_stream_stats();
+}
+
 void genie::WebServer::handle_asset(SoupMessage *msg, const char *path) {
   if (check_method(msg, path, (int)AllowedMethod::GET) != AllowedMethod::GET)
     return;
@@ -165,25 +549,20 @@ void genie::WebServer::handle_asset(SoupMessage *msg, const char *path) {
     return;
   }
 
-  char *filename =
-      g_build_filename(app->config->asset_dir, "webui", path, nullptr);
-  g_debug("Serving asset from %s", filename);
-  GError *error = nullptr;
-  gchar *contents;
-  gsize length;
-  if (!g_file_get_contents(filename, &contents, &length, &error)) {
-    g_free(filename);
-    g_error_free(error);
-
-    if (error->code == G_FILE_ERROR_ACCES || error->code == G_FILE_ERROR_PERM) {
-      log_request(msg, path, 403);
-      send_html(msg, 403, title_error, reply_403);
-    } else {
-      handle_404(msg, path);
-    }
+  auto cached = assets.find(path);
+  if (cached != assets.end()) {
+    send_asset(msg, path, *cached->second);
     return;
   }
-  g_free(filename);
+
+  std::string filename_str;
+  {
+    char *filename =
+        g_build_filename(app->config->asset_dir, "webui", path, nullptr);
+    filename_str = filename;
+    g_free(filename);
+  }
+  g_debug("Loading asset from %s", filename_str.c_str());
 
   const char *content_type = "application/octet-stream";
   if (g_str_has_prefix(path, "/css"))
@@ -193,10 +572,213 @@ void genie::WebServer::handle_asset(SoupMessage *msg, const char *path) {
   else if (strcmp(path, "/favicon.ico") == 0)
     content_type = "image/png";
 
+  // first request for this asset: load it on the worker pool, the message is
+  // resumed once it is in the cache
+  struct AssetLoad {
+    std::shared_ptr<Asset> asset;
+    GError *error = nullptr;
+  };
+  auto result = std::make_shared<AssetLoad>();
+  std::string path_str(path);
+  guint generation = cache_generation;
+
+  g_object_ref(msg);
+  soup_server_pause_message(server.get(), msg);
+  app->worker_pool->run(
+      [filename_str, content_type, result]() {
+        result->asset = load_asset(filename_str, content_type, &result->error);
+      },
+      [this, msg, result, path_str, generation]() {
+        if (result->error) {
+          if (result->error->code == G_FILE_ERROR_ACCES ||
+              result->error->code == G_FILE_ERROR_PERM) {
+            log_request(msg, path_str.c_str(), 403);
+            send_html(msg, 403, title_error, reply_403);
+          } else {
+            handle_404(msg, path_str.c_str());
+          }
+          g_error_free(result->error);
+        } else {
+          if (generation == cache_generation)
+            assets[path_str] = result->asset;
+          send_asset(msg, path_str.c_str(), *result->asset);
+        }
+        soup_server_unpause_message(server.get(), msg);
+        g_object_unref(msg);
+      });
+}
+
+/**
+ * @brief Read an asset and prepare its ETag and compressed variant. Runs on
+ * the worker pool.
+ */
+std::shared_ptr<genie::WebServer::Asset>
+genie::WebServer::load_asset(const std::string &filename,
+                             const char *content_type, GError **error) {
+  gchar *contents;
+  gsize length;
+  if (!g_file_get_contents(filename.c_str(), &contents, &length, error))
+    return nullptr;
+
+  auto asset = std::make_shared<Asset>();
+  asset->content_type = content_type;
+  asset->data = g_bytes_new_take(contents, length);
+
+  gchar *digest = g_compute_checksum_for_bytes(G_CHECKSUM_SHA1, asset->data);
+  asset->etag = "\"" + std::string(digest, 16) + "\"";
+  g_free(digest);
+
+  if (is_compressible(content_type)) {
+    GBytes *compressed = gzip_bytes(asset->data);
+    if (compressed && g_bytes_get_size(compressed) < length)
+      asset->gzip_data = compressed;
+    else if (compressed)
+      g_bytes_unref(compressed);
+  }
+
+  return asset;
+}
+
+void genie::WebServer::send_asset(SoupMessage *msg, const char *path,
+                                  const Asset &asset) {
+  SoupMessageHeaders *headers = msg->response_headers;
+  soup_message_headers_replace(headers, "ETag", asset.etag.c_str());
+  soup_message_headers_replace(headers, "Cache-Control",
+                               app->config->webui_dev_mode
+                                   ? ASSET_CACHE_CONTROL_DEV
+                                   : ASSET_CACHE_CONTROL);
+  if (asset.gzip_data)
+    soup_message_headers_replace(headers, "Vary", "Accept-Encoding");
+
+  const char *if_none_match =
+      soup_message_headers_get_one(msg->request_headers, "If-None-Match");
+  if (if_none_match && (strcmp(if_none_match, "*") == 0 ||
+                        strstr(if_none_match, asset.etag.c_str()))) {
+    log_request(msg, path, 304);
+    soup_message_set_status(msg, 304);
+    return;
+  }
+
+  GBytes *body = asset.data;
+  if (asset.gzip_data) {
+    const char *accept_encoding =
+        soup_message_headers_get_list(msg->request_headers, "Accept-Encoding");
+    if (accept_encoding) {
+      GSList *accepted =
+          soup_header_parse_quality_list(accept_encoding, nullptr);
+      if (g_slist_find_custom(accepted, "gzip", (GCompareFunc)strcmp)) {
+        body = asset.gzip_data;
+        soup_message_headers_replace(headers, "Content-Encoding", "gzip");
+      }
+      soup_header_free_list(accepted);
+    }
+  }
+
   log_request(msg, path, 200);
   soup_message_set_status(msg, 200);
-  soup_message_set_response(msg, content_type, SOUP_MEMORY_TAKE, contents,
-                            length);
+  soup_message_headers_set_content_type(headers, asset.content_type.c_str(),
+                                        nullptr);
+  // shares the cached buffer with the response, no copy
+  soup_message_body_append_bytes(msg->response_body, body);
+}
+
+kainjow::mustache::mustache &
+genie::WebServer::get_template(const char *filename) {
+  auto it = templates.find(filename);
+  if (it == templates.end())
+    it = templates.emplace(filename, load_html_template(app, filename)).first;
+  return it->second;
+}
+
+/**
+ * @brief Drop cached assets and templates whenever a file in the webui
+ * directory changes, so edits show up on reload. Only used in dev mode.
+ */
+void genie::WebServer::watch_assets() {
+  for (const char *subdir : {"", "css", "js"}) {
+    gchar *dirname = g_build_filename(app->config->asset_dir, "webui", subdir,
+                                      nullptr);
+    auto_gobject_ptr<GFile> dir(g_file_new_for_path(dirname),
+                                adopt_mode::owned);
+    g_free(dirname);
+
+    GError *error = nullptr;
+    auto_gobject_ptr<GFileMonitor> monitor(
+        g_file_monitor_directory(dir.get(), G_FILE_MONITOR_NONE, nullptr,
+                                 &error),
+        adopt_mode::owned);
+    if (error) {
+      g_warning("Failed to watch webui assets: %s", error->message);
+      g_error_free(error);
+      continue;
+    }
+
+    g_signal_connect(monitor.get(), "changed", G_CALLBACK(on_asset_changed),
+                     this);
+    asset_monitors.push_back(std::move(monitor));
+  }
+}
+
+void genie::WebServer::on_asset_changed(GFileMonitor *monitor, GFile *file,
+                                        GFile *other_file,
+                                        GFileMonitorEvent event,
+                                        gpointer data) {
+  WebServer *self = static_cast<WebServer *>(data);
+  g_debug("Web UI assets changed, clearing cache");
+  self->assets.clear();
+  self->templates.clear();
+  self->cache_generation++;
+}
+
+/**
+ * @brief Control the audio flight recorder: `action` is one of `dump`,
+ * `enable` or `disable`.
+ */
+void genie::WebServer::handle_recorder(SoupMessage *msg) {
+  const char *path = "/api/recorder";
+  if (check_method(msg, path, (int)AllowedMethod::POST) !=
+      AllowedMethod::POST)
+    return;
+
+  if (g_strcmp0(
+          soup_message_headers_get_content_type(msg->request_headers, nullptr),
+          "application/x-www-form-urlencoded") != 0) {
+    log_request(msg, path, 406);
+    send_html(msg, 406, title_error, "<h1>Not Acceptable</h1>");
+    return;
+  }
+
+  GHashTable *fields = soup_form_decode(msg->request_body->data);
+  const char *action = (const char *)g_hash_table_lookup(fields, "action");
+
+  if (g_strcmp0((const char *)g_hash_table_lookup(fields, "_csrf"),
+                csrf_token.c_str()) != 0) {
+    log_request(msg, path, 403);
+    send_html(msg, 403, title_error, "<h1>Invalid CSRF token</h1>");
+  } else if (g_strcmp0(action, "dump") == 0) {
+    log_request(msg, path, 200);
+    app->dump_audio_recording("webui");
+    send_html(msg, 200, title_normal,
+              _("<h1>Audio Recorder</h1><p>The recent audio is being saved "
+                "to the recordings folder in the cache directory.</p>"));
+  } else if (g_strcmp0(action, "enable") == 0 ||
+             g_strcmp0(action, "disable") == 0) {
+    if (app->set_audio_recorder_enabled(strcmp(action, "enable") == 0)) {
+      log_request(msg, path, 200);
+      send_html(msg, 200, title_normal,
+                strcmp(action, "enable") == 0
+                    ? _("<h1>Audio Recorder</h1><p>Recording enabled.</p>")
+                    : _("<h1>Audio Recorder</h1><p>Recording disabled.</p>"));
+    } else {
+      log_request(msg, path, 409);
+      send_error(msg, 409, _("the audio recorder is disabled in the config"));
+    }
+  } else {
+    log_request(msg, path, 400);
+    send_error(msg, 400, _("unknown action"));
+  }
+
+  g_hash_table_unref(fields);
 }
 
 void genie::WebServer::handle_404(SoupMessage *msg, const char *path) {
@@ -323,8 +905,10 @@ void genie::WebServer::handle_oauth_redirect(SoupMessage *msg,
         json_reader_end_member(reader); // refresh_token
         app->config->set_genie_access_token(refresh_token);
 
-        app->config->save();
-        app->force_reconnect();
+        app->config->save(app->worker_pool.get());
+        ConfigDiff changes;
+        changes.add("general", "accessToken");
+        app->config_changed(changes);
 
         g_object_unref(parser);
         g_object_unref(reader);
@@ -346,8 +930,7 @@ void genie::WebServer::handle_index(SoupMessage *msg) {
 
 void genie::WebServer::handle_index_post(SoupMessage *msg) {
   GHashTable *fields = nullptr;
-  bool any_change = false;
-  bool needs_reconnect = false;
+  ConfigDiff changes;
   bool needs_oauth_redirect = false;
 
   if (g_strcmp0(
@@ -371,8 +954,7 @@ void genie::WebServer::handle_index_post(SoupMessage *msg) {
     const char *url = (const char *)g_hash_table_lookup(fields, "url");
     if (url && *url && g_strcmp0(url, app->config->genie_url) != 0) {
       app->config->set_genie_url(url);
-      any_change = true;
-      needs_reconnect = true;
+      changes.add("general", "url");
     }
   }
   {
@@ -382,8 +964,7 @@ void genie::WebServer::handle_index_post(SoupMessage *msg) {
       AuthMode parsed = Config::parse_auth_mode(auth_mode);
       if (parsed != app->config->auth_mode) {
         app->config->set_auth_mode(parsed);
-        any_change = true;
-        needs_reconnect = true;
+        changes.add("general", "auth_mode");
 
         if (parsed == AuthMode::OAUTH2)
           needs_oauth_redirect = true;
@@ -396,8 +977,7 @@ void genie::WebServer::handle_index_post(SoupMessage *msg) {
     if (access_token && *access_token &&
         g_strcmp0(access_token, app->config->genie_access_token) != 0) {
       app->config->set_genie_access_token(access_token);
-      any_change = true;
-      needs_reconnect = true;
+      changes.add("general", "accessToken");
     }
   }
   {
@@ -406,13 +986,14 @@ void genie::WebServer::handle_index_post(SoupMessage *msg) {
     if (conversation_id && *conversation_id &&
         g_strcmp0(conversation_id, app->config->conversation_id) != 0) {
       app->config->set_conversation_id(conversation_id);
-      any_change = true;
-      needs_reconnect = true;
+      changes.add("general", "conversationId");
     }
   }
 
-  if (any_change)
-    app->config->save();
+  // the config watcher sees this save too, but the file then matches the
+  // config in memory and the reload is a no-op
+  if (!changes.empty())
+    app->config->save(app->worker_pool.get());
   if (app->config->auth_mode == AuthMode::OAUTH2 &&
       (!app->config->genie_access_token || !*app->config->genie_access_token))
     needs_oauth_redirect = true;
@@ -439,8 +1020,8 @@ void genie::WebServer::handle_index_post(SoupMessage *msg) {
     goto out;
   }
 
-  if (needs_reconnect)
-    app->force_reconnect();
+  if (!changes.empty())
+    app->config_changed(changes);
 
   handle_index_get(msg);
 
@@ -464,7 +1045,7 @@ void genie::WebServer::handle_index_get(SoupMessage *msg) {
       {"access_token",
        app->config->genie_access_token ? app->config->genie_access_token : ""},
       {"conversation_id", app->config->conversation_id}};
-  auto body = load_html_template(app, "config.html").render(data);
+  auto body = get_template("config.html").render(data);
 
   log_request(msg, "/", 200);
   send_html(msg, 200, title_normal, body.c_str());
@@ -482,12 +1063,30 @@ void genie::WebServer::handle_net(SoupMessage *msg) {
 void genie::WebServer::handle_net_get(SoupMessage *msg) {
   const char *auth_mode = Config::auth_mode_to_string(app->config->auth_mode);
 
-  mustache::object data{
-      {"csrf_token", csrf_token.c_str()},
-      {"status", "todo"},
-      {"ssid", "test"},
-      {"mac", "00:00:00:00:00:00"}};
-  auto body = load_html_template(app, "network.html").render(data);
+  std::string status = "Disabled";
+  std::string ssid;
+  std::string mac = "00:00:00:00:00:00";
+  if (app->net_controller) {
+    status = app->net_controller->get_status_text();
+    ssid = app->net_controller->get_sta_ssid();
+
+    char *hwaddr = (char *)g_malloc0(16);
+    if (app->net_controller->get_mac_address(app->config->net_wlan_if,
+                                             &hwaddr)) {
+      unsigned char *b = (unsigned char *)hwaddr;
+      gchar *str = g_strdup_printf("%02x:%02x:%02x:%02x:%02x:%02x", b[0],
+                                   b[1], b[2], b[3], b[4], b[5]);
+      mac = str;
+      g_free(str);
+    }
+    g_free(hwaddr);
+  }
+
+  mustache::object data{{"csrf_token", csrf_token.c_str()},
+                        {"status", status},
+                        {"ssid", ssid},
+                        {"mac", mac}};
+  auto body = get_template("network.html").render(data);
 
   log_request(msg, "/", 200);
   send_html(msg, 200, title_normal, body.c_str());
@@ -536,15 +1135,14 @@ void genie::WebServer::handle_net_post(SoupMessage *msg) {
       goto out;
     }
 
-    if (strlen(secret) <= 0 || strlen(secret) > 64) {
+    if (strlen(secret) <= 0 || strlen(secret) > 64 ||
+        !NetController::is_valid_secret(secret)) {
       send_html(msg, 500, title_error, "<h1>Bad parameter: secret</h1>");
       goto out;
     }
 
     if (ssid && auth_mode && secret) {
-      app->net_controller->set_wifi_config(parsed_auth_mode, ssid, secret);
-      app->net_controller->stop_ap();
-      app->net_controller->start_sta();
+      app->net_controller->apply_wifi_config(parsed_auth_mode, ssid, secret);
     } else {
       send_html(msg, 500, title_error, "<h1>Missing parameters</h1>");
       goto out;
@@ -564,7 +1162,7 @@ void genie::WebServer::send_html(SoupMessage *msg, int status,
                                  const char *page_title,
                                  const char *page_body) {
   mustache::object data{{"page_title", page_title}, {"page_body", page_body}};
-  auto rendered = page_layout.render(data);
+  auto rendered = get_template("layout.html").render(data);
 
   soup_message_set_status(msg, status);
   soup_message_set_response(msg, "text/html", SOUP_MEMORY_COPY, rendered.data(),
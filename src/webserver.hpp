@@ -19,23 +19,130 @@
 #pragma once
 
 #include "utils/autoptrs.hpp"
+#include <gio/gio.h>
 #include <libsoup/soup.h>
+#include <list>
+#include <map>
+#include <memory>
 #include <mustache.hpp>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace genie {
 
 class App;
+struct CpuStats;
+struct InputQuality;
+struct MemoryStats;
+struct TLSStats;
 
 class WebServer {
 public:
   WebServer(App *app);
+  ~WebServer();
+
+  // Status stream, all called on the main thread
+  void publish_state(const char *state_name);
+  void publish_volume(int volume);
+  void publish_connection(bool connected);
+  void publish_turn(double stt_ms, double genie_ms, double tts_ms,
+                    double total_ms, const InputQuality *input);
+  void publish_input(const InputQuality &input);
+  void publish_tls(const TLSStats &stats);
+  void publish_memory(const MemoryStats &stats);
+  void publish_cpu(const CpuStats &stats);
 
 private:
+  /**
+   * Kinds of update on the status stream. Only the latest payload of each
+   * kind is kept, so a subscriber that falls behind skips intermediate
+   * values instead of queueing them.
+   */
+  enum StatusTopic {
+    STATUS_STATE,
+    STATUS_VOLUME,
+    STATUS_CONNECTION,
+    STATUS_TURN,
+    STATUS_LEVEL,
+    STATUS_STREAM,
+    STATUS_TLS,
+    STATUS_MEMORY,
+    STATUS_CPU,
+    STATUS_INPUT,
+    STATUS_TOPIC_COUNT,
+  };
+
+  struct StatusSubscriber {
+    WebServer *self;
+    SoupMessage *msg;
+    // bit mask of StatusTopic with an update not yet written
+    guint pending = 0;
+    // chunks handed to libsoup that were not written to the socket yet
+    size_t queued = 0;
+    size_t max_queued = 0;
+    size_t sent = 0;
+    size_t coalesced = 0;
+    gint64 connected_at;
+  };
+
+  /**
+   * A static file from the webui directory, loaded once and served from
+   * memory, with a gzip variant for text types when that is smaller.
+   */
+  struct Asset {
+    std::string content_type;
+    std::string etag;
+    GBytes *data = nullptr;
+    GBytes *gzip_data = nullptr;
+
+    Asset() {}
+    Asset(const Asset &) = delete;
+    Asset &operator=(const Asset &) = delete;
+    ~Asset() {
+      if (data)
+        g_bytes_unref(data);
+      if (gzip_data)
+        g_bytes_unref(gzip_data);
+    }
+  };
+
   App *app;
   auto_gobject_ptr<SoupServer> server;
   std::string csrf_token;
-  kainjow::mustache::mustache page_layout;
+
+  std::unordered_map<std::string, std::shared_ptr<Asset>> assets;
+  std::map<std::string, kainjow::mustache::mustache> templates;
+  // bumped when the caches are invalidated, so loads that were in flight
+  // at the time are not cached
+  guint cache_generation;
+  std::vector<auto_gobject_ptr<GFileMonitor>> asset_monitors;
+
+  kainjow::mustache::mustache &get_template(const char *filename);
+  static std::shared_ptr<Asset> load_asset(const std::string &filename,
+                                           const char *content_type,
+                                           GError **error);
+  void send_asset(SoupMessage *msg, const char *path, const Asset &asset);
+  void watch_assets();
+  static void on_asset_changed(GFileMonitor *monitor, GFile *file,
+                               GFile *other_file, GFileMonitorEvent event,
+                               gpointer data);
+
+  std::list<std::unique_ptr<StatusSubscriber>> status_subscribers;
+  std::string status_payloads[STATUS_TOPIC_COUNT];
+  guint status_flush_source;
+  guint status_level_source;
+  int status_last_level;
+  size_t status_coalesced;
+
+  void handle_status_events(SoupMessage *msg);
+  void publish_status(StatusTopic topic, std::string payload);
+  void publish_stream_stats();
+  void flush_subscriber(StatusSubscriber *sub);
+  static gboolean flush_status(gpointer data);
+  static gboolean poll_input_level(gpointer data);
+  static void on_status_chunk_written(SoupMessage *msg, gpointer data);
+  static void on_status_finished(SoupMessage *msg, gpointer data);
 
   void log_request(SoupMessage *msg, const char *path, int status);
 
@@ -56,6 +163,7 @@ private:
   void handle_net_get(SoupMessage *msg);
   void handle_net_post(SoupMessage *msg);
   void handle_oauth_redirect(SoupMessage *msg, GHashTable *query);
+  void handle_recorder(SoupMessage *msg);
   void handle_404(SoupMessage *msg, const char *path);
   void handle_405(SoupMessage *msg, const char *path);
 };
@@ -198,17 +198,14 @@ void genie::conversation::AudioProtocol::handle_pause(int64_t req,
                                                       JsonReader *reader) {
   auto request = std::make_unique<SimpleAudioResponse>(client, req);
 
-  // TODO handle pause differently than stop
-  app->dispatch(new state::events::audio::StopEvent(std::move(request)));
+  app->dispatch(new state::events::audio::PauseEvent(std::move(request)));
 }
 
 void genie::conversation::AudioProtocol::handle_resume(int64_t req,
                                                        JsonReader *reader) {
   auto request = std::make_unique<SimpleAudioResponse>(client, req);
 
-  // TODO implement resume
-  // this is enough to get resume in spotify but not news/radio
-  request->resolve();
+  app->dispatch(new state::events::audio::ResumeEvent(std::move(request)));
 }
 
 void genie::conversation::AudioProtocol::handle_play_urls(int64_t req,
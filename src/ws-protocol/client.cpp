@@ -26,12 +26,14 @@
 
 #include "../spotifyd.hpp"
 #include "../utils/c-style-callback.hpp"
+#include "../utils/logging.hpp"
 #include "../utils/soup-utils.hpp"
 #include "audio/audioplayer.hpp"
 
 #include "audio.hpp"
 #include "client.hpp"
 #include "conversation.hpp"
+#include "stt.hpp"
 
 #undef G_LOG_DOMAIN
 #define G_LOG_DOMAIN "genie::conversation::Client"
@@ -48,12 +50,13 @@ bool genie::conversation::Client::is_connected() {
       soup_websocket_connection_get_state(m_connection.get());
 
   if (wconnState != SOUP_WEBSOCKET_STATE_OPEN) {
-    g_message("WS connection not open (state %d)", wconnState);
+    GENIE_LOG_RATELIMITED(g_message, 5000, "WS connection not open (state %d)",
+                          wconnState);
     return false;
   }
 
   if (!ready) {
-    g_debug("Connection is not ready yet to receive messages yet");
+    GENIE_DEBUG("Connection is not ready yet to receive messages yet");
   }
 
   return true;
@@ -65,20 +68,78 @@ void genie::conversation::Client::send_json(
   maybe_flush_queue();
 }
 
-void genie::conversation::Client::send_json_now(JsonBuilder *builder) {
+/**
+ * @brief Send a binary message right away. Binary messages are not queued:
+ * they only make sense on the connection they were meant for.
+ */
+void genie::conversation::Client::send_binary(const void *data,
+                                              size_t length) {
+  if (!is_connected() || !ready)
+    return;
+
+  soup_websocket_connection_send_binary(m_connection.get(), data, length);
+}
+
+gchar *genie::conversation::Client::serialize(JsonBuilder *builder,
+                                              gsize *length) {
   JsonGenerator *gen = json_generator_new();
   JsonNode *root = json_builder_get_root(builder);
   json_generator_set_root(gen, root);
-  gchar *str = json_generator_to_data(gen, NULL);
+  gchar *str = json_generator_to_data(gen, length);
+  json_node_free(root);
+  g_object_unref(gen);
+  return str;
+}
+
+/**
+ * @brief Parse a message from the server. `type` points into the returned
+ * reader, and is null if the message has no type.
+ */
+genie::auto_gobject_ptr<JsonReader>
+genie::conversation::Client::parse_message(const gchar *data,
+                                           const char **type) {
+  auto_gobject_ptr<JsonParser> parser(json_parser_new(), adopt_mode::owned);
+  json_parser_load_from_data(parser.get(), data, -1, NULL);
+
+  auto_gobject_ptr<JsonReader> reader(
+      json_reader_new(json_parser_get_root(parser.get())), adopt_mode::owned);
+
+  json_reader_read_member(reader.get(), "type");
+  *type = json_reader_get_string_value(reader.get());
+  json_reader_end_member(reader.get());
+  return reader;
+}
 
-  g_message("Sending: %s", str);
+void genie::conversation::Client::send_json_now(JsonBuilder *builder) {
+  gsize length;
+  gchar *str = serialize(builder, &length);
+
+  g_message("Sending (%zu bytes): %.*s%s", length,
+            genie::log::payload_length(length), str,
+            genie::log::payload_suffix(length));
   soup_websocket_connection_send_text(m_connection.get(), str);
 
-  json_node_free(root);
-  g_object_unref(gen);
   g_free(str);
 }
 
+/**
+ * @brief Account the messages waiting for a connection, and the largest
+ * message parsed since the last report (its DOM is a few times larger).
+ */
+void genie::conversation::Client::report_memory(MemoryReport &report) {
+  size_t bytes = 0;
+  for (const auto &msg : m_outgoing_queue) {
+    gsize length;
+    g_free(serialize(msg.get(), &length));
+    bytes += length;
+  }
+  report.push_back({"ws_outgoing", bytes, m_outgoing_queue.size()});
+
+  report.push_back({"json_peak", received_peak_bytes, received_messages});
+  received_peak_bytes = 0;
+  received_messages = 0;
+}
+
 void genie::conversation::Client::maybe_flush_queue() {
   if (!is_connected())
     return;
@@ -88,7 +149,8 @@ void genie::conversation::Client::maybe_flush_queue() {
   m_outgoing_queue.clear();
 }
 
-void genie::conversation::Client::send_command(const std::string text) {
+genie::auto_gobject_ptr<JsonBuilder>
+genie::conversation::Client::command_message(const char *text) {
   auto_gobject_ptr<JsonBuilder> builder(json_builder_new(), adopt_mode::owned);
 
   json_builder_begin_object(builder.get());
@@ -97,11 +159,18 @@ void genie::conversation::Client::send_command(const std::string text) {
   json_builder_add_string_value(builder.get(), "command");
 
   json_builder_set_member_name(builder.get(), "text");
-  json_builder_add_string_value(builder.get(), text.c_str());
+  json_builder_add_string_value(builder.get(), text);
 
   json_builder_end_object(builder.get());
+  return builder;
+}
 
-  send_json(builder);
+void genie::conversation::Client::send_command(const std::string text) {
+  send_json(command_message(text.c_str()));
+
+  // anything the server sends from now on belongs to the new turn, even if
+  // the server restarted and its sequence numbers went backwards
+  resume_seq = -1;
 
   gettimeofday(&tStart, NULL);
 
@@ -161,17 +230,14 @@ void genie::conversation::Client::on_message(SoupWebsocketConnection *conn,
   const gchar *ptr;
 
   ptr = (const gchar *)g_bytes_get_data(message, &sz);
-  g_message("Received message: %s", ptr);
-
-  auto_gobject_ptr<JsonParser> parser(json_parser_new(), adopt_mode::owned);
-  json_parser_load_from_data(parser.get(), ptr, -1, NULL);
-
-  auto_gobject_ptr<JsonReader> reader(
-      json_reader_new(json_parser_get_root(parser.get())), adopt_mode::owned);
+  obj->received_peak_bytes = MAX(obj->received_peak_bytes, sz);
+  obj->received_messages++;
+  g_message("Received message (%zu bytes): %.*s%s", sz,
+            genie::log::payload_length(sz), ptr,
+            genie::log::payload_suffix(sz));
 
-  json_reader_read_member(reader.get(), "type");
-  const char *type = json_reader_get_string_value(reader.get());
-  json_reader_end_member(reader.get());
+  const char *type;
+  auto_gobject_ptr<JsonReader> reader = parse_message(ptr, &type);
 
   if (g_str_has_prefix(type, "protocol:")) {
     // extension protocol
@@ -205,6 +271,8 @@ void genie::conversation::Client::on_close(SoupWebsocketConnection *conn,
   self->ping_timeout_id = 0;
 
   self->ready = false;
+  self->app->track_connection(false);
+  self->notify_disconnected();
   self->retry_connect();
 }
 
@@ -245,7 +313,16 @@ void genie::conversation::Client::on_connection(SoupSession *session,
     return;
   }
   g_debug("Connected successfully to Genie conversation websocket");
+  if (!self->has_connected) {
+    self->has_connected = true;
+    self->app->track_startup_event("conversation connected");
+  }
   self->connect_time = std::chrono::steady_clock::now();
+  self->app->track_connection(true);
+
+  self->main_parser->connected();
+  for (const auto &it : self->ext_parsers)
+    it.second->connected();
 
   self->ping_timeout_id = g_timeout_add_seconds(30, send_ping, self);
 
@@ -263,6 +340,18 @@ void genie::conversation::Client::mark_ready() {
   for (const auto &it : ext_parsers)
     it.second->ready();
 
+  g_message("Conversation ready %.0Lf ms after connecting (%s)",
+            (std::chrono::steady_clock::now() - connect_begin) / 1.ms,
+            resuming ? "resumed" : "full sync");
+  needs_full_sync = false;
+
+  if (measure_recovery) {
+    measure_recovery = false;
+    g_message("Conversation recovered %.0Lf ms after the network came back",
+              (std::chrono::steady_clock::now() - network_restored_time) /
+                  1.ms);
+  }
+
   ready = true;
   maybe_flush_queue();
 }
@@ -271,11 +360,15 @@ genie::conversation::Client::Client(App *appInstance)
     : app(appInstance), ready(false), ping_timeout_id(0) {
   main_parser.reset(new ConversationProtocol(this));
   ext_parsers.emplace("audio", new AudioProtocol(this));
+  stt_protocol = new STTProtocol(this);
+  ext_parsers.emplace("stt", stt_protocol);
 }
 
 genie::conversation::Client::~Client() {
   if (ping_timeout_id > 0)
     g_source_remove(ping_timeout_id);
+  if (retry_timeout_id > 0)
+    g_source_remove(retry_timeout_id);
 }
 
 int genie::conversation::Client::init() {
@@ -285,19 +378,73 @@ int genie::conversation::Client::init() {
 
 gboolean genie::conversation::Client::retry_connect_timer(gpointer data) {
   conversation::Client *obj = (conversation::Client *)data;
+  obj->retry_timeout_id = 0;
   obj->connect();
   return false;
 }
 
 void genie::conversation::Client::retry_connect() {
-  g_timeout_add(app->config->retry_interval, retry_connect_timer, this);
+  if (!network_available) {
+    g_message("No network, waiting for a route before reconnecting");
+    return;
+  }
+  if (retry_timeout_id > 0)
+    return;
+
+  retry_timeout_id =
+      g_timeout_add(app->config->retry_interval, retry_connect_timer, this);
+}
+
+/**
+ * @brief Close the current websocket without going through `on_close`, so
+ * the caller decides when to connect again.
+ */
+void genie::conversation::Client::drop_connection() {
+  if (ping_timeout_id > 0)
+    g_source_remove(ping_timeout_id);
+  ping_timeout_id = 0;
+
+  if (m_connection) {
+    g_signal_handlers_disconnect_by_data(m_connection.get(), this);
+    if (soup_websocket_connection_get_state(m_connection.get()) ==
+        SOUP_WEBSOCKET_STATE_OPEN)
+      soup_websocket_connection_close(m_connection.get(),
+                                      SOUP_WEBSOCKET_CLOSE_GOING_AWAY, nullptr);
+    m_connection = nullptr;
+    app->track_connection(false);
+  }
+  ready = false;
+  notify_disconnected();
+}
+
+void genie::conversation::Client::notify_disconnected() {
+  main_parser->disconnected();
+  for (const auto &it : ext_parsers)
+    it.second->disconnected();
 }
 
 void genie::conversation::Client::connect_direct(AuthMode auth_mode,
                                                  const char *access_token) {
   SoupURI *uri = soup_uri_new(app->config->genie_url);
-  soup_uri_set_query_from_fields(uri, "skip_history", "1", "sync_devices", "1",
-                                 "id", app->config->conversation_id, nullptr);
+
+  int64_t last_seq = main_parser->last_seq();
+  resuming = !needs_full_sync && last_seq >= 0;
+  if (resuming) {
+    // ask only for what we missed while disconnected; servers that ignore
+    // last_seq replay the whole history and we drop what we already handled
+    gchar *last_seq_str = g_strdup_printf("%" G_GINT64_FORMAT, last_seq);
+    g_message("Resuming conversation after message id=%s", last_seq_str);
+    soup_uri_set_query_from_fields(uri, "last_seq", last_seq_str,
+                                   "sync_devices", "0", "id",
+                                   app->config->conversation_id, nullptr);
+    g_free(last_seq_str);
+    resume_seq = last_seq;
+  } else {
+    soup_uri_set_query_from_fields(uri, "skip_history", "1", "sync_devices",
+                                   "1", "id", app->config->conversation_id,
+                                   nullptr);
+    resume_seq = -1;
+  }
 
   SoupMessage *msg = soup_message_new_from_uri(SOUP_METHOD_GET, uri);
   soup_uri_free(uri);
@@ -511,6 +658,8 @@ void genie::conversation::Client::connect_oauth2() {
 }
 
 void genie::conversation::Client::connect() {
+  connect_begin = std::chrono::steady_clock::now();
+
   if (app->config->auth_mode == AuthMode::HOME_ASSISTANT) {
     connect_home_assistant();
   } else if (app->config->auth_mode == AuthMode::OAUTH2) {
@@ -521,10 +670,31 @@ void genie::conversation::Client::connect() {
 }
 
 void genie::conversation::Client::force_reconnect() {
-  if (is_connected()) {
-    soup_websocket_connection_close(m_connection.get(), 0, nullptr);
-    m_connection = nullptr;
+  // the configuration or the credentials changed, so the server must see a
+  // fresh session with a full device sync
+  needs_full_sync = true;
+
+  drop_connection();
+  connect();
+}
+
+void genie::conversation::Client::network_changed(bool has_route) {
+  network_available = has_route;
+
+  if (retry_timeout_id > 0) {
+    g_source_remove(retry_timeout_id);
+    retry_timeout_id = 0;
+  }
+
+  if (!has_route) {
+    g_message("Network lost, pausing reconnection attempts");
+    return;
   }
 
+  // the socket from before the outage is most likely dead, and waiting for
+  // TCP to notice takes minutes; resuming the session is cheap
+  network_restored_time = std::chrono::steady_clock::now();
+  measure_recovery = true;
+  drop_connection();
   connect();
 }
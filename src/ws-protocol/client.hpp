@@ -21,6 +21,7 @@
 #include "../app.hpp"
 #include "../utils/autoptrs.hpp"
 #include <chrono>
+#include <cstdint>
 #include <deque>
 #include <json-glib/json-glib.h>
 #include <libsoup/soup.h>
@@ -39,12 +40,22 @@ public:
 
   virtual void ready() = 0;
 
+  // the connection closed or was dropped; a new one may follow
+  virtual void disconnected() {}
+
   virtual void handle_message(JsonReader *reader) = 0;
+
+  // Sequence number of the last history message this parser handled, or -1.
+  // Used to resume the conversation after a reconnect.
+  virtual int64_t last_seq() const { return -1; }
 };
 
+class STTProtocol;
+
 class Client {
   friend class ConversationProtocol;
   friend class AudioProtocol;
+  friend class STTProtocol;
   friend class BaseAudioRequest;
 
 public:
@@ -53,6 +64,7 @@ public:
 
   int init();
   void force_reconnect();
+  void network_changed(bool has_route);
   void send_command(const std::string text);
   void send_thingtalk(const char *data);
   void request_subprotocol(const char *extension, const char *const *caps);
@@ -61,8 +73,20 @@ public:
     temporary_access_token = token;
   }
 
+  STTProtocol *get_stt_protocol() { return stt_protocol; }
+
+  void report_memory(MemoryReport &report);
+
+  // Encoding of the socket messages, static so genie-bench times the code
+  // that runs for every message.
+  static auto_gobject_ptr<JsonBuilder> command_message(const char *text);
+  static gchar *serialize(JsonBuilder *builder, gsize *length);
+  static auto_gobject_ptr<JsonReader> parse_message(const gchar *data,
+                                                    const char **type);
+
 protected:
   void send_json(auto_gobject_ptr<JsonBuilder> builder);
+  void send_binary(const void *data, size_t length);
   bool is_connected();
   const char *conversation_id() { return app->config->conversation_id; }
   void mark_ready();
@@ -79,6 +103,8 @@ private:
 
   static gboolean retry_connect_timer(gpointer data);
   void retry_connect();
+  void drop_connection();
+  void notify_disconnected();
   void maybe_flush_queue();
   void send_json_now(JsonBuilder *builder);
 
@@ -92,12 +118,33 @@ private:
 
   auto_gobject_ptr<SoupWebsocketConnection> m_connection;
   std::deque<auto_gobject_ptr<JsonBuilder>> m_outgoing_queue;
+  // since the last report_memory()
+  size_t received_peak_bytes = 0;
+  size_t received_messages = 0;
   bool ready;
+  bool has_connected = false;
   std::chrono::steady_clock::time_point connect_time;
+  std::chrono::steady_clock::time_point connect_begin;
+
+  // Resumption state: when the previous session was fully synced and nothing
+  // changed since, a reconnect asks only for the messages after resume_seq
+  // and skips the device sync. Replayed messages at or below resume_seq are
+  // dropped until the next turn starts.
+  bool needs_full_sync = true;
+  bool resuming = false;
+  int64_t resume_seq = -1;
   unsigned int ping_timeout_id;
+  unsigned int retry_timeout_id = 0;
+
+  // cleared by the network monitor while there is no default route, which
+  // stops the retry timer until the route comes back
+  bool network_available = true;
+  bool measure_recovery = false;
+  std::chrono::steady_clock::time_point network_restored_time;
 
   std::unique_ptr<ProtocolParser> main_parser;
   std::unordered_map<std::string, std::unique_ptr<ProtocolParser>> ext_parsers;
+  STTProtocol *stt_protocol;
 
   struct timeval tStart;
 };
@@ -20,6 +20,8 @@
 
 #include <cstring>
 
+#include "../utils/logging.hpp"
+
 void genie::conversation::ConversationProtocol::handle_message(
     JsonReader *reader) {
   json_reader_read_member(reader, "type");
@@ -44,6 +46,12 @@ void genie::conversation::ConversationProtocol::handle_message(
     gint64 id = json_reader_get_int_value(reader);
     json_reader_end_member(reader);
 
+    if (id <= client->resume_seq) {
+      // replayed by a server that does not understand last_seq
+      GENIE_DEBUG("Skipping replayed message id=%" G_GINT64_FORMAT, id);
+      return;
+    }
+
     g_debug("Handling message id=%" G_GINT64_FORMAT ", setting this->seq", id);
     seq = id;
 
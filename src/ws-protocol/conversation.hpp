@@ -33,6 +33,8 @@ public:
 
   void handle_message(JsonReader *msg) override;
 
+  int64_t last_seq() const override { return seq; }
+
 private:
   Client *const client;
   App *const app;
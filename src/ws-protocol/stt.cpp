@@ -0,0 +1,145 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stt.hpp"
+#include "../stt.hpp"
+
+#include <cstring>
+
+#undef G_LOG_DOMAIN
+#define G_LOG_DOMAIN "genie::conversation::STTProtocol"
+
+void genie::conversation::STTProtocol::connected() { granted = false; }
+
+void genie::conversation::STTProtocol::ready() {
+  if (!app->config->stt_multiplex)
+    return;
+
+  const char *caps[] = {"binary-audio", nullptr};
+  client->request_subprotocol("stt", caps);
+}
+
+void genie::conversation::STTProtocol::disconnected() {
+  granted = false;
+
+  STTSession *lost = session;
+  session = nullptr;
+  current_req = -1;
+  if (lost && !result_received)
+    lost->channel_lost();
+}
+
+void genie::conversation::STTProtocol::handle_message(JsonReader *reader) {
+  json_reader_read_member(reader, "op");
+  const char *op = json_reader_get_string_value(reader);
+  json_reader_end_member(reader);
+
+  if (strcmp(op, "ready") == 0) {
+    g_message("Server granted protocol:stt, STT will use this connection");
+    granted = true;
+    return;
+  }
+
+  if (strcmp(op, "result") != 0) {
+    g_warning("Invalid stt protocol operation %s", op);
+    return;
+  }
+
+  json_reader_read_member(reader, "req");
+  int64_t req = json_reader_get_int_value(reader);
+  json_reader_end_member(reader);
+
+  if (!session || req != current_req) {
+    g_debug("Ignoring STT result for stale request %" G_GINT64_FORMAT, req);
+    return;
+  }
+
+  // the session may be freed by handling its result, and detaches itself
+  result_received = true;
+  session->handle_result(reader);
+}
+
+bool genie::conversation::STTProtocol::begin(STTSession *new_session,
+                                             bool is_follow_up) {
+  if (!granted || !client->ready)
+    return false;
+
+  if (session)
+    end(session);
+
+  session = new_session;
+  current_req = next_req++;
+  result_received = false;
+  send_op("start", true, is_follow_up);
+  return true;
+}
+
+void genie::conversation::STTProtocol::send_frame(STTSession *from,
+                                                  const AudioFrame &frame) {
+  if (from != session)
+    return;
+
+  if (frame.length == 0) {
+    send_op("end");
+    return;
+  }
+  client->send_binary(frame.samples, frame.length * sizeof(int16_t));
+}
+
+void genie::conversation::STTProtocol::end(STTSession *from) {
+  if (from != session)
+    return;
+
+  if (!result_received && client->is_connected())
+    send_op("abort");
+  session = nullptr;
+  current_req = -1;
+}
+
+void genie::conversation::STTProtocol::send_op(const char *op,
+                                               bool with_options,
+                                               bool is_follow_up) {
+  auto_gobject_ptr<JsonBuilder> builder(json_builder_new(), adopt_mode::owned);
+
+  json_builder_begin_object(builder.get());
+
+  json_builder_set_member_name(builder.get(), "type");
+  json_builder_add_string_value(builder.get(), "protocol:stt");
+
+  json_builder_set_member_name(builder.get(), "op");
+  json_builder_add_string_value(builder.get(), op);
+
+  json_builder_set_member_name(builder.get(), "req");
+  json_builder_add_int_value(builder.get(), current_req);
+
+  if (with_options) {
+    // same options as the hello message of /voice/stream
+    json_builder_set_member_name(builder.get(), "ver");
+    json_builder_add_int_value(builder.get(), 1);
+
+    json_builder_set_member_name(builder.get(), "locale");
+    json_builder_add_string_value(builder.get(), app->config->locale);
+
+    json_builder_set_member_name(builder.get(), "follow_up");
+    json_builder_add_boolean_value(builder.get(), is_follow_up);
+  }
+
+  json_builder_end_object(builder.get());
+
+  client->send_json(builder);
+}
@@ -0,0 +1,83 @@
+// -*- mode: cpp; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// This file is part of Genie
+//
+// Copyright 2021 The Board of Trustees of the Leland Stanford Junior University
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "client.hpp"
+#include <cstdint>
+
+namespace genie {
+
+struct AudioFrame;
+class STTSession;
+
+namespace conversation {
+
+/**
+ * @brief Speech-to-text over the conversation websocket (protocol:stt).
+ *
+ * Once the server grants the extension, a turn is sent as a `start` message,
+ * the audio frames as binary messages and an `end` message; the server
+ * answers with a `result` message in the same format as the standalone
+ * /voice/stream endpoint. Only one stream runs at a time.
+ *
+ * If the server does not grant the extension, or the connection drops during
+ * a stream, `STTSession` uses its own websocket as before.
+ */
+class STTProtocol : public ProtocolParser {
+public:
+  STTProtocol(Client *client) : client(client), app(client->app) {}
+
+  void connected() override;
+  void ready() override;
+  void disconnected() override;
+
+  void handle_message(JsonReader *reader) override;
+
+  bool available() const { return granted; }
+
+  /**
+   * @brief Start streaming for `session`. Returns false if the extension is
+   * not available, in which case the session must connect by itself.
+   */
+  bool begin(STTSession *session, bool is_follow_up);
+  void send_frame(STTSession *session, const AudioFrame &frame);
+
+  /**
+   * @brief Detach `session`, telling the server to drop the stream if no
+   * result was received yet.
+   */
+  void end(STTSession *session);
+
+private:
+  Client *const client;
+  App *const app;
+
+  bool granted = false;
+  STTSession *session = nullptr;
+  int64_t next_req = 0;
+  int64_t current_req = -1;
+  bool result_received = false;
+
+  void send_op(const char *op, bool with_options = false,
+               bool is_follow_up = false);
+};
+
+} // namespace conversation
+
+} // namespace genie